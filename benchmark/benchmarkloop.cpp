@@ -0,0 +1,101 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <memory>
+
+#include "benchmarkloop.h"
+
+bool runUntil(std::function<bool()> condition, unsigned int timeout)
+{
+	gint64 deadline = g_get_monotonic_time() + (gint64) timeout * 1000;
+
+	// Makes sure we wake up to check the deadline
+	guint wakeup = g_timeout_add(10, [](gpointer) -> gboolean { return TRUE; }, NULL);
+
+	bool met;
+	while (!(met = condition()) && g_get_monotonic_time() < deadline)
+		g_main_context_iteration(NULL, TRUE);
+
+	g_source_remove(wakeup);
+	return met;
+}
+
+void runOperations(BenchmarkRun &run, size_t count, unsigned int inFlight, Operation operation)
+{
+	struct State
+	{
+		size_t started;
+		size_t finished;
+		unsigned int outstanding;
+		guint idle;
+		std::function<void()> fill;
+	};
+	std::shared_ptr<State> state = std::make_shared<State>();
+	state->started = 0;
+	state->finished = 0;
+	state->outstanding = 0;
+	state->idle = 0;
+
+	BenchmarkRun *runPtr = &run;
+	std::weak_ptr<State> weakState = state;
+
+	state->fill = [weakState, runPtr, count, inFlight, operation]() {
+		auto state = weakState.lock();
+		if (!state)
+			return;
+
+		while (state->outstanding < inFlight && state->started < count)
+		{
+			size_t n = state->started++;
+			state->outstanding++;
+			gint64 begin = g_get_monotonic_time();
+
+			operation(n, [weakState, runPtr, begin](bool success) {
+				auto state = weakState.lock();
+				if (!state)
+					return;
+
+				state->outstanding--;
+				state->finished++;
+
+				if (success)
+					runPtr->addLatency(g_get_monotonic_time() - begin);
+				else
+					runPtr->addFailure();
+
+				if (!state->idle)
+					state->idle = g_idle_add([](gpointer user_data) -> gboolean {
+						State *state = static_cast<State*>(user_data);
+						state->idle = 0;
+						state->fill();
+						return FALSE;
+					}, state.get());
+			});
+		}
+	};
+
+	run.begin();
+	state->fill();
+	runUntil([state, count]() { return state->finished >= count; });
+	run.end();
+
+	if (state->idle)
+		g_source_remove(state->idle);
+
+	for (size_t n = state->finished; n < count; n++)
+		run.addFailure();
+}
@@ -0,0 +1,40 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef BENCHMARKLOOP_H
+#define BENCHMARKLOOP_H
+
+#include <glib.h>
+#include <cstddef>
+#include <functional>
+
+#include "benchmarkstats.h"
+
+#define BENCHMARK_TIMEOUT 60000 // ms
+
+// Dispatches the main loop until the condition is met or timeout ms passed
+bool runUntil(std::function<bool()> condition, unsigned int timeout = BENCHMARK_TIMEOUT);
+
+typedef std::function<void(bool success)> OperationCallback;
+typedef std::function<void(size_t n, OperationCallback done)> Operation;
+
+// Runs count operations with up to inFlight of them at the same time. A
+// new operation is always started from the main loop, so the SIL gets to
+// dispatch between two operations even if they complete synchronously.
+void runOperations(BenchmarkRun &run, size_t count, unsigned int inFlight, Operation operation);
+
+#endif // BENCHMARKLOOP_H
@@ -0,0 +1,160 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cstdio>
+
+#include "benchmarkstats.h"
+
+#define STALL_MONITOR_INTERVAL    1     // ms
+// Timer slack and scheduling noise below this are not counted as stall
+#define STALL_MONITOR_THRESHOLD   2000  // us
+
+MainLoopStallMonitor::MainLoopStallMonitor() :
+	mSource(0),
+	mLastTick(0),
+	mMaxStall(0),
+	mTotalStall(0)
+{
+}
+
+MainLoopStallMonitor::~MainLoopStallMonitor()
+{
+	stop();
+}
+
+void MainLoopStallMonitor::start()
+{
+	stop();
+
+	mMaxStall = 0;
+	mTotalStall = 0;
+	mLastTick = g_get_monotonic_time();
+	mSource = g_timeout_add(STALL_MONITOR_INTERVAL, onTick, this);
+}
+
+void MainLoopStallMonitor::stop()
+{
+	if (!mSource)
+		return;
+
+	// Account for a stall which is still going on
+	onTick(this);
+
+	g_source_remove(mSource);
+	mSource = 0;
+}
+
+gboolean MainLoopStallMonitor::onTick(gpointer user_data)
+{
+	MainLoopStallMonitor *monitor = static_cast<MainLoopStallMonitor*>(user_data);
+
+	gint64 now = g_get_monotonic_time();
+	gint64 late = now - monitor->mLastTick - STALL_MONITOR_INTERVAL * 1000;
+	monitor->mLastTick = now;
+
+	if (late > STALL_MONITOR_THRESHOLD)
+	{
+		monitor->mTotalStall += late;
+		monitor->mMaxStall = std::max(monitor->mMaxStall, late);
+	}
+
+	return TRUE;
+}
+
+BenchmarkRun::BenchmarkRun(const std::string &name) :
+	mName(name),
+	mOperations(0),
+	mFailures(0),
+	mBytes(0),
+	mSyscalls(0),
+	mBegin(0),
+	mElapsed(0)
+{
+}
+
+void BenchmarkRun::begin()
+{
+	mLatencies.clear();
+	mOperations = 0;
+	mFailures = 0;
+	mBytes = 0;
+	mSyscalls = 0;
+	mStallMonitor.start();
+	mBegin = g_get_monotonic_time();
+}
+
+void BenchmarkRun::end()
+{
+	mElapsed = g_get_monotonic_time() - mBegin;
+	mStallMonitor.stop();
+}
+
+void BenchmarkRun::addLatency(gint64 latency)
+{
+	mLatencies.push_back(latency);
+	mOperations++;
+}
+
+gint64 BenchmarkRun::percentile(unsigned int percent) const
+{
+	if (mLatencies.empty())
+		return 0;
+
+	std::vector<gint64> sorted(mLatencies);
+	size_t index = (sorted.size() - 1) * percent / 100;
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+	return sorted[index];
+}
+
+void BenchmarkRun::printHeader()
+{
+	printf("%-24s %8s %6s %10s %10s %10s %10s %10s %10s\n",
+	       "scenario", "ops", "failed", "ops/s", "KiB/s", "p50 [us]", "p99 [us]", "stall [ms]", "max [ms]");
+}
+
+void BenchmarkRun::print() const
+{
+	double seconds = mElapsed / 1000000.0;
+	double opsPerSecond = seconds > 0 ? mOperations / seconds : 0;
+	double kibPerSecond = seconds > 0 ? mBytes / 1024.0 / seconds : 0;
+
+	printf("%-24s %8zu %6zu %10.1f %10.1f %10lld %10lld %10.1f %10.1f\n",
+	       mName.c_str(), mOperations, mFailures, opsPerSecond, kibPerSecond,
+	       (long long) percentile(50), (long long) percentile(99),
+	       mStallMonitor.getTotalStall() / 1000.0, mStallMonitor.getMaxStall() / 1000.0);
+	fflush(stdout);
+}
+
+void BenchmarkRun::printThroughputHeader()
+{
+	printf("%-24s %8s %6s %10s %10s %10s %10s %10s %10s\n",
+	       "scenario", "msgs", "failed", "MB/s", "p50 [us]", "p99 [us]", "calls/MB", "stall [ms]", "max [ms]");
+}
+
+void BenchmarkRun::printThroughput() const
+{
+	double seconds = mElapsed / 1000000.0;
+	double megabytes = mBytes / 1000000.0;
+	double mbPerSecond = seconds > 0 ? megabytes / seconds : 0;
+	double callsPerMb = megabytes > 0 ? mSyscalls / megabytes : 0;
+
+	printf("%-24s %8zu %6zu %10.2f %10lld %10lld %10.1f %10.1f %10.1f\n",
+	       mName.c_str(), mOperations, mFailures, mbPerSecond,
+	       (long long) percentile(50), (long long) percentile(99), callsPerMb,
+	       mStallMonitor.getTotalStall() / 1000.0, mStallMonitor.getMaxStall() / 1000.0);
+	fflush(stdout);
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BENCHMARKSTATS_H
+#define BENCHMARKSTATS_H
+
+#include <glib.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Measures how long the main loop of the calling thread was kept from
+// dispatching. A short timer is expected to fire every interval, whatever
+// it is late by was spent blocked somewhere else.
+class MainLoopStallMonitor
+{
+public:
+	MainLoopStallMonitor();
+	~MainLoopStallMonitor();
+
+	MainLoopStallMonitor(const MainLoopStallMonitor&) = delete;
+	MainLoopStallMonitor& operator = (const MainLoopStallMonitor&) = delete;
+
+	void start();
+	void stop();
+
+	// All values in microseconds
+	gint64 getMaxStall() const { return mMaxStall; }
+	gint64 getTotalStall() const { return mTotalStall; }
+
+private:
+	static gboolean onTick(gpointer user_data);
+
+	guint mSource;
+	gint64 mLastTick;
+	gint64 mMaxStall;
+	gint64 mTotalStall;
+};
+
+class BenchmarkRun
+{
+public:
+	BenchmarkRun(const std::string &name);
+
+	void begin();
+	void end();
+
+	// Latency in microseconds
+	void addLatency(gint64 latency);
+	void addFailure() { mFailures++; }
+	// Operations which have no latency of their own, e.g. socket writes
+	void addOperations(size_t count) { mOperations += count; }
+	void addBytes(size_t count) { mBytes += count; }
+	// Socket calls the SIL made for the data path
+	void addSyscalls(uint64_t count) { mSyscalls += count; }
+
+	size_t getCompleted() const { return mOperations; }
+
+	static void printHeader();
+	void print() const;
+
+	// Same for data path scenarios, throughput in MB/s and socket calls per
+	// MB instead of operation rates
+	static void printThroughputHeader();
+	void printThroughput() const;
+
+private:
+	gint64 percentile(unsigned int percent) const;
+
+	std::string mName;
+	std::vector<gint64> mLatencies;
+	size_t mOperations;
+	size_t mFailures;
+	size_t mBytes;
+	uint64_t mSyscalls;
+	gint64 mBegin;
+	gint64 mElapsed;
+	MainLoopStallMonitor mStallMonitor;
+};
+
+#endif // BENCHMARKSTATS_H
@@ -0,0 +1,558 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unistd.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <bluetooth-sil-api.h>
+
+#include "bluez5sil.h"
+#include "bluez5adapter.h"
+#include "bluez5profilegatt.h"
+#include "utils.h"
+#include "benchmarkloop.h"
+#include "benchmarkstats.h"
+#include "mockbluez.h"
+
+namespace
+{
+
+gint devices = 8;
+gint services = 4;
+gint characteristics = 8;
+gint descriptors = 1;
+gint valueSize = 20;
+gint longValueSize = 512;
+gint mtu = 247;
+gboolean shortReads = FALSE;
+gint latency = 0;
+gint operations = 2000;
+gint depth = 8;
+gint notifyInterval = 0;
+gchar *metricsPath = NULL;
+
+GOptionEntry options[] =
+{
+	{ "devices", 'd', 0, G_OPTION_ARG_INT, &devices, "Number of mock devices", "N" },
+	{ "services", 's', 0, G_OPTION_ARG_INT, &services, "Services per device", "N" },
+	{ "characteristics", 'c', 0, G_OPTION_ARG_INT, &characteristics, "Characteristics per service", "N" },
+	{ "descriptors", 0, 0, G_OPTION_ARG_INT, &descriptors, "Descriptors per characteristic", "N" },
+	{ "value-size", 0, 0, G_OPTION_ARG_INT, &valueSize, "Size of characteristic values", "BYTES" },
+	{ "long-value-size", 0, 0, G_OPTION_ARG_INT, &longValueSize, "Size of the value used for long reads and writes", "BYTES" },
+	{ "mtu", 0, 0, G_OPTION_ARG_INT, &mtu, "ATT MTU reported by the mock", "BYTES" },
+	{ "short-reads", 0, 0, G_OPTION_ARG_NONE, &shortReads, "Let the mock answer reads with at most MTU - 1 bytes", NULL },
+	{ "latency", 'l', 0, G_OPTION_ARG_INT, &latency, "Response latency of the mock", "MS" },
+	{ "operations", 'n', 0, G_OPTION_ARG_INT, &operations, "Operations per scenario", "N" },
+	{ "depth", 0, 0, G_OPTION_ARG_INT, &depth, "Operations in flight at the same time", "N" },
+	{ "notify-interval", 0, 0, G_OPTION_ARG_INT, &notifyInterval, "Interval between notifications, 0 sends them back to back", "MS" },
+	{ "metrics", 0, 0, G_OPTION_ARG_FILENAME, &metricsPath, "Write the GATT metrics of the SIL to a JSON file", "FILE" },
+	{ NULL }
+};
+
+class BenchmarkAdapterObserver : public BluetoothAdapterStatusObserver
+{
+};
+
+class BenchmarkProfileObserver : public BluetoothProfileStatusObserver
+{
+};
+
+class BenchmarkGattObserver : public BluetoothGattProfileStatusObserver
+{
+};
+
+}
+
+int main(int argc, char **argv)
+{
+	GError *error = 0;
+	GOptionContext *context = g_option_context_new("- GATT client benchmark against a mock BlueZ");
+	g_option_context_add_main_entries(context, options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	depth = std::max(depth, 1);
+	devices = std::max(devices, 1);
+	services = std::max(services, 1);
+	characteristics = std::max(characteristics, 1);
+
+	// The SIL talks to the system bus, so point that at a private one
+	GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	g_setenv("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address(bus), TRUE);
+
+	MockBluezConfig config;
+	config.services = services;
+	config.characteristics = characteristics;
+	config.descriptors = descriptors;
+	config.valueSize = valueSize;
+	config.longValueSize = longValueSize;
+	config.mtu = mtu;
+	config.shortReads = shortReads;
+	config.latency = latency;
+
+	MockBluez mock(config);
+	if (!mock.start(g_test_dbus_get_bus_address(bus)))
+	{
+		g_test_dbus_down(bus);
+		g_object_unref(bus);
+		return 1;
+	}
+
+	BluetoothSIL *sil = createBluetoothSIL(BLUETOOTH_SIL_API_VERSION, BLUETOOTH_PAIRING_IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+	if (!sil || !runUntil([sil]() { return sil->getDefaultAdapter() != nullptr; }, 10000))
+	{
+		fprintf(stderr, "SIL did not pick up the mock adapter\n");
+		return 1;
+	}
+
+	BenchmarkAdapterObserver adapterObserver;
+	BenchmarkProfileObserver profileObserver;
+	BenchmarkGattObserver gattObserver;
+
+	Bluez5Adapter *adapter = static_cast<Bluez5Adapter*>(sil->getDefaultAdapter());
+	adapter->registerObserver(&adapterObserver);
+
+	Bluez5ProfileGatt *gatt = dynamic_cast<Bluez5ProfileGatt*>(adapter->getProfile(BLUETOOTH_PROFILE_ID_GATT));
+	static_cast<BluetoothProfile*>(gatt)->registerObserver(&profileObserver);
+	static_cast<BluetoothGattProfile*>(gatt)->registerObserver(&gattObserver);
+
+	std::vector<std::string> addresses;
+	for (gint n = 0; n < devices; n++)
+		addresses.push_back(convertAddressToLowerCase(MockBluez::deviceAddress(n)));
+
+	BluetoothUuid longService(MockBluez::serviceUuid(0));
+	BluetoothUuid longCharacteristic(MockBluez::characteristicUuid(0, 0));
+
+	auto characteristicFor = [](size_t n) {
+		// Leave out the long characteristic unless it is the only one, it
+		// has a scenario of its own
+		size_t count = services * characteristics;
+		size_t index = count > 1 ? 1 + n % (count - 1) : 0;
+		return std::make_pair(BluetoothUuid(MockBluez::serviceUuid(index / characteristics)),
+		                      BluetoothUuid(MockBluez::characteristicUuid(index / characteristics, index % characteristics)));
+	};
+
+	printf("devices %d, services %d, characteristics %d, descriptors %d, latency %d ms, mtu %d\n\n",
+	       devices, services, characteristics, descriptors, latency, mtu);
+	BenchmarkRun::printHeader();
+
+	// Discovery: devices showing up at BlueZ until the SIL knows them all
+	{
+		BenchmarkRun run("discovery");
+		std::vector<bool> seen(devices, false);
+		size_t seenCount = 0;
+		gint64 begin = g_get_monotonic_time();
+
+		run.begin();
+		mock.addDevices(devices);
+		runUntil([&]() {
+			for (gint n = 0; n < devices; n++)
+			{
+				if (!seen[n] && adapter->findDevice(addresses[n]))
+				{
+					seen[n] = true;
+					seenCount++;
+					run.addLatency(g_get_monotonic_time() - begin);
+				}
+			}
+			return seenCount == (size_t) devices;
+		});
+		run.end();
+
+		for (size_t n = seenCount; n < (size_t) devices; n++)
+			run.addFailure();
+		run.print();
+	}
+
+	// Service resolution: connecting every device until its whole tree is known
+	std::map<std::string, uint16_t> connIds;
+	{
+		BenchmarkRun run("service-resolution");
+		uint16_t appId = gatt->addApplication(BluetoothUuid("0000ffff-0000-1000-8000-00805f9b34fb"), ApplicationType::CLIENT);
+		size_t resolvedCount = 0;
+		gint64 begin = g_get_monotonic_time();
+
+		gatt->setServicesResolvedCallback([&](const std::string &, const std::string &,
+		                                      const BluetoothGattServiceList &list) {
+			resolvedCount++;
+			if (list.size() == (size_t) services)
+				run.addLatency(g_get_monotonic_time() - begin);
+			else
+				run.addFailure();
+		});
+
+		run.begin();
+		for (auto &address : addresses)
+		{
+			gatt->connectGatt(appId, false, address, [&connIds, address](BluetoothError error, uint16_t connId) {
+				if (error == BLUETOOTH_ERROR_NONE)
+					connIds[address] = connId;
+			});
+		}
+
+		runUntil([&]() { return resolvedCount == (size_t) devices; });
+		gatt->setServicesResolvedCallback(nullptr);
+		run.end();
+
+		for (size_t n = resolvedCount; n < (size_t) devices; n++)
+			run.addFailure();
+		run.print();
+	}
+
+	// Reads spread over the characteristics of the first device
+	{
+		BenchmarkRun run("read");
+		runOperations(run, operations, depth, [&](size_t n, OperationCallback done) {
+			auto uuids = characteristicFor(n);
+			gatt->readCharacteristic(addresses[0], uuids.first, uuids.second,
+			                         [done](BluetoothError error, const BluetoothGattCharacteristic &) {
+				done(error == BLUETOOTH_ERROR_NONE);
+			});
+		});
+		run.print();
+	}
+
+	// Writes spread over the characteristics of the first device
+	{
+		BenchmarkRun run("write");
+		runOperations(run, operations, depth, [&](size_t n, OperationCallback done) {
+			auto uuids = characteristicFor(n);
+			BluetoothGattCharacteristic characteristic;
+			characteristic.setUuid(uuids.second);
+			characteristic.setValue(BluetoothGattValue(valueSize, n & 0xff));
+
+			gatt->writeCharacteristic(addresses[0], uuids.first, characteristic, [done, &run](BluetoothError error) {
+				if (error == BLUETOOTH_ERROR_NONE)
+					run.addBytes(valueSize);
+				done(error == BLUETOOTH_ERROR_NONE);
+			});
+		});
+		run.print();
+	}
+
+	// Configuration-style transactions of several writes on the first device
+	{
+		const size_t transactionSize = 10;
+		BenchmarkRun run("write-transaction");
+		runOperations(run, std::max<size_t>(operations / transactionSize, 1), 1, [&](size_t n, OperationCallback done) {
+			std::vector<GattCharacteristicWrite> writes;
+			for (size_t w = 0; w < transactionSize; w++)
+			{
+				auto uuids = characteristicFor(n * transactionSize + w);
+				GattCharacteristicWrite write;
+				write.service = uuids.first;
+				write.characteristic.setUuid(uuids.second);
+				write.characteristic.setValue(BluetoothGattValue(valueSize, n & 0xff));
+				writes.push_back(write);
+			}
+
+			gatt->writeCharacteristics(addresses[0], writes, false, [done, &run, transactionSize](BluetoothError error) {
+				if (error == BLUETOOTH_ERROR_NONE)
+					run.addBytes(valueSize * transactionSize);
+				done(error == BLUETOOTH_ERROR_NONE);
+			});
+		});
+		run.print();
+	}
+
+	// Reads hitting all devices at once
+	{
+		BenchmarkRun run("read-multi-device");
+		runOperations(run, operations, depth * devices, [&](size_t n, OperationCallback done) {
+			auto uuids = characteristicFor(n / devices);
+			gatt->readCharacteristic(addresses[n % devices], uuids.first, uuids.second,
+			                         [done](BluetoothError error, const BluetoothGattCharacteristic &) {
+				done(error == BLUETOOTH_ERROR_NONE);
+			});
+		});
+		run.print();
+	}
+
+	// Long values, one transfer per device at a time
+	{
+		BenchmarkRun run("long-read");
+		runOperations(run, std::max(operations / 10, 1), devices, [&](size_t n, OperationCallback done) {
+			gatt->readLongCharacteristic(addresses[n % devices], longService, longCharacteristic,
+			                             [done, &run](BluetoothError error, const BluetoothGattCharacteristic &characteristic) {
+				if (error == BLUETOOTH_ERROR_NONE)
+					run.addBytes(characteristic.getValue().size());
+				done(error == BLUETOOTH_ERROR_NONE);
+			});
+		});
+		run.print();
+	}
+
+	{
+		BenchmarkRun run("long-write");
+		runOperations(run, std::max(operations / 10, 1), devices, [&](size_t n, OperationCallback done) {
+			BluetoothGattCharacteristic characteristic;
+			characteristic.setUuid(longCharacteristic);
+			characteristic.setValue(BluetoothGattValue(longValueSize, n & 0xff));
+
+			gatt->writeLongCharacteristic(addresses[n % devices], longService, characteristic, [done, &run](BluetoothError error) {
+				if (error == BLUETOOTH_ERROR_NONE)
+					run.addBytes(longValueSize);
+				done(error == BLUETOOTH_ERROR_NONE);
+			});
+		});
+		run.print();
+	}
+
+	// Notification storm on every characteristic of the first device. The
+	// latency is the time from the mock sending it to the handler seeing it.
+	{
+		BenchmarkRun run("notify");
+		uint16_t connId = connIds[addresses[0]];
+		size_t subscribed = 0;
+
+		for (gint s = 0; s < services; s++)
+		{
+			for (gint c = 0; c < characteristics; c++)
+			{
+				gatt->changeCharacteristicWatchStatus(connId, BluetoothUuid(MockBluez::serviceUuid(s)),
+				                                      BluetoothUuid(MockBluez::characteristicUuid(s, c)), true,
+				                                      [&subscribed](BluetoothError error) {
+					if (error == BLUETOOTH_ERROR_NONE)
+						subscribed++;
+				});
+			}
+		}
+		runUntil([&]() { return subscribed == (size_t) (services * characteristics); }, 10000);
+
+		gatt->setNotificationHandler(connId, [&run](uint16_t, const BluetoothUuid &, const BluetoothGattCharacteristic &characteristic) {
+			BluetoothGattValue value = characteristic.getValue();
+			gint64 sent = 0;
+			if (value.size() < sizeof(sent))
+			{
+				run.addFailure();
+				return;
+			}
+
+			memcpy(&sent, value.data(), sizeof(sent));
+			run.addLatency(g_get_monotonic_time() - sent);
+			run.addBytes(value.size());
+		});
+
+		run.begin();
+		mock.sendNotifications(0, operations, notifyInterval);
+		runUntil([&]() { return run.getCompleted() >= (size_t) operations; });
+		run.end();
+
+		gatt->setNotificationHandler(connId, nullptr);
+		for (size_t n = run.getCompleted(); n < (size_t) operations; n++)
+			run.addFailure();
+		run.print();
+	}
+
+	// Server side, a service with a characteristic a remote client writes
+	// to and one it gets notifications from through acquired sockets
+	std::string writeUuid = "0000fff1-0000-1000-8000-00805f9b34fb";
+	std::string notifyUuid = "0000fff2-0000-1000-8000-00805f9b34fb";
+	size_t packetSize = std::max(mtu - 3, 1);
+	uint16_t appId = gatt->addApplication(BluetoothUuid("0000fffe-0000-1000-8000-00805f9b34fb"), ApplicationType::SERVER);
+	GattLocalServiceIds serviceIds;
+	bool registered = false;
+	{
+		BluetoothGattCharacteristic writeCharacteristic;
+		writeCharacteristic.setUuid(BluetoothUuid(writeUuid));
+		writeCharacteristic.setProperties(BluetoothGattCharacteristic::PROPERTY_WRITE_WITHOUT_RESPONSE);
+
+		BluetoothGattCharacteristic notifyCharacteristic;
+		notifyCharacteristic.setUuid(BluetoothUuid(notifyUuid));
+		notifyCharacteristic.setProperties(BluetoothGattCharacteristic::PROPERTY_NOTIFY);
+
+		BluetoothGattService service;
+		service.setUuid(BluetoothUuid("0000fff0-0000-1000-8000-00805f9b34fb"));
+		service.setType(BluetoothGattService::PRIMARY);
+		service.addCharacteristic(writeCharacteristic);
+		service.addCharacteristic(notifyCharacteristic);
+
+		// The GATT server object manager only exists once the SIL owns its bus name
+		for (int attempt = 0; attempt < 50 && !registered; attempt++)
+		{
+			bool finished = false;
+			gatt->addServices(appId, BluetoothGattServiceList(1, service), [&](BluetoothError error, const std::vector<GattLocalServiceIds> &ids) {
+				registered = (error == BLUETOOTH_ERROR_NONE && ids.size() == 1 && ids[0].characteristicIds.size() == 2);
+				if (registered)
+					serviceIds = ids[0];
+				finished = true;
+			});
+			runUntil([&finished]() { return finished; }, 1000);
+
+			if (!registered)
+				runUntil([]() { return false; }, 100);
+		}
+	}
+
+	// A remote client pushing writes through an acquired socket
+	{
+		BenchmarkRun run("acquired-write");
+
+		struct WriteThread
+		{
+			MockBluez *mock;
+			std::string uuid;
+			unsigned int count;
+			size_t size;
+			gint64 elapsed;
+			bool success;
+			std::atomic<bool> finished;
+		} writeThread;
+		writeThread.mock = &mock;
+		writeThread.uuid = writeUuid;
+		writeThread.count = operations;
+		writeThread.size = packetSize;
+		writeThread.elapsed = 0;
+		writeThread.success = false;
+		writeThread.finished = false;
+
+		run.begin();
+		GThread *thread = g_thread_new("acquired-write", [](gpointer user_data) -> gpointer {
+			WriteThread *writeThread = static_cast<WriteThread*>(user_data);
+			writeThread->success = writeThread->mock->writeAcquired(writeThread->uuid, writeThread->count,
+			                                                          writeThread->size, writeThread->elapsed);
+			writeThread->finished = true;
+			return NULL;
+		}, &writeThread);
+		runUntil([&]() { return writeThread.finished.load(); });
+		g_thread_join(thread);
+		run.end();
+
+		if (registered && writeThread.success)
+		{
+			run.addOperations(operations);
+			run.addBytes(operations * packetSize);
+		}
+		else
+		{
+			run.addFailure();
+		}
+		run.print();
+	}
+
+	// Notifications of a local characteristic to a remote client which
+	// acquired them. The latency is the time from handing the value to the
+	// SIL until the client read it.
+	{
+		BenchmarkRun run("acquired-notify");
+
+		struct NotifyThread
+		{
+			MockBluez *mock;
+			std::string uuid;
+			unsigned int count;
+			std::atomic<int> fd;
+			std::atomic<unsigned int> received;
+			std::atomic<bool> finished;
+			// Only touched by the thread until it finished
+			std::vector<gint64> latencies;
+			size_t bytes;
+		} notifyThread;
+		notifyThread.mock = &mock;
+		notifyThread.uuid = notifyUuid;
+		notifyThread.count = operations;
+		notifyThread.fd = -1;
+		notifyThread.received = 0;
+		notifyThread.finished = false;
+		notifyThread.bytes = 0;
+
+		GThread *thread = g_thread_new("acquired-notify", [](gpointer user_data) -> gpointer {
+			NotifyThread *notifyThread = static_cast<NotifyThread*>(user_data);
+			int fd = notifyThread->mock->acquireNotify(notifyThread->uuid);
+			notifyThread->fd = fd;
+
+			// Largest attribute value
+			std::vector<uint8_t> packet(512);
+			while (fd >= 0 && notifyThread->received < notifyThread->count)
+			{
+				ssize_t length = read(fd, packet.data(), packet.size());
+				if (length < 0 && errno == EINTR)
+					continue;
+				if (length < (ssize_t) sizeof(gint64))
+					break;
+
+				gint64 sent = 0;
+				memcpy(&sent, packet.data(), sizeof(sent));
+				notifyThread->latencies.push_back(g_get_monotonic_time() - sent);
+				notifyThread->bytes += length;
+				notifyThread->received++;
+			}
+
+			if (fd >= 0)
+				close(fd);
+			notifyThread->finished = true;
+			return NULL;
+		}, &notifyThread);
+
+		// Acquiring is a call to the SIL, so it needs the main loop
+		runUntil([&]() { return notifyThread.fd.load() >= 0 || notifyThread.finished.load(); }, 10000);
+
+		BluetoothGattValue value(std::max(packetSize, sizeof(gint64)), 0x5a);
+		unsigned int sent = 0;
+
+		run.begin();
+		while (registered && notifyThread.fd.load() >= 0 && sent < (unsigned int) operations && !notifyThread.finished.load())
+		{
+			gint64 now = g_get_monotonic_time();
+			memcpy(value.data(), &now, sizeof(now));
+
+			// A full socket drops the value, the client gets to catch up
+			if (gatt->notifyLocalCharacteristicValue(appId, serviceIds.serviceId, serviceIds.characteristicIds[1], value))
+				sent++;
+			else
+				g_main_context_iteration(NULL, FALSE);
+		}
+		runUntil([&]() { return notifyThread.received.load() >= sent || notifyThread.finished.load(); }, 10000);
+		run.end();
+
+		// The thread is blocked on the socket until the SIL lets it go
+		gatt->removeApplication(appId, ApplicationType::SERVER);
+		runUntil([&]() { return notifyThread.finished.load(); }, 10000);
+		g_thread_join(thread);
+
+		for (gint64 latency : notifyThread.latencies)
+			run.addLatency(latency);
+		run.addBytes(notifyThread.bytes);
+		for (unsigned int n = notifyThread.received; n < (unsigned int) operations; n++)
+			run.addFailure();
+		run.print();
+	}
+
+	if (metricsPath && !gatt->dumpMetrics(metricsPath))
+		fprintf(stderr, "Failed to write metrics to %s\n", metricsPath);
+
+	delete sil;
+	mock.stop();
+
+	g_test_dbus_down(bus);
+	g_object_unref(bus);
+
+	return 0;
+}
@@ -0,0 +1,1007 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <gio/gunixfdlist.h>
+
+#include "mockbluez.h"
+
+#define MOCK_BLUEZ_ADAPTER_ADDRESS "00:AA:BB:CC:DD:EE"
+
+struct MockBluez::Attribute
+{
+	MockBluez *mock;
+	BluezObjectSkeleton *object;
+	BluezGattCharacteristic1 *characteristic;
+	BluezGattDescriptor1 *descriptor;
+	std::vector<uint8_t> value;
+	bool notifying;
+};
+
+struct MockBluez::Device
+{
+	MockBluez *mock;
+	unsigned int index;
+	std::string path;
+	BluezObjectSkeleton *object;
+	BluezDevice1 *interface;
+	bool connected;
+	// Exported while connected, in the order they were exported
+	std::vector<BluezObjectSkeleton*> gattObjects;
+	std::vector<Attribute*> attributes;
+	std::vector<Attribute*> characteristics;
+};
+
+namespace
+{
+
+struct NotificationRun
+{
+	MockBluez *mock;
+	unsigned int device;
+	unsigned int remaining;
+	unsigned int next;
+};
+
+gboolean callFunction(gpointer data)
+{
+	(*static_cast<std::function<void()>*>(data))();
+	return FALSE;
+}
+
+void deleteFunction(gpointer data)
+{
+	delete static_cast<std::function<void()>*>(data);
+}
+
+}
+
+MockBluez::MockBluez(const MockBluezConfig &config) :
+	mConfig(config),
+	mLatency(config.latency),
+	mThread(nullptr),
+	mContext(nullptr),
+	mLoop(nullptr),
+	mConn(nullptr),
+	mObjectManager(nullptr),
+	mNameId(0),
+	mReady(false),
+	mNameOwned(false)
+{
+}
+
+MockBluez::~MockBluez()
+{
+	stop();
+}
+
+std::string MockBluez::deviceAddress(unsigned int device)
+{
+	char address[18];
+	snprintf(address, sizeof(address), "00:11:22:33:%02X:%02X", (device >> 8) & 0xff, device & 0xff);
+	return address;
+}
+
+std::string MockBluez::serviceUuid(unsigned int service)
+{
+	char uuid[37];
+	snprintf(uuid, sizeof(uuid), "0000%04x-0000-1000-8000-00805f9b34fb", 0xa000 + (service & 0xfff));
+	return uuid;
+}
+
+std::string MockBluez::characteristicUuid(unsigned int service, unsigned int characteristic)
+{
+	char uuid[37];
+	snprintf(uuid, sizeof(uuid), "%04x%04x-0000-1000-8000-00805f9b34fb", 0xb000 + (service & 0xfff), characteristic & 0xffff);
+	return uuid;
+}
+
+std::string MockBluez::descriptorUuid(unsigned int descriptor)
+{
+	char uuid[37];
+	snprintf(uuid, sizeof(uuid), "0000%04x-0000-1000-8000-00805f9b34fb", 0xc000 + (descriptor & 0xfff));
+	return uuid;
+}
+
+bool MockBluez::start(const std::string &busAddress)
+{
+	if (mThread)
+		return mNameOwned;
+
+	mBusAddress = busAddress;
+	mContext = g_main_context_new();
+	mLoop = g_main_loop_new(mContext, FALSE);
+	mThread = g_thread_new("mock-bluez", run, this);
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mCondition.wait(lock, [this] { return mReady; });
+
+	return mNameOwned;
+}
+
+void MockBluez::stop()
+{
+	if (!mThread)
+		return;
+
+	g_main_loop_quit(mLoop);
+	g_thread_join(mThread);
+	mThread = nullptr;
+
+	g_main_loop_unref(mLoop);
+	mLoop = nullptr;
+	g_main_context_unref(mContext);
+	mContext = nullptr;
+}
+
+gpointer MockBluez::run(gpointer user_data)
+{
+	MockBluez *mock = static_cast<MockBluez*>(user_data);
+
+	g_main_context_push_thread_default(mock->mContext);
+
+	mock->setup();
+	g_main_loop_run(mock->mLoop);
+	mock->teardown();
+
+	g_main_context_pop_thread_default(mock->mContext);
+	return NULL;
+}
+
+void MockBluez::setup()
+{
+	GError *error = 0;
+
+	mConn = g_dbus_connection_new_for_address_sync(mBusAddress.c_str(),
+	                                               (GDBusConnectionFlags) (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+	                                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+	                                               NULL, NULL, &error);
+	if (error)
+	{
+		fprintf(stderr, "mock-bluez: failed to connect to %s: %s\n", mBusAddress.c_str(), error->message);
+		g_error_free(error);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mReady = true;
+		mCondition.notify_all();
+		return;
+	}
+
+	mObjectManager = g_dbus_object_manager_server_new("/");
+	createAdapter();
+	createProfileManager();
+	g_dbus_object_manager_server_set_connection(mObjectManager, mConn);
+
+	mNameId = g_bus_own_name_on_connection(mConn, "org.bluez", G_BUS_NAME_OWNER_FLAGS_NONE,
+	                                       onNameAcquired, onNameLost, this, NULL);
+}
+
+void MockBluez::teardown()
+{
+	for (auto &device : mDevices)
+	{
+		unexportGattTree(device.second);
+		g_dbus_object_manager_server_unexport(mObjectManager, device.second->path.c_str());
+		g_object_unref(device.second->interface);
+		g_object_unref(device.second->object);
+		delete device.second;
+	}
+	mDevices.clear();
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (auto &socket : mProfileSockets)
+			close(socket.second);
+		mProfileSockets.clear();
+	}
+
+	if (mNameId)
+	{
+		g_bus_unown_name(mNameId);
+		mNameId = 0;
+	}
+
+	if (mObjectManager)
+	{
+		g_object_unref(mObjectManager);
+		mObjectManager = nullptr;
+	}
+
+	if (mConn)
+	{
+		g_dbus_connection_close_sync(mConn, NULL, NULL);
+		g_object_unref(mConn);
+		mConn = nullptr;
+	}
+}
+
+void MockBluez::onNameAcquired(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+	MockBluez *mock = static_cast<MockBluez*>(user_data);
+
+	std::lock_guard<std::mutex> lock(mock->mMutex);
+	mock->mReady = true;
+	mock->mNameOwned = true;
+	mock->mCondition.notify_all();
+}
+
+void MockBluez::onNameLost(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+	MockBluez *mock = static_cast<MockBluez*>(user_data);
+
+	std::lock_guard<std::mutex> lock(mock->mMutex);
+	if (!mock->mReady)
+	{
+		fprintf(stderr, "mock-bluez: failed to own org.bluez\n");
+		mock->mReady = true;
+		mock->mCondition.notify_all();
+	}
+}
+
+void MockBluez::invoke(std::function<void()> function)
+{
+	g_main_context_invoke_full(mContext, G_PRIORITY_DEFAULT, callFunction,
+	                           new std::function<void()>(function), deleteFunction);
+}
+
+void MockBluez::reply(std::function<void()> function)
+{
+	unsigned int latency = mLatency;
+	if (!latency)
+	{
+		function();
+		return;
+	}
+
+	GSource *source = g_timeout_source_new(latency);
+	g_source_set_callback(source, callFunction, new std::function<void()>(function), deleteFunction);
+	g_source_attach(source, mContext);
+	g_source_unref(source);
+}
+
+GVariant* MockBluez::createValue(const std::vector<uint8_t> &value)
+{
+	return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, value.data(), value.size(), sizeof(uint8_t));
+}
+
+void MockBluez::createAdapter()
+{
+	BluezObjectSkeleton *object = bluez_object_skeleton_new(MOCK_BLUEZ_ADAPTER_PATH);
+
+	BluezAdapter1 *adapter = bluez_adapter1_skeleton_new();
+	bluez_adapter1_set_address(adapter, MOCK_BLUEZ_ADAPTER_ADDRESS);
+	bluez_object_skeleton_set_adapter1(object, adapter);
+
+	BluezGattManager1 *gattManager = bluez_gatt_manager1_skeleton_new();
+	g_signal_connect(gattManager, "handle-register-application", G_CALLBACK(onHandleRegisterApplication), this);
+	g_signal_connect(gattManager, "handle-unregister-application", G_CALLBACK(onHandleUnregisterApplication), this);
+	bluez_object_skeleton_set_gatt_manager1(object, gattManager);
+
+	BluezLEAdvertisingManager1 *advertisingManager = bluez_leadvertising_manager1_skeleton_new();
+	bluez_object_skeleton_set_leadvertising_manager1(object, advertisingManager);
+
+	g_dbus_object_manager_server_export(mObjectManager, G_DBUS_OBJECT_SKELETON(object));
+
+	g_object_unref(advertisingManager);
+	g_object_unref(gattManager);
+	g_object_unref(adapter);
+	g_object_unref(object);
+}
+
+void MockBluez::createProfileManager()
+{
+	BluezObjectSkeleton *object = bluez_object_skeleton_new(MOCK_BLUEZ_PATH);
+
+	BluezProfileManager1 *profileManager = bluez_profile_manager1_skeleton_new();
+	g_signal_connect(profileManager, "handle-register-profile", G_CALLBACK(onHandleRegisterProfile), this);
+	g_signal_connect(profileManager, "handle-unregister-profile", G_CALLBACK(onHandleUnregisterProfile), this);
+	bluez_object_skeleton_set_profile_manager1(object, profileManager);
+
+	g_dbus_object_manager_server_export(mObjectManager, G_DBUS_OBJECT_SKELETON(object));
+
+	g_object_unref(profileManager);
+	g_object_unref(object);
+}
+
+void MockBluez::addDevices(unsigned int count)
+{
+	invoke([this, count]() {
+		for (unsigned int n = 0; n < count; n++)
+			createDevice(n);
+	});
+}
+
+void MockBluez::removeDevices()
+{
+	invoke([this]() {
+		for (auto &device : mDevices)
+		{
+			unexportGattTree(device.second);
+			g_dbus_object_manager_server_unexport(mObjectManager, device.second->path.c_str());
+			g_object_unref(device.second->interface);
+			g_object_unref(device.second->object);
+			delete device.second;
+		}
+		mDevices.clear();
+	});
+}
+
+void MockBluez::createDevice(unsigned int index)
+{
+	if (mDevices.find(index) != mDevices.end())
+		return;
+
+	std::string address = deviceAddress(index);
+	std::string path = MOCK_BLUEZ_ADAPTER_PATH "/dev_" + address;
+	std::replace(path.begin(), path.end(), ':', '_');
+
+	Device *device = new Device();
+	device->mock = this;
+	device->index = index;
+	device->path = path;
+	device->connected = false;
+	device->object = bluez_object_skeleton_new(path.c_str());
+	device->interface = bluez_device1_skeleton_new();
+
+	std::vector<std::string> uuids;
+	for (unsigned int s = 0; s < mConfig.services; s++)
+		uuids.push_back(serviceUuid(s));
+
+	std::vector<const char*> uuidList(uuids.size() + 1, NULL);
+	for (size_t n = 0; n < uuids.size(); n++)
+		uuidList[n] = uuids[n].c_str();
+
+	std::string name = "Mock device " + std::to_string(index);
+
+	bluez_device1_set_address(device->interface, address.c_str());
+	bluez_device1_set_address_type(device->interface, "random");
+	bluez_device1_set_name(device->interface, name.c_str());
+	bluez_device1_set_alias(device->interface, name.c_str());
+	bluez_device1_set_adapter(device->interface, MOCK_BLUEZ_ADAPTER_PATH);
+	bluez_device1_set_rssi(device->interface, -50);
+	bluez_device1_set_uuids(device->interface, uuidList.data());
+	bluez_device1_set_connected(device->interface, FALSE);
+	bluez_device1_set_services_resolved(device->interface, FALSE);
+	bluez_device1_set_manufacturer_data(device->interface, g_variant_new("a{qv}", NULL));
+	bluez_device1_set_service_data(device->interface, g_variant_new("a{sv}", NULL));
+	bluez_device1_set_key_code(device->interface, g_variant_new("a{sv}", NULL));
+	bluez_device1_set_map_instance_properties(device->interface, g_variant_new("ai", NULL));
+
+	g_signal_connect(device->interface, "handle-connect", G_CALLBACK(onHandleConnect), device);
+	g_signal_connect(device->interface, "handle-connect-gatt", G_CALLBACK(onHandleConnect), device);
+	g_signal_connect(device->interface, "handle-disconnect", G_CALLBACK(onHandleDisconnect), device);
+	g_signal_connect(device->interface, "handle-connect-profile", G_CALLBACK(onHandleConnectProfile), device);
+	g_signal_connect(device->interface, "handle-disconnect-profile", G_CALLBACK(onHandleDisconnectProfile), device);
+
+	bluez_object_skeleton_set_device1(device->object, device->interface);
+	mDevices[index] = device;
+
+	g_dbus_object_manager_server_export(mObjectManager, G_DBUS_OBJECT_SKELETON(device->object));
+}
+
+void MockBluez::exportGattTree(Device *device)
+{
+	const char *characteristicFlags[] = { "read", "write", "write-without-response", "notify", "reliable-write", NULL };
+	const char *descriptorFlags[] = { "read", "write", NULL };
+	const char *noIncludes[] = { NULL };
+	unsigned int handle = 1;
+
+	// Like BlueZ every object is exported right after its parent
+	for (unsigned int s = 0; s < mConfig.services; s++)
+	{
+		char name[16];
+		snprintf(name, sizeof(name), "/service%04x", handle++);
+		std::string servicePath = device->path + name;
+
+		BluezObjectSkeleton *serviceObject = bluez_object_skeleton_new(servicePath.c_str());
+		BluezGattService1 *service = bluez_gatt_service1_skeleton_new();
+		bluez_gatt_service1_set_uuid(service, serviceUuid(s).c_str());
+		bluez_gatt_service1_set_primary(service, TRUE);
+		bluez_gatt_service1_set_device(service, device->path.c_str());
+		bluez_gatt_service1_set_includes(service, noIncludes);
+		bluez_object_skeleton_set_gatt_service1(serviceObject, service);
+		g_object_unref(service);
+
+		g_dbus_object_manager_server_export(mObjectManager, G_DBUS_OBJECT_SKELETON(serviceObject));
+		device->gattObjects.push_back(serviceObject);
+
+		for (unsigned int c = 0; c < mConfig.characteristics; c++)
+		{
+			snprintf(name, sizeof(name), "/char%04x", handle);
+			handle += 2;
+			std::string characteristicPath = servicePath + name;
+
+			Attribute *characteristic = new Attribute();
+			characteristic->mock = this;
+			characteristic->descriptor = nullptr;
+			characteristic->notifying = false;
+			characteristic->value.resize((s == 0 && c == 0) ? mConfig.longValueSize : mConfig.valueSize);
+			for (size_t n = 0; n < characteristic->value.size(); n++)
+				characteristic->value[n] = n & 0xff;
+
+			characteristic->object = bluez_object_skeleton_new(characteristicPath.c_str());
+			characteristic->characteristic = bluez_gatt_characteristic1_skeleton_new();
+			bluez_gatt_characteristic1_set_uuid(characteristic->characteristic, characteristicUuid(s, c).c_str());
+			bluez_gatt_characteristic1_set_service(characteristic->characteristic, servicePath.c_str());
+			bluez_gatt_characteristic1_set_value(characteristic->characteristic, createValue(characteristic->value));
+			bluez_gatt_characteristic1_set_flags(characteristic->characteristic, g_variant_new_strv(characteristicFlags, -1));
+			bluez_gatt_characteristic1_set_notifying(characteristic->characteristic, FALSE);
+
+			g_signal_connect(characteristic->characteristic, "handle-read-value", G_CALLBACK(onHandleCharacteristicRead), characteristic);
+			g_signal_connect(characteristic->characteristic, "handle-write-value", G_CALLBACK(onHandleCharacteristicWrite), characteristic);
+			g_signal_connect(characteristic->characteristic, "handle-start-notify", G_CALLBACK(onHandleStartNotify), characteristic);
+			g_signal_connect(characteristic->characteristic, "handle-stop-notify", G_CALLBACK(onHandleStopNotify), characteristic);
+
+			bluez_object_skeleton_set_gatt_characteristic1(characteristic->object, characteristic->characteristic);
+			g_dbus_object_manager_server_export(mObjectManager, G_DBUS_OBJECT_SKELETON(characteristic->object));
+			device->attributes.push_back(characteristic);
+			device->characteristics.push_back(characteristic);
+
+			for (unsigned int d = 0; d < mConfig.descriptors; d++)
+			{
+				snprintf(name, sizeof(name), "/desc%04x", handle++);
+				std::string descriptorPath = characteristicPath + name;
+
+				Attribute *descriptor = new Attribute();
+				descriptor->mock = this;
+				descriptor->characteristic = nullptr;
+				descriptor->notifying = false;
+				descriptor->value.assign(2, 0);
+
+				descriptor->object = bluez_object_skeleton_new(descriptorPath.c_str());
+				descriptor->descriptor = bluez_gatt_descriptor1_skeleton_new();
+				bluez_gatt_descriptor1_set_uuid(descriptor->descriptor, descriptorUuid(d).c_str());
+				bluez_gatt_descriptor1_set_characteristic(descriptor->descriptor, characteristicPath.c_str());
+				bluez_gatt_descriptor1_set_value(descriptor->descriptor, createValue(descriptor->value));
+				bluez_gatt_descriptor1_set_flags(descriptor->descriptor, g_variant_new_strv(descriptorFlags, -1));
+
+				g_signal_connect(descriptor->descriptor, "handle-read-value", G_CALLBACK(onHandleDescriptorRead), descriptor);
+				g_signal_connect(descriptor->descriptor, "handle-write-value", G_CALLBACK(onHandleDescriptorWrite), descriptor);
+
+				bluez_object_skeleton_set_gatt_descriptor1(descriptor->object, descriptor->descriptor);
+				g_dbus_object_manager_server_export(mObjectManager, G_DBUS_OBJECT_SKELETON(descriptor->object));
+				device->attributes.push_back(descriptor);
+			}
+		}
+	}
+}
+
+void MockBluez::unexportGattTree(Device *device)
+{
+	// Children go first, as BlueZ removes them
+	for (auto attributeIter = device->attributes.rbegin(); attributeIter != device->attributes.rend(); ++attributeIter)
+	{
+		Attribute *attribute = *attributeIter;
+		g_dbus_object_manager_server_unexport(mObjectManager, g_dbus_object_get_object_path(G_DBUS_OBJECT(attribute->object)));
+
+		if (attribute->characteristic)
+			g_object_unref(attribute->characteristic);
+		if (attribute->descriptor)
+			g_object_unref(attribute->descriptor);
+		g_object_unref(attribute->object);
+		delete attribute;
+	}
+	device->attributes.clear();
+	device->characteristics.clear();
+
+	for (auto object : device->gattObjects)
+	{
+		g_dbus_object_manager_server_unexport(mObjectManager, g_dbus_object_get_object_path(G_DBUS_OBJECT(object)));
+		g_object_unref(object);
+	}
+	device->gattObjects.clear();
+}
+
+gboolean MockBluez::onHandleConnect(BluezDevice1 *interface, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+	Device *device = static_cast<Device*>(user_data);
+	MockBluez *mock = device->mock;
+	unsigned int index = device->index;
+
+	mock->reply([mock, index, invocation]() {
+		auto deviceIter = mock->mDevices.find(index);
+		if (deviceIter == mock->mDevices.end())
+		{
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.DoesNotExist", "Device removed");
+			return;
+		}
+
+		Device *device = deviceIter->second;
+		if (!device->connected)
+		{
+			device->connected = true;
+			bluez_device1_set_connected(device->interface, TRUE);
+			mock->exportGattTree(device);
+			bluez_device1_set_services_resolved(device->interface, TRUE);
+		}
+
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleDisconnect(BluezDevice1 *interface, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+	Device *device = static_cast<Device*>(user_data);
+
+	if (device->connected)
+	{
+		device->connected = false;
+		bluez_device1_set_services_resolved(device->interface, FALSE);
+		device->mock->unexportGattTree(device);
+		bluez_device1_set_connected(device->interface, FALSE);
+	}
+
+	device->mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleConnectProfile(BluezDevice1 *interface, GDBusMethodInvocation *invocation,
+                                           const gchar *uuid, gpointer user_data)
+{
+	Device *device = static_cast<Device*>(user_data);
+	MockBluez *mock = device->mock;
+	unsigned int index = device->index;
+	std::string profileUuid = uuid;
+
+	mock->reply([mock, index, profileUuid, invocation]() {
+		auto deviceIter = mock->mDevices.find(index);
+		if (deviceIter == mock->mDevices.end())
+		{
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.DoesNotExist", "Device removed");
+			return;
+		}
+
+		auto profileIter = mock->mProfiles.find(profileUuid);
+		if (profileIter == mock->mProfiles.end())
+		{
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotAvailable", "No profile registered");
+			return;
+		}
+
+		int sockets[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0)
+		{
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", strerror(errno));
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mock->mMutex);
+			auto socketIter = mock->mProfileSockets.find(index);
+			if (socketIter != mock->mProfileSockets.end())
+				close(socketIter->second);
+			mock->mProfileSockets[index] = sockets[0];
+		}
+
+		// The list owns the SIL end from here. NewConnection goes out before
+		// the reply, so the SIL has the socket once ConnectProfile returns.
+		GUnixFDList *fdList = g_unix_fd_list_new_from_array(&sockets[1], 1);
+		g_dbus_connection_call_with_unix_fd_list(mock->mConn, profileIter->second.owner.c_str(), profileIter->second.path.c_str(),
+		                                         "org.bluez.Profile1", "NewConnection",
+		                                         g_variant_new("(oha{sv})", deviceIter->second->path.c_str(), 0, NULL),
+		                                         NULL, G_DBUS_CALL_FLAGS_NONE, -1, fdList, NULL, NULL, NULL);
+		g_object_unref(fdList);
+
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleDisconnectProfile(BluezDevice1 *interface, GDBusMethodInvocation *invocation,
+                                              const gchar *uuid, gpointer user_data)
+{
+	Device *device = static_cast<Device*>(user_data);
+	MockBluez *mock = device->mock;
+
+	auto profileIter = mock->mProfiles.find(uuid);
+	if (profileIter != mock->mProfiles.end())
+		g_dbus_connection_call(mock->mConn, profileIter->second.owner.c_str(), profileIter->second.path.c_str(),
+		                       "org.bluez.Profile1", "RequestDisconnection", g_variant_new("(o)", device->path.c_str()),
+		                       NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+
+	{
+		std::lock_guard<std::mutex> lock(mock->mMutex);
+		auto socketIter = mock->mProfileSockets.find(device->index);
+		if (socketIter != mock->mProfileSockets.end())
+		{
+			close(socketIter->second);
+			mock->mProfileSockets.erase(socketIter);
+		}
+	}
+
+	mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleRegisterProfile(BluezProfileManager1 *interface, GDBusMethodInvocation *invocation,
+                                            const gchar *profile, const gchar *uuid, GVariant *options, gpointer user_data)
+{
+	MockBluez *mock = static_cast<MockBluez*>(user_data);
+
+	Profile &registered = mock->mProfiles[uuid];
+	registered.owner = g_dbus_method_invocation_get_sender(invocation);
+	registered.path = profile;
+
+	mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleUnregisterProfile(BluezProfileManager1 *interface, GDBusMethodInvocation *invocation,
+                                              const gchar *profile, gpointer user_data)
+{
+	MockBluez *mock = static_cast<MockBluez*>(user_data);
+
+	for (auto profileIter = mock->mProfiles.begin(); profileIter != mock->mProfiles.end();)
+	{
+		if (profileIter->second.path == profile)
+			profileIter = mock->mProfiles.erase(profileIter);
+		else
+			++profileIter;
+	}
+
+	mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleRegisterApplication(BluezGattManager1 *interface, GDBusMethodInvocation *invocation,
+                                                const gchar *application, GVariant *options, gpointer user_data)
+{
+	MockBluez *mock = static_cast<MockBluez*>(user_data);
+
+	{
+		std::lock_guard<std::mutex> lock(mock->mMutex);
+		mock->mApplicationOwner = g_dbus_method_invocation_get_sender(invocation);
+		mock->mApplicationPath = application;
+	}
+
+	mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleUnregisterApplication(BluezGattManager1 *interface, GDBusMethodInvocation *invocation,
+                                                  const gchar *application, gpointer user_data)
+{
+	MockBluez *mock = static_cast<MockBluez*>(user_data);
+
+	{
+		std::lock_guard<std::mutex> lock(mock->mMutex);
+		if (mock->mApplicationPath == application)
+		{
+			mock->mApplicationOwner.clear();
+			mock->mApplicationPath.clear();
+		}
+	}
+
+	mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleCharacteristicRead(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation,
+                                               GVariant *options, gpointer user_data)
+{
+	Attribute *attribute = static_cast<Attribute*>(user_data);
+	MockBluez *mock = attribute->mock;
+
+	guint16 offset = 0;
+	g_variant_lookup(options, "offset", "q", &offset);
+
+	if (offset > attribute->value.size())
+	{
+		mock->reply([invocation]() {
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidOffset", "Invalid offset");
+		});
+		return TRUE;
+	}
+
+	// BlueZ continues with Read Blob Requests until the value is complete
+	size_t length = attribute->value.size() - offset;
+	if (mock->mConfig.shortReads)
+		length = std::min(length, (size_t) mock->mConfig.mtu - 1);
+	std::vector<uint8_t> value(attribute->value.begin() + offset, attribute->value.begin() + offset + length);
+
+	mock->reply([invocation, value]() {
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(@ay)", createValue(value)));
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleCharacteristicWrite(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation,
+                                                GVariant *value, GVariant *options, gpointer user_data)
+{
+	Attribute *attribute = static_cast<Attribute*>(user_data);
+	MockBluez *mock = attribute->mock;
+
+	guint16 offset = 0;
+	g_variant_lookup(options, "offset", "q", &offset);
+
+	if (offset > attribute->value.size())
+	{
+		mock->reply([invocation]() {
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidOffset", "Invalid offset");
+		});
+		return TRUE;
+	}
+
+	gsize size = 0;
+	const uint8_t *data = static_cast<const uint8_t*>(g_variant_get_fixed_array(value, &size, sizeof(uint8_t)));
+
+	attribute->value.resize(std::max(attribute->value.size(), (size_t) offset + size));
+	std::copy(data, data + size, attribute->value.begin() + offset);
+
+	mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleStartNotify(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+	Attribute *attribute = static_cast<Attribute*>(user_data);
+
+	attribute->notifying = true;
+	bluez_gatt_characteristic1_set_notifying(interface, TRUE);
+
+	attribute->mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleStopNotify(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+	Attribute *attribute = static_cast<Attribute*>(user_data);
+
+	attribute->notifying = false;
+	bluez_gatt_characteristic1_set_notifying(interface, FALSE);
+
+	attribute->mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleDescriptorRead(BluezGattDescriptor1 *interface, GDBusMethodInvocation *invocation,
+                                           GVariant *options, gpointer user_data)
+{
+	Attribute *attribute = static_cast<Attribute*>(user_data);
+	std::vector<uint8_t> value = attribute->value;
+
+	attribute->mock->reply([invocation, value]() {
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(@ay)", createValue(value)));
+	});
+
+	return TRUE;
+}
+
+gboolean MockBluez::onHandleDescriptorWrite(BluezGattDescriptor1 *interface, GDBusMethodInvocation *invocation,
+                                            GVariant *value, GVariant *options, gpointer user_data)
+{
+	Attribute *attribute = static_cast<Attribute*>(user_data);
+
+	gsize size = 0;
+	const uint8_t *data = static_cast<const uint8_t*>(g_variant_get_fixed_array(value, &size, sizeof(uint8_t)));
+	attribute->value.assign(data, data + size);
+
+	attribute->mock->reply([invocation]() {
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	});
+
+	return TRUE;
+}
+
+void MockBluez::sendNotifications(unsigned int device, unsigned int count, unsigned int interval)
+{
+	invoke([this, device, count, interval]() {
+		NotificationRun *notificationRun = new NotificationRun();
+		notificationRun->mock = this;
+		notificationRun->device = device;
+		notificationRun->remaining = count;
+		notificationRun->next = 0;
+
+		GSource *source = interval ? g_timeout_source_new(interval) : g_idle_source_new();
+		g_source_set_callback(source, [](gpointer user_data) -> gboolean {
+			NotificationRun *notificationRun = static_cast<NotificationRun*>(user_data);
+			MockBluez *mock = notificationRun->mock;
+
+			auto deviceIter = mock->mDevices.find(notificationRun->device);
+			if (deviceIter == mock->mDevices.end() || !deviceIter->second->connected)
+				return FALSE;
+
+			auto &characteristics = deviceIter->second->characteristics;
+			for (size_t tried = 0; tried < characteristics.size(); tried++)
+			{
+				Attribute *characteristic = characteristics[notificationRun->next++ % characteristics.size()];
+				if (!characteristic->notifying)
+					continue;
+
+				std::vector<uint8_t> value(std::max(mock->mConfig.valueSize, (unsigned int) sizeof(gint64)), 0);
+				gint64 now = g_get_monotonic_time();
+				memcpy(value.data(), &now, sizeof(now));
+
+				bluez_gatt_characteristic1_set_value(characteristic->characteristic, createValue(value));
+				g_dbus_interface_skeleton_flush(G_DBUS_INTERFACE_SKELETON(characteristic->characteristic));
+
+				return --notificationRun->remaining ? TRUE : FALSE;
+			}
+
+			// Nobody subscribed
+			return FALSE;
+		}, notificationRun, [](gpointer user_data) {
+			delete static_cast<NotificationRun*>(user_data);
+		});
+		g_source_attach(source, mContext);
+		g_source_unref(source);
+	});
+}
+
+int MockBluez::acquire(const std::string &characteristicUuid, const char *method)
+{
+	std::string owner, application;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		owner = mApplicationOwner;
+		application = mApplicationPath;
+	}
+
+	if (owner.empty() || !mConn)
+		return -1;
+
+	GError *error = 0;
+	GVariant *objects = g_dbus_connection_call_sync(mConn, owner.c_str(), application.c_str(),
+	                                                "org.freedesktop.DBus.ObjectManager", "GetManagedObjects", NULL,
+	                                                G_VARIANT_TYPE("(a{oa{sa{sv}}})"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+	if (error)
+	{
+		fprintf(stderr, "mock-bluez: failed to get objects of %s: %s\n", application.c_str(), error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	std::string characteristicPath;
+	GVariantIter *objectIter = 0;
+	const gchar *objectPath = 0;
+	GVariant *interfaces = 0;
+
+	g_variant_get(objects, "(a{oa{sa{sv}}})", &objectIter);
+	while (g_variant_iter_next(objectIter, "{&o@a{sa{sv}}}", &objectPath, &interfaces))
+	{
+		GVariant *properties = g_variant_lookup_value(interfaces, "org.bluez.GattCharacteristic1", G_VARIANT_TYPE_VARDICT);
+		const gchar *uuid = 0;
+
+		if (properties && g_variant_lookup(properties, "UUID", "&s", &uuid) && characteristicUuid == uuid)
+			characteristicPath = objectPath;
+
+		if (properties)
+			g_variant_unref(properties);
+		g_variant_unref(interfaces);
+	}
+	g_variant_iter_free(objectIter);
+	g_variant_unref(objects);
+
+	if (characteristicPath.empty())
+		return -1;
+
+	GVariantBuilder options;
+	g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&options, "{sv}", "mtu", g_variant_new_uint16(mConfig.mtu));
+	g_variant_builder_add(&options, "{sv}", "link", g_variant_new_string("LE"));
+
+	GUnixFDList *fdList = 0;
+	GVariant *result = g_dbus_connection_call_with_unix_fd_list_sync(mConn, owner.c_str(), characteristicPath.c_str(),
+	                                                                 "org.bluez.GattCharacteristic1", method,
+	                                                                 g_variant_new("(a{sv})", &options), G_VARIANT_TYPE("(hq)"),
+	                                                                 G_DBUS_CALL_FLAGS_NONE, -1, NULL, &fdList, NULL, &error);
+	if (error)
+	{
+		fprintf(stderr, "mock-bluez: %s failed: %s\n", method, error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	gint32 handle = -1;
+	guint16 mtu = 0;
+	g_variant_get(result, "(hq)", &handle, &mtu);
+	g_variant_unref(result);
+
+	int fd = fdList ? g_unix_fd_list_get(fdList, handle, NULL) : -1;
+	if (fdList)
+		g_object_unref(fdList);
+	if (fd < 0)
+		return -1;
+
+	// The SIL creates the pair non-blocking, the mock end is used blocking
+	int flags = fcntl(fd, F_GETFL);
+	if (flags >= 0)
+		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+
+	return fd;
+}
+
+bool MockBluez::writeAcquired(const std::string &characteristicUuid, unsigned int count, size_t size, gint64 &elapsed)
+{
+	int fd = acquire(characteristicUuid, "AcquireWrite");
+	if (fd < 0)
+		return false;
+
+	std::vector<uint8_t> packet(size, 0x5a);
+	bool success = true;
+	gint64 begin = g_get_monotonic_time();
+
+	// The socket only takes as much as the SIL keeps up with
+	for (unsigned int n = 0; n < count && success; n++)
+	{
+		ssize_t written;
+		do
+			written = write(fd, packet.data(), packet.size());
+		while (written < 0 && errno == EINTR);
+
+		success = (written == (ssize_t) packet.size());
+	}
+
+	elapsed = g_get_monotonic_time() - begin;
+	close(fd);
+
+	return success;
+}
+
+int MockBluez::acquireNotify(const std::string &characteristicUuid)
+{
+	return acquire(characteristicUuid, "AcquireNotify");
+}
+
+int MockBluez::takeProfileSocket(unsigned int device)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto socketIter = mProfileSockets.find(device);
+	if (socketIter == mProfileSockets.end())
+		return -1;
+
+	int fd = socketIter->second;
+	mProfileSockets.erase(socketIter);
+	return fd;
+}
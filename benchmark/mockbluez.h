@@ -0,0 +1,182 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef MOCKBLUEZ_H
+#define MOCKBLUEZ_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "bluez-interface.h"
+}
+
+#define MOCK_BLUEZ_PATH "/org/bluez"
+#define MOCK_BLUEZ_ADAPTER_PATH "/org/bluez/hci0"
+
+struct MockBluezConfig
+{
+	unsigned int services;          // per device
+	unsigned int characteristics;   // per service
+	unsigned int descriptors;       // per characteristic
+	unsigned int valueSize;
+	// Size of the value of the first characteristic of every device
+	unsigned int longValueSize;
+	uint16_t mtu;
+	// Answer every ReadValue with at most MTU - 1 bytes like a single Read
+	// (Blob) Request would. BlueZ does long reads itself and returns the
+	// whole value, so this is only for callers that read on by offset.
+	bool shortReads;
+	// Time in ms before a method call is answered
+	unsigned int latency;
+};
+
+// Stand-in for the org.bluez service. It owns the name on the given bus
+// and serves an adapter with any number of LE devices, each with the same
+// configurable GATT tree. Everything runs on a thread of its own so the
+// latency of BlueZ and the time the SIL spends in the main loop can be
+// told apart.
+class MockBluez
+{
+public:
+	MockBluez(const MockBluezConfig &config);
+	~MockBluez();
+
+	MockBluez(const MockBluez&) = delete;
+	MockBluez& operator = (const MockBluez&) = delete;
+
+	bool start(const std::string &busAddress);
+	void stop();
+
+	void setLatency(unsigned int latency) { mLatency = latency; }
+
+	// Devices are numbered from 0, already known devices are kept
+	void addDevices(unsigned int count);
+	void removeDevices();
+
+	// Notifications carry the monotonic time they were sent at in their
+	// first 8 bytes. A notification is sent every interval ms, or as fast
+	// as possible if interval is 0.
+	void sendNotifications(unsigned int device, unsigned int count, unsigned int interval);
+
+	// Acquires the write socket of a characteristic of the application the
+	// SIL registered and pushes count packets through it. This blocks and
+	// has to be called from a thread which does not run the SIL.
+	bool writeAcquired(const std::string &characteristicUuid, unsigned int count, size_t size, gint64 &elapsed);
+	// Acquires the notify socket of a characteristic of the application the
+	// SIL registered, every value it notifies comes out as one packet. The
+	// same as for writeAcquired() applies, the caller owns the fd.
+	int acquireNotify(const std::string &characteristicUuid);
+
+	// A profile connection is made like BlueZ does for RFCOMM, except that
+	// the SIL gets one end of a socketpair. This returns the other end of
+	// the last connection to the device, or -1 if there is none. The
+	// caller owns the fd from then on.
+	int takeProfileSocket(unsigned int device);
+
+	static std::string deviceAddress(unsigned int device);
+	static std::string serviceUuid(unsigned int service);
+	static std::string characteristicUuid(unsigned int service, unsigned int characteristic);
+	static std::string descriptorUuid(unsigned int descriptor);
+
+private:
+	struct Attribute;
+	struct Device;
+
+	static gpointer run(gpointer user_data);
+	void setup();
+	void teardown();
+	void invoke(std::function<void()> function);
+	// Calls AcquireWrite or AcquireNotify, returns a blocking fd
+	int acquire(const std::string &characteristicUuid, const char *method);
+	void reply(std::function<void()> function);
+
+	void createAdapter();
+	void createProfileManager();
+	void createDevice(unsigned int index);
+	void exportGattTree(Device *device);
+	void unexportGattTree(Device *device);
+	static GVariant* createValue(const std::vector<uint8_t> &value);
+
+	static void onNameAcquired(GDBusConnection *connection, const gchar *name, gpointer user_data);
+	static void onNameLost(GDBusConnection *connection, const gchar *name, gpointer user_data);
+
+	static gboolean onHandleConnect(BluezDevice1 *interface, GDBusMethodInvocation *invocation, gpointer user_data);
+	static gboolean onHandleDisconnect(BluezDevice1 *interface, GDBusMethodInvocation *invocation, gpointer user_data);
+	static gboolean onHandleConnectProfile(BluezDevice1 *interface, GDBusMethodInvocation *invocation,
+	                                       const gchar *uuid, gpointer user_data);
+	static gboolean onHandleDisconnectProfile(BluezDevice1 *interface, GDBusMethodInvocation *invocation,
+	                                          const gchar *uuid, gpointer user_data);
+	static gboolean onHandleRegisterProfile(BluezProfileManager1 *interface, GDBusMethodInvocation *invocation,
+	                                        const gchar *profile, const gchar *uuid, GVariant *options, gpointer user_data);
+	static gboolean onHandleUnregisterProfile(BluezProfileManager1 *interface, GDBusMethodInvocation *invocation,
+	                                          const gchar *profile, gpointer user_data);
+	static gboolean onHandleRegisterApplication(BluezGattManager1 *interface, GDBusMethodInvocation *invocation,
+	                                            const gchar *application, GVariant *options, gpointer user_data);
+	static gboolean onHandleUnregisterApplication(BluezGattManager1 *interface, GDBusMethodInvocation *invocation,
+	                                              const gchar *application, gpointer user_data);
+	static gboolean onHandleCharacteristicRead(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation,
+	                                           GVariant *options, gpointer user_data);
+	static gboolean onHandleCharacteristicWrite(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation,
+	                                            GVariant *value, GVariant *options, gpointer user_data);
+	static gboolean onHandleStartNotify(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation, gpointer user_data);
+	static gboolean onHandleStopNotify(BluezGattCharacteristic1 *interface, GDBusMethodInvocation *invocation, gpointer user_data);
+	static gboolean onHandleDescriptorRead(BluezGattDescriptor1 *interface, GDBusMethodInvocation *invocation,
+	                                       GVariant *options, gpointer user_data);
+	static gboolean onHandleDescriptorWrite(BluezGattDescriptor1 *interface, GDBusMethodInvocation *invocation,
+	                                        GVariant *value, GVariant *options, gpointer user_data);
+
+	MockBluezConfig mConfig;
+	std::atomic<unsigned int> mLatency;
+
+	GThread *mThread;
+	GMainContext *mContext;
+	GMainLoop *mLoop;
+	std::string mBusAddress;
+	GDBusConnection *mConn;
+	GDBusObjectManagerServer *mObjectManager;
+	guint mNameId;
+
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mReady;
+	bool mNameOwned;
+	std::string mApplicationOwner;
+	std::string mApplicationPath;
+	// Mock ends of profile connections by device
+	std::map<unsigned int, int> mProfileSockets;
+
+	// Only touched from the mock thread
+	std::map<unsigned int, Device*> mDevices;
+
+	struct Profile
+	{
+		std::string owner;
+		std::string path;
+	};
+	// Registered profiles by UUID
+	std::map<std::string, Profile> mProfiles;
+};
+
+#endif // MOCKBLUEZ_H
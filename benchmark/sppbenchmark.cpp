@@ -0,0 +1,436 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <bluetooth-sil-api.h>
+
+#include "bluez5sil.h"
+#include "bluez5adapter.h"
+#include "bluez5profilespp.h"
+#include "utils.h"
+#include "benchmarkloop.h"
+#include "benchmarkstats.h"
+#include "mockbluez.h"
+
+#define SPP_UUID "00001101-0000-1000-8000-00805f9b34fb"
+// Length prefix and send time
+#define MESSAGE_HEADER_SIZE 4
+#define MESSAGE_MIN_SIZE (MESSAGE_HEADER_SIZE + sizeof(gint64))
+
+namespace
+{
+
+gchar *sizeList = NULL;
+gint messages = 10000;
+gint depth = 16;
+gboolean ioWorker = FALSE;
+
+GOptionEntry options[] =
+{
+	{ "sizes", 's', 0, G_OPTION_ARG_STRING, &sizeList, "Comma separated message sizes, default 16,256,4096,32768", "LIST" },
+	{ "messages", 'n', 0, G_OPTION_ARG_INT, &messages, "Messages per scenario", "N" },
+	{ "depth", 0, 0, G_OPTION_ARG_INT, &depth, "Writes in flight at the same time", "N" },
+	{ "io-worker", 0, 0, G_OPTION_ARG_NONE, &ioWorker, "Do the socket I/O on the SPP I/O thread", NULL },
+	{ NULL }
+};
+
+class BenchmarkAdapterObserver : public BluetoothAdapterStatusObserver
+{
+};
+
+class BenchmarkSppObserver : public BluetoothSppStatusObserver
+{
+public:
+	void dataReceived(const BluetoothSppChannelId channelId, const std::string &adapterAddress,
+	                  const uint8_t *data, const uint32_t size)
+	{
+		if (frameHandler)
+			frameHandler(data, size);
+	}
+
+	// Framing is on, so every call is one message without its length prefix
+	std::function<void(const uint8_t *data, size_t size)> frameHandler;
+};
+
+// Messages carry their size in a big endian length prefix and the
+// monotonic time they were sent at right after it
+void stampMessage(std::vector<uint8_t> &message)
+{
+	uint32_t length = message.size() - MESSAGE_HEADER_SIZE;
+	message[0] = length >> 24;
+	message[1] = length >> 16;
+	message[2] = length >> 8;
+	message[3] = length;
+
+	gint64 now = g_get_monotonic_time();
+	memcpy(&message[MESSAGE_HEADER_SIZE], &now, sizeof(now));
+}
+
+gint64 messageAge(const uint8_t *payload)
+{
+	gint64 sent;
+	memcpy(&sent, payload, sizeof(sent));
+	return g_get_monotonic_time() - sent;
+}
+
+bool writeAll(int fd, const uint8_t *data, size_t size)
+{
+	while (size)
+	{
+		ssize_t written = write(fd, data, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+
+		data += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+bool readAll(int fd, uint8_t *data, size_t size)
+{
+	while (size)
+	{
+		ssize_t count = read(fd, data, size);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+
+		data += count;
+		size -= count;
+	}
+
+	return true;
+}
+
+// The remote side of the connection. It blocks on the mock end of the
+// socketpair, so it has a thread of its own.
+struct PeerThread
+{
+	int fd;
+	std::function<bool()> body;
+	GThread *thread;
+	std::atomic<bool> finished;
+	bool success;
+};
+
+void startPeer(PeerThread &peer, std::function<bool()> body)
+{
+	peer.body = body;
+	peer.finished = false;
+	peer.success = false;
+	peer.thread = g_thread_new("spp-peer", [](gpointer user_data) -> gpointer {
+		PeerThread *peer = static_cast<PeerThread*>(user_data);
+		peer->success = peer->body();
+		peer->finished = true;
+		return NULL;
+	}, &peer);
+}
+
+bool joinPeer(PeerThread &peer)
+{
+	// A peer stuck on a dead connection is woken up by shutting it down
+	if (!runUntil([&peer]() { return peer.finished.load(); }))
+		shutdown(peer.fd, SHUT_RDWR);
+
+	g_thread_join(peer.thread);
+	return peer.success;
+}
+
+std::vector<size_t> parseSizes()
+{
+	std::vector<size_t> sizes;
+	gchar **items = g_strsplit(sizeList ? sizeList : "16,256,4096,32768", ",", -1);
+
+	for (gchar **item = items; *item; item++)
+	{
+		gint64 size = g_ascii_strtoll(*item, NULL, 10);
+		if (size > 0)
+			sizes.push_back(std::max<size_t>(size, MESSAGE_MIN_SIZE));
+	}
+
+	g_strfreev(items);
+	return sizes;
+}
+
+SppIoCounters getIoCounters(Bluez5ProfileSpp *spp, BluetoothSppChannelId channelId)
+{
+	SppIoCounters counters;
+	spp->getIoCounters(channelId, counters);
+	return counters;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	GError *error = 0;
+	GOptionContext *context = g_option_context_new("- SPP data path benchmark against a mock BlueZ");
+	g_option_context_add_main_entries(context, options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	depth = std::max(depth, 1);
+	messages = std::max(messages, 1);
+	std::vector<size_t> sizes = parseSizes();
+	if (sizes.empty())
+	{
+		fprintf(stderr, "No valid message size given\n");
+		return 1;
+	}
+	size_t maxSize = *std::max_element(sizes.begin(), sizes.end());
+
+	// The SIL talks to the system bus, so point that at a private one
+	GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+	g_test_dbus_up(bus);
+	g_setenv("DBUS_SYSTEM_BUS_ADDRESS", g_test_dbus_get_bus_address(bus), TRUE);
+
+	MockBluezConfig config;
+	memset(&config, 0, sizeof(config));
+
+	MockBluez mock(config);
+	if (!mock.start(g_test_dbus_get_bus_address(bus)))
+	{
+		g_test_dbus_down(bus);
+		g_object_unref(bus);
+		return 1;
+	}
+
+	BluetoothSIL *sil = createBluetoothSIL(BLUETOOTH_SIL_API_VERSION, BLUETOOTH_PAIRING_IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+	if (!sil || !runUntil([sil]() { return sil->getDefaultAdapter() != nullptr; }, 10000))
+	{
+		fprintf(stderr, "SIL did not pick up the mock adapter\n");
+		return 1;
+	}
+
+	BenchmarkAdapterObserver adapterObserver;
+	BenchmarkSppObserver sppObserver;
+
+	Bluez5Adapter *adapter = static_cast<Bluez5Adapter*>(sil->getDefaultAdapter());
+	adapter->registerObserver(&adapterObserver);
+
+	std::string address = convertAddressToLowerCase(MockBluez::deviceAddress(0));
+	mock.addDevices(1);
+	if (!runUntil([adapter, &address]() { return adapter->findDevice(address) != nullptr; }, 10000))
+	{
+		fprintf(stderr, "SIL did not pick up the mock device\n");
+		return 1;
+	}
+
+	Bluez5ProfileSpp *spp = dynamic_cast<Bluez5ProfileSpp*>(adapter->getProfile(BLUETOOTH_PROFILE_ID_SPP));
+	static_cast<BluetoothSppProfile*>(spp)->registerObserver(&sppObserver);
+
+	SppFramingOptions framing;
+	framing.mode = SppFramingOptions::LENGTH_PREFIX;
+	framing.prefixSize = MESSAGE_HEADER_SIZE;
+	framing.bigEndian = true;
+	framing.maxFrameSize = maxSize - MESSAGE_HEADER_SIZE;
+	spp->setDefaultFramingOptions(framing);
+	spp->setIoWorkerEnabled(ioWorker);
+
+	BluetoothSppChannelId channelId = BLUETOOTH_SPP_CHANNEL_ID_INVALID;
+	bool connectFinished = false;
+	spp->connectUuid(address, SPP_UUID, [&](BluetoothError error, BluetoothSppChannelId id) {
+		if (error == BLUETOOTH_ERROR_NONE)
+			channelId = id;
+		connectFinished = true;
+	});
+	runUntil([&connectFinished]() { return connectFinished; }, 10000);
+
+	PeerThread peer;
+	peer.fd = mock.takeProfileSocket(0);
+	if (channelId == BLUETOOTH_SPP_CHANNEL_ID_INVALID || peer.fd < 0)
+	{
+		fprintf(stderr, "Failed to connect SPP channel\n");
+		return 1;
+	}
+
+	printf("messages %d, depth %d, %s\n\n", messages, depth, ioWorker ? "I/O thread" : "main loop I/O");
+	BenchmarkRun::printThroughputHeader();
+
+	for (size_t size : sizes)
+	{
+		std::string suffix = "-" + std::to_string(size);
+
+		// Writes queued behind depth messages are not refused
+		SppTransmitOptions transmitOptions;
+		transmitOptions.lowWatermark = size * depth;
+		transmitOptions.highWatermark = 2 * size * depth;
+		spp->setTransmitOptions(channelId, transmitOptions);
+
+		// Remote to SIL, latency from the peer writing a message to the
+		// observer getting it
+		{
+			BenchmarkRun run("rx" + suffix);
+			sppObserver.frameHandler = [&run, size](const uint8_t *data, size_t frameSize) {
+				if (frameSize + MESSAGE_HEADER_SIZE != size)
+				{
+					run.addFailure();
+					return;
+				}
+				run.addLatency(messageAge(data));
+				run.addBytes(size);
+			};
+
+			SppIoCounters before = getIoCounters(spp, channelId);
+			run.begin();
+			startPeer(peer, [&peer, size]() {
+				std::vector<uint8_t> message(size, 0x5a);
+				for (gint n = 0; n < messages; n++)
+				{
+					stampMessage(message);
+					if (!writeAll(peer.fd, message.data(), message.size()))
+						return false;
+				}
+				return true;
+			});
+			runUntil([&run]() { return run.getCompleted() >= (size_t) messages; });
+			run.end();
+			joinPeer(peer);
+
+			SppIoCounters after = getIoCounters(spp, channelId);
+			run.addSyscalls(after.readCalls - before.readCalls);
+			for (size_t n = run.getCompleted(); n < (size_t) messages; n++)
+				run.addFailure();
+			sppObserver.frameHandler = nullptr;
+			run.printThroughput();
+		}
+
+		// SIL to remote, latency until writeData completes
+		{
+			BenchmarkRun run("tx" + suffix);
+			startPeer(peer, [&peer, size]() {
+				std::vector<uint8_t> message(size);
+				for (gint n = 0; n < messages; n++)
+				{
+					if (!readAll(peer.fd, message.data(), message.size()))
+						return false;
+				}
+				return true;
+			});
+
+			SppIoCounters before = getIoCounters(spp, channelId);
+			runOperations(run, messages, depth, [&](size_t n, OperationCallback done) {
+				std::vector<uint8_t> message(size, n & 0xff);
+				stampMessage(message);
+				spp->writeData(channelId, message.data(), message.size(), [done, &run, size](BluetoothError error) {
+					if (error == BLUETOOTH_ERROR_NONE)
+						run.addBytes(size);
+					done(error == BLUETOOTH_ERROR_NONE);
+				});
+			});
+			if (!joinPeer(peer))
+				run.addFailure();
+
+			SppIoCounters after = getIoCounters(spp, channelId);
+			run.addSyscalls(after.writeCalls - before.writeCalls);
+			run.printThroughput();
+		}
+
+		// Both directions, the peer echoes every message back and the
+		// latency is the round trip
+		{
+			BenchmarkRun run("echo" + suffix);
+			std::deque<std::pair<size_t, OperationCallback>> pending;
+
+			sppObserver.frameHandler = [&run, &pending, size](const uint8_t *data, size_t frameSize) {
+				if (pending.empty())
+					return;
+
+				OperationCallback done = pending.front().second;
+				pending.pop_front();
+				if (frameSize + MESSAGE_HEADER_SIZE == size)
+					run.addBytes(2 * size);
+				done(frameSize + MESSAGE_HEADER_SIZE == size);
+			};
+
+			startPeer(peer, [&peer, size]() {
+				std::vector<uint8_t> buffer(std::max<size_t>(size, 65536));
+				size_t remaining = size * messages;
+				while (remaining)
+				{
+					ssize_t count = read(peer.fd, buffer.data(), std::min(buffer.size(), remaining));
+					if (count < 0 && errno == EINTR)
+						continue;
+					if (count <= 0 || !writeAll(peer.fd, buffer.data(), count))
+						return false;
+					remaining -= count;
+				}
+				return true;
+			});
+
+			SppIoCounters before = getIoCounters(spp, channelId);
+			runOperations(run, messages, depth, [&](size_t n, OperationCallback done) {
+				std::vector<uint8_t> message(size, n & 0xff);
+				stampMessage(message);
+				pending.push_back({ n, done });
+				spp->writeData(channelId, message.data(), message.size(), [&pending, n, done](BluetoothError error) {
+					if (error == BLUETOOTH_ERROR_NONE)
+						return;
+
+					// Never goes out, so no echo is coming for it
+					auto pendingIter = std::find_if(pending.begin(), pending.end(),
+					                                [n](const std::pair<size_t, OperationCallback> &entry) { return entry.first == n; });
+					if (pendingIter != pending.end())
+						pending.erase(pendingIter);
+					done(false);
+				});
+			});
+			if (!joinPeer(peer))
+				run.addFailure();
+
+			SppIoCounters after = getIoCounters(spp, channelId);
+			run.addSyscalls(after.readCalls - before.readCalls + after.writeCalls - before.writeCalls);
+			sppObserver.frameHandler = nullptr;
+			run.printThroughput();
+		}
+	}
+
+	bool disconnectFinished = false;
+	spp->disconnectUuid(channelId, [&disconnectFinished](BluetoothError) { disconnectFinished = true; });
+	runUntil([&disconnectFinished]() { return disconnectFinished; }, 10000);
+	close(peer.fd);
+
+	delete sil;
+	mock.stop();
+
+	g_test_dbus_down(bus);
+	g_object_unref(bus);
+
+	return 0;
+}
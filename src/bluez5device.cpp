@@ -794,6 +794,11 @@ bool Bluez5Device::getConnected() const
 	return mConnected;
 }
 
+bool Bluez5Device::getPaired() const
+{
+	return mPaired;
+}
+
 Bluez5Adapter* Bluez5Device::getAdapter() const
 {
 	return mAdapter;
@@ -55,6 +55,7 @@ public:
 	std::vector<std::string> getMapInstancesName() const;
 	std::map<std::string, std::vector<std::string>> getSupportedMessageTypes() const;
 	bool getConnected() const;
+	bool getPaired() const;
 	Bluez5Adapter* getAdapter() const;
 	std::vector<uint8_t> getScanRecord() const;
 	std::string getServiceDataUuid() const;
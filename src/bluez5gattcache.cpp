@@ -0,0 +1,366 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "logging.h"
+#include "utils.h"
+#include "bluez5gattcache.h"
+
+#define GATT_CACHE_MAGIC          0x31434742 // "BGC1"
+#define GATT_CACHE_VERSION        2
+#define GATT_CACHE_ADDRESS_SIZE   18
+#define GATT_CACHE_HASH_SIZE      16
+#define GATT_CACHE_HEADER_SIZE    48
+
+namespace
+{
+
+class CacheWriter
+{
+public:
+	void put8(uint8_t value) { mData.push_back(value); }
+	void put16(uint16_t value) { put8(value & 0xff); put8(value >> 8); }
+	void put32(uint32_t value) { put16(value & 0xffff); put16(value >> 16); }
+
+	void putString(const std::string &value)
+	{
+		uint8_t length = value.size() > 0xff ? 0xff : value.size();
+		put8(length);
+		mData.insert(mData.end(), value.begin(), value.begin() + length);
+	}
+
+	std::vector<uint8_t>& data() { return mData; }
+
+private:
+	std::vector<uint8_t> mData;
+};
+
+class CacheReader
+{
+public:
+	CacheReader(const uint8_t *data, size_t size) :
+		mData(data),
+		mEnd(data + size),
+		mValid(true)
+	{
+	}
+
+	bool isValid() const { return mValid; }
+
+	uint8_t get8()
+	{
+		if (!require(1))
+			return 0;
+		return *mData++;
+	}
+
+	uint16_t get16()
+	{
+		uint16_t low = get8();
+		return low | (get8() << 8);
+	}
+
+	uint32_t get32()
+	{
+		uint32_t low = get16();
+		return low | ((uint32_t) get16() << 16);
+	}
+
+	std::string getString()
+	{
+		uint8_t length = get8();
+		if (!require(length))
+			return std::string();
+
+		std::string value((const char*) mData, length);
+		mData += length;
+		return value;
+	}
+
+private:
+	bool require(size_t length)
+	{
+		if (!mValid || (size_t) (mEnd - mData) < length)
+			mValid = false;
+		return mValid;
+	}
+
+	const uint8_t *mData;
+	const uint8_t *mEnd;
+	bool mValid;
+};
+
+}
+
+Bluez5GattCache::Bluez5GattCache(const std::string &directory) :
+	mDirectory(directory)
+{
+}
+
+Bluez5GattCache::~Bluez5GattCache()
+{
+}
+
+std::string Bluez5GattCache::getFilePath(const std::string &address) const
+{
+	std::string name = convertAddressToLowerCase(address);
+	name.erase(std::remove(name.begin(), name.end(), ':'), name.end());
+
+	return mDirectory + "/" + name;
+}
+
+GattDatabaseHash Bluez5GattCache::computeHash(const BluetoothGattServiceList &services)
+{
+	// Fingerprint the structure of the tree with 64 bit FNV-1a. The Database
+	// Hash characteristic is not used as it is only read after the tree is
+	// resolved, both sides of a comparison would not use the same scheme.
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto addToHash = [&hash](const std::string &value) {
+		for (auto byte : value)
+		{
+			hash ^= (uint8_t) byte;
+			hash *= 0x100000001b3ULL;
+		}
+	};
+
+	for (auto &service : services)
+	{
+		addToHash(service.getUuid().toString());
+		addToHash(std::to_string(service.getType()));
+
+		for (auto &characteristic : service.getCharacteristics())
+		{
+			addToHash(characteristic.getUuid().toString());
+			addToHash(std::to_string(characteristic.getProperties()));
+
+			for (auto &descriptor : characteristic.getDescriptors())
+				addToHash(descriptor.getUuid().toString());
+		}
+	}
+
+	GattDatabaseHash result;
+	for (int n = 0; n < 8; n++)
+		result.push_back((hash >> (n * 8)) & 0xff);
+
+	return result;
+}
+
+BluetoothGattServiceList Bluez5GattCache::withoutValues(const BluetoothGattServiceList &services)
+{
+	BluetoothGattServiceList result;
+
+	for (auto service : services)
+	{
+		BluetoothGattCharacteristicList characteristics;
+
+		for (auto &characteristic : service.getCharacteristics())
+		{
+			BluetoothGattCharacteristic structure;
+			structure.setUuid(characteristic.getUuid());
+			structure.setProperties(characteristic.getProperties());
+
+			for (auto descriptor : characteristic.getDescriptors())
+			{
+				descriptor.setValue(BluetoothGattValue());
+				structure.addDescriptor(descriptor);
+			}
+
+			characteristics.push_back(structure);
+		}
+
+		service.setCharacteristics(characteristics);
+		result.push_back(service);
+	}
+
+	return result;
+}
+
+bool Bluez5GattCache::load(const std::string &address, BluetoothGattServiceList &services, GattDatabaseHash &hash)
+{
+	std::string path = getFilePath(address);
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) < 0 || fileStat.st_size < GATT_CACHE_HEADER_SIZE)
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t size = fileStat.st_size;
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Failed to map GATT cache %s", path.c_str());
+		return false;
+	}
+
+	const uint8_t *data = static_cast<const uint8_t*>(mapping);
+	CacheReader header(data, GATT_CACHE_HEADER_SIZE);
+
+	uint32_t magic = header.get32();
+	uint16_t version = header.get16();
+	uint16_t serviceCount = header.get16();
+
+	bool valid = (magic == GATT_CACHE_MAGIC && version == GATT_CACHE_VERSION);
+
+	std::string storedAddress((const char*) data + 8, strnlen((const char*) data + 8, GATT_CACHE_ADDRESS_SIZE));
+	valid = valid && (storedAddress == convertAddressToLowerCase(address));
+
+	uint8_t hashLength = data[26];
+	uint32_t payloadSize = data[44] | (data[45] << 8) | (data[46] << 16) | ((uint32_t) data[47] << 24);
+	valid = valid && hashLength <= GATT_CACHE_HASH_SIZE && payloadSize == size - GATT_CACHE_HEADER_SIZE;
+
+	BluetoothGattServiceList result;
+	CacheReader reader(data + GATT_CACHE_HEADER_SIZE, size - GATT_CACHE_HEADER_SIZE);
+
+	for (uint16_t n = 0; valid && n < serviceCount && reader.isValid(); n++)
+	{
+		BluetoothGattService service;
+		service.setType(reader.get8() ? BluetoothGattService::PRIMARY : BluetoothGattService::SECONDARY);
+		service.setUuid(BluetoothUuid(reader.getString()));
+
+		uint16_t characteristicCount = reader.get16();
+		for (uint16_t c = 0; c < characteristicCount && reader.isValid(); c++)
+		{
+			BluetoothGattCharacteristic characteristic;
+			characteristic.setUuid(BluetoothUuid(reader.getString()));
+			characteristic.setProperties(reader.get32());
+
+			uint16_t descriptorCount = reader.get16();
+			for (uint16_t d = 0; d < descriptorCount && reader.isValid(); d++)
+			{
+				BluetoothGattDescriptor descriptor;
+				descriptor.setUuid(BluetoothUuid(reader.getString()));
+				characteristic.addDescriptor(descriptor);
+			}
+
+			service.addCharacteristic(characteristic);
+		}
+
+		result.push_back(service);
+	}
+
+	valid = valid && reader.isValid();
+
+	if (valid)
+	{
+		hash.assign(data + 27, data + 27 + hashLength);
+		services.swap(result);
+	}
+	else
+	{
+		WARNING(MSGID_GATT_PROFILE_ERROR, 0, "Dropping invalid GATT cache %s", path.c_str());
+	}
+
+	munmap(mapping, size);
+
+	if (!valid)
+		remove(address);
+
+	return valid;
+}
+
+bool Bluez5GattCache::store(const std::string &address, const BluetoothGattServiceList &services, const GattDatabaseHash &hash)
+{
+	if (g_mkdir_with_parents(mDirectory.c_str(), 0700) < 0)
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Failed to create GATT cache directory %s", mDirectory.c_str());
+		return false;
+	}
+
+	CacheWriter payload;
+
+	for (auto &service : services)
+	{
+		payload.put8(service.getType() == BluetoothGattService::PRIMARY ? 1 : 0);
+		payload.putString(service.getUuid().toString());
+
+		BluetoothGattCharacteristicList characteristics = service.getCharacteristics();
+		payload.put16(characteristics.size());
+
+		for (auto &characteristic : characteristics)
+		{
+			payload.putString(characteristic.getUuid().toString());
+			payload.put32(characteristic.getProperties());
+
+			BluetoothGattDescriptorList descriptors = characteristic.getDescriptors();
+			payload.put16(descriptors.size());
+
+			for (auto &descriptor : descriptors)
+				payload.putString(descriptor.getUuid().toString());
+		}
+	}
+
+	CacheWriter header;
+	header.put32(GATT_CACHE_MAGIC);
+	header.put16(GATT_CACHE_VERSION);
+	header.put16(services.size());
+
+	std::string lowerCaseAddress = convertAddressToLowerCase(address);
+	for (size_t n = 0; n < GATT_CACHE_ADDRESS_SIZE; n++)
+		header.put8(n < lowerCaseAddress.size() && n < GATT_CACHE_ADDRESS_SIZE - 1 ? lowerCaseAddress[n] : 0);
+
+	uint8_t hashLength = hash.size() > GATT_CACHE_HASH_SIZE ? GATT_CACHE_HASH_SIZE : hash.size();
+	header.put8(hashLength);
+	for (int n = 0; n < GATT_CACHE_HASH_SIZE; n++)
+		header.put8(n < hashLength ? hash[n] : 0);
+	header.put8(0);
+	header.put32(payload.data().size());
+
+	// Write to a temporary file first so a reader never maps a partial file
+	std::string path = getFilePath(address);
+	std::string tempPath = path + ".tmp";
+
+	int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Failed to open GATT cache %s", tempPath.c_str());
+		return false;
+	}
+
+	bool written = (write(fd, header.data().data(), header.data().size()) == (ssize_t) header.data().size()) &&
+	               (write(fd, payload.data().data(), payload.data().size()) == (ssize_t) payload.data().size());
+	close(fd);
+
+	if (!written || rename(tempPath.c_str(), path.c_str()) < 0)
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Failed to write GATT cache %s", path.c_str());
+		unlink(tempPath.c_str());
+		return false;
+	}
+
+	DEBUG("Stored GATT cache for %s with %zu services", lowerCaseAddress.c_str(), services.size());
+	return true;
+}
+
+void Bluez5GattCache::remove(const std::string &address)
+{
+	unlink(getFilePath(address).c_str());
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BLUEZ5GATTCACHE_H
+#define BLUEZ5GATTCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <bluetooth-sil-api.h>
+
+typedef std::vector<uint8_t> GattDatabaseHash;
+
+// On-disk cache of the last known remote GATT service tree of bonded
+// devices. Every device is stored in its own file named after its address.
+// The file starts with a fixed size header followed by the service,
+// characteristic and descriptor records in the order of the tree, so it can
+// be parsed straight from a read-only mapping. Only the structure of the
+// tree is stored, attribute values are left out.
+class Bluez5GattCache
+{
+public:
+	Bluez5GattCache(const std::string &directory);
+	~Bluez5GattCache();
+
+	Bluez5GattCache(const Bluez5GattCache&) = delete;
+	Bluez5GattCache& operator = (const Bluez5GattCache&) = delete;
+
+	bool load(const std::string &address, BluetoothGattServiceList &services, GattDatabaseHash &hash);
+	bool store(const std::string &address, const BluetoothGattServiceList &services, const GattDatabaseHash &hash);
+	void remove(const std::string &address);
+
+	static GattDatabaseHash computeHash(const BluetoothGattServiceList &services);
+	static BluetoothGattServiceList withoutValues(const BluetoothGattServiceList &services);
+
+private:
+	std::string getFilePath(const std::string &address) const;
+
+	std::string mDirectory;
+};
+
+#endif // BLUEZ5GATTCACHE_H
@@ -0,0 +1,92 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bluez5gattconnectiontable.h"
+
+Bluez5GattConnectionTable::Bluez5GattConnectionTable()
+{
+}
+
+Bluez5GattConnectionTable::~Bluez5GattConnectionTable()
+{
+}
+
+bool Bluez5GattConnectionTable::insert(uint16_t connId, const std::string &address)
+{
+	if (mConnections.find(connId) != mConnections.end())
+		return false;
+
+	assign(connId, address);
+	return true;
+}
+
+void Bluez5GattConnectionTable::assign(uint16_t connId, const std::string &address)
+{
+	auto connectionIter = mConnections.find(connId);
+	if (connectionIter != mConnections.end())
+	{
+		if (connectionIter->second.address == address)
+			return;
+
+		mConnIds.erase(connectionIter->second.address);
+		mConnections.erase(connectionIter);
+	}
+
+	removeAddress(address);
+
+	mConnections[connId] = { address, g_get_monotonic_time() };
+	mConnIds[address] = connId;
+}
+
+bool Bluez5GattConnectionTable::remove(uint16_t connId)
+{
+	auto connectionIter = mConnections.find(connId);
+	if (connectionIter == mConnections.end())
+		return false;
+
+	mConnIds.erase(connectionIter->second.address);
+	mConnections.erase(connectionIter);
+	return true;
+}
+
+bool Bluez5GattConnectionTable::removeAddress(const std::string &address)
+{
+	auto connIdIter = mConnIds.find(address);
+	if (connIdIter == mConnIds.end())
+		return false;
+
+	mConnections.erase(connIdIter->second);
+	mConnIds.erase(connIdIter);
+	return true;
+}
+
+uint16_t Bluez5GattConnectionTable::findConnId(const std::string &address) const
+{
+	auto connIdIter = mConnIds.find(address);
+	if (connIdIter == mConnIds.end())
+		return 0;
+
+	return connIdIter->second;
+}
+
+const Bluez5GattConnectionTable::Connection* Bluez5GattConnectionTable::find(uint16_t connId) const
+{
+	auto connectionIter = mConnections.find(connId);
+	if (connectionIter == mConnections.end())
+		return nullptr;
+
+	return &connectionIter->second;
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BLUEZ5GATTCONNECTIONTABLE_H
+#define BLUEZ5GATTCONNECTIONTABLE_H
+
+#include <glib.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// State of a GATT connection as reported by listConnections
+struct GattConnectionInfo
+{
+	uint16_t connId;
+	std::string address;
+	uint16_t mtu;
+	// Requests queued or in flight on the connection
+	size_t pendingRequests;
+	// Characteristics the connection gets notifications of
+	size_t subscriptions;
+	// Time in milliseconds since the connection was made
+	uint64_t connectedTime;
+};
+
+// Maps GATT connection ids to the lower case address of the device they
+// are connected to and back. Every device has at most one connection id.
+class Bluez5GattConnectionTable
+{
+public:
+	struct Connection
+	{
+		std::string address;
+		gint64 connectTime;
+	};
+
+	typedef std::unordered_map<uint16_t, Connection> ConnectionMap;
+
+	Bluez5GattConnectionTable();
+	~Bluez5GattConnectionTable();
+
+	Bluez5GattConnectionTable(const Bluez5GattConnectionTable&) = delete;
+	Bluez5GattConnectionTable& operator = (const Bluez5GattConnectionTable&) = delete;
+
+	// Fails if the connection id is already in use. An earlier connection
+	// id of the same device is dropped.
+	bool insert(uint16_t connId, const std::string &address);
+	// Like insert, but replaces the device of a connection id in use
+	void assign(uint16_t connId, const std::string &address);
+	bool remove(uint16_t connId);
+	bool removeAddress(const std::string &address);
+
+	// 0 if the device is not connected
+	uint16_t findConnId(const std::string &address) const;
+	// nullptr if the connection id is not in use
+	const Connection* find(uint16_t connId) const;
+
+	const ConnectionMap& getConnections() const { return mConnections; }
+
+private:
+	ConnectionMap mConnections;
+	std::unordered_map<std::string, uint16_t> mConnIds;
+};
+
+#endif // BLUEZ5GATTCONNECTIONTABLE_H
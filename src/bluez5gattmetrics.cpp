@@ -0,0 +1,313 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <cinttypes>
+#include <cstdio>
+
+#include "logging.h"
+#include "bluez5gattmetrics.h"
+
+static const gint64 bucketLimits[GattLatencyHistogram::BUCKET_COUNT - 1] = {
+	500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000
+};
+
+static void appendJsonValue(std::string &json, const char *name, uint64_t value)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "\"%s\":%" PRIu64, name, value);
+	json += buffer;
+}
+
+GattLatencyHistogram::GattLatencyHistogram() :
+	mCount(0),
+	mTotal(0)
+{
+	for (auto &bucket : mBuckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+void GattLatencyHistogram::record(gint64 latency)
+{
+	if (latency < 0)
+		latency = 0;
+
+	size_t index = 0;
+	while (index < BUCKET_COUNT - 1 && latency > bucketLimits[index])
+		index++;
+
+	mBuckets[index].fetch_add(1, std::memory_order_relaxed);
+	mCount.fetch_add(1, std::memory_order_relaxed);
+	mTotal.fetch_add(latency, std::memory_order_relaxed);
+}
+
+gint64 GattLatencyHistogram::getBucketLimit(size_t index)
+{
+	if (index >= BUCKET_COUNT - 1)
+		return G_MAXINT64;
+
+	return bucketLimits[index];
+}
+
+gint64 GattLatencyHistogram::getPercentile(unsigned int percent) const
+{
+	uint64_t count = getCount();
+	if (!count)
+		return 0;
+
+	uint64_t rank = (count * percent + 99) / 100;
+	uint64_t seen = 0;
+	for (size_t index = 0; index < BUCKET_COUNT; index++)
+	{
+		seen += getBucket(index);
+		if (seen >= rank)
+			return getBucketLimit(index);
+	}
+
+	return getBucketLimit(BUCKET_COUNT - 1);
+}
+
+void GattLatencyHistogram::appendJson(std::string &json) const
+{
+	json += "{";
+	appendJsonValue(json, "count", getCount());
+	json += ",";
+	appendJsonValue(json, "totalUs", getTotal());
+	json += ",\"buckets\":[";
+	for (size_t index = 0; index < BUCKET_COUNT; index++)
+	{
+		if (index)
+			json += ",";
+		json += "{";
+		if (index < BUCKET_COUNT - 1)
+		{
+			appendJsonValue(json, "leUs", getBucketLimit(index));
+			json += ",";
+		}
+		appendJsonValue(json, "count", getBucket(index));
+		json += "}";
+	}
+	json += "]}";
+}
+
+GattOperationMetrics::GattOperationMetrics() :
+	reads(0),
+	writes(0),
+	failures(0),
+	bytesRead(0),
+	bytesWritten(0),
+	notifications(0),
+	notificationBytes(0),
+	firstNotification(0),
+	lastNotification(0)
+{
+}
+
+void GattOperationMetrics::recordRead(bool success, size_t bytes, gint64 roundTrip)
+{
+	reads.fetch_add(1, std::memory_order_relaxed);
+	if (success)
+		bytesRead.fetch_add(bytes, std::memory_order_relaxed);
+	else
+		failures.fetch_add(1, std::memory_order_relaxed);
+	this->roundTrip.record(roundTrip);
+}
+
+void GattOperationMetrics::recordWrite(bool success, size_t bytes, gint64 roundTrip)
+{
+	writes.fetch_add(1, std::memory_order_relaxed);
+	if (success)
+		bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+	else
+		failures.fetch_add(1, std::memory_order_relaxed);
+	this->roundTrip.record(roundTrip);
+}
+
+void GattOperationMetrics::recordNotification(size_t bytes)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 unset = 0;
+	firstNotification.compare_exchange_strong(unset, now, std::memory_order_relaxed);
+	lastNotification.store(now, std::memory_order_relaxed);
+
+	notifications.fetch_add(1, std::memory_order_relaxed);
+	notificationBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+double GattOperationMetrics::getNotificationRate() const
+{
+	uint64_t count = notifications.load(std::memory_order_relaxed);
+	gint64 elapsed = lastNotification.load(std::memory_order_relaxed) - firstNotification.load(std::memory_order_relaxed);
+	if (count < 2 || elapsed <= 0)
+		return 0;
+
+	return (count - 1) * 1000000.0 / elapsed;
+}
+
+void GattOperationMetrics::appendJson(std::string &json) const
+{
+	char rate[64];
+	snprintf(rate, sizeof(rate), "\"notificationRate\":%.2f", getNotificationRate());
+
+	json += "{";
+	appendJsonValue(json, "reads", reads.load(std::memory_order_relaxed));
+	json += ",";
+	appendJsonValue(json, "writes", writes.load(std::memory_order_relaxed));
+	json += ",";
+	appendJsonValue(json, "failures", failures.load(std::memory_order_relaxed));
+	json += ",";
+	appendJsonValue(json, "bytesRead", bytesRead.load(std::memory_order_relaxed));
+	json += ",";
+	appendJsonValue(json, "bytesWritten", bytesWritten.load(std::memory_order_relaxed));
+	json += ",";
+	appendJsonValue(json, "notifications", notifications.load(std::memory_order_relaxed));
+	json += ",";
+	appendJsonValue(json, "notificationBytes", notificationBytes.load(std::memory_order_relaxed));
+	json += ",";
+	json += rate;
+	json += ",\"queueDelay\":";
+	queueDelay.appendJson(json);
+	json += ",\"roundTrip\":";
+	roundTrip.appendJson(json);
+	json += "}";
+}
+
+Bluez5GattMetrics::Bluez5GattMetrics()
+{
+}
+
+Bluez5GattMetrics::~Bluez5GattMetrics()
+{
+}
+
+Bluez5GattMetrics::DeviceMetrics* Bluez5GattMetrics::getDeviceMetrics(const std::string &address)
+{
+	std::unique_ptr<DeviceMetrics> &device = mDevices[address];
+	if (!device)
+		device.reset(new DeviceMetrics());
+
+	return device.get();
+}
+
+std::shared_ptr<GattOperationMetrics> Bluez5GattMetrics::getDevice(const std::string &address)
+{
+	return getDeviceMetrics(address)->total;
+}
+
+std::shared_ptr<GattOperationMetrics> Bluez5GattMetrics::getCharacteristic(const std::string &address, const std::string &objectPath,
+                                                                           const std::string &uuid)
+{
+	CharacteristicMetrics &characteristic = getDeviceMetrics(address)->characteristics[objectPath];
+
+	// A path BlueZ reused for a different characteristic starts over
+	if (!characteristic.metrics || characteristic.uuid != uuid)
+	{
+		characteristic.uuid = uuid;
+		characteristic.metrics = std::make_shared<GattOperationMetrics>();
+	}
+
+	return characteristic.metrics;
+}
+
+std::shared_ptr<const GattOperationMetrics> Bluez5GattMetrics::findDevice(const std::string &address) const
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end())
+		return nullptr;
+
+	return deviceIter->second->total;
+}
+
+std::shared_ptr<const GattOperationMetrics> Bluez5GattMetrics::findCharacteristic(const std::string &address, const std::string &objectPath) const
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end())
+		return nullptr;
+
+	auto characteristicIter = deviceIter->second->characteristics.find(objectPath);
+	if (characteristicIter == deviceIter->second->characteristics.end())
+		return nullptr;
+
+	return characteristicIter->second.metrics;
+}
+
+std::shared_ptr<const GattOperationMetrics> Bluez5GattMetrics::findCharacteristicByUuid(const std::string &address, const std::string &uuid) const
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end())
+		return nullptr;
+
+	for (auto &characteristic : deviceIter->second->characteristics)
+	{
+		if (characteristic.second.uuid == uuid)
+			return characteristic.second.metrics;
+	}
+
+	return nullptr;
+}
+
+void Bluez5GattMetrics::removeDevice(const std::string &address)
+{
+	mDevices.erase(address);
+}
+
+std::string Bluez5GattMetrics::toJson() const
+{
+	std::string json = "{\"devices\":{";
+	bool firstDevice = true;
+
+	for (auto &device : mDevices)
+	{
+		if (!firstDevice)
+			json += ",";
+		firstDevice = false;
+
+		json += "\"" + device.first + "\":{\"total\":";
+		device.second->total->appendJson(json);
+		json += ",\"characteristics\":{";
+
+		bool firstCharacteristic = true;
+		for (auto &characteristic : device.second->characteristics)
+		{
+			if (!firstCharacteristic)
+				json += ",";
+			firstCharacteristic = false;
+
+			json += "\"" + characteristic.first + "\":{\"uuid\":\"" + characteristic.second.uuid + "\",\"metrics\":";
+			characteristic.second.metrics->appendJson(json);
+			json += "}";
+		}
+		json += "}}";
+	}
+
+	json += "}}\n";
+	return json;
+}
+
+bool Bluez5GattMetrics::dump(const std::string &path) const
+{
+	std::string json = toJson();
+	GError *error = 0;
+
+	// Written to a temporary file first, a reader never sees half a dump
+	if (!g_file_set_contents(path.c_str(), json.c_str(), json.length(), &error))
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Failed to write GATT metrics to %s: %s", path.c_str(), error->message);
+		g_error_free(error);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BLUEZ5GATTMETRICS_H
+#define BLUEZ5GATTMETRICS_H
+
+#include <glib.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+// Latency histogram with fixed buckets. Recording never locks or
+// allocates, so it can be read from any thread while the main loop keeps
+// adding to it.
+class GattLatencyHistogram
+{
+public:
+	static const size_t BUCKET_COUNT = 12;
+
+	GattLatencyHistogram();
+
+	GattLatencyHistogram(const GattLatencyHistogram&) = delete;
+	GattLatencyHistogram& operator = (const GattLatencyHistogram&) = delete;
+
+	// Latency in microseconds
+	void record(gint64 latency);
+
+	uint64_t getCount() const { return mCount.load(std::memory_order_relaxed); }
+	uint64_t getTotal() const { return mTotal.load(std::memory_order_relaxed); }
+	uint64_t getBucket(size_t index) const { return mBuckets[index].load(std::memory_order_relaxed); }
+	// Upper bound of a bucket in microseconds, the last one is unbounded
+	static gint64 getBucketLimit(size_t index);
+	// Upper bound of the bucket the given percentile falls into
+	gint64 getPercentile(unsigned int percent) const;
+
+	void appendJson(std::string &json) const;
+
+private:
+	std::atomic<uint64_t> mBuckets[BUCKET_COUNT];
+	std::atomic<uint64_t> mCount;
+	std::atomic<uint64_t> mTotal;
+};
+
+// Operation counters of a device or of one of its characteristics
+class GattOperationMetrics
+{
+public:
+	GattOperationMetrics();
+
+	GattOperationMetrics(const GattOperationMetrics&) = delete;
+	GattOperationMetrics& operator = (const GattOperationMetrics&) = delete;
+
+	void recordRead(bool success, size_t bytes, gint64 roundTrip);
+	void recordWrite(bool success, size_t bytes, gint64 roundTrip);
+	void recordNotification(size_t bytes);
+	void recordQueueDelay(gint64 delay) { queueDelay.record(delay); }
+
+	// Notifications per second since the first one arrived
+	double getNotificationRate() const;
+
+	void appendJson(std::string &json) const;
+
+	std::atomic<uint64_t> reads;
+	std::atomic<uint64_t> writes;
+	std::atomic<uint64_t> failures;
+	std::atomic<uint64_t> bytesRead;
+	std::atomic<uint64_t> bytesWritten;
+	std::atomic<uint64_t> notifications;
+	std::atomic<uint64_t> notificationBytes;
+	std::atomic<gint64> firstNotification;
+	std::atomic<gint64> lastNotification;
+
+	// Time requests spent waiting in the request queue of the device
+	GattLatencyHistogram queueDelay;
+	// Time from sending a D-Bus method call to BlueZ until its reply
+	GattLatencyHistogram roundTrip;
+};
+
+// Metrics of every known remote device the GATT profile talked to, in
+// total and per characteristic. Characteristics are told apart by their
+// object path, a device may have several with the same UUID. Entries are
+// created on the main loop and shared, so a reply arriving after its device
+// was removed still has somewhere to record to.
+class Bluez5GattMetrics
+{
+public:
+	Bluez5GattMetrics();
+	~Bluez5GattMetrics();
+
+	Bluez5GattMetrics(const Bluez5GattMetrics&) = delete;
+	Bluez5GattMetrics& operator = (const Bluez5GattMetrics&) = delete;
+
+	std::shared_ptr<GattOperationMetrics> getDevice(const std::string &address);
+	std::shared_ptr<GattOperationMetrics> getCharacteristic(const std::string &address, const std::string &objectPath,
+	                                                        const std::string &uuid);
+
+	// nullptr if nothing was recorded yet
+	std::shared_ptr<const GattOperationMetrics> findDevice(const std::string &address) const;
+	std::shared_ptr<const GattOperationMetrics> findCharacteristic(const std::string &address, const std::string &objectPath) const;
+	// The first characteristic with the UUID
+	std::shared_ptr<const GattOperationMetrics> findCharacteristicByUuid(const std::string &address, const std::string &uuid) const;
+
+	void removeDevice(const std::string &address);
+
+	std::string toJson() const;
+	bool dump(const std::string &path) const;
+
+private:
+	struct CharacteristicMetrics
+	{
+		std::string uuid;
+		std::shared_ptr<GattOperationMetrics> metrics;
+	};
+
+	struct DeviceMetrics
+	{
+		DeviceMetrics() : total(std::make_shared<GattOperationMetrics>()) {}
+
+		std::shared_ptr<GattOperationMetrics> total;
+		// By object path
+		std::map<std::string, CharacteristicMetrics> characteristics;
+	};
+
+	DeviceMetrics* getDeviceMetrics(const std::string &address);
+
+	std::map<std::string, std::unique_ptr<DeviceMetrics>> mDevices;
+};
+
+#endif // BLUEZ5GATTMETRICS_H
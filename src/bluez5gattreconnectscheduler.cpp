@@ -0,0 +1,336 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "logging.h"
+#include "bluez5gattreconnectscheduler.h"
+
+#define RECONNECT_TICK_INTERVAL        250    // ms
+#define RECONNECT_WHEEL_SIZE           256    // slots, one round is 64 seconds
+#define RECONNECT_INITIAL_DELAY        1000   // ms
+#define RECONNECT_MAX_DELAY            60000  // ms
+#define RECONNECT_JITTER_PERCENT       20
+#define RECONNECT_EXPIRY               0      // ms, never
+#define RECONNECT_MAX_CONCURRENT       2
+
+Bluez5GattReconnectScheduler::Bluez5GattReconnectScheduler(ConnectFunction connect, ExpireFunction expire) :
+	mConnect(connect),
+	mExpire(expire),
+	mInitialDelay(RECONNECT_INITIAL_DELAY),
+	mMaxDelay(RECONNECT_MAX_DELAY),
+	mJitterPercent(RECONNECT_JITTER_PERCENT),
+	mExpiry(RECONNECT_EXPIRY),
+	mMaxConcurrentAttempts(RECONNECT_MAX_CONCURRENT),
+	mWheel(RECONNECT_WHEEL_SIZE),
+	mCurrentSlot(0),
+	mScheduledCount(0),
+	mActiveAttempts(0),
+	mTimer(0)
+{
+}
+
+Bluez5GattReconnectScheduler::~Bluez5GattReconnectScheduler()
+{
+	if (mTimer)
+		g_source_remove(mTimer);
+}
+
+void Bluez5GattReconnectScheduler::setBackoff(uint32_t initialDelay, uint32_t maxDelay, uint32_t jitterPercent)
+{
+	mInitialDelay = initialDelay;
+	mMaxDelay = maxDelay < initialDelay ? initialDelay : maxDelay;
+	mJitterPercent = jitterPercent > 100 ? 100 : jitterPercent;
+}
+
+void Bluez5GattReconnectScheduler::addDevice(const std::string &address)
+{
+	if (mDevices.find(address) != mDevices.end())
+		return;
+
+	Device device = {};
+	device.state = CONNECTED;
+	mDevices.insert(std::make_pair(address, device));
+}
+
+void Bluez5GattReconnectScheduler::removeDevice(const std::string &address)
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end())
+		return;
+
+	unschedule(deviceIter->second);
+	mDevices.erase(deviceIter);
+}
+
+void Bluez5GattReconnectScheduler::deviceLost(const std::string &address)
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end() || deviceIter->second.state != CONNECTED)
+		return;
+
+	Device &device = deviceIter->second;
+	device.state = WAITING;
+	device.expiryTime = g_get_monotonic_time() + (gint64) mExpiry * 1000;
+
+	DEBUG("Lost auto connect device %s", address.c_str());
+	schedule(address, device, nextBackoffDelay(device));
+}
+
+void Bluez5GattReconnectScheduler::deviceAvailable(const std::string &address)
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end())
+		return;
+
+	Device &device = deviceIter->second;
+	if (device.state == READY || device.state == CONNECTING)
+		return;
+
+	if (device.state == CONNECTED)
+	{
+		device.state = WAITING;
+		device.expiryTime = g_get_monotonic_time() + (gint64) mExpiry * 1000;
+	}
+
+	// Don't connect right away, devices tend to come back all at once
+	schedule(address, device, nextBackoffDelay(device));
+}
+
+void Bluez5GattReconnectScheduler::deviceConnected(const std::string &address)
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end())
+		return;
+
+	Device &device = deviceIter->second;
+	unschedule(device);
+	device.state = CONNECTED;
+	device.statistics.consecutiveFailures = 0;
+}
+
+bool Bluez5GattReconnectScheduler::isReconnecting(const std::string &address) const
+{
+	auto deviceIter = mDevices.find(address);
+	return deviceIter != mDevices.end() && deviceIter->second.state != CONNECTED;
+}
+
+bool Bluez5GattReconnectScheduler::getStatistics(const std::string &address, GattReconnectStatistics &statistics) const
+{
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter == mDevices.end())
+		return false;
+
+	statistics = deviceIter->second.statistics;
+	return true;
+}
+
+uint32_t Bluez5GattReconnectScheduler::nextBackoffDelay(const Device &device) const
+{
+	uint32_t exponent = device.statistics.consecutiveFailures > 16 ? 16 : device.statistics.consecutiveFailures;
+	uint64_t delay = (uint64_t) mInitialDelay << exponent;
+	if (delay > mMaxDelay)
+		delay = mMaxDelay;
+
+	int32_t jitter = delay * mJitterPercent / 100;
+	if (jitter)
+		delay += g_random_int_range(-jitter, jitter + 1);
+
+	if (!mExpiry)
+		return delay;
+
+	// Wake up in time to give the device up when it expires
+	gint64 remaining = (device.expiryTime - g_get_monotonic_time()) / 1000;
+	if (remaining < 0)
+		remaining = 0;
+	if ((gint64) delay > remaining)
+		delay = remaining;
+
+	return delay;
+}
+
+void Bluez5GattReconnectScheduler::schedule(const std::string &address, Device &device, uint32_t delay)
+{
+	unschedule(device);
+
+	unsigned int ticks = (delay + RECONNECT_TICK_INTERVAL - 1) / RECONNECT_TICK_INTERVAL;
+	if (ticks == 0)
+		ticks = 1;
+
+	device.slot = (mCurrentSlot + ticks) % RECONNECT_WHEEL_SIZE;
+	device.rounds = (ticks - 1) / RECONNECT_WHEEL_SIZE;
+	device.slotIter = mWheel[device.slot].insert(mWheel[device.slot].end(), address);
+	device.scheduled = true;
+	device.statistics.nextDelay = delay;
+	mScheduledCount++;
+
+	if (!mTimer)
+		mTimer = g_timeout_add(RECONNECT_TICK_INTERVAL, onTick, this);
+}
+
+void Bluez5GattReconnectScheduler::unschedule(Device &device)
+{
+	if (!device.scheduled)
+		return;
+
+	mWheel[device.slot].erase(device.slotIter);
+	device.scheduled = false;
+	device.statistics.nextDelay = 0;
+	mScheduledCount--;
+}
+
+gboolean Bluez5GattReconnectScheduler::onTick(gpointer user_data)
+{
+	Bluez5GattReconnectScheduler *scheduler = static_cast<Bluez5GattReconnectScheduler*>(user_data);
+	scheduler->tick();
+
+	if (scheduler->mScheduledCount)
+		return TRUE;
+
+	scheduler->mTimer = 0;
+	return FALSE;
+}
+
+void Bluez5GattReconnectScheduler::tick()
+{
+	mCurrentSlot = (mCurrentSlot + 1) % RECONNECT_WHEEL_SIZE;
+
+	std::vector<std::string> due;
+	auto &slot = mWheel[mCurrentSlot];
+
+	for (auto slotIter = slot.begin(); slotIter != slot.end();)
+	{
+		Device &device = mDevices[*slotIter];
+		if (device.rounds)
+		{
+			device.rounds--;
+			++slotIter;
+			continue;
+		}
+
+		due.push_back(*slotIter);
+		device.scheduled = false;
+		device.statistics.nextDelay = 0;
+		mScheduledCount--;
+		slotIter = slot.erase(slotIter);
+	}
+
+	gint64 now = g_get_monotonic_time();
+
+	for (auto &address : due)
+	{
+		auto deviceIter = mDevices.find(address);
+		if (deviceIter == mDevices.end())
+			continue;
+
+		if (isExpired(deviceIter->second, now))
+		{
+			expire(address);
+			continue;
+		}
+
+		deviceIter->second.state = READY;
+		deviceIter->second.readyTime = now;
+		mReadyQueue.push_back(address);
+	}
+
+	startAttempts();
+}
+
+void Bluez5GattReconnectScheduler::startAttempts()
+{
+	while (mActiveAttempts < mMaxConcurrentAttempts && !mReadyQueue.empty())
+	{
+		std::string address = mReadyQueue.front();
+		mReadyQueue.pop_front();
+
+		// The queue may hold addresses which connected or were removed since
+		auto deviceIter = mDevices.find(address);
+		if (deviceIter == mDevices.end() || deviceIter->second.state != READY)
+			continue;
+
+		// Waiting for a free slot is not held against the device
+		deviceIter->second.expiryTime += g_get_monotonic_time() - deviceIter->second.readyTime;
+		deviceIter->second.state = CONNECTING;
+		deviceIter->second.statistics.attempts++;
+		mActiveAttempts++;
+
+		DEBUG("Reconnecting %s, attempt %u", address.c_str(), deviceIter->second.statistics.attempts);
+
+		bool started = mConnect(address, [this, address](bool connected) {
+			attemptFinished(address, connected);
+		});
+
+		if (started)
+			continue;
+
+		// The device is not around, look again later without counting it
+		mActiveAttempts--;
+		deviceIter = mDevices.find(address);
+		if (deviceIter == mDevices.end())
+			continue;
+
+		deviceIter->second.statistics.attempts--;
+		deviceIter->second.state = WAITING;
+		schedule(address, deviceIter->second, nextBackoffDelay(deviceIter->second));
+	}
+}
+
+void Bluez5GattReconnectScheduler::attemptFinished(const std::string &address, bool connected)
+{
+	mActiveAttempts--;
+
+	auto deviceIter = mDevices.find(address);
+	if (deviceIter != mDevices.end() && deviceIter->second.state == CONNECTING)
+	{
+		Device &device = deviceIter->second;
+
+		if (connected)
+		{
+			device.statistics.successes++;
+			deviceConnected(address);
+		}
+		else
+		{
+			device.statistics.failures++;
+			device.statistics.consecutiveFailures++;
+
+			if (isExpired(device, g_get_monotonic_time()))
+			{
+				expire(address);
+			}
+			else
+			{
+				device.state = WAITING;
+				schedule(address, device, nextBackoffDelay(device));
+			}
+		}
+	}
+
+	startAttempts();
+}
+
+bool Bluez5GattReconnectScheduler::isExpired(const Device &device, gint64 now) const
+{
+	return mExpiry && now >= device.expiryTime;
+}
+
+void Bluez5GattReconnectScheduler::expire(const std::string &address)
+{
+	DEBUG("Giving up reconnecting %s", address.c_str());
+
+	removeDevice(address);
+	if (mExpire)
+		mExpire(address);
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BLUEZ5GATTRECONNECTSCHEDULER_H
+#define BLUEZ5GATTRECONNECTSCHEDULER_H
+
+#include <glib.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct GattReconnectStatistics
+{
+	uint32_t attempts;
+	uint32_t successes;
+	uint32_t failures;
+	uint32_t consecutiveFailures;
+	// Delay in milliseconds before the next attempt, 0 if none is scheduled
+	uint32_t nextDelay;
+};
+
+// Paces the reconnection of auto-connect devices. All pending attempts live
+// in a single timer wheel driven by one GLib timeout, every device backs off
+// exponentially with random jitter after failed attempts and only a limited
+// number of attempts run at the same time. Devices are retried until they
+// are removed, unless an expiry is set. Then a device which could not be
+// reconnected within it is given up; time spent waiting for a free attempt
+// slot does not count towards it.
+class Bluez5GattReconnectScheduler
+{
+public:
+	typedef std::function<void(bool connected)> ConnectResultCallback;
+	// Returns false if no attempt could be started, e.g. the device is not
+	// known to BlueZ at the moment.
+	typedef std::function<bool(const std::string &address, ConnectResultCallback callback)> ConnectFunction;
+	typedef std::function<void(const std::string &address)> ExpireFunction;
+
+	Bluez5GattReconnectScheduler(ConnectFunction connect, ExpireFunction expire);
+	~Bluez5GattReconnectScheduler();
+
+	Bluez5GattReconnectScheduler(const Bluez5GattReconnectScheduler&) = delete;
+	Bluez5GattReconnectScheduler& operator = (const Bluez5GattReconnectScheduler&) = delete;
+
+	void setBackoff(uint32_t initialDelay, uint32_t maxDelay, uint32_t jitterPercent);
+	void setMaxConcurrentAttempts(unsigned int maxAttempts) { mMaxConcurrentAttempts = maxAttempts ? maxAttempts : 1; }
+	// In milliseconds, 0 to never give a device up
+	void setExpiry(uint32_t expiry) { mExpiry = expiry; }
+
+	void addDevice(const std::string &address);
+	void removeDevice(const std::string &address);
+
+	void deviceLost(const std::string &address);
+	void deviceAvailable(const std::string &address);
+	void deviceConnected(const std::string &address);
+
+	bool isReconnecting(const std::string &address) const;
+	bool getStatistics(const std::string &address, GattReconnectStatistics &statistics) const;
+
+private:
+	enum State
+	{
+		CONNECTED,
+		WAITING,
+		READY,
+		CONNECTING
+	};
+
+	struct Device
+	{
+		State state;
+		bool scheduled;
+		unsigned int slot;
+		unsigned int rounds;
+		std::list<std::string>::iterator slotIter;
+		gint64 expiryTime;
+		gint64 readyTime;
+		GattReconnectStatistics statistics;
+	};
+
+	static gboolean onTick(gpointer user_data);
+	void tick();
+	void schedule(const std::string &address, Device &device, uint32_t delay);
+	void unschedule(Device &device);
+	uint32_t nextBackoffDelay(const Device &device) const;
+	void startAttempts();
+	void attemptFinished(const std::string &address, bool connected);
+	bool isExpired(const Device &device, gint64 now) const;
+	void expire(const std::string &address);
+
+	ConnectFunction mConnect;
+	ExpireFunction mExpire;
+
+	uint32_t mInitialDelay;
+	uint32_t mMaxDelay;
+	uint32_t mJitterPercent;
+	uint32_t mExpiry;
+	unsigned int mMaxConcurrentAttempts;
+
+	std::unordered_map<std::string, Device> mDevices;
+	std::vector<std::list<std::string>> mWheel;
+	std::deque<std::string> mReadyQueue;
+	unsigned int mCurrentSlot;
+	unsigned int mScheduledCount;
+	unsigned int mActiveAttempts;
+	guint mTimer;
+};
+
+#endif // BLUEZ5GATTRECONNECTSCHEDULER_H
@@ -14,8 +14,11 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+
 #include "logging.h"
 #include "utils.h"
+#include "asyncutils.h"
 #include "bluez5profilegatt.h"
 #include "bluetooth-sil-api.h"
 #include "bluez5gattremoteattribute.h"
@@ -40,30 +43,48 @@ const std::map <BluetoothGattPermission, std::string> GattRemoteDescriptor::desc
 	{ PERMISSION_WRITE_SIGNED, "secure-write"}
 };
 
-bool GattRemoteCharacteristic::startNotify()
+void GattRemoteCharacteristic::startNotify(BluetoothResultCallback callback)
 {
-	GError *error = NULL;
-	bool result = bluez_gatt_characteristic1_call_start_notify_sync(mInterface, NULL, &error);
-	if (error)
-	{
-		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "startNotify failed due to %s for path %s", error->message, objectPath.c_str());
-		g_error_free(error);
-		return false;
-	}
-	return result;
+	BluezGattCharacteristic1 *interface = mInterface;
+	std::string path = objectPath;
+
+	auto startNotifyCallback = [interface, path, callback](GAsyncResult *result) {
+		GError *error = NULL;
+		bluez_gatt_characteristic1_call_start_notify_finish(interface, result, &error);
+		if (error)
+		{
+			ERROR(MSGID_GATT_PROFILE_ERROR, 0, "startNotify failed due to %s for path %s", error->message, path.c_str());
+			g_error_free(error);
+			callback(BLUETOOTH_ERROR_FAIL);
+			return;
+		}
+		callback(BLUETOOTH_ERROR_NONE);
+	};
+
+	bluez_gatt_characteristic1_call_start_notify(mInterface, NULL, glibAsyncMethodWrapper,
+	                                             new GlibAsyncFunctionWrapper(startNotifyCallback));
 }
 
-bool GattRemoteCharacteristic::stopNotify()
+void GattRemoteCharacteristic::stopNotify(BluetoothResultCallback callback)
 {
-	GError *error = NULL;
-	bool result = bluez_gatt_characteristic1_call_stop_notify_sync(mInterface, NULL, &error);
-	if (error)
-	{
-		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "startNotify failed due to %s for path %s", error->message, objectPath.c_str());
-		g_error_free(error);
-		return false;
-	}
-	return result;
+	BluezGattCharacteristic1 *interface = mInterface;
+	std::string path = objectPath;
+
+	auto stopNotifyCallback = [interface, path, callback](GAsyncResult *result) {
+		GError *error = NULL;
+		bluez_gatt_characteristic1_call_stop_notify_finish(interface, result, &error);
+		if (error)
+		{
+			ERROR(MSGID_GATT_PROFILE_ERROR, 0, "stopNotify failed due to %s for path %s", error->message, path.c_str());
+			g_error_free(error);
+			callback(BLUETOOTH_ERROR_FAIL);
+			return;
+		}
+		callback(BLUETOOTH_ERROR_NONE);
+	};
+
+	bluez_gatt_characteristic1_call_stop_notify(mInterface, NULL, glibAsyncMethodWrapper,
+	                                            new GlibAsyncFunctionWrapper(stopNotifyCallback));
 }
 
 void GattRemoteCharacteristic::onCharacteristicPropertiesChanged(GDBusProxy *proxy, GVariant *changed_properties, GStrv invalidated_properties, gpointer userdata)
@@ -87,17 +108,23 @@ std::vector<unsigned char> GattRemoteCharacteristic::readValue(uint16_t offset)
 	GVariant *variant = g_variant_dict_end(&dict);
 
 	GVariant *value;
+	gint64 begin = g_get_monotonic_time();
 
+	mReadState->pending++;
 	bluez_gatt_characteristic1_call_read_value_sync(mInterface, variant, &value, NULL, &error);
 
 	if (error)
 	{
 		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "readValue failed due to %s", error->message);
 		g_error_free(error);
+		finishRead(*mReadState, false, result);
+		recordRead(false, 0, begin);
 		return result;
 	}
 
 	result = convertArrayByteGVariantToVector(value);
+	finishRead(*mReadState, true, result);
+	recordRead(true, result.size(), begin);
 
 	return result;
 }
@@ -115,6 +142,7 @@ bool GattRemoteCharacteristic::writeValue(const std::vector<unsigned char> &char
 		g_variant_dict_insert_value(&dict, "offset", g_variant_new_uint16(offset));
 
 	GVariant *variant = g_variant_dict_end(&dict);
+	gint64 begin = g_get_monotonic_time();
 
 	result = bluez_gatt_characteristic1_call_write_value_sync(mInterface, variantValue, variant, NULL, &error);
 
@@ -122,12 +150,196 @@ bool GattRemoteCharacteristic::writeValue(const std::vector<unsigned char> &char
 	{
 		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "WriteValue failed due to %s", error->message);
 		g_error_free(error);
+		recordWrite(false, 0, begin);
 		return false;
 	}
 
+	recordWrite(result, characteristicValue.size(), begin);
 	return result;
 }
 
+void GattRemoteCharacteristic::readValue(uint16_t offset, GattReadValueCallback callback)
+{
+	GVariantDict dict;
+	g_variant_dict_init(&dict, NULL);
+
+	if (offset)
+		g_variant_dict_insert_value(&dict, "offset", g_variant_new_uint16(offset));
+
+	BluezGattCharacteristic1 *interface = mInterface;
+	std::shared_ptr<ReadState> readState = mReadState;
+	std::shared_ptr<GattOperationMetrics> metrics = mMetrics;
+	std::shared_ptr<GattOperationMetrics> deviceMetrics = mDeviceMetrics;
+	gint64 begin = g_get_monotonic_time();
+
+	readState->pending++;
+
+	// The characteristic may be gone by the time the reply arrives, the
+	// metrics outlive it
+	auto readValueCallback = [interface, callback, readState, metrics, deviceMetrics, begin](GAsyncResult *result) {
+		GError *error = NULL;
+		GVariant *value = NULL;
+		gint64 roundTrip = g_get_monotonic_time() - begin;
+
+		bluez_gatt_characteristic1_call_read_value_finish(interface, &value, result, &error);
+		if (error)
+		{
+			ERROR(MSGID_GATT_PROFILE_ERROR, 0, "readValue failed due to %s", error->message);
+			g_error_free(error);
+			finishRead(*readState, false, BluetoothGattValue());
+			if (metrics)
+				metrics->recordRead(false, 0, roundTrip);
+			if (deviceMetrics)
+				deviceMetrics->recordRead(false, 0, roundTrip);
+			callback(false, BluetoothGattValue());
+			return;
+		}
+
+		BluetoothGattValue readValue = convertArrayByteGVariantToVector(value);
+		g_variant_unref(value);
+		finishRead(*readState, true, readValue);
+		if (metrics)
+			metrics->recordRead(true, readValue.size(), roundTrip);
+		if (deviceMetrics)
+			deviceMetrics->recordRead(true, readValue.size(), roundTrip);
+		callback(true, readValue);
+	};
+
+	bluez_gatt_characteristic1_call_read_value(mInterface, g_variant_dict_end(&dict), NULL,
+	                                           glibAsyncMethodWrapper, new GlibAsyncFunctionWrapper(readValueCallback));
+}
+
+void GattRemoteCharacteristic::writeValue(const std::vector<unsigned char> &characteristicValue, uint16_t offset, BluetoothResultCallback callback,
+                                          bool reliable)
+{
+	GVariantDict dict;
+	g_variant_dict_init(&dict, NULL);
+
+	if (offset)
+		g_variant_dict_insert_value(&dict, "offset", g_variant_new_uint16(offset));
+
+	// BlueZ sends the value with Prepare Write Requests and checks every
+	// echoed part before it executes the write
+	if (reliable)
+		g_variant_dict_insert_value(&dict, "type", g_variant_new_string("reliable"));
+
+	BluezGattCharacteristic1 *interface = mInterface;
+	std::shared_ptr<GattOperationMetrics> metrics = mMetrics;
+	std::shared_ptr<GattOperationMetrics> deviceMetrics = mDeviceMetrics;
+	size_t bytes = characteristicValue.size();
+	gint64 begin = g_get_monotonic_time();
+
+	auto writeValueCallback = [interface, callback, metrics, deviceMetrics, bytes, begin](GAsyncResult *result) {
+		GError *error = NULL;
+		gint64 roundTrip = g_get_monotonic_time() - begin;
+
+		bluez_gatt_characteristic1_call_write_value_finish(interface, result, &error);
+		if (error)
+		{
+			ERROR(MSGID_GATT_PROFILE_ERROR, 0, "WriteValue failed due to %s", error->message);
+			g_error_free(error);
+			if (metrics)
+				metrics->recordWrite(false, 0, roundTrip);
+			if (deviceMetrics)
+				deviceMetrics->recordWrite(false, 0, roundTrip);
+			callback(BLUETOOTH_ERROR_FAIL);
+			return;
+		}
+
+		if (metrics)
+			metrics->recordWrite(true, bytes, roundTrip);
+		if (deviceMetrics)
+			deviceMetrics->recordWrite(true, bytes, roundTrip);
+		callback(BLUETOOTH_ERROR_NONE);
+	};
+
+	bluez_gatt_characteristic1_call_write_value(mInterface, convertVectorToArrayByteGVariant(characteristicValue),
+	                                            g_variant_dict_end(&dict), NULL,
+	                                            glibAsyncMethodWrapper, new GlibAsyncFunctionWrapper(writeValueCallback));
+}
+
+void GattRemoteCharacteristic::setMetrics(const std::shared_ptr<GattOperationMetrics> &metrics,
+                                          const std::shared_ptr<GattOperationMetrics> &deviceMetrics)
+{
+	mMetrics = metrics;
+	mDeviceMetrics = deviceMetrics;
+}
+
+void GattRemoteCharacteristic::finishRead(ReadState &state, bool success, const BluetoothGattValue &value)
+{
+	if (state.pending)
+		state.pending--;
+
+	// A change seen while the read was in flight was its result already
+	if (success && !state.changed)
+	{
+		state.echoPending = true;
+		state.echo = value;
+	}
+
+	if (!state.pending)
+		state.changed = false;
+}
+
+bool GattRemoteCharacteristic::isReadResult(const BluetoothGattValue &value)
+{
+	if (mReadState->pending)
+	{
+		mReadState->changed = true;
+		return true;
+	}
+
+	if (!mReadState->echoPending)
+		return false;
+
+	mReadState->echoPending = false;
+	return mReadState->echo == value;
+}
+
+void GattRemoteCharacteristic::recordRead(bool success, size_t bytes, gint64 begin)
+{
+	gint64 roundTrip = g_get_monotonic_time() - begin;
+
+	if (mMetrics)
+		mMetrics->recordRead(success, bytes, roundTrip);
+	if (mDeviceMetrics)
+		mDeviceMetrics->recordRead(success, bytes, roundTrip);
+}
+
+void GattRemoteCharacteristic::recordWrite(bool success, size_t bytes, gint64 begin)
+{
+	gint64 roundTrip = g_get_monotonic_time() - begin;
+
+	if (mMetrics)
+		mMetrics->recordWrite(success, bytes, roundTrip);
+	if (mDeviceMetrics)
+		mDeviceMetrics->recordWrite(success, bytes, roundTrip);
+}
+
+void GattRemoteCharacteristic::recordNotification(size_t bytes)
+{
+	if (mMetrics)
+		mMetrics->recordNotification(bytes);
+	if (mDeviceMetrics)
+		mDeviceMetrics->recordNotification(bytes);
+}
+
+uint16_t GattRemoteCharacteristic::getMtu() const
+{
+	// The MTU is not part of the generated interface, as that one is also
+	// exported for local characteristics. Older BlueZ versions don't expose
+	// it at all, assume the ATT default then.
+	uint16_t mtu = 0;
+	if (GVariant *value = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(mInterface), "MTU"))
+	{
+		if (g_variant_is_of_type(value, G_VARIANT_TYPE_UINT16))
+			mtu = g_variant_get_uint16(value);
+		g_variant_unref(value);
+	}
+
+	return mtu >= GATT_DEFAULT_ATT_MTU ? mtu : GATT_DEFAULT_ATT_MTU;
+}
+
 BluetoothGattCharacteristicProperties GattRemoteCharacteristic::readProperties()
 {
 	BluetoothGattCharacteristicProperties properties = 0;
@@ -145,6 +357,39 @@ BluetoothGattCharacteristicProperties GattRemoteCharacteristic::readProperties()
 	return 	properties;
 }
 
+bool GattRemoteCharacteristic::supportsReliableWrite()
+{
+	GVariant* flagVariant = bluez_gatt_characteristic1_get_flags(mInterface);
+	if (!flagVariant)
+		return false;
+
+	std::vector<std::string> characteristicFlags = convertArrayStringGVariantToVector(flagVariant);
+	return std::find(characteristicFlags.begin(), characteristicFlags.end(), "reliable-write") != characteristicFlags.end();
+}
+
+void GattRemoteCharacteristic::cacheValue(const BluetoothGattValue &value)
+{
+	characteristic.setValue(value);
+	mValueCached = true;
+	mValueCacheTime = g_get_monotonic_time();
+}
+
+bool GattRemoteCharacteristic::hasCachedValue(const GattReadCachePolicy &policy) const
+{
+	if (!mValueCached)
+		return false;
+
+	switch (policy.mode)
+	{
+	case GattReadCachePolicy::STATIC:
+		return true;
+	case GattReadCachePolicy::TIME_TO_LIVE:
+		return (g_get_monotonic_time() - mValueCacheTime) < (gint64) policy.timeToLive * 1000;
+	default:
+		return false;
+	}
+}
+
 std::vector<unsigned char> GattRemoteDescriptor::readValue(uint16_t offset)
 {
 	GError *error = NULL;
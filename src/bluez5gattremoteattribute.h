@@ -18,16 +18,118 @@
 #define BLUEZ5GATTREMOTEATTRIBUTE_H
 
 #include <gio/gio.h>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "bluez5gattmetrics.h"
+
 extern "C" {
 #include "freedesktop-interface.h"
 #include "bluez-interface.h"
 }
 
+#define GATT_DEFAULT_ATT_MTU 23
+
 class Bluez5ProfileGatt;
 
+typedef std::function<void(bool success, const BluetoothGattValue &value)> GattReadValueCallback;
+
+class GattReadCachePolicy
+{
+public:
+	enum Mode
+	{
+		NO_CACHE,
+		STATIC,
+		TIME_TO_LIVE
+	};
+
+	GattReadCachePolicy(Mode mode = NO_CACHE, uint32_t timeToLive = 0)
+		: mode(mode), timeToLive(timeToLive) {
+	}
+
+	Mode mode;
+	// Only used in TIME_TO_LIVE mode, in milliseconds
+	uint32_t timeToLive;
+};
+
+struct GattReadCacheStatistics
+{
+	uint64_t hits;
+	uint64_t misses;
+};
+
+class GattNotificationOptions
+{
+public:
+	enum Mode
+	{
+		// Deliver every notification as soon as it arrives
+		PASS_THROUGH,
+		// Deliver only the latest value once per interval
+		LATEST_ONLY,
+		// Collect all values and deliver them together once per interval
+		BATCH
+	};
+
+	GattNotificationOptions(Mode mode = PASS_THROUGH, uint32_t interval = 0)
+		: mode(mode), interval(interval) {
+	}
+
+	Mode mode;
+	// Delivery interval in milliseconds for LATEST_ONLY and BATCH
+	uint32_t interval;
+};
+
+// Notification state of a characteristic. Everything needed to deliver a
+// value to the observer is resolved once when the subscription is created.
+// StartNotify/StopNotify are only sent to BlueZ when the first connection
+// subscribes and when the last one unsubscribes.
+class GattNotificationSubscription
+{
+public:
+	enum NotifyState
+	{
+		NOTIFY_STOPPED,
+		NOTIFY_STARTING,
+		NOTIFY_STARTED,
+		NOTIFY_STOPPING
+	};
+
+	GattNotificationSubscription()
+		: notifyState(NOTIFY_STOPPED), timeoutSource(0) {
+	}
+	~GattNotificationSubscription() {
+		if (timeoutSource)
+			g_source_remove(timeoutSource);
+
+		for (auto &pending : pendingEnables)
+			pending.second(BLUETOOTH_ERROR_FAIL);
+	}
+
+	// Subscribers enabling notifications by address rather than through a
+	// connection, out of the range of connection ids so removing a
+	// connection leaves them alone
+	static const uint32_t ADDRESS_SUBSCRIBER = 0x10000;
+
+	// Number of enable requests per connection id or ADDRESS_SUBSCRIBER
+	std::map<uint32_t, unsigned int> subscribers;
+	NotifyState notifyState;
+	// Enable requests waiting for StartNotify to complete
+	std::vector<std::pair<uint32_t, BluetoothResultCallback>> pendingEnables;
+
+	GattNotificationOptions options;
+	std::string deviceAddress;
+	std::string adapterAddress;
+	BluetoothUuid serviceUuid;
+	BluetoothUuid characteristicUuid;
+	BluetoothGattCharacteristicList pendingValues;
+	guint timeoutSource;
+};
+
 class GattRemoteDescriptor
 {
 public:
@@ -50,15 +152,35 @@ public:
 	static void onCharacteristicPropertiesChanged(GDBusProxy *proxy, GVariant *changed_properties,
                                                   GStrv invalidated_properties, gpointer userdata);
 	GattRemoteCharacteristic(BluezGattCharacteristic1 *interface, Bluez5ProfileGatt *gattProfile)
-		: mInterface(interface), mGattProfile(gattProfile) {
+		: mInterface(interface), mGattProfile(gattProfile), mValueCached(false), mValueCacheTime(0),
+		  mReadState(std::make_shared<ReadState>()) {
 		g_signal_connect(G_DBUS_PROXY(interface), "g-properties-changed",
 						 G_CALLBACK(GattRemoteCharacteristic::onCharacteristicPropertiesChanged), this);
 	}
-	bool startNotify();
-	bool stopNotify();
+	void startNotify(BluetoothResultCallback callback);
+	void stopNotify(BluetoothResultCallback callback);
 	std::vector<unsigned char> readValue(uint16_t offset = 0);
 	bool writeValue(const std::vector<unsigned char> &characteristicValue, uint16_t offset = 0);
+	void readValue(uint16_t offset, GattReadValueCallback callback);
+	void writeValue(const std::vector<unsigned char> &characteristicValue, uint16_t offset, BluetoothResultCallback callback,
+	                bool reliable = false);
+	uint16_t getMtu() const;
 	BluetoothGattCharacteristicProperties readProperties();
+	// Declared with the Reliable Write bit of the extended properties
+	bool supportsReliableWrite();
+
+	void cacheValue(const BluetoothGattValue &value);
+	void invalidateCachedValue() { mValueCached = false; }
+	bool hasCachedValue(const GattReadCachePolicy &policy) const;
+
+	void setMetrics(const std::shared_ptr<GattOperationMetrics> &metrics,
+	                const std::shared_ptr<GattOperationMetrics> &deviceMetrics);
+	void recordNotification(size_t bytes);
+	// Whether a change of the value came with one of our reads rather than
+	// with a notification
+	bool isReadResult(const BluetoothGattValue &value);
+
+	std::unique_ptr<GattNotificationSubscription> notificationSubscription;
 
 	static const std::map <std::string, BluetoothGattCharacteristic::Property> characteristicPropertyMap;
 	std::string parentObjectPath;
@@ -67,6 +189,30 @@ public:
 	BluezGattCharacteristic1 *mInterface;
 	Bluez5ProfileGatt *mGattProfile;
 	std::vector<GattRemoteDescriptor*> gattRemoteDescriptors;
+
+private:
+	// Shared with the replies of reads in flight
+	struct ReadState
+	{
+		ReadState() : pending(0), changed(false), echoPending(false) {}
+
+		unsigned int pending;
+		// The value changed while reads were in flight
+		bool changed;
+		// Otherwise BlueZ updates it after the reply
+		bool echoPending;
+		BluetoothGattValue echo;
+	};
+
+	static void finishRead(ReadState &state, bool success, const BluetoothGattValue &value);
+	void recordRead(bool success, size_t bytes, gint64 begin);
+	void recordWrite(bool success, size_t bytes, gint64 begin);
+
+	bool mValueCached;
+	gint64 mValueCacheTime;
+	std::shared_ptr<ReadState> mReadState;
+	std::shared_ptr<GattOperationMetrics> mMetrics;
+	std::shared_ptr<GattOperationMetrics> mDeviceMetrics;
 };
 
 class GattRemoteService
@@ -77,6 +223,7 @@ public:
 	}
 	std::string parentObjectPath;
 	std::string objectPath;
+	std::string deviceAddress;
 	BluetoothGattService service;
 	BluezGattService1 *mInterface;
 	std::vector<GattRemoteCharacteristic*> gattRemoteCharacteristics;
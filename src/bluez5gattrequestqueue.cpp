@@ -0,0 +1,87 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bluez5gattrequestqueue.h"
+
+Bluez5GattRequestQueue::Bluez5GattRequestQueue()
+{
+}
+
+Bluez5GattRequestQueue::~Bluez5GattRequestQueue()
+{
+}
+
+void Bluez5GattRequestQueue::push(const std::string &address, RunFunction run, CancelFunction cancel)
+{
+	DeviceQueue &queue = mQueues[address];
+	queue.requests.push_back({run, cancel, g_get_monotonic_time()});
+
+	if (!queue.busy)
+		runNext(address);
+}
+
+void Bluez5GattRequestQueue::clear(const std::string &address)
+{
+	auto queueIter = mQueues.find(address);
+	if (queueIter == mQueues.end())
+		return;
+
+	std::deque<Request> requests;
+	requests.swap(queueIter->second.requests);
+	queueIter->second.busy = false;
+	queueIter->second.generation++;
+
+	for (auto &request : requests)
+	{
+		if (request.cancel)
+			request.cancel();
+	}
+}
+
+size_t Bluez5GattRequestQueue::pending(const std::string &address) const
+{
+	auto queueIter = mQueues.find(address);
+	if (queueIter == mQueues.end())
+		return 0;
+
+	return queueIter->second.requests.size() + (queueIter->second.busy ? 1 : 0);
+}
+
+void Bluez5GattRequestQueue::runNext(const std::string &address)
+{
+	DeviceQueue &queue = mQueues[address];
+	if (queue.requests.empty())
+	{
+		queue.busy = false;
+		return;
+	}
+
+	Request request = queue.requests.front();
+	queue.requests.pop_front();
+	queue.busy = true;
+
+	if (mDelayCallback)
+		mDelayCallback(address, g_get_monotonic_time() - request.queueTime);
+
+	uint32_t generation = queue.generation;
+	request.run([this, address, generation]() {
+		auto queueIter = mQueues.find(address);
+		if (queueIter == mQueues.end() || queueIter->second.generation != generation)
+			return;
+
+		runNext(address);
+	});
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BLUEZ5GATTREQUESTQUEUE_H
+#define BLUEZ5GATTREQUESTQUEUE_H
+
+#include <glib.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Queue of asynchronous GATT requests per remote device. ATT allows only one
+// outstanding request per bearer, so requests of a device are started one
+// after the other as soon as the previous one completes, without going back
+// to the caller in between.
+class Bluez5GattRequestQueue
+{
+public:
+	typedef std::function<void()> CompletionCallback;
+	// Starts the request, done must be called exactly once when it finished
+	typedef std::function<void(CompletionCallback done)> RunFunction;
+	// Called instead of run when the request is dropped before it started
+	typedef std::function<void()> CancelFunction;
+	// Reports how long a request waited in the queue, in microseconds
+	typedef std::function<void(const std::string &address, gint64 delay)> DelayCallback;
+
+	Bluez5GattRequestQueue();
+	~Bluez5GattRequestQueue();
+
+	Bluez5GattRequestQueue(const Bluez5GattRequestQueue&) = delete;
+	Bluez5GattRequestQueue& operator = (const Bluez5GattRequestQueue&) = delete;
+
+	void push(const std::string &address, RunFunction run, CancelFunction cancel);
+	void clear(const std::string &address);
+	size_t pending(const std::string &address) const;
+
+	void setDelayCallback(DelayCallback callback) { mDelayCallback = callback; }
+
+private:
+	struct Request
+	{
+		RunFunction run;
+		CancelFunction cancel;
+		gint64 queueTime;
+	};
+
+	struct DeviceQueue
+	{
+		DeviceQueue() : busy(false), generation(0) { }
+
+		std::deque<Request> requests;
+		bool busy;
+		// Completions of requests started before a clear are ignored
+		uint32_t generation;
+	};
+
+	void runNext(const std::string &address);
+
+	std::unordered_map<std::string, DeviceQueue> mQueues;
+	DelayCallback mDelayCallback;
+};
+
+#endif // BLUEZ5GATTREQUESTQUEUE_H
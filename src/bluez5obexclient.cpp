@@ -150,8 +150,19 @@ void Bluez5ObexClient::createSession(Bluez5ObexSession::Type type, const std::st
 
 		Bluez5ObexSession *session = new Bluez5ObexSession(this, type, std::string(objectPath), deviceAddress);
 
-		// The caller has to take care to release the memory for the session when it isn't used anymore
-		callback(session);
+		// The session is handed out once its proxies are there. The caller
+		// has to take care to release the memory for the session when it
+		// isn't used anymore.
+		session->createProxies([session, callback](bool success) {
+			if (!success)
+			{
+				delete session;
+				callback(0);
+				return;
+			}
+
+			callback(session);
+		});
 	};
 
 	GVariantBuilder *builder = 0;
@@ -231,6 +231,7 @@ void Bluez5ObexProfileBase::startTransfer(BluetoothFtpTransferId id, const std::
 	// NOTE: ownership of the transfer object is passed to updateActiveTransfer which
 	// will delete it once there is nothing to left to do with it
 	Bluez5ObexTransfer *transfer = new Bluez5ObexTransfer(std::string(objectPath), type);
+	transfer->setProgressOptions(mProgressOptions);
 	mTransfers.insert(std::pair<BluetoothFtpTransferId, Bluez5ObexTransfer*>(id, transfer));
 	transfer->watch(std::bind(&Bluez5ObexProfileBase::updateActiveTransfer, this, id, transfer, callback));
 }
@@ -272,6 +273,16 @@ void Bluez5ObexProfileBase::removeTransfer(BluetoothFtpTransferId id)
 	delete transfer;
 }
 
+BluetoothError Bluez5ObexProfileBase::getTransferProgress(BluetoothFtpTransferId id, Bluez5ObexTransferProgress &progress)
+{
+	Bluez5ObexTransfer *transfer = findTransfer(id);
+	if (!transfer)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	progress = transfer->getProgress();
+	return BLUETOOTH_ERROR_NONE;
+}
+
 Bluez5ObexTransfer* Bluez5ObexProfileBase::findTransfer(BluetoothFtpTransferId id)
 {
 	auto transferIter = mTransfers.find(id);
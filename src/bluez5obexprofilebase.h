@@ -43,12 +43,16 @@ public:
 	virtual void updateProperties(GVariant *changedProperties);
 	static void handlePropertiesChanged(BluezObexSession1 *, gchar *interface,  GVariant *changedProperties, GVariant *invalidatedProperties, gpointer userData);
 	virtual void notifySessionStatus(const std::string &address, bool createdOrRemoved);
+	// Applies to transfers started from now on
+	void setTransferProgressOptions(const Bluez5ObexProgressOptions &options) { mProgressOptions = options; }
+	BluetoothError getTransferProgress(BluetoothFtpTransferId id, Bluez5ObexTransferProgress &progress);
 
 private:
 
 	std::map<std::string, Bluez5ObexSession*> mSessions;
 	std::map<BluetoothFtpTransferId, Bluez5ObexTransfer*> mTransfers;
 	Bluez5ObexSession::Type mType;
+	Bluez5ObexProgressOptions mProgressOptions;
 
 protected:
 	void createSession(const std::string &address, Bluez5ObexSession::Type type, BluetoothResultCallback callback);
@@ -26,86 +26,18 @@ Bluez5ObexSession::Bluez5ObexSession(Bluez5ObexClient *client, Type type, const
 	mType(type),
 	mObjectPath(objectPath),
 	mDeviceAddress(deviceAddress),
-	mSessionProxy(0),
 	mFileTransferProxy(0),
 	mObjectPushProxy(0),
 	mPhonebookAccessProxy(nullptr),
 	mMessageAccessProxy(nullptr),
 	mPropertiesProxy(nullptr),
 	mLostRemote(false),
-	mObjectWatch(new DBusUtils::ObjectWatch(BLUEZ5_OBEX_DBUS_BUS_TYPE, "org.bluez.obex", objectPath))
+	mObjectWatch(new DBusUtils::ObjectWatch(BLUEZ5_OBEX_DBUS_BUS_TYPE, "org.bluez.obex", objectPath)),
+	mCancellable(g_cancellable_new()),
+	mPendingProxies(0),
+	mProxyFailed(false),
+	mReady(false)
 {
-	GError *error = 0;
-
-	mSessionProxy = bluez_obex_session1_proxy_new_for_bus_sync(BLUEZ5_OBEX_DBUS_BUS_TYPE, G_DBUS_PROXY_FLAGS_NONE,
-	                                                           "org.bluez.obex", mObjectPath.c_str(), NULL, &error);
-	if (error)
-	{
-		ERROR(MSGID_FAILED_TO_CREATE_OBEX_SESSION_PROXY, 0,
-			  "Failed to create dbus proxy for session client on path %s",
-			  mObjectPath.c_str());
-		g_error_free(error);
-		return;
-	}
-
-	mFileTransferProxy = bluez_obex_file_transfer1_proxy_new_for_bus_sync(BLUEZ5_OBEX_DBUS_BUS_TYPE, G_DBUS_PROXY_FLAGS_NONE,
-																		"org.bluez.obex", mObjectPath.c_str(), NULL, &error);
-	if (error)
-	{
-		ERROR(MSGID_FAILED_TO_CREATE_OBEX_FILE_TRANSFER_PROXY, 0,
-			  "Failed to create dbus proxy for file transfer on path %s",
-			  mObjectPath.c_str());
-		g_error_free(error);
-		return;
-	}
-
-	mObjectPushProxy = bluez_obex_object_push1_proxy_new_for_bus_sync(BLUEZ5_OBEX_DBUS_BUS_TYPE, G_DBUS_PROXY_FLAGS_NONE,
-																		"org.bluez.obex", mObjectPath.c_str(), NULL, &error);
-
-	if (error)
-	{
-		ERROR(MSGID_FAILED_TO_CREATE_OBEX_PUSH_PROXY, 0,
-			  "Failed to create dbus proxy for obex push on path %s",
-			  mObjectPath.c_str());
-		g_error_free(error);
-		return;
-	}
-
-	mPhonebookAccessProxy = bluez_obex_phonebook_access1_proxy_new_for_bus_sync(BLUEZ5_OBEX_DBUS_BUS_TYPE, G_DBUS_PROXY_FLAGS_NONE,
-																		"org.bluez.obex", mObjectPath.c_str(), NULL, &error);
-
-	if (error)
-	{
-		ERROR(MSGID_FAILED_TO_CREATE_OBEX_PHONEBOOK_PROXY, 0,
-			  "Failed to create dbus proxy for obex phonebook on path %s",
-			  mObjectPath.c_str());
-		g_error_free(error);
-		return;
-	}
-
-	mMessageAccessProxy = bluez_obex_message_access1_proxy_new_for_bus_sync(BLUEZ5_OBEX_DBUS_BUS_TYPE, G_DBUS_PROXY_FLAGS_NONE,
-																		"org.bluez.obex", mObjectPath.c_str(), NULL, &error);
-
-	if (error)
-	{
-		ERROR(MSGID_FAILED_TO_CREATE_OBEX_MESSAGE_PROXY, 0,
-			  "Failed to create dbus proxy for obex message on path %s",
-			  mObjectPath.c_str());
-		g_error_free(error);
-		return;
-	}
-
-	mPropertiesProxy = free_desktop_dbus_properties_proxy_new_for_bus_sync(BLUEZ5_OBEX_DBUS_BUS_TYPE, G_DBUS_PROXY_FLAGS_NONE,
-																		"org.bluez.obex", objectPath.c_str(), NULL, &error);
-	if (error)
-	{
-		ERROR(MSGID_FAILED_TO_CREATE_OBEX_PHONEBOOK_PROXY, 0,
-			  "Not able to get property interface on path %s",
-			  mObjectPath.c_str());
-		g_error_free(error);
-		return;
-	}
-
 	mObjectWatch->watchInterfaceRemoved([this](const std::string &name) {
 		if (name != "org.bluez.obex.Session1" && name != "all")
 			return;
@@ -120,12 +52,15 @@ Bluez5ObexSession::Bluez5ObexSession(Bluez5ObexClient *client, Type type, const
 
 Bluez5ObexSession::~Bluez5ObexSession()
 {
+	g_cancellable_cancel(mCancellable);
+	g_object_unref(mCancellable);
+
 	if (!mLostRemote)
 		mClient->destroySession(mObjectPath);
 	if(mFileTransferProxy)
 		g_object_unref(mFileTransferProxy);
-	if(mSessionProxy)
-		g_object_unref(mSessionProxy);
+	if(mObjectPushProxy)
+		g_object_unref(mObjectPushProxy);
 	if(mPhonebookAccessProxy)
 		g_object_unref(mPhonebookAccessProxy);
 	if(mMessageAccessProxy)
@@ -136,6 +71,89 @@ Bluez5ObexSession::~Bluez5ObexSession()
 	delete mObjectWatch;
 }
 
+void Bluez5ObexSession::createProxies(Bluez5ObexSessionReadyCallback callback)
+{
+	mReadyCallback = callback;
+	mProxyFailed = false;
+
+	// Only the interface the session type goes with is there on the object
+	switch (mType)
+	{
+	case FTP:
+		createProxy(bluez_obex_file_transfer1_proxy_new_for_bus, bluez_obex_file_transfer1_proxy_new_for_bus_finish,
+		            G_DBUS_PROXY_FLAGS_NONE, &mFileTransferProxy, MSGID_FAILED_TO_CREATE_OBEX_FILE_TRANSFER_PROXY, "file transfer");
+		break;
+	case OPP:
+		createProxy(bluez_obex_object_push1_proxy_new_for_bus, bluez_obex_object_push1_proxy_new_for_bus_finish,
+		            G_DBUS_PROXY_FLAGS_NONE, &mObjectPushProxy, MSGID_FAILED_TO_CREATE_OBEX_PUSH_PROXY, "obex push");
+		break;
+	case PBAP:
+		createProxy(bluez_obex_phonebook_access1_proxy_new_for_bus, bluez_obex_phonebook_access1_proxy_new_for_bus_finish,
+		            G_DBUS_PROXY_FLAGS_NONE, &mPhonebookAccessProxy, MSGID_FAILED_TO_CREATE_OBEX_PHONEBOOK_PROXY, "obex phonebook");
+		break;
+	case MAP:
+		createProxy(bluez_obex_message_access1_proxy_new_for_bus, bluez_obex_message_access1_proxy_new_for_bus_finish,
+		            G_DBUS_PROXY_FLAGS_NONE, &mMessageAccessProxy, MSGID_FAILED_TO_CREATE_OBEX_MESSAGE_PROXY, "obex message");
+		break;
+	default:
+		break;
+	}
+
+	// Only its signal is of use, the interface has no properties to load
+	createProxy(free_desktop_dbus_properties_proxy_new_for_bus, free_desktop_dbus_properties_proxy_new_for_bus_finish,
+	            G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES, &mPropertiesProxy, MSGID_FAILED_TO_CREATE_OBEX_SESSION_PROXY, "properties");
+}
+
+template <typename Proxy>
+void Bluez5ObexSession::createProxy(void (*create)(GBusType, GDBusProxyFlags, const gchar*, const gchar*, GCancellable*, GAsyncReadyCallback, gpointer),
+                                    Proxy* (*finish)(GAsyncResult*, GError**), GDBusProxyFlags flags, Proxy **proxy,
+                                    const char *messageId, const char *description)
+{
+	auto createProxyCallback = [this, finish, proxy, messageId, description](GAsyncResult *result) {
+		GError *error = 0;
+
+		Proxy *newProxy = finish(result, &error);
+		if (error)
+		{
+			// The session is gone already
+			if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			{
+				g_error_free(error);
+				return;
+			}
+
+			ERROR(messageId, 0, "Failed to create dbus proxy for %s on path %s: %s",
+			      description, mObjectPath.c_str(), error->message);
+			g_error_free(error);
+		}
+
+		*proxy = newProxy;
+		handleProxyCreated(newProxy != nullptr);
+	};
+
+	mPendingProxies++;
+	create(BLUEZ5_OBEX_DBUS_BUS_TYPE, flags, "org.bluez.obex", mObjectPath.c_str(), mCancellable,
+	       glibAsyncMethodWrapper, new GlibAsyncFunctionWrapper(createProxyCallback));
+}
+
+void Bluez5ObexSession::handleProxyCreated(bool success)
+{
+	if (!success)
+		mProxyFailed = true;
+
+	if (--mPendingProxies)
+		return;
+
+	mReady = !mProxyFailed;
+	DEBUG("Proxies for session %s %s", mObjectPath.c_str(), mReady ? "created" : "failed");
+
+	// The callback may delete the session
+	Bluez5ObexSessionReadyCallback callback = mReadyCallback;
+	mReadyCallback = nullptr;
+	if (callback)
+		callback(mReady);
+}
+
 void Bluez5ObexSession::watch(Bluez5ObexSessionStatusCallback callback)
 {
 	mStatusCallback = callback;
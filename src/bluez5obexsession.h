@@ -33,6 +33,7 @@ namespace DBusUtils
 }
 
 typedef std::function<void(bool)> Bluez5ObexSessionStatusCallback;
+typedef std::function<void(bool success)> Bluez5ObexSessionReadyCallback;
 
 class Bluez5ObexSession
 {
@@ -56,6 +57,12 @@ public:
 	std::string getDeviceAddress() const { return mDeviceAddress; }
 	std::string getObjectPath() const { return mObjectPath; }
 
+	// Creates the proxy for the interface of the session type and the
+	// properties proxy without blocking. The getters return nullptr until
+	// the callback reported success.
+	void createProxies(Bluez5ObexSessionReadyCallback callback);
+	bool isReady() const { return mReady; }
+
 	BluezObexFileTransfer1* getFileTransferProxy() const { return mFileTransferProxy; }
 
 	BluezObexObjectPush1* getObjectPushProxy() const { return mObjectPushProxy; }
@@ -69,11 +76,16 @@ public:
 	void watch(Bluez5ObexSessionStatusCallback callback);
 
 private:
+	template <typename Proxy>
+	void createProxy(void (*create)(GBusType, GDBusProxyFlags, const gchar*, const gchar*, GCancellable*, GAsyncReadyCallback, gpointer),
+	                 Proxy* (*finish)(GAsyncResult*, GError**), GDBusProxyFlags flags, Proxy **proxy,
+	                 const char *messageId, const char *description);
+	void handleProxyCreated(bool success);
+
 	Bluez5ObexClient *mClient;
 	Type mType;
 	std::string mObjectPath;
 	std::string mDeviceAddress;
-	BluezObexSession1 *mSessionProxy;
 	BluezObexFileTransfer1 *mFileTransferProxy;
 	BluezObexObjectPush1 *mObjectPushProxy;
 	BluezObexPhonebookAccess1 *mPhonebookAccessProxy;
@@ -82,6 +94,12 @@ private:
 	bool mLostRemote;
 	DBusUtils::ObjectWatch *mObjectWatch;
 	Bluez5ObexSessionStatusCallback mStatusCallback;
+	// Cancelled with the session so no proxy callback comes in after it
+	GCancellable *mCancellable;
+	unsigned int mPendingProxies;
+	bool mProxyFailed;
+	bool mReady;
+	Bluez5ObexSessionReadyCallback mReadyCallback;
 };
 
 #endif // BLUEZ5OBEXSESSION_H
@@ -30,7 +30,13 @@ Bluez5ObexTransfer::Bluez5ObexTransfer(const std::string &objectPath, TransferTy
 	mBytesTransferred(0),
 	mFileSize(0),
 	mState(INACTIVE),
-	mTransferType(type)
+	mTransferType(type),
+	mStartTime(g_get_monotonic_time()),
+	mLastSampleTime(mStartTime),
+	mLastSampleBytes(0),
+	mCurrentThroughput(0),
+	mLastNotifyTime(mStartTime),
+	mLastNotifiedBytes(0)
 {
 	GError *error = 0;
 
@@ -168,6 +174,8 @@ bool Bluez5ObexTransfer::parsePropertyFromVariant(const std::string &key, GVaria
 void Bluez5ObexTransfer::updateFromProperties(GVariant *properties)
 {
 	bool changed = false;
+	State previousState = mState;
+	uint64_t previousBytes = mBytesTransferred;
 
 	for (int n = 0; n < g_variant_n_children(properties); n++)
 	{
@@ -186,8 +194,63 @@ void Bluez5ObexTransfer::updateFromProperties(GVariant *properties)
 		g_variant_unref(realValueVar);
 	}
 
-	if (changed)
-		notifyWatcherAboutChangedProperties();
+	if (!changed)
+		return;
+
+	gint64 now = g_get_monotonic_time();
+	if (mBytesTransferred != previousBytes)
+		updateThroughput(now);
+
+	// Large transfers report progress far more often than anyone needs it
+	bool finished = mFileSize && mBytesTransferred >= mFileSize;
+	if (mState == previousState && !finished && !isProgressDue(now))
+		return;
+
+	mLastNotifyTime = now;
+	mLastNotifiedBytes = mBytesTransferred;
+	notifyWatcherAboutChangedProperties();
+}
+
+void Bluez5ObexTransfer::updateThroughput(gint64 now)
+{
+	gint64 elapsed = now - mLastSampleTime;
+	if (elapsed > 0 && mBytesTransferred >= mLastSampleBytes)
+		mCurrentThroughput = (mBytesTransferred - mLastSampleBytes) * 1000000.0 / elapsed;
+
+	mLastSampleTime = now;
+	mLastSampleBytes = mBytesTransferred;
+}
+
+bool Bluez5ObexTransfer::isProgressDue(gint64 now) const
+{
+	if (mProgressOptions.minInterval && now - mLastNotifyTime < (gint64) mProgressOptions.minInterval * 1000)
+		return false;
+
+	if (mProgressOptions.minBytes && mBytesTransferred >= mLastNotifiedBytes &&
+	    mBytesTransferred - mLastNotifiedBytes < mProgressOptions.minBytes)
+		return false;
+
+	return true;
+}
+
+Bluez5ObexTransferProgress Bluez5ObexTransfer::getProgress() const
+{
+	Bluez5ObexTransferProgress progress;
+
+	progress.bytesTransferred = mBytesTransferred;
+	progress.fileSize = mFileSize;
+	progress.currentThroughput = mCurrentThroughput;
+
+	gint64 elapsed = mLastSampleTime - mStartTime;
+	if (elapsed > 0)
+		progress.averageThroughput = mLastSampleBytes * 1000000.0 / elapsed;
+
+	if (mState == COMPLETE)
+		progress.remainingTime = 0;
+	else if (mFileSize && mBytesTransferred <= mFileSize && progress.averageThroughput > 0)
+		progress.remainingTime = (mFileSize - mBytesTransferred) * 1000 / progress.averageThroughput;
+
+	return progress;
 }
 
 void Bluez5ObexTransfer::handlePropertiesChanged(BluezObexTransfer1 *, gchar *interface,  GVariant *changedProperties,
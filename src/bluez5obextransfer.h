@@ -29,6 +29,35 @@ extern "C" {
 
 typedef std::function<void()> Bluez5ObexTransferWatchCallback;
 
+// A progress update is passed on once both minimums were reached since the
+// previous one, 0 disables either. State changes, including the final
+// one, are always passed on.
+struct Bluez5ObexProgressOptions
+{
+	Bluez5ObexProgressOptions()
+		: minInterval(0), minBytes(0) {
+	}
+
+	unsigned int minInterval; // ms
+	uint64_t minBytes;
+};
+
+struct Bluez5ObexTransferProgress
+{
+	Bluez5ObexTransferProgress()
+		: bytesTransferred(0), fileSize(0), currentThroughput(0), averageThroughput(0), remainingTime(-1) {
+	}
+
+	uint64_t bytesTransferred;
+	uint64_t fileSize;
+	// Bytes per second between the last two updates from obexd and since
+	// the transfer was started
+	double currentThroughput;
+	double averageThroughput;
+	// At the average throughput in ms, -1 if it isn't known
+	int64_t remainingTime;
+};
+
 class Bluez5ObexSession;
 
 class Bluez5ObexTransfer
@@ -59,6 +88,7 @@ public:
 	void cancel(BluetoothResultCallback callback);
 
 	void watch(Bluez5ObexTransferWatchCallback callback);
+	void setProgressOptions(const Bluez5ObexProgressOptions &options) { mProgressOptions = options; }
 
 	bool isPartOfSession(Bluez5ObexSession *session);
 
@@ -68,6 +98,7 @@ public:
 	const std::string& getFileName() const { return mFileName; }
 	const std::string& getFilePath() const { return mFilePath; }
 	const std::string& getMessageHandle() const { return mMessageHandle; }
+	Bluez5ObexTransferProgress getProgress() const;
 
 public:
 	static void handlePropertiesChanged(BluezObexTransfer1 *, gchar *interface,  GVariant *changedProperties,
@@ -85,7 +116,18 @@ private:
 	std::string mFileName;
 	std::string mFilePath;
 	std::string mMessageHandle;
+
+	Bluez5ObexProgressOptions mProgressOptions;
+	gint64 mStartTime;
+	gint64 mLastSampleTime;
+	uint64_t mLastSampleBytes;
+	double mCurrentThroughput;
+	gint64 mLastNotifyTime;
+	uint64_t mLastNotifiedBytes;
+
 	void updateFromProperties(GVariant *properties);
+	void updateThroughput(gint64 now);
+	bool isProgressDue(gint64 now) const;
 	bool parsePropertyFromVariant(const std::string &key, GVariant *valueVar);
 	void notifyWatcherAboutChangedProperties();
 };
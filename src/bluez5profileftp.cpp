@@ -191,6 +191,16 @@ Bluez5ObexSession* Bluez5ProfileFtp::findSession(const std::string &address)
 	return session;
 }
 
+BluetoothError Bluez5ProfileFtp::getTransferProgress(BluetoothFtpTransferId id, Bluez5ObexTransferProgress &progress)
+{
+	Bluez5ObexTransfer *transfer = findTransfer(id);
+	if (!transfer)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	progress = transfer->getProgress();
+	return BLUETOOTH_ERROR_NONE;
+}
+
 Bluez5ObexTransfer* Bluez5ProfileFtp::findTransfer(BluetoothFtpTransferId id)
 {
 	auto transferIter = mTransfers.find(id);
@@ -433,6 +443,7 @@ void Bluez5ProfileFtp::startTransfer(BluetoothFtpTransferId id, const std::strin
 	// NOTE: ownership of the transfer object is passed to updateActiveTransfer which
 	// will delete it once there is nothing to left to do with it
 	Bluez5ObexTransfer *transfer = new Bluez5ObexTransfer(std::string(objectPath));
+	transfer->setProgressOptions(mProgressOptions);
 	mTransfers.insert(std::pair<BluetoothFtpTransferId, Bluez5ObexTransfer*>(id, transfer));
 	transfer->watch(std::bind(&Bluez5ProfileFtp::updateActiveTransfer, this, id, transfer, callback));
 }
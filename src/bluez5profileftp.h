@@ -24,6 +24,7 @@
 #include <bluetooth-sil-api.h>
 
 #include "bluez5profilebase.h"
+#include "bluez5obextransfer.h"
 
 class Bluez5Adapter;
 class Bluez5Device;
@@ -51,10 +52,15 @@ public:
 				const std::string &targetPath, BluetoothFtpTransferResultCallback callback);
 	void cancelTransfer(BluetoothFtpTransferId id, BluetoothResultCallback callback);
 
+	// Applies to transfers started from now on
+	void setTransferProgressOptions(const Bluez5ObexProgressOptions &options) { mProgressOptions = options; }
+	BluetoothError getTransferProgress(BluetoothFtpTransferId id, Bluez5ObexTransferProgress &progress);
+
 private:
 	std::map<std::string, Bluez5ObexSession*> mSessions;
 	std::map<BluetoothFtpTransferId, Bluez5ObexTransfer*> mTransfers;
 	uint64_t mTranfserIdCounter;
+	Bluez5ObexProgressOptions mProgressOptions;
 
 	inline uint64_t nextTransferId() { return ++mTranfserIdCounter; }
 
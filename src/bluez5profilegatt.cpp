@@ -14,8 +14,14 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <sys/socket.h>
+#include <gio/gunixfdlist.h>
 
 #include "logging.h"
 #include "bluez5adapter.h"
@@ -32,7 +38,25 @@ const std::string BLUETOOTH_PROFILE_GATT_UUID = "00001801-0000-1000-8000-00805f9
 
 #define CLIENT_PATH "/client"
 #define SERVER_PATH "/server"
-#define GATT_RECONN_TIMEOUT (30 * 1000)
+#define GATT_ATTRIBUTE_CACHE_DIR "/var/lib/bluetooth/gatt-cache"
+#define GATT_MAX_ATTRIBUTE_VALUE_LENGTH 512
+
+// Characteristics whose value never changes during a connection and may
+// therefore be answered from the read cache without re-reading them.
+static const char* staticCharacteristicUuids[] = {
+	"00002a01-0000-1000-8000-00805f9b34fb", // Appearance
+	"00002a23-0000-1000-8000-00805f9b34fb", // System ID
+	"00002a24-0000-1000-8000-00805f9b34fb", // Model Number String
+	"00002a25-0000-1000-8000-00805f9b34fb", // Serial Number String
+	"00002a26-0000-1000-8000-00805f9b34fb", // Firmware Revision String
+	"00002a27-0000-1000-8000-00805f9b34fb", // Hardware Revision String
+	"00002a28-0000-1000-8000-00805f9b34fb", // Software Revision String
+	"00002a29-0000-1000-8000-00805f9b34fb", // Manufacturer Name String
+	"00002a2a-0000-1000-8000-00805f9b34fb", // IEEE Regulatory Certification
+	"00002a4a-0000-1000-8000-00805f9b34fb", // HID Information
+	"00002a4b-0000-1000-8000-00805f9b34fb", // Report Map
+	"00002a50-0000-1000-8000-00805f9b34fb"  // PnP ID
+};
 #define BLUEZ5_GATT_OBJECT_CLIENT_PATH BLUEZ5_GATT_OBJECT_PATH CLIENT_PATH
 #define BLUEZ5_GATT_OBJECT_SERVER_PATH BLUEZ5_GATT_OBJECT_PATH SERVER_PATH
 
@@ -43,9 +67,23 @@ Bluez5ProfileGatt::Bluez5ProfileGatt(Bluez5Adapter *adapter):
 	mLastCharId(0),
 	mConn(nullptr),
 	mAdapter(adapter),
-	mObjectManagerGattServer(nullptr)
+	mObjectManagerGattServer(nullptr),
+	mLocalApplicationRegistered(false),
+	mReconnectScheduler(std::bind(&Bluez5ProfileGatt::handleAutoConnAttempt, this, std::placeholders::_1, std::placeholders::_2),
+	                    std::bind(&Bluez5ProfileGatt::handleAutoConnTimeout, this, std::placeholders::_1)),
+	mResolvingServices(false),
+	mAttributeCache(GATT_ATTRIBUTE_CACHE_DIR),
+	mReadCacheStatistics({0, 0})
 {
 	DEBUG("Bluez5ProfileGatt created");
+
+	for (auto uuid : staticCharacteristicUuids)
+		mReadCachePolicies[uuid] = GattReadCachePolicy(GattReadCachePolicy::STATIC);
+
+	mRequestQueue.setDelayCallback([this](const std::string &address, gint64 delay) {
+		mMetrics.getDevice(address)->recordQueueDelay(delay);
+	});
+
 	mBusId = g_bus_own_name(G_BUS_TYPE_SYSTEM, BLUEZ5_GATT_BUS_NAME,
 				G_BUS_NAME_OWNER_FLAGS_NONE,
 				handleBusAcquired, NULL, NULL, this, NULL);
@@ -89,13 +127,20 @@ void Bluez5ProfileGatt::addRemoteServiceToDevice(GattRemoteService* gattService)
 
 	std::string deviceAddress = device->getAddress();
 	std::string lowerCaseAddress = convertAddressToLowerCase(deviceAddress);
+	gattService->deviceAddress = lowerCaseAddress;
 
 	auto deviceServicesIter = mDeviceServicesMap.find(lowerCaseAddress);
 
 	if (deviceServicesIter == mDeviceServicesMap.end())
 	{
 		mDeviceServicesMap.insert({ lowerCaseAddress, { gattService }});
-		getGattObserver()->serviceFound(lowerCaseAddress, gattService->service);
+		mAttributeCacheStored.erase(lowerCaseAddress);
+		mReconnectScheduler.deviceConnected(lowerCaseAddress);
+		if (!mResolvingServices)
+		{
+			getGattObserver()->serviceFound(lowerCaseAddress, gattService->service);
+			updateRemoteDeviceServices(lowerCaseAddress);
+		}
 
 		/* Send connect status*/
 		BluetoothPropertiesList properties;
@@ -114,8 +159,11 @@ void Bluez5ProfileGatt::addRemoteServiceToDevice(GattRemoteService* gattService)
 		if (serviceIter == servicesList.end())
 		{
 			servicesList.push_back(gattService);
-			getGattObserver()->serviceFound(lowerCaseAddress, gattService->service);
-			updateRemoteDeviceServices();
+			if (!mResolvingServices)
+			{
+				getGattObserver()->serviceFound(lowerCaseAddress, gattService->service);
+				updateRemoteDeviceServices(lowerCaseAddress);
+			}
 		}
 	}
 }
@@ -199,8 +247,12 @@ void Bluez5ProfileGatt::addRemoteCharacteristicToService(GattRemoteCharacteristi
 	GattRemoteService* service = getRemoteGattService(gattCharacteristic->parentObjectPath);
 	if (service)
 	{
+		std::string uuid = convertToLowerCase(gattCharacteristic->characteristic.getUuid().toString());
+		gattCharacteristic->setMetrics(mMetrics.getCharacteristic(service->deviceAddress, gattCharacteristic->objectPath, uuid),
+		                               mMetrics.getDevice(service->deviceAddress));
 		service->gattRemoteCharacteristics.push_back(gattCharacteristic);
 		service->service.addCharacteristic(gattCharacteristic->characteristic);
+		updateRemoteService(service);
 	}
 }
 
@@ -242,12 +294,33 @@ void Bluez5ProfileGatt::createRemoteGattCharacteristic(const std::string &charac
 	gattCharacteristic.setProperties(gattRemoteCharacteristic->readProperties());
 	gattRemoteCharacteristic->characteristic = gattCharacteristic;
 
-	if (gattRemoteCharacteristic->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_READ))
-	{
-		BluetoothGattValue charValue = gattRemoteCharacteristic->readValue();
-		gattRemoteCharacteristic->characteristic.setValue(charValue);
-	}
 	addRemoteCharacteristicToService(gattRemoteCharacteristic);
+
+	if (!gattRemoteCharacteristic->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_READ))
+		return;
+
+	// A failed read must not end up in the cache, for a STATIC characteristic
+	// it would be returned for the whole connection.
+	auto readValueCallback = [this, characteristicObjectPath](bool success, const BluetoothGattValue &value) {
+		if (!success)
+			return;
+
+		GattRemoteCharacteristic *characteristic = findRemoteCharacteristic(characteristicObjectPath);
+		if (!characteristic)
+			return;
+
+		characteristic->cacheValue(value);
+
+		GattRemoteService *service = getRemoteGattService(characteristic->parentObjectPath);
+		if (!service)
+			return;
+
+		BluetoothUuid characteristicUuid = characteristic->characteristic.getUuid();
+		service->service.updateCharacteristicValue(characteristicUuid, value);
+		if (mRemoteDeviceServicesMap.find(service->deviceAddress) != mRemoteDeviceServicesMap.end())
+			updateRemoteCharacteristicValue(service->deviceAddress, service->service.getUuid(), characteristicUuid, value);
+	};
+	gattRemoteCharacteristic->readValue(0, readValueCallback);
 }
 
 void Bluez5ProfileGatt::removeRemoteGattCharacteristic(const std::string &characteristicObjectPath)
@@ -268,9 +341,19 @@ void Bluez5ProfileGatt::removeRemoteGattCharacteristic(const std::string &charac
 
 		if (characteristicIter != characteristicList.end())
 		{
+			// The characteristics of the service are kept in the same order
+			BluetoothGattCharacteristicList serviceCharacteristicList = service->service.getCharacteristics();
+			size_t index = characteristicIter - characteristicList.begin();
+			if (index < serviceCharacteristicList.size())
+			{
+				serviceCharacteristicList.erase(serviceCharacteristicList.begin() + index);
+				service->service.setCharacteristics(serviceCharacteristicList);
+			}
+
 			g_object_unref((*characteristicIter)->mInterface);
 			delete (*characteristicIter);
 			characteristicList.erase(characteristicIter);
+			updateRemoteService(service);
 		}
 	}
 }
@@ -317,6 +400,7 @@ void Bluez5ProfileGatt::addRemoteDescriptorToCharacteristic(GattRemoteDescriptor
 			{
 				(*serviceCharacteristicIter).addDescriptor(gattDescriptor->descriptor);
 				remoteService->service.setCharacteristics(serviceCharacteristicList);
+				updateRemoteService(remoteService);
 			}
 		}
 	}
@@ -391,6 +475,10 @@ void Bluez5ProfileGatt::removeRemoteGattDescriptor(const std::string &descriptor
 
 			if (descriptorsIter != descriptorsList.end())
 			{
+				size_t characteristicIndex = characteristicIter - characteristicList.begin();
+				size_t descriptorIndex = descriptorsIter - descriptorsList.begin();
+				removeServiceDescriptor(service, characteristicIndex, descriptorIndex);
+
 				if ((*descriptorsIter)->mInterface)
 				{
 					g_object_unref((*descriptorsIter)->mInterface);
@@ -398,6 +486,7 @@ void Bluez5ProfileGatt::removeRemoteGattDescriptor(const std::string &descriptor
 				}
 				delete (*descriptorsIter);
 				descriptorsList.erase(descriptorsIter);
+				updateRemoteService(service);
 			}
 		}
 	}
@@ -430,14 +519,21 @@ void Bluez5ProfileGatt::removeRemoteGattService(const std::string &serviceObject
 
 		if (serviceIter != servicesList.end())
 		{
+			// The tree is still complete when its first service goes away,
+			// remember it for the next connection of a bonded device.
+			if (mAttributeCacheStored.find(lowerCaseAddress) == mAttributeCacheStored.end())
+				storeAttributeCache(lowerCaseAddress);
+
 			getGattObserver()->serviceLost(lowerCaseAddress, (*serviceIter)->service);
 			g_object_unref((*serviceIter)->mInterface);
 			delete (*serviceIter);
 			servicesList.erase(serviceIter);
+			updateRemoteDeviceServices(lowerCaseAddress);
 		}
 		if (servicesList.size() == 0)
 		{
 			mDeviceServicesMap.erase(deviceServicesIter);
+			mRemoteDeviceServicesMap.erase(lowerCaseAddress);
 			BluetoothPropertiesList properties;
 			properties.push_back(BluetoothProperty(BluetoothProperty::Type::CONNECTED, false));
 			getObserver()->propertiesChanged(convertAddressToLowerCase(mAdapter->getAddress()), lowerCaseAddress, properties);
@@ -463,23 +559,26 @@ void Bluez5ProfileGatt::handleObjectAdded(GDBusObjectManager *objectManager, GDB
 
 	if (auto serviceInterface = g_dbus_object_get_interface(object, "org.bluez.GattService1"))
 	{
-		auto objectPath = g_dbus_object_get_object_path(object);
-
-		pThis->createRemoteGattService(std::string(objectPath));
+		if (auto pending = pThis->getPendingGattObjects(objectPath))
+			pending->services.push_back(objectPath);
+		else
+			pThis->createRemoteGattService(objectPath);
 		g_object_unref(serviceInterface);
 	}
 	else if (auto characteristicInterface = g_dbus_object_get_interface(object, "org.bluez.GattCharacteristic1"))
 	{
-		auto objectPath = g_dbus_object_get_object_path(object);
-
-		pThis->createRemoteGattCharacteristic(std::string(objectPath));
+		if (auto pending = pThis->getPendingGattObjects(objectPath))
+			pending->characteristics.push_back(objectPath);
+		else
+			pThis->createRemoteGattCharacteristic(objectPath);
 		g_object_unref(characteristicInterface);
 	}
 	else if (auto descriptorInterface = g_dbus_object_get_interface(object, "org.bluez.GattDescriptor1"))
 	{
-		auto objectPath = g_dbus_object_get_object_path(object);
-
-		pThis->createRemoteGattDescriptor(std::string(objectPath));
+		if (auto pending = pThis->getPendingGattObjects(objectPath))
+			pending->descriptors.push_back(objectPath);
+		else
+			pThis->createRemoteGattDescriptor(objectPath);
 		g_object_unref(descriptorInterface);
 	}
 	else if (auto deviceInterface = g_dbus_object_get_interface(object, "org.bluez.Device1"))
@@ -500,6 +599,8 @@ void Bluez5ProfileGatt::handleObjectRemoved(GDBusObjectManager *objectManager, G
 	if (!pThis)
 		return;
 
+	pThis->removePendingGattObject(g_dbus_object_get_object_path(object));
+
 	if (auto adapterInterface = g_dbus_object_get_interface(object, "org.bluez.GattService1"))
 	{
 		auto objectPath = g_dbus_object_get_object_path(object);
@@ -521,15 +622,165 @@ void Bluez5ProfileGatt::handleObjectRemoved(GDBusObjectManager *objectManager, G
 		pThis->removeRemoteGattDescriptor(std::string(objectPath));
 		g_object_unref(descriptorInterface);
 	}
+	else if (auto deviceInterface = g_dbus_object_get_interface(object, "org.bluez.Device1"))
+	{
+		// The metrics of a device go with it
+		if (GVariant *address = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(deviceInterface), "Address"))
+		{
+			pThis->mMetrics.removeDevice(convertAddressToLowerCase(g_variant_get_string(address, NULL)));
+			g_variant_unref(address);
+		}
+		g_object_unref(deviceInterface);
+	}
+}
+
+void Bluez5ProfileGatt::handleInterfacePropertiesChanged(GDBusObjectManagerClient *objectManager, GDBusObjectProxy *objectProxy,
+                                                         GDBusProxy *interfaceProxy, GVariant *changedProperties,
+                                                         GStrv invalidatedProperties, gpointer user_data)
+{
+	UNUSED(objectManager);
+	UNUSED(objectProxy);
+	UNUSED(invalidatedProperties);
+
+	Bluez5ProfileGatt *pThis = static_cast<Bluez5ProfileGatt*>(user_data);
+	if (!pThis)
+		return;
+
+	if (g_strcmp0(g_dbus_proxy_get_interface_name(interfaceProxy), "org.bluez.Device1"))
+		return;
+
+	gboolean servicesResolved = FALSE;
+	if (!g_variant_lookup(changedProperties, "ServicesResolved", "b", &servicesResolved))
+		return;
+
+	std::string deviceObjectPath = g_dbus_proxy_get_object_path(interfaceProxy);
+	DEBUG("ServicesResolved of %s changed to %d", deviceObjectPath.c_str(), servicesResolved);
+
+	if (servicesResolved)
+		pThis->resolveDeviceServices(deviceObjectPath);
+	else
+		pThis->mPendingGattObjects.erase(deviceObjectPath);
+}
+
+std::string Bluez5ProfileGatt::getDeviceObjectPath(const std::string &objectPath)
+{
+	// Attribute objects live below their device, e.g.
+	// /org/bluez/hci0/dev_00_11_22_33_44_55/service000a/char000b
+	std::string adapterPath = mAdapter->getObjectPath() + "/";
+	if (objectPath.compare(0, adapterPath.length(), adapterPath))
+		return std::string();
+
+	return objectPath.substr(0, objectPath.find('/', adapterPath.length()));
+}
+
+bool Bluez5ProfileGatt::getServicesResolved(const std::string &deviceObjectPath)
+{
+	GDBusInterface *interface = g_dbus_object_manager_get_interface(mObjectManager, deviceObjectPath.c_str(),
+	                                                                "org.bluez.Device1");
+	if (!interface)
+		return true;
+
+	// BlueZ versions without the property get the attributes reported as
+	// they come in, as before.
+	bool servicesResolved = true;
+	GVariant *value = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "ServicesResolved");
+	if (value)
+	{
+		servicesResolved = g_variant_get_boolean(value);
+		g_variant_unref(value);
+	}
+
+	g_object_unref(interface);
+	return servicesResolved;
+}
+
+Bluez5ProfileGatt::PendingGattObjects* Bluez5ProfileGatt::getPendingGattObjects(const std::string &objectPath)
+{
+	std::string deviceObjectPath = getDeviceObjectPath(objectPath);
+	if (deviceObjectPath.empty() || getServicesResolved(deviceObjectPath))
+		return nullptr;
+
+	return &mPendingGattObjects[deviceObjectPath];
+}
+
+void Bluez5ProfileGatt::removePendingGattObject(const std::string &objectPath)
+{
+	auto pendingIter = mPendingGattObjects.find(objectPath);
+	if (pendingIter != mPendingGattObjects.end())
+	{
+		mPendingGattObjects.erase(pendingIter);
+		return;
+	}
+
+	pendingIter = mPendingGattObjects.find(getDeviceObjectPath(objectPath));
+	if (pendingIter == mPendingGattObjects.end())
+		return;
+
+	for (auto objectPaths : { &pendingIter->second.services, &pendingIter->second.characteristics,
+	                          &pendingIter->second.descriptors })
+		objectPaths->erase(std::remove(objectPaths->begin(), objectPaths->end(), objectPath), objectPaths->end());
+}
+
+void Bluez5ProfileGatt::resolveDeviceServices(const std::string &deviceObjectPath)
+{
+	DEBUG("%s::%s %s",__FILE__,__FUNCTION__, deviceObjectPath.c_str());
+
+	Bluez5Device* device = mAdapter->findDeviceByObjectPath(deviceObjectPath);
+	if (!device)
+	{
+		mPendingGattObjects.erase(deviceObjectPath);
+		return;
+	}
+
+	std::string lowerCaseAddress = convertAddressToLowerCase(device->getAddress());
+
+	auto deviceServicesIter = mDeviceServicesMap.find(lowerCaseAddress);
+	size_t knownServices = deviceServicesIter != mDeviceServicesMap.end() ? deviceServicesIter->second.size() : 0;
+
+	auto pendingIter = mPendingGattObjects.find(deviceObjectPath);
+	if (pendingIter != mPendingGattObjects.end())
+	{
+		PendingGattObjects pending = std::move(pendingIter->second);
+		mPendingGattObjects.erase(pendingIter);
+
+		// Parents before children so every object finds the one it belongs to
+		mResolvingServices = true;
+		for (auto &objectPath : pending.services)
+			createRemoteGattService(objectPath);
+		for (auto &objectPath : pending.characteristics)
+			createRemoteGattCharacteristic(objectPath);
+		for (auto &objectPath : pending.descriptors)
+			createRemoteGattDescriptor(objectPath);
+		mResolvingServices = false;
+	}
+
+	updateRemoteDeviceServices(lowerCaseAddress);
+
+	auto remoteServicesIter = mRemoteDeviceServicesMap.find(lowerCaseAddress);
+	if (remoteServicesIter == mRemoteDeviceServicesMap.end())
+		return;
+
+	validateAttributeCache(lowerCaseAddress);
+
+	if (mServicesResolvedCallback)
+	{
+		mServicesResolvedCallback(convertAddressToLowerCase(mAdapter->getAddress()), lowerCaseAddress,
+		                          remoteServicesIter->second);
+		return;
+	}
+
+	// Services seen before the device was resolved were already reported
+	for (size_t index = knownServices; index < remoteServicesIter->second.size(); index++)
+		getGattObserver()->serviceFound(lowerCaseAddress, remoteServicesIter->second[index]);
 }
 
 void Bluez5ProfileGatt::updateDeviceProperties(std::string deviceAddress)
 {
 	std::string lowerCaseAddress = convertAddressToLowerCase(deviceAddress);
-	int connectId = getConnectId(lowerCaseAddress);
-	if (mAutoConnDevMap.find(convertAddressToLowerCase(deviceAddress)) == mAutoConnDevMap.end())
-		if (mConnectedDevices.find(connectId) != mConnectedDevices.end())
-			mConnectedDevices.erase(connectId);
+	if (mAutoConnDevMap.find(lowerCaseAddress) == mAutoConnDevMap.end())
+		mConnections.removeAddress(lowerCaseAddress);
+
+	mRequestQueue.clear(lowerCaseAddress);
 
 	auto deviceServicesIter = mDeviceServicesMap.find(lowerCaseAddress);
 	if (deviceServicesIter != mDeviceServicesMap.end())
@@ -542,6 +793,25 @@ void Bluez5ProfileGatt::updateDeviceProperties(std::string deviceAddress)
 	getObserver()->propertiesChanged(convertAddressToLowerCase(mAdapter->getAddress()), lowerCaseAddress, properties);
 }
 
+void Bluez5ProfileGatt::setReadCachePolicy(const BluetoothUuid &characteristic, const GattReadCachePolicy &policy)
+{
+	std::string uuid = convertToLowerCase(characteristic.toString());
+
+	if (policy.mode == GattReadCachePolicy::NO_CACHE)
+		mReadCachePolicies.erase(uuid);
+	else
+		mReadCachePolicies[uuid] = policy;
+}
+
+GattReadCachePolicy Bluez5ProfileGatt::getReadCachePolicy(const BluetoothUuid &characteristic) const
+{
+	auto policyIter = mReadCachePolicies.find(convertToLowerCase(characteristic.toString()));
+	if (policyIter == mReadCachePolicies.end())
+		return GattReadCachePolicy();
+
+	return policyIter->second;
+}
+
 void Bluez5ProfileGatt::registerSignalHandlers()
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
@@ -560,6 +830,8 @@ void Bluez5ProfileGatt::registerSignalHandlers()
 
 	g_signal_connect(mObjectManager, "object-added", G_CALLBACK(handleObjectAdded), this);
 	g_signal_connect(mObjectManager, "object-removed", G_CALLBACK(handleObjectRemoved), this);
+	g_signal_connect(mObjectManager, "interface-proxy-properties-changed",
+	                 G_CALLBACK(handleInterfacePropertiesChanged), this);
 }
 
 void Bluez5ProfileGatt::handleAutoConnectDevAdd(const std::string & objPath)
@@ -582,48 +854,40 @@ void Bluez5ProfileGatt::handleAutoConnectDevAdd(const std::string & objPath)
 		address = device->getAddress();
 	DEBUG("%s:%s", __FUNCTION__, address.c_str());
 	std::string devAddress = convertAddressToLowerCase(address);
-	auto iter = mAutoConnDevMap.find(devAddress);
-	if (iter != mAutoConnDevMap.end())
-	{
-		if (iter->second.first != 0)
-			g_source_remove(iter->second.first);
-		uint16_t appId = iter->second.second;
-		mAutoConnDevMap[devAddress] = {0, appId};
-
-		Bluez5Device *device = mAdapter->findDevice(convertAddressToUpperCase(devAddress));
-		if (device)
-		{
-			auto gattConnCallBack = [devAddress, appId, this](BluetoothError error)
-			{
-				DEBUG("gattConnCallBack error : %d", error);
-				if (error != BLUETOOTH_ERROR_NONE)
-				{
-					mConnectedDevices[appId] = devAddress;
-				}
-			};
-			DEBUG("Trigger reconnection connectGatt %s", devAddress.c_str());
-			device->connectGatt(gattConnCallBack);
-		}
-	}
-
+	if (mAutoConnDevMap.find(devAddress) != mAutoConnDevMap.end())
+		mReconnectScheduler.deviceAvailable(devAddress);
 }
 
 void Bluez5ProfileGatt::handleAutoConnectDevRem(const std::string & address)
 {
 	DEBUG("%s:%s", __FUNCTION__, address.c_str());
 	std::string devAddress = convertAddressToLowerCase(address);
-	auto iter = mAutoConnDevMap.find(devAddress);
-	if (iter != mAutoConnDevMap.end())
-	{
-		if (iter->second.first != 0)
-			g_source_remove(iter->second.first);
-		std::pair<std::string, Bluez5ProfileGatt*> userData = {devAddress, this};
-		guint autoConnectTimeoutSource = g_timeout_add_seconds(GATT_RECONN_TIMEOUT,
-							Bluez5ProfileGatt::autoConnTimeoutHandler, &userData);
-		DEBUG("autoConnectTimeoutSource %d", autoConnectTimeoutSource);
+	if (mAutoConnDevMap.find(devAddress) != mAutoConnDevMap.end())
+		mReconnectScheduler.deviceLost(devAddress);
+}
 
-		mAutoConnDevMap[devAddress] = {autoConnectTimeoutSource, iter->second.second};
-	}
+bool Bluez5ProfileGatt::handleAutoConnAttempt(const std::string & address, Bluez5GattReconnectScheduler::ConnectResultCallback callback)
+{
+	auto iter = mAutoConnDevMap.find(address);
+	if (iter == mAutoConnDevMap.end())
+		return false;
+
+	Bluez5Device *device = mAdapter->findDevice(convertAddressToUpperCase(address));
+	if (!device)
+		return false;
+
+	uint16_t appId = iter->second;
+	auto gattConnCallBack = [address, appId, callback, this](BluetoothError error)
+	{
+		DEBUG("gattConnCallBack error : %d", error);
+		// The connection id of an auto connect device stays reserved
+		// until it is given up
+		mConnections.assign(appId, address);
+		callback(error == BLUETOOTH_ERROR_NONE);
+	};
+	DEBUG("Trigger reconnection connectGatt %s", address.c_str());
+	device->connectGatt(gattConnCallBack);
+	return true;
 }
 
 void Bluez5ProfileGatt::handleAutoConnTimeout(const std::string & address)
@@ -631,36 +895,39 @@ void Bluez5ProfileGatt::handleAutoConnTimeout(const std::string & address)
 	DEBUG("%s:%s", __FUNCTION__, address.c_str());
 	std::string devAddress = convertAddressToLowerCase(address);
 	auto iter = mAutoConnDevMap.find(devAddress);
-	if ((iter != mAutoConnDevMap.end()) && (iter->second.first != 0))
+	if (iter != mAutoConnDevMap.end())
 	{
-		mAutoConnDevMap.erase(devAddress);
-		mConnectedDevices.erase(iter->second.second);
+		mConnections.remove(iter->second);
+		mAutoConnDevMap.erase(iter);
 	}
 }
 
-gboolean Bluez5ProfileGatt::autoConnTimeoutHandler(gpointer user_data)
-{
-	DEBUG("%s", __FUNCTION__);
-	std::pair<std::string, Bluez5ProfileGatt*> *userData =
-		static_cast<std::pair<std::string, Bluez5ProfileGatt*>*>(user_data);
-	std::string address = userData->first;
-	Bluez5ProfileGatt *ptr = userData->second;
-	ptr->handleAutoConnTimeout(address);
-	return true;
-}
-
 void Bluez5ProfileGatt::handleAutoConnectReq(const bool& autoConnection, const std::string & address, const uint16_t& appId)
 {
 	DEBUG("%s:%s autoCon=%d, appId=%d", __FUNCTION__, address.c_str(), autoConnection, appId);
 	std::string devAddress = convertAddressToLowerCase(address);
-	auto iter = mAutoConnDevMap.find(devAddress);
-	if ((iter != mAutoConnDevMap.end()) && (iter->second.first != 0))
-		g_source_remove(iter->second.first);
 
 	if (autoConnection)
-		mAutoConnDevMap[devAddress] = {0, appId};
+	{
+		mAutoConnDevMap[devAddress] = appId;
+		mReconnectScheduler.addDevice(devAddress);
+		mReconnectScheduler.deviceConnected(devAddress);
+	}
 	else
+	{
 		mAutoConnDevMap.erase(devAddress);
+		mReconnectScheduler.removeDevice(devAddress);
+	}
+}
+
+void Bluez5ProfileGatt::setReconnectExpiry(uint32_t expiry)
+{
+	mReconnectScheduler.setExpiry(expiry);
+}
+
+bool Bluez5ProfileGatt::getReconnectStatistics(const std::string &address, GattReconnectStatistics &statistics) const
+{
+	return mReconnectScheduler.getStatistics(convertAddressToLowerCase(address), statistics);
 }
 
 void Bluez5ProfileGatt::connectGatt(const uint16_t & appId, bool autoConnection, const std::string & address, BluetoothConnectCallback callback)
@@ -676,17 +943,15 @@ void Bluez5ProfileGatt::connectGatt(const uint16_t & appId, bool autoConnection,
 	std::string deviceAddress = device->getAddress();
 	std::string lowerCaseAddress = convertAddressToLowerCase(deviceAddress);
 	uint16_t pAppId = appId;
-	for (auto connDev : mConnectedDevices)
+	uint16_t connId = mConnections.findConnId(lowerCaseAddress);
+	if (connId)
 	{
-		if (connDev.second == lowerCaseAddress)
+		pAppId = connId;
+		auto iter = mAutoConnDevMap.find(lowerCaseAddress);
+		if ((iter != mAutoConnDevMap.end()) && !mReconnectScheduler.isReconnecting(lowerCaseAddress))
 		{
-			pAppId = connDev.first;
-			auto iter = mAutoConnDevMap.find(lowerCaseAddress);
-			if ((iter != mAutoConnDevMap.end()) && (iter->second.first == 0))
-			{
-				callback(BLUETOOTH_ERROR_NONE, pAppId);
-				return;
-			}
+			callback(BLUETOOTH_ERROR_NONE, pAppId);
+			return;
 		}
 	}
 	auto isConnectCallback = [this, lowerCaseAddress, callback, pAppId, autoConnection](BluetoothError error) {
@@ -698,7 +963,7 @@ void Bluez5ProfileGatt::connectGatt(const uint16_t & appId, bool autoConnection,
 
 		handleAutoConnectReq(autoConnection, lowerCaseAddress, pAppId);
 
-		mConnectedDevices.insert({ pAppId, lowerCaseAddress});
+		mConnections.insert(pAppId, lowerCaseAddress);
 		callback(BLUETOOTH_ERROR_NONE, pAppId);
 	};
 	device->connectGatt(isConnectCallback);
@@ -707,16 +972,14 @@ void Bluez5ProfileGatt::connectGatt(const uint16_t & appId, bool autoConnection,
 void Bluez5ProfileGatt::disconnectGatt(const uint16_t &appId, const uint16_t &connectId, const std::string &address, BluetoothResultCallback callback)
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
-	std::string deviceAddress;
-	auto deviceInfo = mConnectedDevices.find(appId);
-	if (deviceInfo == mConnectedDevices.end())
+	const Bluez5GattConnectionTable::Connection *connection = mConnections.find(appId);
+	if (!connection)
 	{
 		callback(BLUETOOTH_ERROR_FAIL);
 		return;
 	}
-	deviceAddress = deviceInfo->second;
-
-	deviceAddress = convertAddressToUpperCase(deviceAddress);
+	std::string lowerCaseAddress = connection->address;
+	std::string deviceAddress = convertAddressToUpperCase(lowerCaseAddress);
 	Bluez5Device *device = mAdapter->findDevice(deviceAddress);
 	if (!device)
 	{
@@ -725,14 +988,15 @@ void Bluez5ProfileGatt::disconnectGatt(const uint16_t &appId, const uint16_t &co
 		return;
 	}
 
-	auto isDisconnectCallback = [this, deviceInfo, deviceAddress, appId, callback](BluetoothError error)
+	auto isDisconnectCallback = [this, lowerCaseAddress, deviceAddress, appId, callback](BluetoothError error)
 	{
 		if (error != BLUETOOTH_ERROR_NONE)
 		{
 			callback(error);
 			return;
 		}
-		mConnectedDevices.erase(deviceInfo);
+		removeNotificationSubscriber(appId, lowerCaseAddress);
+		mConnections.remove(appId);
 
 		GError *err = nullptr;
 		Bluez5Device *device = mAdapter->findDevice(deviceAddress);
@@ -745,6 +1009,7 @@ void Bluez5ProfileGatt::disconnectGatt(const uint16_t &appId, const uint16_t &co
 			}
 		}
 
+		removeAttributeCache(convertAddressToLowerCase(deviceAddress));
 		handleAutoConnectReq(false, deviceAddress, appId);
 
 		callback(BLUETOOTH_ERROR_NONE);
@@ -887,12 +1152,16 @@ void Bluez5ProfileGatt::registerLocalApplication(BluetoothResultCallback callbac
 			return;
 		}
 
+		mLocalApplicationRegistered = true;
 		callback(BLUETOOTH_ERROR_NONE);
 		return;
 	};
 
-	if (unRegisterFirst)
+	// Nothing to unregister before the application was registered once
+	if (unRegisterFirst && mLocalApplicationRegistered)
 	{
+		mLocalApplicationRegistered = false;
+
 		GError *error = NULL;
 		bluez_gatt_manager1_call_unregister_application_sync(mAdapter->getGattManager(), objPath.c_str(), NULL, &error);
 		if (error)
@@ -922,51 +1191,125 @@ void Bluez5ProfileGatt::discoverServices(BluetoothResultCallback callback)
 		callback(BLUETOOTH_ERROR_FAIL);
 }
 
-void Bluez5ProfileGatt::updateRemoteDeviceServices()
+void Bluez5ProfileGatt::updateRemoteDeviceServices(const std::string &address)
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
 
-	if (mRemoteDeviceServicesMap.size())
-		mRemoteDeviceServicesMap.clear();
-
-	for (auto &deviceServicesIter : mDeviceServicesMap)
+	// Only the public view of the given device is rebuilt, the other devices
+	// are left untouched so the cost does not grow with the connected devices.
+	auto deviceServicesIter = mDeviceServicesMap.find(address);
+	if (deviceServicesIter == mDeviceServicesMap.end())
 	{
-		auto &servicesList = deviceServicesIter.second;
-		BluetoothGattServiceList serviceList;
+		mRemoteDeviceServicesMap.erase(address);
+		return;
+	}
 
-		std::for_each(servicesList.begin(), servicesList.end(),
-					  [&serviceList](GattRemoteService* devService)
-		{
-			serviceList.push_back(devService->service);
-		});
+	auto &servicesList = deviceServicesIter->second;
+	BluetoothGattServiceList &serviceList = mRemoteDeviceServicesMap[address];
+	serviceList.clear();
+	serviceList.reserve(servicesList.size());
 
-		mRemoteDeviceServicesMap[deviceServicesIter.first] = serviceList;
-	}
+	for (auto devService : servicesList)
+		serviceList.push_back(devService->service);
+}
+
+void Bluez5ProfileGatt::updateRemoteService(GattRemoteService *service)
+{
+	// Resolving builds the public view once all attributes are there
+	if (mResolvingServices)
+		return;
+
+	auto deviceIter = mRemoteDeviceServicesMap.find(service->deviceAddress);
+	auto deviceServicesIter = mDeviceServicesMap.find(service->deviceAddress);
+	if (deviceIter == mRemoteDeviceServicesMap.end() || deviceServicesIter == mDeviceServicesMap.end())
+		return;
 
+	auto &servicesList = deviceServicesIter->second;
+	size_t index = std::find(servicesList.begin(), servicesList.end(), service) - servicesList.begin();
+	if (index < deviceIter->second.size() && deviceIter->second.size() == servicesList.size())
+		deviceIter->second[index] = service->service;
+	else
+		updateRemoteDeviceServices(service->deviceAddress);
 }
 
-void Bluez5ProfileGatt::discoverServices(const std::string &address, BluetoothResultCallback callback)
+void Bluez5ProfileGatt::removeServiceDescriptor(GattRemoteService *service, size_t characteristicIndex,
+                                                size_t descriptorIndex)
 {
-	DEBUG("%s::%s",__FILE__,__FUNCTION__);
-	if (mRemoteDeviceServicesMap.size())
-		mRemoteDeviceServicesMap.clear();
+	BluetoothGattCharacteristicList serviceCharacteristicList = service->service.getCharacteristics();
+	if (characteristicIndex >= serviceCharacteristicList.size())
+		return;
 
-	auto deviceServicesIter = mDeviceServicesMap.find(address);
-	if (deviceServicesIter != mDeviceServicesMap.end())
+	// Characteristics can only gain descriptors, so rebuild it without the removed one
+	BluetoothGattCharacteristic &characteristic = serviceCharacteristicList[characteristicIndex];
+	BluetoothGattCharacteristic updated;
+	updated.setUuid(characteristic.getUuid());
+	updated.setProperties(characteristic.getProperties());
+	updated.setPermissions(characteristic.getPermissions());
+	updated.setValue(characteristic.getValue());
+
+	BluetoothGattDescriptorList descriptors = characteristic.getDescriptors();
+	for (size_t n = 0; n < descriptors.size(); n++)
 	{
-		auto &servicesList = deviceServicesIter->second;
-		BluetoothGattServiceList serviceList;
+		if (n != descriptorIndex)
+			updated.addDescriptor(descriptors[n]);
+	}
+
+	characteristic = updated;
+	service->service.setCharacteristics(serviceCharacteristicList);
+}
+
+void Bluez5ProfileGatt::updateRemoteCharacteristicValue(const std::string &address, const BluetoothUuid &service,
+                                                        const BluetoothUuid &characteristic, const BluetoothGattValue &value)
+{
+	auto deviceIter = mRemoteDeviceServicesMap.find(address);
+	if (deviceIter == mRemoteDeviceServicesMap.end())
+	{
+		updateRemoteDeviceServices(address);
+		return;
+	}
 
-		std::for_each(servicesList.begin(), servicesList.end(),
-					  [&serviceList](GattRemoteService* devService)
+	for (auto &remoteService : deviceIter->second)
+	{
+		if (remoteService.getUuid() == service)
 		{
-			serviceList.push_back(devService->service);
-		});
+			remoteService.updateCharacteristicValue(characteristic, value);
+			return;
+		}
+	}
+
+	updateRemoteDeviceServices(address);
+}
 
-		mRemoteDeviceServicesMap[deviceServicesIter->first] = serviceList;
+void Bluez5ProfileGatt::updateRemoteDescriptorValue(const std::string &address, const BluetoothUuid &service,
+                                                    const BluetoothUuid &characteristic, const BluetoothUuid &descriptor,
+                                                    const BluetoothGattValue &value)
+{
+	auto deviceIter = mRemoteDeviceServicesMap.find(address);
+	if (deviceIter == mRemoteDeviceServicesMap.end())
+	{
+		updateRemoteDeviceServices(address);
+		return;
 	}
 
-	if (mRemoteDeviceServicesMap.size())
+	for (auto &remoteService : deviceIter->second)
+	{
+		if (remoteService.getUuid() == service)
+		{
+			remoteService.updateDescriptorValue(characteristic, descriptor, value);
+			return;
+		}
+	}
+
+	updateRemoteDeviceServices(address);
+}
+
+void Bluez5ProfileGatt::discoverServices(const std::string &address, BluetoothResultCallback callback)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	updateRemoteDeviceServices(address);
+
+	if (mRemoteDeviceServicesMap.find(address) != mRemoteDeviceServicesMap.end())
 		callback(BLUETOOTH_ERROR_NONE);
 	else
 		callback(BLUETOOTH_ERROR_FAIL);
@@ -993,7 +1336,9 @@ void Bluez5ProfileGatt::writeDescriptor(const std::string &address, const Blueto
 			remoteService->service.updateDescriptorValue(remoteChar->characteristic.getUuid(),
 														 descriptor.getUuid(),
 														 descriptor.getValue());
-			updateRemoteDeviceServices();
+			updateRemoteDescriptorValue(remoteService->deviceAddress, remoteService->service.getUuid(),
+										remoteChar->characteristic.getUuid(), descriptor.getUuid(),
+										descriptor.getValue());
 			callback(BLUETOOTH_ERROR_NONE);
 			return;
 		}
@@ -1007,11 +1352,17 @@ BluetoothGattService Bluez5ProfileGatt::getService(const std::string &address, c
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
 	std::string lowerCaseAddress = convertAddressToLowerCase(address);
 
+	const BluetoothGattServiceList *services = nullptr;
 	auto deviceIter = mRemoteDeviceServicesMap.find(lowerCaseAddress);
-	if (deviceIter == mRemoteDeviceServicesMap.end())
+	if (deviceIter != mRemoteDeviceServicesMap.end())
+		services = &deviceIter->second;
+	else
+		services = getCachedDeviceServices(lowerCaseAddress);
+
+	if (!services)
 		return BluetoothGattService();
 
-	for (auto service : deviceIter->second)
+	for (auto &service : *services)
 	{
 		if (service.getUuid() == uuid)
 			return service;
@@ -1027,38 +1378,125 @@ BluetoothGattServiceList Bluez5ProfileGatt::getServices(const std::string &addre
 	std::string lowerCaseAddress = convertAddressToLowerCase(address);
 
 	auto deviceIter = mRemoteDeviceServicesMap.find(lowerCaseAddress);
-	if (deviceIter == mRemoteDeviceServicesMap.end())
-		return BluetoothGattServiceList();
+	if (deviceIter != mRemoteDeviceServicesMap.end())
+		return deviceIter->second;
+
+	// Until BlueZ has exported the attributes of a reconnected bonded device
+	// answer from the service tree we saw on the previous connection.
+	const BluetoothGattServiceList *cachedServices = getCachedDeviceServices(lowerCaseAddress);
+	if (cachedServices)
+		return *cachedServices;
 
-	return deviceIter->second;
+	return BluetoothGattServiceList();
 }
 
-void Bluez5ProfileGatt::readCharacteristic(const uint16_t &connId, const BluetoothUuid& service,
-									 const BluetoothUuid &characteristics,
-									 BluetoothGattReadCharacteristicCallback callback)
+const BluetoothGattServiceList* Bluez5ProfileGatt::getCachedDeviceServices(const std::string &address)
 {
-	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+	Bluez5Device *device = mAdapter->findDevice(convertAddressToUpperCase(address));
+	if (!device || !device->getPaired() || !device->getConnected())
+		return nullptr;
 
-	BluetoothGattCharacteristic readCharacteristicValue;
-	std::string deviceAddress = getAddress(connId);
-	if (deviceAddress.empty())
-	{
-		callback(BLUETOOTH_ERROR_FAIL, readCharacteristicValue);
-		return;
-	}
+	auto cachedIter = mCachedDeviceServicesMap.find(address);
+	if (cachedIter != mCachedDeviceServicesMap.end())
+		return &cachedIter->second.services;
 
-	readCharacteristicValue = readCharacteristic(deviceAddress, service, characteristics);
-	if (readCharacteristicValue.isValid())
-		callback(BLUETOOTH_ERROR_NONE, readCharacteristicValue);
-	else
-		callback(BLUETOOTH_ERROR_FAIL, readCharacteristicValue);
+	CachedDeviceServices cached;
+	if (!mAttributeCache.load(address, cached.services, cached.hash))
+		return nullptr;
+
+	DEBUG("Loaded %zu cached GATT services for %s", cached.services.size(), address.c_str());
+	auto result = mCachedDeviceServicesMap.insert({ address, std::move(cached) });
+	return &result.first->second.services;
 }
 
-void Bluez5ProfileGatt::readCharacteristics(const uint16_t &connId, const BluetoothUuid& service,
-									 const BluetoothUuidList &characteristics,
-									 BluetoothGattReadCharacteristicsCallback callback)
+void Bluez5ProfileGatt::storeAttributeCache(const std::string &address)
 {
-	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+	Bluez5Device *device = mAdapter->findDevice(convertAddressToUpperCase(address));
+	if (!device || !device->getPaired())
+		return;
+
+	auto deviceIter = mRemoteDeviceServicesMap.find(address);
+	if (deviceIter == mRemoteDeviceServicesMap.end())
+		return;
+
+	mAttributeCacheStored.insert(address);
+
+	GattDatabaseHash hash = Bluez5GattCache::computeHash(deviceIter->second);
+
+	auto cachedIter = mCachedDeviceServicesMap.find(address);
+	if (cachedIter != mCachedDeviceServicesMap.end() && cachedIter->second.hash == hash)
+		return;
+
+	if (mAttributeCache.store(address, deviceIter->second, hash))
+		mCachedDeviceServicesMap[address] = { Bluez5GattCache::withoutValues(deviceIter->second), hash };
+}
+
+void Bluez5ProfileGatt::validateAttributeCache(const std::string &address)
+{
+	Bluez5Device *device = mAdapter->findDevice(convertAddressToUpperCase(address));
+	if (!device || !device->getPaired())
+		return;
+
+	auto deviceIter = mRemoteDeviceServicesMap.find(address);
+	if (deviceIter == mRemoteDeviceServicesMap.end())
+		return;
+
+	// Load the copy on disk if nothing asked for it while BlueZ was resolving
+	if (!getCachedDeviceServices(address))
+		return;
+
+	auto cachedIter = mCachedDeviceServicesMap.find(address);
+	GattDatabaseHash hash = Bluez5GattCache::computeHash(deviceIter->second);
+	if (cachedIter->second.hash == hash)
+		return;
+
+	// The device changed its database since the cache was written, replace
+	// the stale copy so the next reconnection does not report it.
+	DEBUG("Cached GATT services of %s changed, updating the cache", address.c_str());
+	if (mAttributeCache.store(address, deviceIter->second, hash))
+	{
+		cachedIter->second = { Bluez5GattCache::withoutValues(deviceIter->second), hash };
+	}
+	else
+	{
+		mCachedDeviceServicesMap.erase(cachedIter);
+		mAttributeCache.remove(address);
+	}
+}
+
+void Bluez5ProfileGatt::removeAttributeCache(const std::string &address)
+{
+	mCachedDeviceServicesMap.erase(address);
+	mAttributeCacheStored.erase(address);
+	mAttributeCache.remove(address);
+}
+
+void Bluez5ProfileGatt::readCharacteristic(const uint16_t &connId, const BluetoothUuid& service,
+									 const BluetoothUuid &characteristics,
+									 BluetoothGattReadCharacteristicCallback callback)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	BluetoothGattCharacteristic readCharacteristicValue;
+	std::string deviceAddress = getAddress(connId);
+	if (deviceAddress.empty())
+	{
+		callback(BLUETOOTH_ERROR_FAIL, readCharacteristicValue);
+		return;
+	}
+
+	readCharacteristicValue = readCharacteristic(deviceAddress, service, characteristics);
+	if (readCharacteristicValue.isValid())
+		callback(BLUETOOTH_ERROR_NONE, readCharacteristicValue);
+	else
+		callback(BLUETOOTH_ERROR_FAIL, readCharacteristicValue);
+}
+
+void Bluez5ProfileGatt::readCharacteristics(const uint16_t &connId, const BluetoothUuid& service,
+									 const BluetoothUuidList &characteristics,
+									 BluetoothGattReadCharacteristicsCallback callback)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
 
 	BluetoothGattCharacteristicList serviceCharacteristicList;
 	bool found = false;
@@ -1100,8 +1538,10 @@ void Bluez5ProfileGatt::writeCharacteristic(const uint16_t &connId, const Blueto
 	{
 		if (remoteChar->writeValue(characteristic.getValue()))
 		{
+			remoteChar->invalidateCachedValue();
 			remoteService->service.updateCharacteristicValue(characteristic.getUuid(), characteristic.getValue());
-			updateRemoteDeviceServices();
+			updateRemoteCharacteristicValue(remoteService->deviceAddress, service,
+											characteristic.getUuid(), characteristic.getValue());
 			getGattObserver()->characteristicValueChanged(deviceAddress, service, characteristic, convertAddressToLowerCase(mAdapter->getAddress()));
 			callback(BLUETOOTH_ERROR_NONE);
 			return;
@@ -1179,7 +1619,9 @@ void Bluez5ProfileGatt::writeDescriptor(const uint16_t &connId, const BluetoothU
 			remoteService->service.updateDescriptorValue(remoteChar->characteristic.getUuid(),
 														 descriptor.getUuid(),
 														 descriptor.getValue());
-			updateRemoteDeviceServices();
+			updateRemoteDescriptorValue(remoteService->deviceAddress, remoteService->service.getUuid(),
+										remoteChar->characteristic.getUuid(), descriptor.getUuid(),
+										descriptor.getValue());
 			callback(BLUETOOTH_ERROR_NONE);
 			return;
 		}
@@ -1192,43 +1634,179 @@ void Bluez5ProfileGatt::changeCharacteristicWatchStatus(const std::string &addre
 										BluetoothResultCallback callback)
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
-	bool result = false;
-	auto deviceServicesIter = mDeviceServicesMap.find(address);
 
-	if (deviceServicesIter == mDeviceServicesMap.end())
+	if (mDeviceServicesMap.find(address) == mDeviceServicesMap.end())
 	{
 		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Device is not connected");
 		callback(BLUETOOTH_ERROR_FAIL);
 		return;
 	}
 
-	auto &servicesList = deviceServicesIter->second;
-	for (auto serviceIt : servicesList)
+	GattRemoteService* remoteService = findService(address, service);
+	GattRemoteCharacteristic* remoteChar = remoteService ? findCharacteristic(remoteService, characteristic) : nullptr;
+	if (!remoteChar)
 	{
-		if (serviceIt->service.getUuid() == service)
-		{
-			for (auto charIt = serviceIt->gattRemoteCharacteristics.begin(); charIt != serviceIt->gattRemoteCharacteristics.end(); charIt++)
+		callback(BLUETOOTH_ERROR_FAIL);
+		return;
+	}
+
+	changeNotificationSubscription(GattNotificationSubscription::ADDRESS_SUBSCRIBER, remoteChar, enabled, callback);
+}
+
+void Bluez5ProfileGatt::changeCharacteristicWatchStatus(const uint16_t &connId, const BluetoothUuid &service,
+										const BluetoothUuid &characteristic, bool enabled,
+										BluetoothResultCallback callback)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	std::string address = getAddress(connId);
+	GattRemoteService* remoteService = address.empty() ? nullptr : findService(address, service);
+	GattRemoteCharacteristic* remoteChar = remoteService ? findCharacteristic(remoteService, characteristic) : nullptr;
+	if (!remoteChar)
+	{
+		callback(BLUETOOTH_ERROR_FAIL);
+		return;
+	}
+
+	changeNotificationSubscription(connId, remoteChar, enabled, callback);
+}
+
+void Bluez5ProfileGatt::changeNotificationSubscription(uint32_t subscriber, GattRemoteCharacteristic *characteristic, bool enabled,
+                                                       BluetoothResultCallback callback)
+{
+	GattNotificationSubscription *subscription = getNotificationSubscription(characteristic);
+	if (!subscription)
+	{
+		callback(BLUETOOTH_ERROR_FAIL);
+		return;
+	}
+
+	if (enabled)
+	{
+		subscription->subscribers[subscriber]++;
+
+		if (subscription->notifyState != GattNotificationSubscription::NOTIFY_STARTED)
+			subscription->pendingEnables.push_back(std::make_pair(subscriber, callback));
+		else
+			callback(BLUETOOTH_ERROR_NONE);
+	}
+	else
+	{
+		auto subscriberIter = subscription->subscribers.find(subscriber);
+		if (subscriberIter != subscription->subscribers.end() && --subscriberIter->second == 0)
+			subscription->subscribers.erase(subscriberIter);
+
+		callback(BLUETOOTH_ERROR_NONE);
+	}
+
+	updateNotifyState(characteristic);
+}
+
+void Bluez5ProfileGatt::updateNotifyState(GattRemoteCharacteristic *characteristic)
+{
+	GattNotificationSubscription *subscription = characteristic->notificationSubscription.get();
+	bool subscribed = !subscription->subscribers.empty();
+	std::string objectPath = characteristic->objectPath;
+
+	if (subscribed && subscription->notifyState == GattNotificationSubscription::NOTIFY_STOPPED)
+	{
+		subscription->notifyState = GattNotificationSubscription::NOTIFY_STARTING;
+
+		auto startNotifyCallback = [this, objectPath](BluetoothError error) {
+			// The characteristic may have disappeared while the call was pending
+			GattRemoteCharacteristic *characteristic = findRemoteCharacteristic(objectPath);
+			if (!characteristic || !characteristic->notificationSubscription)
+				return;
+
+			GattNotificationSubscription *subscription = characteristic->notificationSubscription.get();
+			subscription->notifyState = (error == BLUETOOTH_ERROR_NONE) ?
+			                            GattNotificationSubscription::NOTIFY_STARTED : GattNotificationSubscription::NOTIFY_STOPPED;
+
+			std::vector<std::pair<uint32_t, BluetoothResultCallback>> pendingEnables;
+			pendingEnables.swap(subscription->pendingEnables);
+
+			for (auto &pending : pendingEnables)
 			{
-				if ((*charIt)->characteristic.getUuid() == characteristic)
+				if (error != BLUETOOTH_ERROR_NONE)
 				{
-					if (enabled)
-					{
-						result = (*charIt)->startNotify();
-					}
-					else
-					{
-						result = (*charIt)->stopNotify();
-					}
-					break;
+					auto subscriberIter = subscription->subscribers.find(pending.first);
+					if (subscriberIter != subscription->subscribers.end() && --subscriberIter->second == 0)
+						subscription->subscribers.erase(subscriberIter);
 				}
+				pending.second(error);
 			}
+
+			// Everybody may have unsubscribed again in the meantime
+			updateNotifyState(characteristic);
+		};
+		characteristic->startNotify(startNotifyCallback);
+	}
+	else if (!subscribed && subscription->notifyState == GattNotificationSubscription::NOTIFY_STARTED)
+	{
+		subscription->notifyState = GattNotificationSubscription::NOTIFY_STOPPING;
+
+		auto stopNotifyCallback = [this, objectPath](BluetoothError error) {
+			GattRemoteCharacteristic *characteristic = findRemoteCharacteristic(objectPath);
+			if (!characteristic || !characteristic->notificationSubscription)
+				return;
+
+			// Even when StopNotify failed there is nothing left to stop, BlueZ
+			// only fails it when the notify session is already gone.
+			characteristic->notificationSubscription->notifyState = GattNotificationSubscription::NOTIFY_STOPPED;
+			updateNotifyState(characteristic);
+		};
+		characteristic->stopNotify(stopNotifyCallback);
+	}
+}
+
+void Bluez5ProfileGatt::removeNotificationSubscriber(uint16_t connId, const std::string &address)
+{
+	mNotificationHandlers.erase(connId);
+
+	auto deviceServicesIter = mDeviceServicesMap.find(address);
+	if (deviceServicesIter == mDeviceServicesMap.end())
+		return;
+
+	for (auto service : deviceServicesIter->second)
+	{
+		for (auto characteristic : service->gattRemoteCharacteristics)
+		{
+			GattNotificationSubscription *subscription = characteristic->notificationSubscription.get();
+			if (!subscription || !subscription->subscribers.erase(connId))
+				continue;
+
+			// Other clients may keep the device connected, so the notify
+			// session is stopped once the last subscriber went. If BlueZ
+			// dropped it with the connection already StopNotify just fails.
+			updateNotifyState(characteristic);
 		}
 	}
+}
 
-	if (result)
-		callback(BLUETOOTH_ERROR_NONE);
+void Bluez5ProfileGatt::setNotificationHandler(uint16_t connId, GattNotificationHandler handler)
+{
+	if (handler)
+		mNotificationHandlers[connId] = handler;
 	else
-		callback(BLUETOOTH_ERROR_FAIL);
+		mNotificationHandlers.erase(connId);
+}
+
+GattRemoteCharacteristic* Bluez5ProfileGatt::findRemoteCharacteristic(const std::string &characteristicObjectPath)
+{
+	std::string serviceObjectPath, characteristicName;
+	splitInPathAndName(characteristicObjectPath, serviceObjectPath, characteristicName);
+
+	GattRemoteService* service = getRemoteGattService(serviceObjectPath);
+	if (!service)
+		return nullptr;
+
+	for (auto characteristic : service->gattRemoteCharacteristics)
+	{
+		if (characteristic->objectPath == characteristicObjectPath)
+			return characteristic;
+	}
+
+	return nullptr;
 }
 
 void Bluez5ProfileGatt::readCharacteristic(const std::string &address, const BluetoothUuid& service,
@@ -1276,8 +1854,10 @@ void Bluez5ProfileGatt::writeCharacteristic(const std::string &address, const Bl
 	{
 		if (remoteChar->writeValue(characteristic.getValue()))
 		{
+			remoteChar->invalidateCachedValue();
 			remoteService->service.updateCharacteristicValue(characteristic.getUuid(), characteristic.getValue());
-			updateRemoteDeviceServices();
+			updateRemoteCharacteristicValue(remoteService->deviceAddress, service,
+											characteristic.getUuid(), characteristic.getValue());
 			getGattObserver()->characteristicValueChanged(address, service, characteristic, convertAddressToLowerCase(mAdapter->getAddress()));
 			callback(BLUETOOTH_ERROR_NONE);
 			return;
@@ -1286,102 +1866,475 @@ void Bluez5ProfileGatt::writeCharacteristic(const std::string &address, const Bl
 	callback(BLUETOOTH_ERROR_FAIL);
 }
 
-void Bluez5ProfileGatt::readDescriptor(const std::string &address, const BluetoothUuid& service, const BluetoothUuid &characteristic,
-								 const BluetoothUuid &descriptor, BluetoothGattReadDescriptorCallback callback)
+void Bluez5ProfileGatt::readLongCharacteristic(const std::string &address, const BluetoothUuid &service, const BluetoothUuid &characteristic,
+                                               BluetoothGattReadCharacteristicCallback callback, GattProgressCallback progress)
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
 
-	BluetoothGattDescriptor readDescriptorValue;
+	std::string lowerCaseAddress = convertAddressToLowerCase(address);
+	GattRemoteService* remoteService = findService(lowerCaseAddress, service);
+	GattRemoteCharacteristic* remoteChar = remoteService ? findCharacteristic(remoteService, characteristic) : nullptr;
 
-	readDescriptorValue = readDescriptor(address, service, characteristic, descriptor);
-	if (readDescriptorValue.isValid())
-		callback(BLUETOOTH_ERROR_NONE, readDescriptorValue);
-	else
-		callback(BLUETOOTH_ERROR_FAIL, readDescriptorValue);
-}
+	if (!remoteChar || !remoteChar->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_READ))
+	{
+		callback(BLUETOOTH_ERROR_FAIL, BluetoothGattCharacteristic());
+		return;
+	}
 
-void Bluez5ProfileGatt::readDescriptors(const std::string &address, const BluetoothUuid& service, const BluetoothUuid &characteristic,
-						const BluetoothUuidList &descriptors, BluetoothGattReadDescriptorsCallback callback)
-{
-	DEBUG("%s::%s",__FILE__,__FUNCTION__);
-	BluetoothGattDescriptorList characteristicDescriptorList;
-	bool found = false;
+	std::string objectPath = remoteChar->objectPath;
 
-	characteristicDescriptorList = readDescriptors(address, service, characteristic, descriptors, found);
-	if (found)
-		callback(BLUETOOTH_ERROR_NONE, characteristicDescriptorList);
-	else
-		callback(BLUETOOTH_ERROR_FAIL, characteristicDescriptorList);
+	// BlueZ continues with Read Blob Requests on its own when the first
+	// response fills the MTU, a single ReadValue returns the whole value.
+	// Reading on from the end offset ourselves would fail with Invalid
+	// Offset for values that are a multiple of the chunk size.
+	auto readValue = [this, lowerCaseAddress, objectPath, service, callback, progress](Bluez5GattRequestQueue::CompletionCallback done)
+	{
+		GattRemoteCharacteristic *remoteChar = findRemoteCharacteristic(objectPath);
+		if (!remoteChar)
+		{
+			done();
+			callback(BLUETOOTH_ERROR_FAIL, BluetoothGattCharacteristic());
+			return;
+		}
+
+		if (progress)
+			progress(0, 0);
+
+		remoteChar->readValue(0, [this, lowerCaseAddress, objectPath, service, callback, progress, done](bool success, const BluetoothGattValue &value)
+		{
+			done();
+
+			GattRemoteCharacteristic *remoteChar = success ? findRemoteCharacteristic(objectPath) : nullptr;
+			if (!remoteChar)
+			{
+				callback(BLUETOOTH_ERROR_FAIL, BluetoothGattCharacteristic());
+				return;
+			}
+
+			if (progress)
+				progress(value.size(), value.size());
+
+			remoteChar->cacheValue(value);
+			updateRemoteCharacteristicValue(lowerCaseAddress, service, remoteChar->characteristic.getUuid(), value);
+			callback(BLUETOOTH_ERROR_NONE, remoteChar->characteristic);
+		});
+	};
+
+	auto cancelRead = [callback]()
+	{
+		callback(BLUETOOTH_ERROR_FAIL, BluetoothGattCharacteristic());
+	};
+
+	mRequestQueue.push(lowerCaseAddress, readValue, cancelRead);
 }
 
-uint16_t Bluez5ProfileGatt::getConnectId(const std::string &address)
+void Bluez5ProfileGatt::writeLongCharacteristic(const std::string &address, const BluetoothUuid &service,
+                                                const BluetoothGattCharacteristic &characteristic,
+                                                BluetoothResultCallback callback, GattProgressCallback progress,
+                                                bool reliable)
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
 	std::string lowerCaseAddress = convertAddressToLowerCase(address);
+	GattRemoteService* remoteService = findService(lowerCaseAddress, service);
+	GattRemoteCharacteristic* remoteChar = remoteService ? findCharacteristic(remoteService, characteristic.getUuid()) : nullptr;
 
-	for ( auto it = mConnectedDevices.begin(); it != mConnectedDevices.end(); ++it )
+	if (!remoteChar || !remoteChar->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_WRITE))
 	{
-		if (lowerCaseAddress == it->second)
-		{
-			return it->first;
-		}
+		callback(BLUETOOTH_ERROR_FAIL);
+		return;
 	}
-	return 0;
-}
 
-std::string Bluez5ProfileGatt::getAddress(const uint16_t &connId)
-{
-	DEBUG("%s::%s",__FILE__,__FUNCTION__);
-	std::string deviceAddress;
-	if (mConnectedDevices.find(connId) == mConnectedDevices.end())
+	const BluetoothGattValue &value = characteristic.getValue();
+	if (value.size() > GATT_MAX_ATTRIBUTE_VALUE_LENGTH)
 	{
-		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Device not connected");
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Value of %zu bytes is too long to be written", value.size());
+		callback(BLUETOOTH_ERROR_PARAM_INVALID);
+		return;
 	}
-	else
+
+	// The whole value goes out in one WriteValue. BlueZ switches to Prepare
+	// and Execute Write Requests itself when it does not fit into the MTU,
+	// so the peripheral sees one long write instead of a write per chunk.
+	// A reliable write also has every prepared part checked against its
+	// echo before the write is executed.
+	std::string objectPath = remoteChar->objectPath;
+	uint32_t total = value.size();
+
+	auto writeValue = [this, lowerCaseAddress, objectPath, service, characteristic, total, callback, progress, reliable](Bluez5GattRequestQueue::CompletionCallback done)
 	{
-		deviceAddress = mConnectedDevices.find(connId)->second;
-	}
-	return deviceAddress;
-}
+		GattRemoteCharacteristic *remoteChar = findRemoteCharacteristic(objectPath);
+		if (!remoteChar)
+		{
+			done();
+			callback(BLUETOOTH_ERROR_FAIL);
+			return;
+		}
 
-BluetoothGattCharacteristic Bluez5ProfileGatt::readCharacteristic(const std::string &address, const BluetoothUuid& service,
-									 const BluetoothUuid &characteristic)
-{
-	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+		if (progress)
+			progress(0, total);
 
-	BluetoothGattCharacteristic readCharacteristicValue;
+		remoteChar->writeValue(characteristic.getValue(), 0, [this, lowerCaseAddress, service, characteristic, total, callback, progress, done](BluetoothError error)
+		{
+			done();
 
-	GattRemoteService* remoteService = findService(address, service);
-	if (!remoteService)
+			if (error != BLUETOOTH_ERROR_NONE)
+			{
+				callback(BLUETOOTH_ERROR_FAIL);
+				return;
+			}
+
+			if (progress)
+				progress(total, total);
+
+			completeCharacteristicWrite(lowerCaseAddress, service, characteristic);
+			callback(BLUETOOTH_ERROR_NONE);
+		}, reliable);
+	};
+
+	auto cancelWrite = [callback]()
 	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "remote GATT service object is null");
-		return readCharacteristicValue;
-	}
-	GattRemoteCharacteristic* remoteChar = findCharacteristic(remoteService, characteristic);
-	if (remoteChar && remoteChar->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_READ))
-		readCharacteristicValue = readCharValue(remoteService, remoteChar, characteristic);
-	return readCharacteristicValue;
+		callback(BLUETOOTH_ERROR_FAIL);
+	};
+
+	mRequestQueue.push(lowerCaseAddress, writeValue, cancelWrite);
 }
 
-BluetoothGattCharacteristicList Bluez5ProfileGatt::readCharacteristics(const std::string &address, const BluetoothUuid& service,
-									const BluetoothUuidList &characteristics, bool &found)
+void Bluez5ProfileGatt::writeCharacteristics(const std::string &address, const std::vector<GattCharacteristicWrite> &writes,
+                                             bool reliable, BluetoothResultCallback callback)
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
 
-	BluetoothGattCharacteristicList serviceCharacteristicList;
-	BluetoothGattCharacteristicList result;
-	GattRemoteService* remoteService = findService(address, service);
-	if (!remoteService)
+	std::string lowerCaseAddress = convertAddressToLowerCase(address);
+	if (writes.empty())
 	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "remote GATT service object is null");
-		return result;
+		callback(BLUETOOTH_ERROR_PARAM_INVALID);
+		return;
 	}
 
-	serviceCharacteristicList =  remoteService->service.getCharacteristics();
-
-	for (auto &currentCharacteristic : characteristics)
+	// Every target is checked before the first write goes out so a bad
+	// entry cannot leave the device half configured. A reliable write needs
+	// a write request the peer echoes, which it has to declare support for.
+	std::vector<std::string> objectPaths;
+	objectPaths.reserve(writes.size());
+	for (auto &write : writes)
 	{
-		found = false;
+		GattRemoteService* remoteService = findService(lowerCaseAddress, write.service);
+		GattRemoteCharacteristic* remoteChar = remoteService ? findCharacteristic(remoteService, write.characteristic.getUuid()) : nullptr;
+
+		bool writable = false;
+		if (remoteChar && reliable)
+			writable = remoteChar->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_WRITE) &&
+			           remoteChar->supportsReliableWrite();
+		else if (remoteChar)
+			writable = remoteChar->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_WRITE) ||
+			           remoteChar->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_WRITE_WITHOUT_RESPONSE);
+
+		if (!writable)
+		{
+			ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Characteristic %s of service %s can't be written%s",
+			      write.characteristic.getUuid().toString().c_str(), write.service.toString().c_str(), reliable ? " reliably" : "");
+			callback(BLUETOOTH_ERROR_PARAM_INVALID);
+			return;
+		}
+
+		objectPaths.push_back(remoteChar->objectPath);
+	}
+
+	std::shared_ptr<WriteTransaction> transaction = std::make_shared<WriteTransaction>();
+	transaction->address = lowerCaseAddress;
+	transaction->writes = writes;
+	transaction->objectPaths = objectPaths;
+	transaction->written.resize(writes.size(), false);
+	transaction->outstanding = writes.size();
+	transaction->reliable = reliable;
+	transaction->failed = false;
+	transaction->callback = callback;
+
+	// The transaction takes a single slot of the request queue. Plain writes
+	// are all handed to BlueZ at once so they are pipelined on the link. A
+	// reliable transaction goes one write after the other and stops at the
+	// first failure, BlueZ can't execute prepared writes of several
+	// characteristics at once.
+	auto writeAll = [this, transaction](Bluez5GattRequestQueue::CompletionCallback done)
+	{
+		transaction->done = done;
+
+		if (transaction->reliable)
+		{
+			writeTransactionValue(transaction, 0);
+			return;
+		}
+
+		for (size_t n = 0; n < transaction->writes.size(); n++)
+			writeTransactionValue(transaction, n);
+	};
+
+	auto cancel = [callback]()
+	{
+		callback(BLUETOOTH_ERROR_FAIL);
+	};
+
+	mRequestQueue.push(lowerCaseAddress, writeAll, cancel);
+}
+
+void Bluez5ProfileGatt::writeTransactionValue(const std::shared_ptr<WriteTransaction> &transaction, size_t index)
+{
+	GattRemoteCharacteristic *remoteChar = findRemoteCharacteristic(transaction->objectPaths[index]);
+	if (!remoteChar)
+	{
+		onTransactionValueWritten(transaction, index, false);
+		return;
+	}
+
+	remoteChar->writeValue(transaction->writes[index].characteristic.getValue(), 0, [this, transaction, index](BluetoothError error)
+	{
+		onTransactionValueWritten(transaction, index, error == BLUETOOTH_ERROR_NONE);
+	}, transaction->reliable);
+}
+
+void Bluez5ProfileGatt::onTransactionValueWritten(const std::shared_ptr<WriteTransaction> &transaction, size_t index, bool success)
+{
+	if (success)
+		transaction->written[index] = true;
+	else
+		transaction->failed = true;
+
+	if (transaction->reliable)
+	{
+		if (!transaction->failed && index + 1 < transaction->writes.size())
+			writeTransactionValue(transaction, index + 1);
+		else
+			finishWriteTransaction(transaction);
+		return;
+	}
+
+	if (!--transaction->outstanding)
+		finishWriteTransaction(transaction);
+}
+
+void Bluez5ProfileGatt::finishWriteTransaction(const std::shared_ptr<WriteTransaction> &transaction)
+{
+	transaction->done();
+
+	// Whatever reached the device is reflected in the service tree, even if
+	// the transaction as a whole failed. The observer only hears about it
+	// once, with the last value of every characteristic.
+	std::vector<GattCharacteristicWrite> written;
+	for (size_t n = 0; n < transaction->writes.size(); n++)
+	{
+		if (!transaction->written[n])
+			continue;
+
+		const GattCharacteristicWrite &write = transaction->writes[n];
+		completeCharacteristicWrite(transaction->address, write.service, write.characteristic, false);
+
+		auto writtenIter = std::find_if(written.begin(), written.end(), [&write](const GattCharacteristicWrite &other) {
+			return other.service == write.service && other.characteristic.getUuid() == write.characteristic.getUuid();
+		});
+		if (writtenIter != written.end())
+			writtenIter->characteristic = write.characteristic;
+		else
+			written.push_back(write);
+	}
+
+	std::string adapterAddress = convertAddressToLowerCase(mAdapter->getAddress());
+	if (mWriteTransactionCallback)
+	{
+		if (!written.empty())
+			mWriteTransactionCallback(adapterAddress, transaction->address, written);
+	}
+	else
+	{
+		for (auto &write : written)
+			getGattObserver()->characteristicValueChanged(transaction->address, write.service, write.characteristic, adapterAddress);
+	}
+
+	transaction->callback(transaction->failed ? BLUETOOTH_ERROR_FAIL : BLUETOOTH_ERROR_NONE);
+}
+
+void Bluez5ProfileGatt::completeCharacteristicWrite(const std::string &address, const BluetoothUuid &service,
+                                                    const BluetoothGattCharacteristic &characteristic, bool notifyObserver)
+{
+	GattRemoteService* remoteService = findService(address, service);
+	GattRemoteCharacteristic* remoteChar = remoteService ? findCharacteristic(remoteService, characteristic.getUuid()) : nullptr;
+	if (!remoteChar)
+		return;
+
+	remoteChar->invalidateCachedValue();
+	remoteService->service.updateCharacteristicValue(characteristic.getUuid(), characteristic.getValue());
+	updateRemoteCharacteristicValue(address, service, characteristic.getUuid(), characteristic.getValue());
+	if (notifyObserver)
+		getGattObserver()->characteristicValueChanged(address, service, characteristic, convertAddressToLowerCase(mAdapter->getAddress()));
+}
+
+void Bluez5ProfileGatt::readDescriptor(const std::string &address, const BluetoothUuid& service, const BluetoothUuid &characteristic,
+								 const BluetoothUuid &descriptor, BluetoothGattReadDescriptorCallback callback)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	BluetoothGattDescriptor readDescriptorValue;
+
+	readDescriptorValue = readDescriptor(address, service, characteristic, descriptor);
+	if (readDescriptorValue.isValid())
+		callback(BLUETOOTH_ERROR_NONE, readDescriptorValue);
+	else
+		callback(BLUETOOTH_ERROR_FAIL, readDescriptorValue);
+}
+
+void Bluez5ProfileGatt::readDescriptors(const std::string &address, const BluetoothUuid& service, const BluetoothUuid &characteristic,
+						const BluetoothUuidList &descriptors, BluetoothGattReadDescriptorsCallback callback)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+	BluetoothGattDescriptorList characteristicDescriptorList;
+	bool found = false;
+
+	characteristicDescriptorList = readDescriptors(address, service, characteristic, descriptors, found);
+	if (found)
+		callback(BLUETOOTH_ERROR_NONE, characteristicDescriptorList);
+	else
+		callback(BLUETOOTH_ERROR_FAIL, characteristicDescriptorList);
+}
+
+uint16_t Bluez5ProfileGatt::getConnectId(const std::string &address)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+	return mConnections.findConnId(convertAddressToLowerCase(address));
+}
+
+std::string Bluez5ProfileGatt::getAddress(const uint16_t &connId)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+	const Bluez5GattConnectionTable::Connection *connection = mConnections.find(connId);
+	if (!connection)
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Device not connected");
+		return std::string();
+	}
+	return connection->address;
+}
+
+std::shared_ptr<const GattOperationMetrics> Bluez5ProfileGatt::getMetrics(const std::string &address) const
+{
+	return mMetrics.findDevice(convertAddressToLowerCase(address));
+}
+
+std::shared_ptr<const GattOperationMetrics> Bluez5ProfileGatt::getMetrics(const std::string &address, const BluetoothUuid &characteristic) const
+{
+	return mMetrics.findCharacteristicByUuid(convertAddressToLowerCase(address), convertToLowerCase(characteristic.toString()));
+}
+
+std::shared_ptr<const GattOperationMetrics> Bluez5ProfileGatt::getMetrics(const std::string &address, const BluetoothUuid &service,
+                                                                          const BluetoothUuid &characteristic) const
+{
+	std::string lowerCaseAddress = convertAddressToLowerCase(address);
+	auto deviceServicesIter = mDeviceServicesMap.find(lowerCaseAddress);
+	if (deviceServicesIter == mDeviceServicesMap.end())
+		return nullptr;
+
+	for (auto gattService : deviceServicesIter->second)
+	{
+		if (gattService->service.getUuid() != service)
+			continue;
+
+		for (auto gattCharacteristic : gattService->gattRemoteCharacteristics)
+		{
+			if (gattCharacteristic->characteristic.getUuid() == characteristic)
+				return mMetrics.findCharacteristic(lowerCaseAddress, gattCharacteristic->objectPath);
+		}
+	}
+
+	return nullptr;
+}
+
+bool Bluez5ProfileGatt::dumpMetrics(const std::string &path) const
+{
+	DEBUG("Dumping GATT metrics to %s", path.c_str());
+	return mMetrics.dump(path);
+}
+
+std::vector<GattConnectionInfo> Bluez5ProfileGatt::listConnections()
+{
+	std::vector<GattConnectionInfo> connections;
+	connections.reserve(mConnections.getConnections().size());
+	gint64 now = g_get_monotonic_time();
+
+	for (auto &connection : mConnections.getConnections())
+	{
+		GattConnectionInfo info;
+		info.connId = connection.first;
+		info.address = connection.second.address;
+		info.mtu = GATT_DEFAULT_ATT_MTU;
+		info.pendingRequests = mRequestQueue.pending(info.address);
+		info.subscriptions = 0;
+		info.connectedTime = (now - connection.second.connectTime) / 1000;
+
+		auto deviceServicesIter = mDeviceServicesMap.find(info.address);
+		if (deviceServicesIter != mDeviceServicesMap.end())
+		{
+			bool mtuKnown = false;
+			for (auto service : deviceServicesIter->second)
+			{
+				for (auto characteristic : service->gattRemoteCharacteristics)
+				{
+					// The MTU belongs to the bearer, every characteristic reports the same
+					if (!mtuKnown)
+					{
+						info.mtu = characteristic->getMtu();
+						mtuKnown = true;
+					}
+
+					auto &subscription = characteristic->notificationSubscription;
+					if (subscription && subscription->subscribers.find(info.connId) != subscription->subscribers.end())
+						info.subscriptions++;
+				}
+			}
+		}
+
+		connections.push_back(info);
+	}
+
+	return connections;
+}
+
+BluetoothGattCharacteristic Bluez5ProfileGatt::readCharacteristic(const std::string &address, const BluetoothUuid& service,
+									 const BluetoothUuid &characteristic)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	BluetoothGattCharacteristic readCharacteristicValue;
+
+	GattRemoteService* remoteService = findService(address, service);
+	if (!remoteService)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "remote GATT service object is null");
+		return readCharacteristicValue;
+	}
+	GattRemoteCharacteristic* remoteChar = findCharacteristic(remoteService, characteristic);
+	if (remoteChar && remoteChar->characteristic.isPropertySet(BluetoothGattCharacteristic::Property::PROPERTY_READ))
+		readCharacteristicValue = readCharValue(remoteService, remoteChar, characteristic);
+	return readCharacteristicValue;
+}
+
+BluetoothGattCharacteristicList Bluez5ProfileGatt::readCharacteristics(const std::string &address, const BluetoothUuid& service,
+									const BluetoothUuidList &characteristics, bool &found)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	BluetoothGattCharacteristicList serviceCharacteristicList;
+	BluetoothGattCharacteristicList result;
+	GattRemoteService* remoteService = findService(address, service);
+	if (!remoteService)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "remote GATT service object is null");
+		return result;
+	}
+
+	serviceCharacteristicList =  remoteService->service.getCharacteristics();
+
+	for (auto &currentCharacteristic : characteristics)
+	{
+		found = false;
 		for (auto characteristic : serviceCharacteristicList)
 		{
 			if (characteristic.getUuid() == currentCharacteristic)
@@ -1545,7 +2498,8 @@ BluetoothGattDescriptor Bluez5ProfileGatt::readDescValue(GattRemoteService *remo
 	remoteService->service.updateDescriptorValue(remoteCharacteristic->characteristic.getUuid(),
 												 descriptor,
 												 descValue);
-	updateRemoteDeviceServices();
+	updateRemoteDescriptorValue(remoteService->deviceAddress, remoteService->service.getUuid(),
+								remoteCharacteristic->characteristic.getUuid(), descriptor, descValue);
 	return readDescriptorValue;
 }
 
@@ -1553,15 +2507,180 @@ BluetoothGattCharacteristic Bluez5ProfileGatt::readCharValue(GattRemoteService*
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
 	BluetoothGattCharacteristic readCharacteristicValue;
+	readCharacteristicValue.setUuid(characteristic);
+
+	GattReadCachePolicy policy = getReadCachePolicy(characteristic);
+	if (remoteCharacteristic->hasCachedValue(policy))
+	{
+		mReadCacheStatistics.hits++;
+		readCharacteristicValue.setProperties(remoteCharacteristic->characteristic.getProperties());
+		readCharacteristicValue.setValue(remoteCharacteristic->characteristic.getValue());
+		return readCharacteristicValue;
+	}
+
+	if (policy.mode != GattReadCachePolicy::NO_CACHE)
+		mReadCacheStatistics.misses++;
+
 	readCharacteristicValue.setProperties(remoteCharacteristic->readProperties());
 	BluetoothGattValue charValue = remoteCharacteristic->readValue();
-	readCharacteristicValue.setUuid(characteristic);
 	readCharacteristicValue.setValue(charValue);
+	remoteCharacteristic->cacheValue(charValue);
 	remoteService->service.updateCharacteristicValue(characteristic, charValue);
-	updateRemoteDeviceServices();
+	updateRemoteCharacteristicValue(remoteService->deviceAddress, remoteService->service.getUuid(),
+									characteristic, charValue);
 	return readCharacteristicValue;
 }
 
+Bluez5ProfileGatt::Bluez5GattLocalService* Bluez5ProfileGatt::createLocalService(const std::string &serviceObjPath, const BluetoothGattService &service)
+{
+	BluezGattService1 *skeletonGattService = bluez_gatt_service1_skeleton_new();
+	if (!skeletonGattService)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Failed to allocate memory for gatt service interface");
+		return nullptr;
+	}
+
+	BluezObjectSkeleton *object = bluez_object_skeleton_new(serviceObjPath.c_str());
+	if (!object)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
+		g_object_unref(skeletonGattService);
+		return nullptr;
+	}
+
+	std::vector<std::string> includedServices;
+	for (auto &uuid : service.getIncludedServices())
+		includedServices.push_back(uuid.toString());
+
+	std::vector<const char*> uuidArray;
+	for (auto &uuid : includedServices)
+		uuidArray.push_back(uuid.c_str());
+	uuidArray.push_back(NULL);
+
+	bluez_gatt_service1_set_uuid(skeletonGattService, service.getUuid().toString().c_str());
+	bluez_gatt_service1_set_primary(skeletonGattService, service.getType() == BluetoothGattService::PRIMARY);
+	bluez_gatt_service1_set_includes(skeletonGattService, uuidArray.data());
+	bluez_object_skeleton_set_gatt_service1(object, skeletonGattService);
+	g_dbus_object_manager_server_export(mObjectManagerGattServer, G_DBUS_OBJECT_SKELETON (object));
+
+	Bluez5GattLocalService *localService = new Bluez5GattLocalService(G_DBUS_OBJECT(object));
+	localService->mServiceInterface = skeletonGattService;
+	return localService;
+}
+
+Bluez5ProfileGatt::Bluez5GattLocalCharacteristic* Bluez5ProfileGatt::createLocalCharacteristic(const std::string &charObjPath,
+                                                                                               const std::string &serviceObjPath,
+                                                                                               const BluetoothGattCharacteristic &characteristic)
+{
+	BluezGattCharacteristic1 *skeletonGattChar = bluez_gatt_characteristic1_skeleton_new();
+	if (!skeletonGattChar)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Failed to allocate memroy for gatt characteristic interface");
+		return nullptr;
+	}
+
+	BluezObjectSkeleton *object = bluez_object_skeleton_new(charObjPath.c_str());
+	if (!object)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
+		g_object_unref(skeletonGattChar);
+		return nullptr;
+	}
+
+	bluez_gatt_characteristic1_set_service(skeletonGattChar, serviceObjPath.c_str());
+	bluez_gatt_characteristic1_set_uuid(skeletonGattChar, characteristic.getUuid().toString().c_str());
+	bluez_gatt_characteristic1_set_value(skeletonGattChar, convertVectorToArrayByteGVariant(characteristic.getValue()));
+
+	std::vector<const char*> flags(GattRemoteCharacteristic::characteristicPropertyMap.size() + 1, NULL);
+	updatePropertyFlags(characteristic, flags.data());
+	bluez_gatt_characteristic1_set_flags(skeletonGattChar, g_variant_new_strv(flags.data(), -1));
+
+	bluez_object_skeleton_set_gatt_characteristic1(object, skeletonGattChar);
+
+	Bluez5GattLocalCharacteristic *localCharacteristic = new Bluez5GattLocalCharacteristic(G_DBUS_OBJECT(object), this);
+	localCharacteristic->mInterface = skeletonGattChar;
+
+	g_signal_connect(skeletonGattChar,
+		"handle_read_value",
+		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleReadValue),
+		localCharacteristic);
+
+	g_signal_connect(skeletonGattChar,
+		"handle_write_value",
+		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleWriteValue),
+		this);
+
+	g_signal_connect(skeletonGattChar,
+		"handle_start_notify",
+		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleStartNotify),
+		this);
+
+	g_signal_connect(skeletonGattChar,
+		"handle_stop_notify",
+		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleStopNotify),
+		this);
+
+	g_signal_connect(skeletonGattChar,
+		"handle_acquire_write",
+		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleAcquireWrite),
+		localCharacteristic);
+
+	g_signal_connect(skeletonGattChar,
+		"handle_acquire_notify",
+		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleAcquireNotify),
+		localCharacteristic);
+
+	g_dbus_object_manager_server_export(mObjectManagerGattServer, G_DBUS_OBJECT_SKELETON (object));
+
+	return localCharacteristic;
+}
+
+Bluez5ProfileGatt::Bluez5GattLocalDescriptor* Bluez5ProfileGatt::createLocalDescriptor(const std::string &descObjPath,
+                                                                                       const std::string &charObjPath,
+                                                                                       const BluetoothGattDescriptor &descriptor)
+{
+	BluezGattDescriptor1 *skeletonGattDesc = bluez_gatt_descriptor1_skeleton_new();
+	if (!skeletonGattDesc)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Failed to allocate memroy for gatt descriptor interface");
+		return nullptr;
+	}
+
+	BluezObjectSkeleton *object = bluez_object_skeleton_new(descObjPath.c_str());
+	if (!object)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
+		g_object_unref(skeletonGattDesc);
+		return nullptr;
+	}
+
+	bluez_gatt_descriptor1_set_value(skeletonGattDesc, convertVectorToArrayByteGVariant(descriptor.getValue()));
+	bluez_gatt_descriptor1_set_characteristic(skeletonGattDesc, charObjPath.c_str());
+	bluez_gatt_descriptor1_set_uuid(skeletonGattDesc, descriptor.getUuid().toString().c_str());
+
+	std::vector<const char*> flags(GattRemoteDescriptor::descriptorPermissionMap.size() + 1, NULL);
+	updatePermissionFlags(descriptor, flags.data());
+	bluez_gatt_descriptor1_set_flags(skeletonGattDesc, g_variant_new_strv(flags.data(), -1));
+
+	bluez_object_skeleton_set_gatt_descriptor1(object, skeletonGattDesc);
+
+	g_signal_connect(skeletonGattDesc,
+		"handle_read_value",
+		G_CALLBACK (Bluez5GattLocalDescriptor::onHandleReadValue),
+		this);
+
+	g_signal_connect(skeletonGattDesc,
+		"handle_write_value",
+		G_CALLBACK (Bluez5GattLocalDescriptor::onHandleWriteValue),
+		this);
+
+	g_dbus_object_manager_server_export(mObjectManagerGattServer, G_DBUS_OBJECT_SKELETON (object));
+
+	Bluez5GattLocalDescriptor *localDescriptor = new Bluez5GattLocalDescriptor(G_DBUS_OBJECT(object));
+	localDescriptor->mInterface = skeletonGattDesc;
+	return localDescriptor;
+}
+
 void Bluez5ProfileGatt::addService(uint16_t appId, const BluetoothGattService &service, BluetoothGattAddCallback callback)
 {
 	if (!mObjectManagerGattServer)
@@ -1570,35 +2689,24 @@ void Bluez5ProfileGatt::addService(uint16_t appId, const BluetoothGattService &s
 		return;
 	}
 
-	BluetoothUuid uuid = service.getUuid();
 	auto serviceId = nextServiceId();
 
-	bool isPrimary = (service.getType() == BluetoothGattService::PRIMARY) ? true : false;
-
 	std::string objPath = g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(mObjectManagerGattServer));
 	std::string serviceObjPath = objPath  + "/App" + std::to_string(appId) + "/Service" + std::to_string(serviceId);
 
-	std::vector<BluetoothUuid> BluetoothUuidList = service.getIncludedServices();
-	const char *uuidArray[BluetoothUuidList.size()+1];
-
-	int index = 0;
-	for (auto it : BluetoothUuidList)
-		uuidArray[index++] = it.toString().c_str();
-
-	if (index < sizeof(uuidArray)) uuidArray[index] = NULL;
-
-	BluezObjectSkeleton *object = bluez_object_skeleton_new(serviceObjPath.c_str());
+	Bluez5GattLocalService *localService = createLocalService(serviceObjPath, service);
+	if (!localService)
+	{
+		callback(BLUETOOTH_ERROR_NOMEM, -1);
+		return;
+	}
 
-	BluezGattService1 *skeletonGattService = bluez_gatt_service1_skeleton_new();
-	bluez_gatt_service1_set_uuid(skeletonGattService, uuid.toString().c_str());
-	bluez_gatt_service1_set_primary(skeletonGattService, isPrimary);
-	bluez_gatt_service1_set_includes(skeletonGattService, uuidArray);
-	bluez_object_skeleton_set_gatt_service1(object, skeletonGattService);
-	g_dbus_object_manager_server_export(mObjectManagerGattServer, G_DBUS_OBJECT_SKELETON (object));
 	g_dbus_object_manager_server_set_connection (mObjectManagerGattServer, mConn);
 
-	auto registerCallback = [this, callback, object, skeletonGattService, appId, serviceId](BluetoothError error)
+	auto registerCallback = [this, callback, localService, appId, serviceId](BluetoothError error)
 	{
+		std::unique_ptr <Bluez5GattLocalService> service(localService);
+
 		if (error == BLUETOOTH_ERROR_NONE)
 		{
 			DEBUG("Register application successfully");
@@ -1607,11 +2715,10 @@ void Bluez5ProfileGatt::addService(uint16_t appId, const BluetoothGattService &s
 			if (appIt == mGattLocalApplications.end())
 			{
 				ERROR("MSGID_GATT_PROFILE_ERROR", 0, "application not present list");
+				removeLocalServices(service.get());
 				return;
 			}
 
-			std::unique_ptr <Bluez5GattLocalService> service(new Bluez5GattLocalService(G_DBUS_OBJECT(object)));
-			service->mServiceInterface = skeletonGattService;
 			auto &services = ((appIt->second).get())->mGattLocalServices;
 			services.insert(make_pair(serviceId, std::move(service)));
 			callback(BLUETOOTH_ERROR_NONE, serviceId);
@@ -1620,6 +2727,7 @@ void Bluez5ProfileGatt::addService(uint16_t appId, const BluetoothGattService &s
 		else
 		{
 			ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Register application failed %d", error);
+			removeLocalServices(service.get());
 			callback(BLUETOOTH_ERROR_FAIL, -1);
 		}
 	};
@@ -1627,6 +2735,120 @@ void Bluez5ProfileGatt::addService(uint16_t appId, const BluetoothGattService &s
 	registerLocalApplication(registerCallback, objPath, true);
 }
 
+void Bluez5ProfileGatt::addServices(uint16_t appId, const BluetoothGattServiceList &services, GattAddServicesCallback callback)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	if (!mObjectManagerGattServer || mGattLocalApplications.find(appId) == mGattLocalApplications.end())
+	{
+		callback(BLUETOOTH_ERROR_PARAM_INVALID, std::vector<GattLocalServiceIds>());
+		return;
+	}
+
+	std::string objPath = g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(mObjectManagerGattServer));
+
+	// The whole tree is exported before the application is registered, so
+	// BlueZ picks it up with a single GetManagedObjects call.
+	typedef std::vector<std::pair<uint16_t, std::unique_ptr<Bluez5GattLocalService>>> LocalServiceList;
+	std::shared_ptr<LocalServiceList> localServices = std::make_shared<LocalServiceList>();
+	std::vector<GattLocalServiceIds> ids;
+	bool created = true;
+
+	for (auto &service : services)
+	{
+		GattLocalServiceIds serviceIds;
+		serviceIds.serviceId = nextServiceId();
+
+		std::string serviceObjPath = objPath  + "/App" + std::to_string(appId) + "/Service" + std::to_string(serviceIds.serviceId);
+		std::unique_ptr<Bluez5GattLocalService> localService(createLocalService(serviceObjPath, service));
+		if (!localService)
+		{
+			created = false;
+			break;
+		}
+
+		for (auto &characteristic : service.getCharacteristics())
+		{
+			uint16_t charId = nextCharId();
+			std::string charObjPath = serviceObjPath + "/Char"+ std::to_string(charId);
+
+			std::unique_ptr<Bluez5GattLocalCharacteristic> localCharacteristic(createLocalCharacteristic(charObjPath, serviceObjPath, characteristic));
+			if (!localCharacteristic)
+			{
+				created = false;
+				break;
+			}
+
+			std::vector<uint16_t> descIds;
+			for (auto &descriptor : characteristic.getDescriptors())
+			{
+				uint16_t descId = nextDescId();
+				std::string descObjPath = charObjPath + "/Desc" + std::to_string(descId);
+
+				std::unique_ptr<Bluez5GattLocalDescriptor> localDescriptor(createLocalDescriptor(descObjPath, charObjPath, descriptor));
+				if (!localDescriptor)
+				{
+					created = false;
+					break;
+				}
+
+				localCharacteristic->mDescriptors.insert(std::make_pair(descId, std::move(localDescriptor)));
+				descIds.push_back(descId);
+			}
+
+			localService->mCharacteristics.insert(std::make_pair(charId, std::move(localCharacteristic)));
+			serviceIds.characteristicIds.push_back(charId);
+			serviceIds.descriptorIds.push_back(descIds);
+
+			if (!created)
+				break;
+		}
+
+		localServices->push_back(std::make_pair(serviceIds.serviceId, std::move(localService)));
+		ids.push_back(serviceIds);
+
+		if (!created)
+			break;
+	}
+
+	if (!created)
+	{
+		for (auto &localService : *localServices)
+			removeLocalServices(localService.second.get());
+
+		callback(BLUETOOTH_ERROR_NOMEM, std::vector<GattLocalServiceIds>());
+		return;
+	}
+
+	g_dbus_object_manager_server_set_connection (mObjectManagerGattServer, mConn);
+
+	auto registerCallback = [this, callback, localServices, ids, appId](BluetoothError error)
+	{
+		auto appIt = mGattLocalApplications.find(appId);
+
+		if (error != BLUETOOTH_ERROR_NONE || appIt == mGattLocalApplications.end())
+		{
+			ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Register application with %zu services failed %d", localServices->size(), error);
+			for (auto &localService : *localServices)
+				removeLocalServices(localService.second.get());
+
+			callback(BLUETOOTH_ERROR_FAIL, std::vector<GattLocalServiceIds>());
+			return;
+		}
+
+		DEBUG("Registered application with %zu services", localServices->size());
+
+		auto &services = appIt->second->mGattLocalServices;
+		for (auto &localService : *localServices)
+			services.insert(std::make_pair(localService.first, std::move(localService.second)));
+		localServices->clear();
+
+		callback(BLUETOOTH_ERROR_NONE, ids);
+	};
+
+	registerLocalApplication(registerCallback, objPath, true);
+}
+
 void Bluez5ProfileGatt::removeService(uint16_t appId, uint16_t serviceId, BluetoothResultCallback callback)
 {
 	if (!mObjectManagerGattServer)
@@ -1729,109 +2951,28 @@ void Bluez5ProfileGatt::addCharacteristic(uint16_t appId, uint16_t serviceId, co
 
 	auto &chars = srvIt->second->mCharacteristics;
 
-	BluezGattCharacteristic1 *skeletonGattChar = bluez_gatt_characteristic1_skeleton_new();
-	if (!skeletonGattChar)
-	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Failed to allocate memroy for gatt characteristic interface");
-		callback(BLUETOOTH_ERROR_NOMEM, -1);
-		return;
-	}
-
 	uint16_t charId = nextCharId();
 
 	std::string objPath = g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(mObjectManagerGattServer));
 	std::string serviceObjPath = objPath  + "/App" + std::to_string(appId) + "/Service" + std::to_string(serviceId);
 	std::string charObjPath = serviceObjPath + "/Char"+ std::to_string(charId);
 
-	BluezObjectSkeleton *object = bluez_object_skeleton_new(charObjPath.c_str());
-
-	if (!object)
+	Bluez5GattLocalCharacteristic *localCharacteristic = createLocalCharacteristic(charObjPath, serviceObjPath, characteristic);
+	if (!localCharacteristic)
 	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
-		if (skeletonGattChar) g_object_unref(skeletonGattChar);
 		callback(BLUETOOTH_ERROR_NOMEM, -1);
 		return;
 	}
 
-	bluez_gatt_characteristic1_set_service(skeletonGattChar, serviceObjPath.c_str());
-	bluez_gatt_characteristic1_set_uuid(skeletonGattChar, characteristic.getUuid().toString().c_str());
-
-	const char *flags[GattRemoteCharacteristic::characteristicPropertyMap.size() + 1];
-	updatePropertyFlags(characteristic, flags);
-
-	BluetoothGattValue value = characteristic.getValue();
-
-	GVariantBuilder *dataBuilder = g_variant_builder_new (G_VARIANT_TYPE ("ay"));
-
-	if (!dataBuilder)
-	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
-		if (object) g_object_unref(object);
-		if (skeletonGattChar) g_object_unref(skeletonGattChar);
-		callback(BLUETOOTH_ERROR_NOMEM, -1);
-		return;
-	}
-
-	for (auto &byteIt : value)
-		g_variant_builder_add(dataBuilder, "y", byteIt);
-
-	GVariant *dataValue = g_variant_builder_end(dataBuilder);
-	g_variant_builder_unref(dataBuilder);
-
-	bluez_gatt_characteristic1_set_value(skeletonGattChar, dataValue);
-
-	GVariantBuilder *builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
-	if (!builder)
-	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
-		if (object) g_object_unref(object);
-		if (skeletonGattChar) g_object_unref(skeletonGattChar);
-		callback(BLUETOOTH_ERROR_NOMEM, -1);
-		return;
-	}
-
-	for (int i = 0; i < sizeof(flags) && flags[i] != NULL; i++)
-	{
-		g_variant_builder_add(builder, "s", flags[i]);
-	}
-
-	GVariant *flagsVariant = g_variant_builder_end(builder);
-	g_variant_builder_unref(builder);
-
-	bluez_gatt_characteristic1_set_flags(skeletonGattChar, flagsVariant);
-
-	bluez_object_skeleton_set_gatt_characteristic1(object, skeletonGattChar);
-
-	g_signal_connect(skeletonGattChar,
-		"handle_read_value",
-		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleReadValue),
-		this);
-
-	g_signal_connect(skeletonGattChar,
-		"handle_write_value",
-		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleWriteValue),
-		this);
-
-	g_signal_connect(skeletonGattChar,
-		"handle_start_notify",
-		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleStartNotify),
-		this);
-
-	g_signal_connect(skeletonGattChar,
-		"handle_stop_notify",
-		G_CALLBACK (Bluez5GattLocalCharacteristic::onHandleStopNotify),
-		this);
-
-	g_dbus_object_manager_server_export(mObjectManagerGattServer, G_DBUS_OBJECT_SKELETON (object));
 	g_dbus_object_manager_server_set_connection (mObjectManagerGattServer, mConn);
 
-	auto registerCallback = [this, callback, charId, object, &chars, skeletonGattChar](BluetoothError error)
+	auto registerCallback = [this, callback, charId, &chars, localCharacteristic](BluetoothError error)
 	{
+		std::unique_ptr<Bluez5GattLocalCharacteristic> character(localCharacteristic);
+
 		if (error == BLUETOOTH_ERROR_NONE)
 		{
 			DEBUG("Characterstic registered successfully");
-			std::unique_ptr<Bluez5GattLocalCharacteristic> character(new Bluez5GattLocalCharacteristic(G_DBUS_OBJECT(object)));
-			character->mInterface = skeletonGattChar;
 			chars.insert(std::make_pair(charId, std::move(character)));
 			mLastCharId = charId;
 			callback(BLUETOOTH_ERROR_NONE, charId);
@@ -1839,8 +2980,7 @@ void Bluez5ProfileGatt::addCharacteristic(uint16_t appId, uint16_t serviceId, co
 		else
 		{
 			ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Removed application  and register application failed %d", error);
-			g_object_unref(object);
-			g_object_unref(skeletonGattChar);
+			removeLocalCharacteristic(character.get());
 			callback(BLUETOOTH_ERROR_FAIL, -1);
 		}
 		return;
@@ -1849,6 +2989,27 @@ void Bluez5ProfileGatt::addCharacteristic(uint16_t appId, uint16_t serviceId, co
 	registerLocalApplication(registerCallback, objPath, true);
 }
 
+void Bluez5ProfileGatt::removeLocalCharacteristic(Bluez5GattLocalCharacteristic *characteristic)
+{
+	removeLocalDescriptors(characteristic);
+	characteristic->releaseAcquiredWrite();
+	characteristic->releaseAcquiredNotify();
+
+	if (characteristic->mCharObject)
+	{
+		g_dbus_object_manager_server_unexport (mObjectManagerGattServer, g_dbus_object_get_object_path(characteristic->mCharObject));
+
+		if (characteristic->mInterface)
+		{
+			g_object_unref(characteristic->mInterface);
+			characteristic->mInterface = 0;
+		}
+
+		g_object_unref(characteristic->mCharObject);
+		characteristic->mCharObject = 0;
+	}
+}
+
 void Bluez5ProfileGatt::removeLocalCharacteristics(Bluez5GattLocalService *service)
 {
 	if (!service)
@@ -1860,27 +3021,8 @@ void Bluez5ProfileGatt::removeLocalCharacteristics(Bluez5GattLocalService *servi
 	auto &chars = service->mCharacteristics;
 
 	for (auto &it : chars)
-	{
-		removeLocalDescriptors(it.second.get());
-
-		if (it.second->mCharObject)
-		{
-			g_dbus_object_manager_server_unexport (mObjectManagerGattServer, g_dbus_object_get_object_path(it.second->mCharObject));
-
-			if (it.second->mInterface)
-			{
-				g_object_unref(it.second->mInterface);
-				it.second->mInterface = 0;
-			}
-
-			if (it.second->mCharObject)
-			{
-				g_object_unref(it.second->mCharObject);
-				it.second->mCharObject = 0;
-			}
-		}
+		removeLocalCharacteristic(it.second.get());
 
-	}
 	chars.clear();
 }
 
@@ -1894,13 +3036,6 @@ void Bluez5ProfileGatt::addDescriptor(uint16_t appId, uint16_t serviceId, const
 	{
 		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Failed to get desc list");
 		callback(BLUETOOTH_ERROR_PARAM_INVALID, -1);
-	}
-
-	BluezGattDescriptor1 *skeletonGattDesc = bluez_gatt_descriptor1_skeleton_new();
-	if (!skeletonGattDesc)
-	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Failed to allocate memroy for gatt descriptor interface");
-		callback(BLUETOOTH_ERROR_NOMEM, -1);
 		return;
 	}
 
@@ -1908,85 +3043,31 @@ void Bluez5ProfileGatt::addDescriptor(uint16_t appId, uint16_t serviceId, const
 	std::string objPath = g_dbus_object_manager_get_object_path(G_DBUS_OBJECT_MANAGER(mObjectManagerGattServer));
 	std::string serviceObjPath = objPath  + "/App" + std::to_string(appId) + "/Service" + std::to_string(serviceId);
 	std::string charObjPath = serviceObjPath + "/Char"+ std::to_string(mLastCharId);
-	std::string descObjPath = charObjPath + "/Desc" + std::to_string(descId);
-
-	BluezObjectSkeleton *object = bluez_object_skeleton_new(descObjPath.c_str());
-	if (!object)
-	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
-		if (skeletonGattDesc) g_object_unref(skeletonGattDesc);
-		callback(BLUETOOTH_ERROR_FAIL, -1);
-		return;
-	}
-
-	BluetoothGattValue value = descriptor.getValue();
-
-	const char *flags[GattRemoteDescriptor::descriptorPermissionMap.size() + 1];
-
-	updatePermissionFlags(descriptor, flags);
-
-	GVariantBuilder *dataBuilder = g_variant_builder_new (G_VARIANT_TYPE ("ay"));
-	for (auto &byteIt : value)
-		g_variant_builder_add(dataBuilder, "y", byteIt);
-
-	GVariant *dataValue = g_variant_builder_end(dataBuilder);
-	g_variant_builder_unref(dataBuilder);
-
-	bluez_gatt_descriptor1_set_value(skeletonGattDesc, dataValue);
-
-	bluez_gatt_descriptor1_set_characteristic(skeletonGattDesc, charObjPath.c_str());
-	bluez_gatt_descriptor1_set_uuid(skeletonGattDesc, descriptor.getUuid().toString().c_str());
-
-	GVariantBuilder *builder = g_variant_builder_new (G_VARIANT_TYPE ("as"));
-	if (!builder)
-	{
-		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Memory allocation failed %d", __LINE__);
-		if (object) g_object_unref(object);
-		if (skeletonGattDesc) g_object_unref(skeletonGattDesc);
-		callback(BLUETOOTH_ERROR_NOMEM, -1);
-		return;
-	}
-
-	for (int i = 0; i < sizeof(flags) && flags[i] != NULL; i++)
-	{
-		g_variant_builder_add(builder, "s", flags[i]);
-	}
-
-	GVariant *flagsVariant = g_variant_builder_end(builder);
-	g_variant_builder_unref(builder);
-
-	bluez_gatt_descriptor1_set_flags(skeletonGattDesc, flagsVariant);
-
-	bluez_object_skeleton_set_gatt_descriptor1(object, skeletonGattDesc);
-
-	g_signal_connect(skeletonGattDesc,
-		"handle_read_value",
-		G_CALLBACK (Bluez5GattLocalDescriptor::onHandleReadValue),
-		this);
+	std::string descObjPath = charObjPath + "/Desc" + std::to_string(descId);
 
-	g_signal_connect(skeletonGattDesc,
-		"handle_write_value",
-		G_CALLBACK (Bluez5GattLocalDescriptor::onHandleWriteValue),
-		this);
+	Bluez5GattLocalDescriptor *localDescriptor = createLocalDescriptor(descObjPath, charObjPath, descriptor);
+	if (!localDescriptor)
+	{
+		callback(BLUETOOTH_ERROR_NOMEM, -1);
+		return;
+	}
 
-	g_dbus_object_manager_server_export(mObjectManagerGattServer, G_DBUS_OBJECT_SKELETON (object));
 	g_dbus_object_manager_server_set_connection (mObjectManagerGattServer, mConn);
 
-	auto registerCallback = [this, callback, descId, object, descs, skeletonGattDesc](BluetoothError error)
+	auto registerCallback = [this, callback, descId, descs, localDescriptor](BluetoothError error)
 	{
+		std::unique_ptr<Bluez5GattLocalDescriptor> desc(localDescriptor);
+
 		if (error == BLUETOOTH_ERROR_NONE)
 		{
 			DEBUG("Descriptor registered successfully");
-			std::unique_ptr<Bluez5GattLocalDescriptor> desc(new Bluez5GattLocalDescriptor(G_DBUS_OBJECT(object)));
-			desc->mInterface = skeletonGattDesc;
 			descs->insert(std::make_pair(descId, std::move(desc)));
 			callback(BLUETOOTH_ERROR_NONE, descId);
 		}
 		else
 		{
 			ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Descriptor register failed %d", error);
-			if (object) g_object_unref(object);
-			if (skeletonGattDesc) g_object_unref(skeletonGattDesc);
+			removeLocalDescriptor(desc.get());
 			callback(BLUETOOTH_ERROR_FAIL, -1);
 		}
 		return;
@@ -1995,6 +3076,26 @@ void Bluez5ProfileGatt::addDescriptor(uint16_t appId, uint16_t serviceId, const
 	registerLocalApplication(registerCallback, objPath, true);
 }
 
+void Bluez5ProfileGatt::removeLocalDescriptor(Bluez5GattLocalDescriptor *descriptor)
+{
+	if (descriptor->mDescObject)
+		g_dbus_object_manager_server_unexport (mObjectManagerGattServer, g_dbus_object_get_object_path(descriptor->mDescObject));
+	else
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "removeDescriptors trying remove null object");
+
+	if (descriptor->mInterface)
+	{
+		g_object_unref(descriptor->mInterface);
+		descriptor->mInterface = 0;
+	}
+
+	if (descriptor->mDescObject)
+	{
+		g_object_unref(descriptor->mDescObject);
+		descriptor->mDescObject = 0;
+	}
+}
+
 void Bluez5ProfileGatt::removeLocalDescriptors(Bluez5GattLocalCharacteristic *characteristic)
 {
 	if (!characteristic)
@@ -2003,24 +3104,7 @@ void Bluez5ProfileGatt::removeLocalDescriptors(Bluez5GattLocalCharacteristic *ch
 	auto &descs = characteristic->mDescriptors;
 
 	for (auto &it: descs)
-	{
-		if (it.second->mDescObject)
-			g_dbus_object_manager_server_unexport (mObjectManagerGattServer, g_dbus_object_get_object_path(it.second->mDescObject));
-		else
-			ERROR("MSGID_GATT_PROFILE_ERROR", 0, "removeDescriptors trying remove null object");
-
-		if (it.second->mInterface)
-		{
-			g_object_unref(it.second->mInterface);
-			it.second->mInterface = 0;
-		}
-
-		if (it.second->mDescObject)
-		{
-			g_object_unref(it.second->mDescObject);
-			it.second->mDescObject = 0;
-		}
-	}
+		removeLocalDescriptor(it.second.get());
 
 	descs.clear();
 }
@@ -2107,6 +3191,98 @@ void Bluez5ProfileGatt::notifyDescriptorValueChanged(uint16_t appId, uint16_t se
 	return;
 }
 
+Bluez5ProfileGatt::Bluez5GattLocalCharacteristic* Bluez5ProfileGatt::findLocalCharacteristic(uint16_t appId, uint16_t serviceId, uint16_t charId)
+{
+	auto appIt = mGattLocalApplications.find(appId);
+	if (appIt == mGattLocalApplications.end())
+		return nullptr;
+
+	auto &services = appIt->second->mGattLocalServices;
+	auto srvIt = services.find(serviceId);
+	if (srvIt == services.end())
+		return nullptr;
+
+	auto &chars = srvIt->second->mCharacteristics;
+	auto charIt = chars.find(charId);
+	if (charIt == chars.end())
+		return nullptr;
+
+	return charIt->second.get();
+}
+
+bool Bluez5ProfileGatt::setLocalValueProvider(uint16_t appId, uint16_t serviceId, uint16_t charId, GattLocalValueProvider provider)
+{
+	Bluez5GattLocalCharacteristic *localCharacteristic = findLocalCharacteristic(appId, serviceId, charId);
+	if (!localCharacteristic)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Characteristic is not present list for setLocalValueProvider");
+		return false;
+	}
+
+	localCharacteristic->mValueProvider = provider;
+	return true;
+}
+
+bool Bluez5ProfileGatt::notifyLocalCharacteristicValue(uint16_t appId, uint16_t serviceId, uint16_t charId, const BluetoothGattValue &value)
+{
+	Bluez5GattLocalCharacteristic *localCharacteristic = findLocalCharacteristic(appId, serviceId, charId);
+	if (!localCharacteristic || !localCharacteristic->mCharObject)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Characteristic is not present list for notifyLocalCharacteristicValue");
+		return false;
+	}
+
+	// A client which acquired the notifications gets the value through the
+	// socket, bypassing D-Bus completely. BlueZ sends every packet as one
+	// notification, so it has to fit into one.
+	if (localCharacteristic->mNotifyFd >= 0)
+	{
+		if (localCharacteristic->mNotifyMtu > 3 && value.size() > (size_t) localCharacteristic->mNotifyMtu - 3)
+		{
+			ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Value of %zu bytes doesn't fit into a notification with MTU %d",
+			      value.size(), localCharacteristic->mNotifyMtu);
+			return false;
+		}
+
+		if (write(localCharacteristic->mNotifyFd, value.data(), value.size()) >= 0)
+			return true;
+
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			WARNING(MSGID_GATT_PROFILE_ERROR, 0, "Acquired notify socket is full, dropping value");
+			return false;
+		}
+
+		localCharacteristic->releaseAcquiredNotify();
+	}
+
+	// Nobody subscribed, there is nothing to send
+	if (!bluez_gatt_characteristic1_get_notifying(localCharacteristic->mInterface))
+		return true;
+
+	// Emit the change without replacing the stored value of the skeleton so
+	// high rate notifications don't pay for updating the property each time.
+	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(builder, "{sv}", "Value", convertVectorToArrayByteGVariant(value));
+	GVariant *changedProperties = g_variant_builder_end(builder);
+	g_variant_builder_unref(builder);
+
+	GError *error = 0;
+	g_dbus_connection_emit_signal(mConn, NULL, g_dbus_object_get_object_path(localCharacteristic->mCharObject),
+	                              "org.freedesktop.DBus.Properties", "PropertiesChanged",
+	                              g_variant_new("(s@a{sv}@as)", "org.bluez.GattCharacteristic1", changedProperties,
+	                                            g_variant_new_strv(NULL, 0)),
+	                              &error);
+	if (error)
+	{
+		ERROR("MSGID_GATT_PROFILE_ERROR", 0, "Failed to emit characteristic value: %s", error->message);
+		g_error_free(error);
+		return false;
+	}
+
+	return true;
+}
+
 void Bluez5ProfileGatt::startService(uint16_t serviceId, BluetoothGattTransportMode mode, BluetoothResultCallback callback)
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
@@ -2186,8 +3362,11 @@ void Bluez5ProfileGatt::updatePermissionFlags(const BluetoothGattDescriptor &des
 	if (index < sizeof(permissionflags)) permissionflags[index] = NULL;
 }
 
-void Bluez5ProfileGatt::onCharacteristicPropertiesChanged(GattRemoteCharacteristic* characteristic, GVariant *changed_properties)
+GattNotificationSubscription* Bluez5ProfileGatt::getNotificationSubscription(GattRemoteCharacteristic *characteristic)
 {
+	if (characteristic->notificationSubscription)
+		return characteristic->notificationSubscription.get();
+
 	std::string deviceObjPath, serviceName;
 	splitInPathAndName(characteristic->parentObjectPath, deviceObjPath, serviceName);
 
@@ -2195,46 +3374,157 @@ void Bluez5ProfileGatt::onCharacteristicPropertiesChanged(GattRemoteCharacterist
 
 	if (!device)
 	{
-		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "onCharacteristicPropertiesChanged device is not present");
-		return;
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "getNotificationSubscription device is not present");
+		return nullptr;
 	}
 
-	std::string deviceAddress = device->getAddress();
-	std::string lowerCaseAddress = convertAddressToLowerCase(deviceAddress);
+	std::string lowerCaseAddress = convertAddressToLowerCase(device->getAddress());
 
 	GattRemoteService* service = getRemoteGattService(characteristic->parentObjectPath);
 
 	if (!service)
 	{
-		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "onCharacteristicPropertiesChanged unable to get service instance for deviceAddress %s",lowerCaseAddress.c_str());
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "getNotificationSubscription unable to get service instance for deviceAddress %s",lowerCaseAddress.c_str());
+		return nullptr;
+	}
+
+	GattNotificationSubscription *subscription = new GattNotificationSubscription();
+	subscription->deviceAddress = lowerCaseAddress;
+	subscription->adapterAddress = convertAddressToLowerCase(mAdapter->getAddress());
+	subscription->serviceUuid = BluetoothUuid(bluez_gatt_service1_get_uuid(service->mInterface), BluetoothUuid::UUID128);
+	subscription->characteristicUuid = BluetoothUuid(bluez_gatt_characteristic1_get_uuid(characteristic->mInterface), BluetoothUuid::UUID128);
+
+	characteristic->notificationSubscription.reset(subscription);
+	return subscription;
+}
+
+bool Bluez5ProfileGatt::setNotificationOptions(const std::string &address, const BluetoothUuid &service,
+                                               const BluetoothUuid &characteristic, const GattNotificationOptions &options)
+{
+	GattRemoteService *remoteService = findService(convertAddressToLowerCase(address), service);
+	if (!remoteService)
+		return false;
+
+	GattRemoteCharacteristic *remoteChar = findCharacteristic(remoteService, characteristic);
+	if (!remoteChar)
+		return false;
+
+	GattNotificationSubscription *subscription = getNotificationSubscription(remoteChar);
+	if (!subscription)
+		return false;
+
+	// Values collected with the previous options are delivered right away
+	flushNotifications(remoteChar);
+	subscription->options = options;
+	return true;
+}
+
+void Bluez5ProfileGatt::deliverNotification(GattRemoteCharacteristic *characteristic, const BluetoothGattValue &value)
+{
+	GattNotificationSubscription *subscription = getNotificationSubscription(characteristic);
+
+	// Values nobody subscribed to, e.g. the result of a read, are not delivered
+	if (!subscription || subscription->subscribers.empty())
+		return;
+
+	BluetoothGattCharacteristic remoteChar;
+	remoteChar.setUuid(subscription->characteristicUuid);
+	remoteChar.setValue(value);
+
+	if (subscription->options.mode == GattNotificationOptions::PASS_THROUGH || !subscription->options.interval)
+	{
+		notifySubscribers(subscription, remoteChar);
+		return;
+	}
+
+	if (subscription->options.mode == GattNotificationOptions::LATEST_ONLY)
+		subscription->pendingValues.clear();
+
+	subscription->pendingValues.push_back(remoteChar);
+
+	if (!subscription->timeoutSource)
+		subscription->timeoutSource = g_timeout_add(subscription->options.interval, notificationFlushTimeout, characteristic);
+}
+
+void Bluez5ProfileGatt::flushNotifications(GattRemoteCharacteristic *characteristic)
+{
+	GattNotificationSubscription *subscription = characteristic->notificationSubscription.get();
+	if (!subscription)
 		return;
+
+	if (subscription->timeoutSource)
+	{
+		g_source_remove(subscription->timeoutSource);
+		subscription->timeoutSource = 0;
 	}
 
-	const char* uuid = bluez_gatt_service1_get_uuid(service->mInterface);
-	BluetoothUuid service_uuid(uuid, BluetoothUuid::UUID128);
+	if (subscription->pendingValues.empty())
+		return;
+
+	BluetoothGattCharacteristicList values;
+	values.swap(subscription->pendingValues);
 
-	if(g_variant_n_children(changed_properties) > 0)
+	if (subscription->options.mode == GattNotificationOptions::BATCH && mNotificationBatchCallback)
 	{
-		GVariantIter *iter = NULL;
+		mNotificationBatchCallback(subscription->adapterAddress, subscription->deviceAddress,
+		                           subscription->serviceUuid, values);
+		return;
+	}
 
-		GVariant *value;
-		const gchar *key;
-		g_variant_get(changed_properties, "a{sv}", &iter);
+	for (auto &value : values)
+		notifySubscribers(subscription, value);
+}
 
-		while (iter != nullptr && g_variant_iter_loop(iter, "{&sv}", &key, &value))
-		{
-			if (g_ascii_strncasecmp(key, "value", 5) == 0)
-			{
-				BluetoothGattValue charValue = convertArrayByteGVariantToVector(value);
-				BluetoothGattCharacteristic remoteChar;
-				BluetoothUuid charUuid(bluez_gatt_characteristic1_get_uuid(characteristic->mInterface), BluetoothUuid::UUID128);
-				remoteChar.setUuid(charUuid);
-				remoteChar.setValue(charValue);
-				getGattObserver()->characteristicValueChanged(lowerCaseAddress, service_uuid, remoteChar, convertAddressToLowerCase(mAdapter->getAddress()));
-			}
-		}
-		g_variant_iter_free (iter);
+void Bluez5ProfileGatt::notifySubscribers(GattNotificationSubscription *subscription, const BluetoothGattCharacteristic &characteristic)
+{
+	bool notifyObserver = false;
+
+	for (auto &subscriber : subscription->subscribers)
+	{
+		auto handlerIter = mNotificationHandlers.end();
+		if (subscriber.first != GattNotificationSubscription::ADDRESS_SUBSCRIBER)
+			handlerIter = mNotificationHandlers.find(subscriber.first);
+
+		if (handlerIter != mNotificationHandlers.end())
+			handlerIter->second(subscriber.first, subscription->serviceUuid, characteristic);
+		else
+			notifyObserver = true;
 	}
+
+	// Subscribers without a handler of their own share the profile observer
+	if (notifyObserver)
+		getGattObserver()->characteristicValueChanged(subscription->deviceAddress, subscription->serviceUuid,
+		                                              characteristic, subscription->adapterAddress);
+}
+
+gboolean Bluez5ProfileGatt::notificationFlushTimeout(gpointer user_data)
+{
+	GattRemoteCharacteristic *characteristic = static_cast<GattRemoteCharacteristic*>(user_data);
+
+	// The source is removed when returning FALSE, don't remove it twice
+	characteristic->notificationSubscription->timeoutSource = 0;
+	characteristic->mGattProfile->flushNotifications(characteristic);
+	return FALSE;
+}
+
+void Bluez5ProfileGatt::onCharacteristicPropertiesChanged(GattRemoteCharacteristic* characteristic, GVariant *changed_properties)
+{
+	GVariant *value = g_variant_lookup_value(changed_properties, "Value", G_VARIANT_TYPE_BYTESTRING);
+	if (!value)
+		return;
+
+	BluetoothGattValue charValue = convertArrayByteGVariantToVector(value);
+	g_variant_unref(value);
+
+	characteristic->cacheValue(charValue);
+
+	// BlueZ updates the value on reads as well
+	bool readResult = characteristic->isReadResult(charValue);
+	if (!readResult && characteristic->notificationSubscription &&
+	    characteristic->notificationSubscription->notifyState == GattNotificationSubscription::NOTIFY_STARTED)
+		characteristic->recordNotification(charValue.size());
+
+	deliverNotification(characteristic, charValue);
 }
 
 gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onHandleReadValue(BluezGattCharacteristic1* interface,
@@ -2242,7 +3532,43 @@ gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onHandleReadValue(Blu
 																			 GVariant *arg_options,
 																			 gpointer user_data)
 {
-	GVariant *value = bluez_gatt_characteristic1_get_value(interface);
+	Bluez5GattLocalCharacteristic *localCharacteristic = static_cast<Bluez5GattLocalCharacteristic*>(user_data);
+
+	uint16_t offset = 0;
+	uint16_t mtu = 0;
+	if (arg_options)
+	{
+		g_variant_lookup(arg_options, "offset", "q", &offset);
+		g_variant_lookup(arg_options, "mtu", "q", &mtu);
+	}
+
+	GVariant *value = nullptr;
+
+	if (localCharacteristic->mValueProvider)
+	{
+		BluetoothGattValue providedValue;
+		if (!localCharacteristic->mValueProvider(offset, mtu, providedValue))
+		{
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", "Value not available");
+			return true;
+		}
+		value = convertVectorToArrayByteGVariant(providedValue);
+	}
+	else if (offset)
+	{
+		BluetoothGattValue storedValue = convertArrayByteGVariantToVector(bluez_gatt_characteristic1_get_value(interface));
+		if (offset > storedValue.size())
+		{
+			g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidOffset", "Invalid offset");
+			return true;
+		}
+		value = convertVectorToArrayByteGVariant(BluetoothGattValue(storedValue.begin() + offset, storedValue.end()));
+	}
+	else
+	{
+		value = bluez_gatt_characteristic1_get_value(interface);
+	}
+
 	GVariant *tuple = g_variant_new_tuple(&value, 1);
 	g_dbus_method_invocation_return_value(invocation, tuple);
 	return true;
@@ -2262,6 +3588,11 @@ gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onHandleWriteValue(Bl
 }
 
 void Bluez5ProfileGatt::onHandleCharacteriscticWriteValue(BluezGattCharacteristic1* charInterface, GVariant * charValue)
+{
+	onHandleCharacteriscticWriteValue(charInterface, convertArrayByteGVariantToVector(charValue));
+}
+
+void Bluez5ProfileGatt::onHandleCharacteriscticWriteValue(BluezGattCharacteristic1* charInterface, const BluetoothGattValue &charValue)
 {
 	BluetoothGattCharacteristic characteristic;
 
@@ -2285,11 +3616,7 @@ void Bluez5ProfileGatt::onHandleCharacteriscticWriteValue(BluezGattCharacteristi
 
 	characteristic.setProperties(properties);
 
-	BluetoothGattValue result;
-
-	result = convertArrayByteGVariantToVector(charValue);
-
-	characteristic.setValue(result);
+	characteristic.setValue(charValue);
 
 	//Get service uuid for this characteristic
 	std::string servicePath(bluez_gatt_characteristic1_get_service(charInterface));
@@ -2347,6 +3674,201 @@ gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onHandleStopNotify(Bl
 	return true;
 }
 
+static int createAcquiredSocketPair(int &remoteFd)
+{
+	int fds[2];
+
+	// Sequential packets keep the boundaries of every value written
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0)
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Failed to create socket pair: %s", strerror(errno));
+		return -1;
+	}
+
+	remoteFd = fds[1];
+	return fds[0];
+}
+
+static guint addAcquiredSocketWatch(int fd, GIOCondition condition, GIOFunc func, gpointer user_data)
+{
+	GIOChannel *channel = g_io_channel_unix_new(fd);
+	guint watch = g_io_add_watch(channel, condition, func, user_data);
+	g_io_channel_unref(channel);
+	return watch;
+}
+
+static void returnAcquiredSocket(GDBusMethodInvocation *invocation, int remoteFd, uint16_t mtu)
+{
+	GError *error = 0;
+	GUnixFDList *fdList = g_unix_fd_list_new();
+	g_unix_fd_list_append(fdList, remoteFd, &error);
+	close(remoteFd);
+
+	if (error)
+	{
+		ERROR(MSGID_GATT_PROFILE_ERROR, 0, "Failed to pass socket: %s", error->message);
+		g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", error->message);
+		g_error_free(error);
+		g_object_unref(fdList);
+		return;
+	}
+
+	g_dbus_method_invocation_return_value_with_unix_fd_list(invocation, g_variant_new("(hq)", 0, mtu), fdList);
+	g_object_unref(fdList);
+}
+
+gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onHandleAcquireWrite(BluezGattCharacteristic1 *object,
+																				GDBusMethodInvocation *invocation,
+																				GVariant *arg_options,
+																				gpointer user_data)
+{
+	Bluez5GattLocalCharacteristic *localCharacteristic = static_cast<Bluez5GattLocalCharacteristic*>(user_data);
+
+	if (localCharacteristic->mWriteFd >= 0)
+	{
+		g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotPermitted", "Write already acquired");
+		return true;
+	}
+
+	uint16_t mtu = 0;
+	g_variant_lookup(arg_options, "mtu", "q", &mtu);
+
+	int remoteFd = -1;
+	int localFd = createAcquiredSocketPair(remoteFd);
+	if (localFd < 0)
+	{
+		g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", "Failed to create socket");
+		return true;
+	}
+
+	localCharacteristic->mWriteFd = localFd;
+	localCharacteristic->mWriteWatch = addAcquiredSocketWatch(localFd, (GIOCondition) (G_IO_IN | G_IO_HUP | G_IO_ERR),
+	                                                          onAcquiredWriteIo, localCharacteristic);
+	bluez_gatt_characteristic1_set_write_acquired(object, TRUE);
+
+	returnAcquiredSocket(invocation, remoteFd, mtu);
+	return true;
+}
+
+gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onHandleAcquireNotify(BluezGattCharacteristic1 *object,
+																				 GDBusMethodInvocation *invocation,
+																				 GVariant *arg_options,
+																				 gpointer user_data)
+{
+	Bluez5GattLocalCharacteristic *localCharacteristic = static_cast<Bluez5GattLocalCharacteristic*>(user_data);
+
+	if (localCharacteristic->mNotifyFd >= 0)
+	{
+		g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotPermitted", "Notify already acquired");
+		return true;
+	}
+
+	uint16_t mtu = 0;
+	g_variant_lookup(arg_options, "mtu", "q", &mtu);
+
+	int remoteFd = -1;
+	int localFd = createAcquiredSocketPair(remoteFd);
+	if (localFd < 0)
+	{
+		g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", "Failed to create socket");
+		return true;
+	}
+
+	// BlueZ closes its end once the last client unsubscribes
+	localCharacteristic->mNotifyFd = localFd;
+	localCharacteristic->mNotifyMtu = mtu;
+	localCharacteristic->mNotifyWatch = addAcquiredSocketWatch(localFd, (GIOCondition) (G_IO_HUP | G_IO_ERR),
+	                                                           onAcquiredNotifyIo, localCharacteristic);
+	bluez_gatt_characteristic1_set_notify_acquired(object, TRUE);
+
+	returnAcquiredSocket(invocation, remoteFd, mtu);
+	return true;
+}
+
+gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onAcquiredWriteIo(GIOChannel *channel, GIOCondition condition, gpointer user_data)
+{
+	Bluez5GattLocalCharacteristic *localCharacteristic = static_cast<Bluez5GattLocalCharacteristic*>(user_data);
+	bool closed = (condition & (G_IO_HUP | G_IO_ERR));
+
+	if (condition & G_IO_IN)
+	{
+		// Every packet is one write, read all of them which are queued
+		unsigned char buffer[GATT_MAX_ATTRIBUTE_VALUE_LENGTH];
+
+		while (true)
+		{
+			ssize_t length = read(localCharacteristic->mWriteFd, buffer, sizeof(buffer));
+			if (length > 0)
+			{
+				localCharacteristic->mGattProfile->onHandleCharacteriscticWriteValue(localCharacteristic->mInterface,
+				                                                                     BluetoothGattValue(buffer, buffer + length));
+				continue;
+			}
+
+			if (length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				closed = true;
+
+			if (length == 0 || errno != EINTR)
+				break;
+		}
+	}
+
+	if (closed)
+	{
+		// The source is removed when returning FALSE, don't remove it twice
+		localCharacteristic->mWriteWatch = 0;
+		localCharacteristic->releaseAcquiredWrite();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::onAcquiredNotifyIo(GIOChannel *channel, GIOCondition condition, gpointer user_data)
+{
+	Bluez5GattLocalCharacteristic *localCharacteristic = static_cast<Bluez5GattLocalCharacteristic*>(user_data);
+
+	localCharacteristic->mNotifyWatch = 0;
+	localCharacteristic->releaseAcquiredNotify();
+	return FALSE;
+}
+
+void Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::releaseAcquiredWrite()
+{
+	if (mWriteWatch)
+	{
+		g_source_remove(mWriteWatch);
+		mWriteWatch = 0;
+	}
+
+	if (mWriteFd >= 0)
+	{
+		close(mWriteFd);
+		mWriteFd = -1;
+
+		if (mInterface)
+			bluez_gatt_characteristic1_set_write_acquired(mInterface, FALSE);
+	}
+}
+
+void Bluez5ProfileGatt::Bluez5GattLocalCharacteristic::releaseAcquiredNotify()
+{
+	if (mNotifyWatch)
+	{
+		g_source_remove(mNotifyWatch);
+		mNotifyWatch = 0;
+	}
+
+	if (mNotifyFd >= 0)
+	{
+		close(mNotifyFd);
+		mNotifyFd = -1;
+
+		if (mInterface)
+			bluez_gatt_characteristic1_set_notify_acquired(mInterface, FALSE);
+	}
+}
+
 gboolean Bluez5ProfileGatt::Bluez5GattLocalDescriptor::onHandleReadValue(BluezGattDescriptor1* interface,
 																		 GDBusMethodInvocation *invocation,
 																		 GVariant *arg_options,
@@ -22,9 +22,15 @@
 #include <gio/gio.h>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <bluetooth-sil-api.h>
 #include "bluez5profilebase.h"
+#include "bluez5gattcache.h"
+#include "bluez5gattreconnectscheduler.h"
+#include "bluez5gattrequestqueue.h"
+#include "bluez5gattconnectiontable.h"
+#include "bluez5gattremoteattribute.h"
 
 extern "C" {
 #include "freedesktop-interface.h"
@@ -36,6 +42,44 @@ class GattRemoteDescriptor;
 class GattRemoteService;
 class GattRemoteCharacteristic;
 
+typedef std::function<void(const std::string &adapterAddress, const std::string &address,
+                           const BluetoothUuid &service, const BluetoothGattCharacteristicList &values)> GattNotificationBatchCallback;
+typedef std::function<void(uint16_t connId, const BluetoothUuid &service,
+                           const BluetoothGattCharacteristic &characteristic)> GattNotificationHandler;
+typedef std::function<void(const std::string &adapterAddress, const std::string &address,
+                           const BluetoothGattServiceList &services)> GattServicesResolvedCallback;
+
+// Ids assigned to a local service added with addServices. The
+// characteristic and descriptor ids follow the order of the service tree.
+struct GattLocalServiceIds
+{
+	uint16_t serviceId;
+	std::vector<uint16_t> characteristicIds;
+	std::vector<std::vector<uint16_t>> descriptorIds;
+};
+
+typedef std::function<void(BluetoothError error, const std::vector<GattLocalServiceIds> &ids)> GattAddServicesCallback;
+
+// Called when a long read or write starts and when it has completed. BlueZ
+// transfers the value in one call, so there are no intermediate steps: a
+// read reports (0, 0) and (n, n), a write reports (0, n) and (n, n).
+typedef std::function<void(uint32_t transferred, uint32_t total)> GattProgressCallback;
+
+// One write of a transaction started with writeCharacteristics
+struct GattCharacteristicWrite
+{
+	BluetoothUuid service;
+	BluetoothGattCharacteristic characteristic;
+};
+
+// Gets the values a transaction wrote, once it finished
+typedef std::function<void(const std::string &adapterAddress, const std::string &address,
+                           const std::vector<GattCharacteristicWrite> &written)> GattWriteTransactionCallback;
+
+// Provides the value of a local characteristic when a client reads it. The
+// returned value starts at the requested offset, mtu is 0 when unknown.
+typedef std::function<bool(uint16_t offset, uint16_t mtu, BluetoothGattValue &value)> GattLocalValueProvider;
+
 class Bluez5ProfileGatt : public Bluez5ProfileBase,
 	                         public BluetoothGattProfile
 {
@@ -80,6 +124,9 @@ public:
 	void changeCharacteristicWatchStatus(const std::string &address, const BluetoothUuid &service,
 												 const BluetoothUuid &characteristic, bool enabled,
 												 BluetoothResultCallback callback);
+	void changeCharacteristicWatchStatus(const uint16_t &connId, const BluetoothUuid &service,
+												 const BluetoothUuid &characteristic, bool enabled,
+												 BluetoothResultCallback callback);
 	void readCharacteristic(const std::string &address, const BluetoothUuid& service,
 									 const BluetoothUuid &characteristic,
 									 BluetoothGattReadCharacteristicCallback callback);
@@ -94,8 +141,51 @@ public:
 	void readDescriptors(const std::string &address, const BluetoothUuid& service, const BluetoothUuid &characteristic,
 	                             const BluetoothUuidList &descriptors, BluetoothGattReadDescriptorsCallback callback);
 	void updateDeviceProperties(std::string deviceAddress);
+
+	void readLongCharacteristic(const std::string &address, const BluetoothUuid &service, const BluetoothUuid &characteristic,
+	                            BluetoothGattReadCharacteristicCallback callback, GattProgressCallback progress = nullptr);
+	void writeLongCharacteristic(const std::string &address, const BluetoothUuid &service,
+	                             const BluetoothGattCharacteristic &characteristic,
+	                             BluetoothResultCallback callback, GattProgressCallback progress = nullptr,
+	                             bool reliable = false);
+	void writeCharacteristics(const std::string &address, const std::vector<GattCharacteristicWrite> &writes,
+	                          bool reliable, BluetoothResultCallback callback);
+	// Without it the observer gets a value change per written characteristic
+	void setWriteTransactionCallback(GattWriteTransactionCallback callback) { mWriteTransactionCallback = callback; }
+
+	void setReadCachePolicy(const BluetoothUuid &characteristic, const GattReadCachePolicy &policy);
+	GattReadCachePolicy getReadCachePolicy(const BluetoothUuid &characteristic) const;
+	GattReadCacheStatistics getReadCacheStatistics() const { return mReadCacheStatistics; }
+
+	bool setNotificationOptions(const std::string &address, const BluetoothUuid &service,
+	                            const BluetoothUuid &characteristic, const GattNotificationOptions &options);
+	void setNotificationBatchCallback(GattNotificationBatchCallback callback) { mNotificationBatchCallback = callback; }
+	void setNotificationHandler(uint16_t connId, GattNotificationHandler handler);
+
+	// Called once per connection when BlueZ has discovered the whole
+	// attribute database of a device. Without a callback every service is
+	// reported through serviceFound instead, but only once it is complete.
+	void setServicesResolvedCallback(GattServicesResolvedCallback callback) { mServicesResolvedCallback = callback; }
+
+	// Auto-connect devices are retried until auto-connect is turned off for
+	// them, unless an expiry in milliseconds is set
+	void setReconnectExpiry(uint32_t expiry);
+	bool getReconnectStatistics(const std::string &address, GattReconnectStatistics &statistics) const;
+
 	uint16_t getConnectId(const std::string &address);
 	std::string getAddress(const uint16_t &connId);
+	std::vector<GattConnectionInfo> listConnections();
+
+	// Counters and latency histograms of the requests to a device, in total
+	// or for one of its characteristics. nullptr until the first request
+	// and once the device was removed. Without a service the first
+	// characteristic with the UUID is taken.
+	std::shared_ptr<const GattOperationMetrics> getMetrics(const std::string &address) const;
+	std::shared_ptr<const GattOperationMetrics> getMetrics(const std::string &address, const BluetoothUuid &characteristic) const;
+	std::shared_ptr<const GattOperationMetrics> getMetrics(const std::string &address, const BluetoothUuid &service,
+	                                                       const BluetoothUuid &characteristic) const;
+	std::string getMetricsJson() const { return mMetrics.toJson(); }
+	bool dumpMetrics(const std::string &path) const;
 	BluetoothGattCharacteristic readCharacteristic(const std::string &address, const BluetoothUuid& service,
 									 const BluetoothUuid &characteristic);
 	BluetoothGattCharacteristicList readCharacteristics(const std::string &address, const BluetoothUuid& service,
@@ -110,6 +200,9 @@ public:
 	BluetoothGattDescriptor readDescValue(GattRemoteService *service, GattRemoteCharacteristic* remoteCharacteristic, GattRemoteDescriptor* remoteDescriptor, const BluetoothUuid &descriptor);
 	BluetoothGattCharacteristic readCharValue(GattRemoteService* remoteService, GattRemoteCharacteristic* remoteCharacteristic, const BluetoothUuid &characteristic);
 	void addService(uint16_t appId, const BluetoothGattService &service, BluetoothGattAddCallback callback);
+	void addServices(uint16_t appId, const BluetoothGattServiceList &services, GattAddServicesCallback callback);
+	bool setLocalValueProvider(uint16_t appId, uint16_t serviceId, uint16_t charId, GattLocalValueProvider provider);
+	bool notifyLocalCharacteristicValue(uint16_t appId, uint16_t serviceId, uint16_t charId, const BluetoothGattValue &value);
 	void removeService(uint16_t appId, uint16_t serviceId, BluetoothResultCallback callback);
 
 	void addDescriptor(uint16_t appId, uint16_t serviceId, const BluetoothGattDescriptor &descriptor, BluetoothGattAddCallback callback);
@@ -118,11 +211,12 @@ public:
 	void startService(uint16_t appId, uint16_t serviceId, BluetoothGattTransportMode mode, BluetoothResultCallback callback);
 	void onCharacteristicPropertiesChanged(GattRemoteCharacteristic* characteristic, GVariant* changed_properties);
 	void onHandleCharacteriscticWriteValue(BluezGattCharacteristic1* interface, GVariant* charValue);
+	void onHandleCharacteriscticWriteValue(BluezGattCharacteristic1* interface, const BluetoothGattValue &charValue);
 	void onHandleDescrptorWriteValue(BluezGattDescriptor1* interface, GVariant* descValue);
 
 	static gboolean handleRelease(BluezGattProfile1 *proxy, GDBusMethodInvocation *invocation, gpointer user_data);
 	static void handleBusAcquired(GDBusConnection *connection, const gchar *name, gpointer user_data);
-	static gboolean autoConnTimeoutHandler(gpointer user_data);
+	static gboolean notificationFlushTimeout(gpointer user_data);
 
 private:
 
@@ -151,18 +245,40 @@ private:
 	class Bluez5GattLocalCharacteristic
 	{
 		public:
-			Bluez5GattLocalCharacteristic(GDBusObject *object):
+			Bluez5GattLocalCharacteristic(GDBusObject *object, Bluez5ProfileGatt *gattProfile):
 			mCharObject(object),
-			mInterface(nullptr)
+			mInterface(nullptr),
+			mGattProfile(gattProfile),
+			mWriteFd(-1),
+			mWriteWatch(0),
+			mNotifyFd(-1),
+			mNotifyWatch(0),
+			mNotifyMtu(0)
 			{
 			}
 			static gboolean onHandleReadValue(BluezGattCharacteristic1* obj, GDBusMethodInvocation *invocation, GVariant *arg_options, gpointer user_data);
 			static gboolean onHandleWriteValue(BluezGattCharacteristic1* interface, GDBusMethodInvocation *invocation, GVariant *arg_value, GVariant *arg_options, gpointer user_data);
 			static gboolean onHandleStartNotify(BluezGattCharacteristic1 *object, GDBusMethodInvocation *invocation, gpointer user_data);
 			static gboolean onHandleStopNotify(BluezGattCharacteristic1 *object, GDBusMethodInvocation *invocation, gpointer user_data);
+			static gboolean onHandleAcquireWrite(BluezGattCharacteristic1 *object, GDBusMethodInvocation *invocation, GVariant *arg_options, gpointer user_data);
+			static gboolean onHandleAcquireNotify(BluezGattCharacteristic1 *object, GDBusMethodInvocation *invocation, GVariant *arg_options, gpointer user_data);
+			static gboolean onAcquiredWriteIo(GIOChannel *channel, GIOCondition condition, gpointer user_data);
+			static gboolean onAcquiredNotifyIo(GIOChannel *channel, GIOCondition condition, gpointer user_data);
+			void releaseAcquiredWrite();
+			void releaseAcquiredNotify();
 			GDBusObject *mCharObject;
 			BluezGattCharacteristic1 *mInterface;
+			Bluez5ProfileGatt *mGattProfile;
 			GattLocalDescriptorsMap mDescriptors;
+			GattLocalValueProvider mValueProvider;
+
+			// Sockets handed to BlueZ with AcquireWrite/AcquireNotify
+			int mWriteFd;
+			guint mWriteWatch;
+			int mNotifyFd;
+			guint mNotifyWatch;
+			// Limits the values sent through the socket
+			uint16_t mNotifyMtu;
 	};
 
 	class Bluez5GattLocalService
@@ -187,19 +303,28 @@ private:
 	void setGdbusConnection(GDBusConnection *conn) { mConn = conn; }
 	void registerLocalApplication(BluetoothResultCallback callback, const std::string &objPath, bool unRegisterFirst);
 	void createObjectManagers();
+	Bluez5GattLocalService* createLocalService(const std::string &serviceObjPath, const BluetoothGattService &service);
+	Bluez5GattLocalCharacteristic* createLocalCharacteristic(const std::string &charObjPath, const std::string &serviceObjPath,
+	                                                         const BluetoothGattCharacteristic &characteristic);
+	Bluez5GattLocalDescriptor* createLocalDescriptor(const std::string &descObjPath, const std::string &charObjPath,
+	                                                 const BluetoothGattDescriptor &descriptor);
 	void removeLocalServices(Bluez5GattLocalService *service);
 	void removeLocalCharacteristics(Bluez5GattLocalService *service);
+	void removeLocalCharacteristic(Bluez5GattLocalCharacteristic *characteristic);
 	void removeLocalDescriptors(Bluez5GattLocalCharacteristic *characteristic);
+	void removeLocalDescriptor(Bluez5GattLocalDescriptor *descriptor);
 	void notifyCharacteristicValueChanged(uint16_t serverId, uint16_t serviceId, BluetoothGattCharacteristic characteristic, uint16_t charId);
 	void notifyDescriptorValueChanged(uint16_t appId, uint16_t serviceId, uint16_t descId, BluetoothGattDescriptor descriptor, uint16_t charId);
 	GattLocalDescriptorsMap* getLocalDescriptorList(uint16_t appId, uint16_t serviceId, uint16_t charId);
+	Bluez5GattLocalCharacteristic* findLocalCharacteristic(uint16_t appId, uint16_t serviceId, uint16_t charId);
 	void updatePropertyFlags(const BluetoothGattCharacteristic &characteristic, const char **propertyflags);
 	void updatePermissionFlags(const BluetoothGattDescriptor &descriptor, const char **permissionflags);
 	void handleAutoConnectDevAdd(const std::string & objPath);
 	void handleAutoConnectDevRem(const std::string & address);
 	void handleAutoConnectReq(const bool& autoConnection, const std::string& address, const uint16_t& appId);
 	void handleAutoConnTimeout(const std::string& address);
-	std::unordered_map<std::string, std::pair<guint, uint16_t>> mAutoConnDevMap;
+	bool handleAutoConnAttempt(const std::string& address, Bluez5GattReconnectScheduler::ConnectResultCallback callback);
+	std::unordered_map<std::string, uint16_t> mAutoConnDevMap;
 
 	id_type nextAppId();
 	id_type nextServiceId();
@@ -222,25 +347,110 @@ private:
 	void removeRemoteGattDescriptor(const std::string &descriptorObjectPath);
 
 	GattRemoteService* getRemoteGattService(std::string& serviceObjectPath);
-	void updateRemoteDeviceServices();
+
+	struct PendingGattObjects;
+	std::string getDeviceObjectPath(const std::string &objectPath);
+	bool getServicesResolved(const std::string &deviceObjectPath);
+	PendingGattObjects* getPendingGattObjects(const std::string &objectPath);
+	void removePendingGattObject(const std::string &objectPath);
+	void resolveDeviceServices(const std::string &deviceObjectPath);
+	GattNotificationSubscription* getNotificationSubscription(GattRemoteCharacteristic *characteristic);
+	void deliverNotification(GattRemoteCharacteristic *characteristic, const BluetoothGattValue &value);
+	void flushNotifications(GattRemoteCharacteristic *characteristic);
+	void notifySubscribers(GattNotificationSubscription *subscription, const BluetoothGattCharacteristic &characteristic);
+	void changeNotificationSubscription(uint32_t subscriber, GattRemoteCharacteristic *characteristic, bool enabled,
+	                                    BluetoothResultCallback callback);
+	void updateNotifyState(GattRemoteCharacteristic *characteristic);
+	void removeNotificationSubscriber(uint16_t connId, const std::string &address);
+	GattRemoteCharacteristic* findRemoteCharacteristic(const std::string &characteristicObjectPath);
+	void completeCharacteristicWrite(const std::string &address, const BluetoothUuid &service,
+	                                 const BluetoothGattCharacteristic &characteristic, bool notifyObserver = true);
+	struct WriteTransaction;
+	void writeTransactionValue(const std::shared_ptr<WriteTransaction> &transaction, size_t index);
+	void onTransactionValueWritten(const std::shared_ptr<WriteTransaction> &transaction, size_t index, bool success);
+	void finishWriteTransaction(const std::shared_ptr<WriteTransaction> &transaction);
+	void updateRemoteDeviceServices(const std::string &address);
+	void updateRemoteService(GattRemoteService *service);
+	void removeServiceDescriptor(GattRemoteService *service, size_t characteristicIndex, size_t descriptorIndex);
+	void updateRemoteCharacteristicValue(const std::string &address, const BluetoothUuid &service,
+	                                     const BluetoothUuid &characteristic, const BluetoothGattValue &value);
+	void updateRemoteDescriptorValue(const std::string &address, const BluetoothUuid &service,
+	                                 const BluetoothUuid &characteristic, const BluetoothUuid &descriptor,
+	                                 const BluetoothGattValue &value);
+
+	const BluetoothGattServiceList* getCachedDeviceServices(const std::string &address);
+	void storeAttributeCache(const std::string &address);
+	void validateAttributeCache(const std::string &address);
+	void removeAttributeCache(const std::string &address);
 
 	static void handleObjectAdded(GDBusObjectManager *objectManager, GDBusObject *object,
 									void *user_data);
 	static void handleObjectRemoved(GDBusObjectManager *objectManager, GDBusObject *object,
 									void *user_data);
+	static void handleInterfacePropertiesChanged(GDBusObjectManagerClient *objectManager, GDBusObjectProxy *objectProxy,
+	                                             GDBusProxy *interfaceProxy, GVariant *changedProperties,
+	                                             GStrv invalidatedProperties, gpointer user_data);
 
 	guint mBusId;
 	id_type mLastCharId;
 	GDBusConnection *mConn;
 	Bluez5Adapter *mAdapter;
 	GDBusObjectManagerServer *mObjectManagerGattServer;
+	bool mLocalApplicationRegistered;
 	GDBusObjectManager *mObjectManager;
+	Bluez5GattReconnectScheduler mReconnectScheduler;
 
 	typedef std::vector<GattRemoteService*> GattServiceList;
-	std::unordered_map<id_type, std::string> mConnectedDevices;
+	Bluez5GattConnectionTable mConnections;
 	std::unordered_map<id_type, std::unique_ptr <BluezGattLocalApplication>> mGattLocalApplications;
 	std::unordered_map<std::string, GattServiceList> mDeviceServicesMap;
 	std::unordered_map<std::string, BluetoothGattServiceList> mRemoteDeviceServicesMap;
+
+	// Attribute objects of a device which BlueZ is still discovering, keyed
+	// by the object path of the device. They are only turned into remote
+	// services once Device1.ServicesResolved is set.
+	struct PendingGattObjects
+	{
+		std::vector<std::string> services;
+		std::vector<std::string> characteristics;
+		std::vector<std::string> descriptors;
+	};
+	std::unordered_map<std::string, PendingGattObjects> mPendingGattObjects;
+	bool mResolvingServices;
+	GattServicesResolvedCallback mServicesResolvedCallback;
+
+	struct WriteTransaction
+	{
+		std::string address;
+		std::vector<GattCharacteristicWrite> writes;
+		std::vector<std::string> objectPaths;
+		std::vector<bool> written;
+		size_t outstanding;
+		bool reliable;
+		bool failed;
+		BluetoothResultCallback callback;
+		Bluez5GattRequestQueue::CompletionCallback done;
+	};
+
+	struct CachedDeviceServices
+	{
+		BluetoothGattServiceList services;
+		GattDatabaseHash hash;
+	};
+
+	Bluez5GattCache mAttributeCache;
+	std::unordered_map<std::string, CachedDeviceServices> mCachedDeviceServicesMap;
+	std::unordered_set<std::string> mAttributeCacheStored;
+
+	std::unordered_map<std::string, GattReadCachePolicy> mReadCachePolicies;
+	GattReadCacheStatistics mReadCacheStatistics;
+
+	GattNotificationBatchCallback mNotificationBatchCallback;
+	GattWriteTransactionCallback mWriteTransactionCallback;
+	std::unordered_map<uint16_t, GattNotificationHandler> mNotificationHandlers;
+
+	Bluez5GattRequestQueue mRequestQueue;
+	Bluez5GattMetrics mMetrics;
 };
 
 #endif // BLUEZ5PROFILEGATT_H
@@ -14,6 +14,10 @@
 //
 // SPDX-License-Identifier: Apache-2.0
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
 #include "bluez5profilespp.h"
 #include "logging.h"
 #include "bluez5adapter.h"
@@ -25,8 +29,19 @@
 const std::string BLUETOOTH_PROFILE_SPP_UUID = "00001101-0000-1000-8000-00805f9b34fb";
 const std::string BASE_OBJ_PATH = "/bluetooth/profile/serial_port/";
 
+// Channel health is checked four times per timeout, but not more often than this
+#define SPP_HEALTH_CHECK_MIN_INTERVAL 100 // ms
+
+// RFCOMM channels registered for new channels unless configured otherwise
+#define SPP_DEFAULT_RFCOMM_CHANNELS 22, 6
+#define SPP_RFCOMM_CHANNEL_MIN 1
+#define SPP_RFCOMM_CHANNEL_MAX 30
+
+// Bytes read per wakeup before the main loop gets to run other sources
+#define SPP_RX_WAKEUP_BUDGET (64 * 1024)
+
 Bluez5ProfileSpp::Bluez5ProfileSpp(Bluez5Adapter *adapter):
-	Bluez5ProfileBase(adapter, BLUETOOTH_PROFILE_SPP_UUID), mAdapter(adapter), mConn(0)
+	Bluez5ProfileBase(adapter, BLUETOOTH_PROFILE_SPP_UUID), mAdapter(adapter), mConn(0), mHealthTimer(0), mIoWorkerEnabled(false)
 {
 	GError *error = nullptr;
 	mConn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
@@ -35,23 +50,57 @@ Bluez5ProfileSpp::Bluez5ProfileSpp(Bluez5Adapter *adapter):
 		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to connect on system bus %s", error->message);
 		g_error_free(error);
 	}
-	initialiseChannelIds();
+	resetRfcommChannels();
 }
 
 Bluez5ProfileSpp::~Bluez5ProfileSpp()
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	if (mHealthTimer)
+		g_source_remove(mHealthTimer);
 }
 
-void Bluez5ProfileSpp::initialiseChannelIds()
+void Bluez5ProfileSpp::resetRfcommChannels()
 {
-	mChannelIdList = {
-		{22, false},
-		{6 , false},
-	};
+	if (mRfcommChannels.empty())
+		mRfcommChannels = { SPP_DEFAULT_RFCOMM_CHANNELS };
+
+	mFreeRfcommChannels.clear();
+	for (auto channel = mRfcommChannels.rbegin(); channel != mRfcommChannels.rend(); ++channel)
+	{
+		uint8_t rfcommChannel = *channel;
+		auto inUse = [rfcommChannel](SppDeviceInfo *deviceInfo) {
+			return deviceInfo->mRfcommChannel == rfcommChannel;
+		};
+
+		if (!mConnectedDevices.findIf(inUse))
+			mFreeRfcommChannels.push_back(rfcommChannel);
+	}
+}
+
+BluetoothError Bluez5ProfileSpp::setChannelLimits(const std::vector<uint8_t> &rfcommChannels, size_t maxChannels)
+{
+	if (rfcommChannels.empty() || !maxChannels || maxChannels > ConnectedDevice::MAX_SLOTS)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	for (size_t n = 0; n < rfcommChannels.size(); n++)
+	{
+		if (rfcommChannels[n] < SPP_RFCOMM_CHANNEL_MIN || rfcommChannels[n] > SPP_RFCOMM_CHANNEL_MAX)
+			return BLUETOOTH_ERROR_PARAM_INVALID;
+
+		if (std::find(rfcommChannels.begin(), rfcommChannels.begin() + n, rfcommChannels[n]) != rfcommChannels.begin() + n)
+			return BLUETOOTH_ERROR_PARAM_INVALID;
+	}
+
+	mRfcommChannels = rfcommChannels;
+	mConnectedDevices.setLimit(maxChannels);
+	resetRfcommChannels();
+
+	return BLUETOOTH_ERROR_NONE;
 }
 
-int Bluez5ProfileSpp::registerProfile(spDeviceInfo &deviceInfo, std::string objPath, BluezProfileManager1 *proxy)
+int Bluez5ProfileSpp::registerProfile(SppDeviceInfo *deviceInfo, std::string objPath, BluezProfileManager1 *proxy)
 {
 	GVariant *profileVariant;
 	GVariantBuilder profileBuilder;
@@ -72,7 +121,7 @@ int Bluez5ProfileSpp::registerProfile(spDeviceInfo &deviceInfo, std::string objP
 
 	g_variant_builder_open(&profileBuilder, G_VARIANT_TYPE("{sv}"));
 	g_variant_builder_add (&profileBuilder, "s", "Channel");
-	g_variant_builder_add (&profileBuilder, "v", g_variant_new_uint16(deviceInfo->mChannelId));
+	g_variant_builder_add (&profileBuilder, "v", g_variant_new_uint16(deviceInfo->mRfcommChannel));
 	g_variant_builder_close(&profileBuilder);
 
 	g_variant_builder_open(&profileBuilder, G_VARIANT_TYPE("{sv}"));
@@ -156,21 +205,13 @@ void Bluez5ProfileSpp::getProperty(const std::string &address, BluetoothProperty
 
 void Bluez5ProfileSpp::getChannelState(const std::string &address, const std::string &uuid, BluetoothChannelStateResultCallback callback)
 {
-	auto deviceIterator = mConnectedDevices.begin();
 	std::string lowerCaseAddress = convertAddressToLowerCase(address);
 
-	while (deviceIterator != mConnectedDevices.end())
-	{
-		if ((deviceIterator->second->mDeviceAddress == lowerCaseAddress) && (deviceIterator->second->mUuid == uuid))
-		{
-			callback(BLUETOOTH_ERROR_NONE, true);
-			return;
-		}
-
-		++deviceIterator;
-	}
+	auto matchChannel = [&lowerCaseAddress, &uuid](SppDeviceInfo *deviceInfo) {
+		return (deviceInfo->mDeviceAddress == lowerCaseAddress) && (deviceInfo->mUuid == uuid);
+	};
 
-	callback(BLUETOOTH_ERROR_NONE, false);
+	callback(BLUETOOTH_ERROR_NONE, mConnectedDevices.findIf(matchChannel) != nullptr);
 }
 
 gboolean Bluez5ProfileSpp::onHandleNewConnection (BluezProfile1 *interface,
@@ -243,8 +284,31 @@ gboolean Bluez5ProfileSpp::handleNewConnection (GDBusMethodInvocation *invocatio
 
 	devieInfo->mAdapterAddress = mAdapter->getAddress();
 
+	// Neither direction may ever block the main loop
+	int flags = fcntl(devieInfo->mSockfd, F_GETFL);
+	if (flags < 0 || fcntl(devieInfo->mSockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to make socket non-blocking: %s", strerror(errno));
+
 	getSppObserver()->channelStateChanged(mAdapter->getAddress(), deviceAddress, devieInfo->mUuid, devieInfo->mChannelId, true);
 
+	const SppReceiveOptions &options = devieInfo->mReceiveOptions;
+	devieInfo->mRxBuffer.reset(new Bluez5SppRingBuffer(options.bufferSize, options.maxBufferSize));
+	setupFramer(devieInfo);
+	devieInfo->mTxQueuedBytes = 0;
+	devieInfo->mTxWrittenBytes = 0;
+	devieInfo->mTxBlocked = false;
+	devieInfo->mStats = SppChannelStats();
+	devieInfo->mLastRxTime = g_get_monotonic_time();
+	devieInfo->mLastTxTime = devieInfo->mLastRxTime;
+	devieInfo->mTxProgressTime = devieInfo->mLastRxTime;
+	devieInfo->mForwarder.reset();
+
+	if (mIoWorkerEnabled && attachIoWorker(devieInfo))
+	{
+		DEBUG("Channel %d is served by the SPP I/O worker", devieInfo->mChannelId);
+		return TRUE;
+	}
+
 	devieInfo->mChannel = g_io_channel_unix_new (devieInfo->mSockfd);
 
 	g_io_channel_set_encoding(devieInfo->mChannel, NULL, &error);
@@ -254,12 +318,21 @@ gboolean Bluez5ProfileSpp::handleNewConnection (GDBusMethodInvocation *invocatio
 		g_error_free(error);
 	}
 
-	devieInfo->mIoWatchId = g_io_add_watch (devieInfo->mChannel, G_IO_IN, ioCallback, devieInfo);
+	devieInfo->mTxBuffer.reset(new Bluez5SppRingBuffer(options.bufferSize, devieInfo->mTransmitOptions.highWatermark));
+	watchChannel(devieInfo);
 
 	DEBUG("devieInfo->mIoWatchId = %d", devieInfo->mIoWatchId);
 	return TRUE;
 }
 
+void Bluez5ProfileSpp::watchChannel(SppDeviceInfo *deviceInfo)
+{
+	if (!deviceInfo->mChannel || deviceInfo->mIoWatchId)
+		return;
+
+	deviceInfo->mIoWatchId = g_io_add_watch (deviceInfo->mChannel, (GIOCondition) (G_IO_IN | G_IO_HUP | G_IO_ERR), ioCallback, deviceInfo);
+}
+
 gboolean Bluez5ProfileSpp::handleRequestDisconnection (BluezProfile1 *interface, GDBusMethodInvocation *invocation, const gchar *device, SppDeviceInfo* devieInfo)
 {
 	GError *error = nullptr;
@@ -267,12 +340,28 @@ gboolean Bluez5ProfileSpp::handleRequestDisconnection (BluezProfile1 *interface,
 	UNUSED(device);
 	UNUSED(interface);
 
+	// The forwarder is done with the socket before it is closed
+	if (isForwarding(devieInfo))
+		finishForwarding(devieInfo, SPP_FORWARDING_CHANNEL_CLOSED);
+
+	// Whatever is still buffered arrived before the disconnection, that
+	// includes what the I/O worker read but didn't report yet
+	if (devieInfo->mIoWorkerChannel)
+		mIoWorker->dispatchEvents();
+	deliverRxData(devieInfo);
+	if (devieInfo->mFramer && devieInfo->mRxBuffer)
+		devieInfo->mFramer->finish(*devieInfo->mRxBuffer);
+	devieInfo->mRxBuffer.reset();
+	failTxData(devieInfo);
+	detachIoWorker(devieInfo);
+
 	getSppObserver()->channelStateChanged(devieInfo->mAdapterAddress, devieInfo->mDeviceAddress, devieInfo->mUuid, devieInfo->mChannelId, false);
 
 	if (devieInfo->mChannel)
 	{
 		if (devieInfo->mIoWatchId)
 			g_source_remove(devieInfo->mIoWatchId);
+		devieInfo->mIoWatchId = 0;
 		g_io_channel_shutdown(devieInfo->mChannel, TRUE, &error);
 		g_io_channel_unref (devieInfo->mChannel);
 		if (error)
@@ -308,8 +397,7 @@ gboolean Bluez5ProfileSpp::handleRequestDisconnection (BluezProfile1 *interface,
 		};
 		bluez_profile_manager1_call_unregister_profile(mAdapter->getProfileManager(), objPath.c_str(), NULL, glibAsyncMethodWrapper, new GlibAsyncFunctionWrapper(unRegisterCallback));
 		g_object_unref(devieInfo->mInterface);
-		removeConnectedDevice(devieInfo->mChannelId);
-		deallocateChannelId(devieInfo->mChannelId);
+		removeDeviceInfo(devieInfo->mChannelId);
 	}
 
 	return TRUE;
@@ -317,61 +405,213 @@ gboolean Bluez5ProfileSpp::handleRequestDisconnection (BluezProfile1 *interface,
 
 gboolean Bluez5ProfileSpp::handleRelease()
 {
-	auto deviceIterator = mConnectedDevices.begin();
-
-	while (deviceIterator != mConnectedDevices.end())
-	{
-		GError *error = nullptr;
-		g_io_channel_shutdown(deviceIterator->second->mChannel, TRUE, &error);
-		if (error)
+	mConnectedDevices.forEach([this](SppDeviceInfo *deviceInfo) {
+		deviceInfo->mForwarder.reset();
+		detachIoWorker(deviceInfo);
+		if (deviceInfo->mChannel)
 		{
-			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to release profile on system bus %s",error->message);
-			g_error_free(error);
+			GError *error = nullptr;
+			g_io_channel_shutdown(deviceInfo->mChannel, TRUE, &error);
+			if (error)
+			{
+				ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to release profile on system bus %s",error->message);
+				g_error_free(error);
+			}
+			g_io_channel_unref (deviceInfo->mChannel);
 		}
-		g_io_channel_unref (deviceIterator->second->mChannel);
-		g_object_unref(deviceIterator->second->mInterface);
-		++deviceIterator;
-	}
+		g_object_unref(deviceInfo->mInterface);
+	});
 
 	mConnectedDevices.clear();
+	resetRfcommChannels();
 	return TRUE;
 }
 
 gboolean Bluez5ProfileSpp::ioCallback(GIOChannel * io, GIOCondition condition, gpointer data)
 {
+	UNUSED(io);
 	SppDeviceInfo* sppDevice = static_cast<SppDeviceInfo*>(data);
 
-	return sppDevice->mSppProfile->handleRxData(io, condition, sppDevice->mChannelId, sppDevice->mAdapterAddress);
+	return sppDevice->mSppProfile->handleRxData(sppDevice, condition);
 }
 
-gboolean Bluez5ProfileSpp::handleRxData(GIOChannel *io, GIOCondition condition, BluetoothSppChannelId channelId, const std::string &adapterAddress)
+gboolean Bluez5ProfileSpp::handleRxData(SppDeviceInfo *deviceInfo, GIOCondition condition)
 {
-	char buf[1024] = { 0 };
-	gsize bytesRead = 0;
-	GError *error = nullptr;
 	UNUSED(condition);
+	Bluez5SppRingBuffer &buffer = *deviceInfo->mRxBuffer;
+	bool closed = false;
+	size_t burst = 0;
 
-	do
+	// Drain the socket so a single wakeup picks up everything that arrived,
+	// up to a budget. Whatever is left over wakes us up again right away.
+	while (burst < SPP_RX_WAKEUP_BUDGET)
 	{
-		GIOStatus status = g_io_channel_read_chars (io, buf, sizeof(buf), &bytesRead, &error);
-
-		if (status == G_IO_STATUS_NORMAL && bytesRead > 0)
+		// A full buffer grows, once it can't anymore its content is handed
+		// on right away
+		if (!buffer.freeSpace() && !buffer.grow())
+			deliverRxData(deviceInfo);
+
+		struct iovec regions[2];
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = regions;
+		message.msg_iovlen = buffer.getFreeRegions(regions);
+
+		ssize_t bytesRead = recvmsg(deviceInfo->mSockfd, &message, MSG_DONTWAIT);
+		deviceInfo->mStats.io.readCalls++;
+		if (bytesRead > 0)
 		{
-			getSppObserver()->dataReceived(channelId, adapterAddress, (const uint8_t *)buf, bytesRead);
-			DEBUG("received [%s] bytes_read[%lu]", buf, bytesRead);
+			buffer.commit(bytesRead);
+			deviceInfo->mStats.io.bytesRead += bytesRead;
+			burst += bytesRead;
+			continue;
 		}
 
-		if (error)
-		{
-			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to read data due to %s",error->message);
-			g_error_free(error);
-		}
+		if (bytesRead < 0 && errno == EINTR)
+			continue;
+
+		if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		if (bytesRead < 0)
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to read data due to %s", strerror(errno));
+
+		closed = true;
+		break;
+	}
 
-	} while (bytesRead > 0);
+	recordRxBurst(deviceInfo, burst);
+	scheduleRxData(deviceInfo, closed);
+
+	if (closed)
+	{
+		// BlueZ tells us through RequestDisconnection, until then there is
+		// nothing more to read
+		deviceInfo->mIoWatchId = 0;
+		return FALSE;
+	}
 
 	return TRUE;
 }
 
+void Bluez5ProfileSpp::scheduleRxData(SppDeviceInfo *deviceInfo, bool closed)
+{
+	Bluez5SppRingBuffer &buffer = *deviceInfo->mRxBuffer;
+	const SppReceiveOptions &options = deviceInfo->mReceiveOptions;
+
+	if (closed || !options.batchLatency || (options.batchSize && buffer.size() >= options.batchSize))
+		deliverRxData(deviceInfo);
+	else if (!buffer.empty() && !deviceInfo->mRxFlushSource)
+		deviceInfo->mRxFlushSource = g_timeout_add(options.batchLatency, onRxFlushTimeout, deviceInfo);
+}
+
+gboolean Bluez5ProfileSpp::onRxFlushTimeout(gpointer user_data)
+{
+	SppDeviceInfo* deviceInfo = static_cast<SppDeviceInfo*>(user_data);
+
+	deviceInfo->mRxFlushSource = 0;
+	deviceInfo->mSppProfile->deliverRxData(deviceInfo);
+
+	return FALSE;
+}
+
+void Bluez5ProfileSpp::deliverRxData(SppDeviceInfo *deviceInfo)
+{
+	if (deviceInfo->mRxFlushSource)
+	{
+		g_source_remove(deviceInfo->mRxFlushSource);
+		deviceInfo->mRxFlushSource = 0;
+	}
+
+	Bluez5SppRingBuffer *buffer = deviceInfo->mRxBuffer.get();
+	if (!buffer || buffer->empty())
+		return;
+
+	size_t size = buffer->size();
+	if (deviceInfo->mFramer)
+	{
+		auto frameCallback = [this, deviceInfo](const uint8_t *data, size_t size) {
+			deviceInfo->mStats.framesReceived++;
+			getSppObserver()->dataReceived(deviceInfo->mChannelId, deviceInfo->mAdapterAddress, data, size);
+		};
+		deviceInfo->mFramer->process(*buffer, frameCallback);
+	}
+	else
+	{
+		deviceInfo->mStats.framesReceived++;
+		getSppObserver()->dataReceived(deviceInfo->mChannelId, deviceInfo->mAdapterAddress, buffer->linearize(), size);
+		buffer->consume(size);
+	}
+
+	// Lets the I/O worker read on once it was held back
+	if (deviceInfo->mIoWorkerChannel && deviceInfo->mRxBuffer)
+		mIoWorker->acknowledge(deviceInfo->mIoWorkerChannel, size - deviceInfo->mRxBuffer->size());
+}
+
+BluetoothError Bluez5ProfileSpp::setReceiveOptions(const BluetoothSppChannelId channelId, const SppReceiveOptions &options)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo || !options.bufferSize || options.maxBufferSize < options.bufferSize)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	deviceInfo->mReceiveOptions = options;
+	if (deviceInfo->mRxBuffer)
+		deviceInfo->mRxBuffer->setMaxCapacity(getRxBufferLimit(deviceInfo));
+	if (deviceInfo->mIoWorkerChannel)
+		mIoWorker->setReceiveLimit(deviceInfo->mIoWorkerChannel, getRxBufferLimit(deviceInfo));
+
+	return BLUETOOTH_ERROR_NONE;
+}
+
+size_t Bluez5ProfileSpp::getRxBufferLimit(SppDeviceInfo *deviceInfo)
+{
+	// A frame within the size limit has to fit as a whole
+	size_t limit = deviceInfo->mReceiveOptions.maxBufferSize;
+	if (deviceInfo->mFramer)
+		limit = std::max(limit, deviceInfo->mFramer->getBufferSize());
+
+	return limit;
+}
+
+void Bluez5ProfileSpp::setupFramer(SppDeviceInfo *deviceInfo)
+{
+	if (deviceInfo->mFramingOptions.mode == SppFramingOptions::NONE)
+		deviceInfo->mFramer.reset();
+	else
+		deviceInfo->mFramer.reset(new Bluez5SppFramer(deviceInfo->mFramingOptions));
+
+	if (deviceInfo->mRxBuffer)
+		deviceInfo->mRxBuffer->setMaxCapacity(getRxBufferLimit(deviceInfo));
+	if (deviceInfo->mIoWorkerChannel)
+		mIoWorker->setReceiveLimit(deviceInfo->mIoWorkerChannel, getRxBufferLimit(deviceInfo));
+}
+
+BluetoothError Bluez5ProfileSpp::setFramingOptions(const BluetoothSppChannelId channelId, const SppFramingOptions &options)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo || !Bluez5SppFramer::isValid(options))
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	// Data received so far is handed on the way it was meant to be
+	deliverRxData(deviceInfo);
+
+	deviceInfo->mFramingOptions = options;
+	if (deviceInfo->mRxBuffer)
+		setupFramer(deviceInfo);
+
+	return BLUETOOTH_ERROR_NONE;
+}
+
+BluetoothError Bluez5ProfileSpp::getFramingStats(const BluetoothSppChannelId channelId, SppFramingStats &stats)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	stats = deviceInfo->mFramer ? deviceInfo->mFramer->getStats() : SppFramingStats();
+	return BLUETOOTH_ERROR_NONE;
+}
+
 
 void Bluez5ProfileSpp::connectUuid(const std::string &address, const std::string &uuid, BluetoothChannelResultCallback callback)
 {
@@ -383,29 +623,19 @@ void Bluez5ProfileSpp::connectUuid(const std::string &address, const std::string
 		return;
 	}
 
-	BluetoothSppChannelId channelId = allocateChannelId();
-	if (!channelId)
+	SppDeviceInfo *channelInfo = addDeviceInfo(CLIENT, "SerialPort", uuid);
+	if (!channelInfo)
 	{
-		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to allocate Channel Id");
 		callback(BLUETOOTH_ERROR_FAIL, BLUETOOTH_SPP_CHANNEL_ID_INVALID);
 		return;
 	}
 
-	SppDeviceInfo * sppDevInfo = new (std::nothrow) SppDeviceInfo(this, channelId, CLIENT, "SerialPort", uuid);
-	if (!sppDevInfo)
-	{
-		//Remove ChannelId used
-		deallocateChannelId(channelId);
-		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to allocate memory for sppDevice");
-		callback(BLUETOOTH_ERROR_NOMEM, BLUETOOTH_SPP_CHANNEL_ID_INVALID);
-		return;
-	}
-
-	spDeviceInfo channelInfo(sppDevInfo);
+	BluetoothSppChannelId channelId = channelInfo->mChannelId;
 	BluetoothError error = createSkeletonAndExport(uuid, channelInfo);
 
 	if (error != BLUETOOTH_ERROR_NONE)
 	{
+		removeDeviceInfo(channelId);
 		callback(BLUETOOTH_ERROR_NOT_READY, BLUETOOTH_SPP_CHANNEL_ID_INVALID);
 		return;
 	}
@@ -423,25 +653,17 @@ void Bluez5ProfileSpp::connectUuid(const std::string &address, const std::string
 			bluez_profile_manager1_call_unregister_profile_sync(mAdapter->getProfileManager(), objPath.c_str(), NULL, NULL);
 			if (mInterface)
 				g_object_unref(mInterface);
-			deallocateChannelId(channelId);
+			removeDeviceInfo(channelId);
 			callback(BLUETOOTH_ERROR_NOT_READY, BLUETOOTH_SPP_CHANNEL_ID_INVALID);
 		}
 	};
 
-	this->mConnectedDevices[channelInfo->mChannelId] = std::move(channelInfo);
 	device->connect(uuid, ConnectedCallback);
 }
 
 void Bluez5ProfileSpp::disconnectUuid(const BluetoothSppChannelId channelId, BluetoothResultCallback callback)
 {
-	auto deviceIterator = mConnectedDevices.find(channelId);
-	if (deviceIterator == mConnectedDevices.end())
-	{
-		callback(BLUETOOTH_ERROR_FAIL);
-		return;
-	}
-
-	SppDeviceInfo *sppConnectionInfo = (deviceIterator->second).get();
+	SppDeviceInfo *sppConnectionInfo = getSppDevice(channelId);
 
 	if (!sppConnectionInfo)
 	{
@@ -476,55 +698,577 @@ void Bluez5ProfileSpp::writeData(const BluetoothSppChannelId channelId, const ui
 {
 	DEBUG("%s::%s",__FILE__,__FUNCTION__);
 
-	UNUSED(data);
-	UNUSED(size);
-	auto deviceIterator = mConnectedDevices.find(channelId);
-	if (deviceIterator == mConnectedDevices.end())
+	SppDeviceInfo *sppConnectionInfo = getSppDevice(channelId);
+	if (!sppConnectionInfo || sppConnectionInfo->mSockfd < 0 ||
+	    (!sppConnectionInfo->mTxBuffer && !sppConnectionInfo->mIoWorkerChannel))
 	{
 		callback(BLUETOOTH_ERROR_FAIL);
 		return;
 	}
 
-	SppDeviceInfo *sppConnectionInfo = (deviceIterator->second).get();
-	int status = write(sppConnectionInfo->mSockfd, data, size);
+	// The forwarder is the only writer while it runs
+	if (isForwarding(sppConnectionInfo))
+	{
+		callback(BLUETOOTH_ERROR_BUSY);
+		return;
+	}
+
+	uint64_t pending = sppConnectionInfo->mTxQueuedBytes - sppConnectionInfo->mTxWrittenBytes;
 
-	if (status < 0) {
-		perror("client: write to socket failed!\n");
+	// The worker does all writes, the data is queued with it as a whole
+	if (sppConnectionInfo->mIoWorkerChannel)
+	{
+		if (pending && pending + size > sppConnectionInfo->mTransmitOptions.highWatermark)
+		{
+			sppConnectionInfo->mTxBlocked = true;
+			callback(BLUETOOTH_ERROR_BUSY);
+			return;
+		}
+
+		if (!pending)
+			sppConnectionInfo->mTxProgressTime = g_get_monotonic_time();
+		sppConnectionInfo->mTxQueuedBytes += size;
+		sppConnectionInfo->mStats.framesSent++;
+		sppConnectionInfo->mStats.txQueueHighWater = std::max(sppConnectionInfo->mStats.txQueueHighWater, pending + size);
+		sppConnectionInfo->mTxCompletions.push_back({ sppConnectionInfo->mTxQueuedBytes, callback });
+		mIoWorker->write(sppConnectionInfo->mIoWorkerChannel, sppConnectionInfo->mTxQueuedBytes, data, size);
+		return;
 	}
 
-	callback(BLUETOOTH_ERROR_NONE);
+	Bluez5SppRingBuffer &buffer = *sppConnectionInfo->mTxBuffer;
+	size_t written = 0;
+
+	// Nothing queued, so the data can go straight to the kernel without
+	// being copied. Only what it doesn't take is queued.
+	if (buffer.empty())
+	{
+		while (written < size)
+		{
+			ssize_t count = send(sppConnectionInfo->mSockfd, data + written, size - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+			sppConnectionInfo->mStats.io.writeCalls++;
+			if (count > 0)
+			{
+				if ((size_t) count < size - written)
+					sppConnectionInfo->mStats.shortWrites++;
+				written += count;
+				recordTxData(sppConnectionInfo, count);
+				continue;
+			}
+
+			if (count < 0 && errno == EINTR)
+				continue;
+
+			if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				sppConnectionInfo->mStats.wouldBlock++;
+				break;
+			}
+
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to write data due to %s", strerror(errno));
+			callback(BLUETOOTH_ERROR_FAIL);
+			return;
+		}
+
+		if (written == size)
+		{
+			sppConnectionInfo->mStats.framesSent++;
+			callback(BLUETOOTH_ERROR_NONE);
+			return;
+		}
+	}
+	else if (pending + size > sppConnectionInfo->mTransmitOptions.highWatermark)
+	{
+		sppConnectionInfo->mTxBlocked = true;
+		callback(BLUETOOTH_ERROR_BUSY);
+		return;
+	}
+
+	// A single write larger than the high watermark is still taken as a whole
+	size_t remaining = size - written;
+	buffer.setMaxCapacity(std::max(sppConnectionInfo->mTransmitOptions.highWatermark, buffer.size() + remaining));
+
+	if (buffer.empty())
+		sppConnectionInfo->mTxProgressTime = g_get_monotonic_time();
+	buffer.append(data + written, remaining);
+
+	sppConnectionInfo->mTxQueuedBytes += remaining;
+	sppConnectionInfo->mStats.framesSent++;
+	sppConnectionInfo->mStats.txQueueHighWater = std::max(sppConnectionInfo->mStats.txQueueHighWater, (uint64_t) buffer.size());
+	sppConnectionInfo->mTxCompletions.push_back({ sppConnectionInfo->mTxQueuedBytes, callback });
+
+	if (!sppConnectionInfo->mTxWatchId)
+		sppConnectionInfo->mTxWatchId = g_io_add_watch(sppConnectionInfo->mChannel, (GIOCondition) (G_IO_OUT | G_IO_HUP | G_IO_ERR),
+		                                               onTxReady, sppConnectionInfo);
 }
 
-BluetoothError Bluez5ProfileSpp::createChannel(const std::string &name, const std::string &uuid)
+gboolean Bluez5ProfileSpp::onTxReady(GIOChannel *io, GIOCondition condition, gpointer user_data)
 {
-	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+	UNUSED(io);
+	UNUSED(condition);
+	SppDeviceInfo* deviceInfo = static_cast<SppDeviceInfo*>(user_data);
 
-	BluetoothSppChannelId channelId = allocateChannelId();
-	if (!channelId)
+	if (deviceInfo->mSppProfile->flushTxData(deviceInfo))
+		return TRUE;
+
+	deviceInfo->mTxWatchId = 0;
+	return FALSE;
+}
+
+bool Bluez5ProfileSpp::flushTxData(SppDeviceInfo *deviceInfo)
+{
+	Bluez5SppRingBuffer &buffer = *deviceInfo->mTxBuffer;
+
+	while (!buffer.empty())
 	{
-		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to get channelId");
+		struct iovec regions[2];
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = regions;
+		message.msg_iovlen = buffer.getDataRegions(regions);
+
+		ssize_t count = sendmsg(deviceInfo->mSockfd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+		deviceInfo->mStats.io.writeCalls++;
+		if (count > 0)
+		{
+			if ((size_t) count < buffer.size())
+				deviceInfo->mStats.shortWrites++;
+			buffer.consume(count);
+			deviceInfo->mTxWrittenBytes += count;
+			recordTxData(deviceInfo, count);
+			continue;
+		}
+
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			deviceInfo->mStats.wouldBlock++;
+			break;
+		}
+
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to write data due to %s", strerror(errno));
+		failTxData(deviceInfo);
+		return false;
+	}
+
+	completeTxData(deviceInfo);
+
+	return !buffer.empty();
+}
+
+void Bluez5ProfileSpp::completeTxData(SppDeviceInfo *deviceInfo)
+{
+	// Callbacks may queue more data, so each one is taken off first
+	while (!deviceInfo->mTxCompletions.empty() &&
+	       deviceInfo->mTxCompletions.front().first <= deviceInfo->mTxWrittenBytes)
+	{
+		BluetoothResultCallback callback = deviceInfo->mTxCompletions.front().second;
+		deviceInfo->mTxCompletions.pop_front();
+		callback(BLUETOOTH_ERROR_NONE);
+	}
+
+	uint64_t pending = deviceInfo->mTxQueuedBytes - deviceInfo->mTxWrittenBytes;
+	if (deviceInfo->mTxBlocked && pending <= deviceInfo->mTransmitOptions.lowWatermark)
+	{
+		deviceInfo->mTxBlocked = false;
+		if (mWritableCallback)
+			mWritableCallback(deviceInfo->mChannelId);
+	}
+}
+
+void Bluez5ProfileSpp::failTxData(SppDeviceInfo *deviceInfo)
+{
+	if (deviceInfo->mTxWatchId)
+	{
+		g_source_remove(deviceInfo->mTxWatchId);
+		deviceInfo->mTxWatchId = 0;
+	}
+
+	if (deviceInfo->mTxBuffer)
+		deviceInfo->mTxBuffer->clear();
+	deviceInfo->mTxWrittenBytes = deviceInfo->mTxQueuedBytes;
+	deviceInfo->mTxBlocked = false;
+
+	std::deque<std::pair<uint64_t, BluetoothResultCallback>> completions;
+	completions.swap(deviceInfo->mTxCompletions);
+	for (auto &completion : completions)
+		completion.second(BLUETOOTH_ERROR_FAIL);
+}
+
+bool Bluez5ProfileSpp::attachIoWorker(SppDeviceInfo *deviceInfo)
+{
+	if (!mIoWorker)
+	{
+		auto eventHandler = [this](Bluez5SppIoWorker::Event &event) {
+			handleIoWorkerEvent(event);
+		};
+		mIoWorker.reset(new Bluez5SppIoWorker(eventHandler));
+	}
+
+	if (!mIoWorker->start())
+		return false;
+
+	// Holding back what the receive buffer could not take either
+	uint32_t key = mIoWorker->addChannel(deviceInfo->mSockfd, getRxBufferLimit(deviceInfo));
+	if (!key)
+		return false;
+
+	deviceInfo->mIoWorkerChannel = key;
+	mIoWorkerChannels[key] = deviceInfo->mChannelId;
+
+	return true;
+}
+
+void Bluez5ProfileSpp::detachIoWorker(SppDeviceInfo *deviceInfo)
+{
+	if (!deviceInfo->mIoWorkerChannel)
+		return;
+
+	// The worker closes the socket
+	mIoWorker->removeChannel(deviceInfo->mIoWorkerChannel);
+	mIoWorkerChannels.erase(deviceInfo->mIoWorkerChannel);
+	deviceInfo->mIoWorkerChannel = 0;
+	deviceInfo->mSockfd = -1;
+}
+
+void Bluez5ProfileSpp::handleIoWorkerEvent(Bluez5SppIoWorker::Event &event)
+{
+	// Events of channels which are gone already are dropped
+	auto channelIter = mIoWorkerChannels.find(event.channel);
+	if (channelIter == mIoWorkerChannels.end())
+		return;
+
+	SppDeviceInfo *deviceInfo = getSppDevice(channelIter->second);
+	if (!deviceInfo || deviceInfo->mIoWorkerChannel != event.channel || !deviceInfo->mRxBuffer)
+		return;
+
+	deviceInfo->mStats.io.readCalls += event.readCalls;
+	deviceInfo->mStats.io.writeCalls += event.writeCalls;
+	deviceInfo->mStats.wouldBlock += event.wouldBlock;
+	deviceInfo->mStats.shortWrites += event.shortWrites;
+
+	switch (event.type)
+	{
+	case Bluez5SppIoWorker::Event::DATA:
+	{
+		// Goes through the receive buffer so batching works the same as
+		// with the main loop doing the reads
+		Bluez5SppRingBuffer &buffer = *deviceInfo->mRxBuffer;
+		size_t offset = 0;
+		deviceInfo->mStats.io.bytesRead += event.data.size();
+		recordRxBurst(deviceInfo, event.data.size());
+		while (offset < event.data.size())
+		{
+			offset += buffer.append(event.data.data() + offset, event.data.size() - offset);
+			if (offset < event.data.size())
+				deliverRxData(deviceInfo);
+		}
+		scheduleRxData(deviceInfo, false);
+		break;
+	}
+	case Bluez5SppIoWorker::Event::CLOSED:
+		// BlueZ tells us through RequestDisconnection
+		scheduleRxData(deviceInfo, true);
+		break;
+	case Bluez5SppIoWorker::Event::WRITTEN:
+		if (!event.success)
+		{
+			failTxData(deviceInfo);
+			break;
+		}
+		if (event.writeId > deviceInfo->mTxWrittenBytes)
+		{
+			recordTxData(deviceInfo, event.writeId - deviceInfo->mTxWrittenBytes);
+			deviceInfo->mTxWrittenBytes = event.writeId;
+		}
+		completeTxData(deviceInfo);
+		break;
+	}
+}
+
+BluetoothError Bluez5ProfileSpp::setTransmitOptions(const BluetoothSppChannelId channelId, const SppTransmitOptions &options)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo || !options.highWatermark || options.lowWatermark > options.highWatermark)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	deviceInfo->mTransmitOptions = options;
+	return BLUETOOTH_ERROR_NONE;
+}
+
+BluetoothError Bluez5ProfileSpp::startForwarding(const BluetoothSppChannelId channelId, int localFd, SppForwardingCallback callback)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo || localFd < 0)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	// The worker owns the socket of its channels
+	if (deviceInfo->mIoWorkerChannel)
+		return BLUETOOTH_ERROR_UNSUPPORTED;
+
+	if (!deviceInfo->mChannel || !deviceInfo->mRxBuffer)
+		return BLUETOOTH_ERROR_NOT_READY;
+
+	// Queued writes would end up behind the forwarded data
+	if (isForwarding(deviceInfo) || deviceInfo->mTxQueuedBytes != deviceInfo->mTxWrittenBytes)
+		return BLUETOOTH_ERROR_BUSY;
+
+	// What was received so far still goes to the observer
+	deliverRxData(deviceInfo);
+
+	if (deviceInfo->mIoWatchId)
+	{
+		g_source_remove(deviceInfo->mIoWatchId);
+		deviceInfo->mIoWatchId = 0;
+	}
+
+	auto finishedCallback = [this, channelId](SppForwardingResult result) {
+		SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+		if (deviceInfo)
+			finishForwarding(deviceInfo, result);
+	};
+
+	deviceInfo->mForwarder.reset(new Bluez5SppForwarder(deviceInfo->mSockfd, localFd, finishedCallback));
+	if (!deviceInfo->mForwarder->start())
+	{
+		deviceInfo->mForwarder.reset();
+		watchChannel(deviceInfo);
 		return BLUETOOTH_ERROR_FAIL;
 	}
 
-	SppDeviceInfo * sppDevInfo = new (std::nothrow) SppDeviceInfo(this, channelId, SERVER, name, uuid);
+	deviceInfo->mForwardingCallback = callback;
+	DEBUG("Channel %d is forwarded to fd %d", channelId, localFd);
+
+	return BLUETOOTH_ERROR_NONE;
+}
+
+BluetoothError Bluez5ProfileSpp::stopForwarding(const BluetoothSppChannelId channelId)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	if (!isForwarding(deviceInfo))
+		return BLUETOOTH_ERROR_NOT_READY;
+
+	finishForwarding(deviceInfo, SPP_FORWARDING_STOPPED);
+	return BLUETOOTH_ERROR_NONE;
+}
+
+BluetoothError Bluez5ProfileSpp::getForwardingCounters(const BluetoothSppChannelId channelId, SppForwardingCounters &counters)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	if (!deviceInfo->mForwarder)
+		return BLUETOOTH_ERROR_NOT_READY;
+
+	counters = deviceInfo->mForwarder->getCounters();
+	return BLUETOOTH_ERROR_NONE;
+}
 
-	if (!sppDevInfo)
+bool Bluez5ProfileSpp::isForwarding(SppDeviceInfo *deviceInfo)
+{
+	return deviceInfo->mForwarder && deviceInfo->mForwarder->isRunning();
+}
+
+void Bluez5ProfileSpp::finishForwarding(SppDeviceInfo *deviceInfo, SppForwardingResult result)
+{
+	SppForwardingCallback callback = deviceInfo->mForwardingCallback;
+	deviceInfo->mForwardingCallback = nullptr;
+
+	deviceInfo->mForwarder->stop();
+	SppForwardingCounters counters = deviceInfo->mForwarder->getCounters();
+	deviceInfo->mStats.io.bytesRead += counters.bytesToLocal;
+	deviceInfo->mStats.io.bytesWritten += counters.bytesToChannel;
+
+	// Data the forwarder was still holding takes the way it would have
+	// taken without it
+	std::vector<uint8_t> toLocal;
+	std::vector<uint8_t> toChannel;
+	deviceInfo->mForwarder->takeUndelivered(toLocal, toChannel);
+
+	if (!toLocal.empty() && deviceInfo->mRxBuffer)
 	{
-		deallocateChannelId(channelId);
-		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to allocate memory for sppDevInfo");
-		return BLUETOOTH_ERROR_NOMEM;
+		Bluez5SppRingBuffer &buffer = *deviceInfo->mRxBuffer;
+		size_t offset = 0;
+		deviceInfo->mStats.io.bytesRead += toLocal.size();
+		while (offset < toLocal.size())
+		{
+			offset += buffer.append(toLocal.data() + offset, toLocal.size() - offset);
+			if (offset < toLocal.size())
+				deliverRxData(deviceInfo);
+		}
+		deliverRxData(deviceInfo);
 	}
 
-	spDeviceInfo channelInfo(sppDevInfo);
+	if (!toChannel.empty() && deviceInfo->mTxBuffer)
+	{
+		writeData(deviceInfo->mChannelId, toChannel.data(), toChannel.size(), [](BluetoothError error) {
+			if (error != BLUETOOTH_ERROR_NONE)
+				ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to send data left over from forwarding");
+		});
+	}
+
+	// A channel the peer closed finds out about it by reading again
+	watchChannel(deviceInfo);
+
+	if (callback)
+		callback(deviceInfo->mChannelId, result);
+}
+
+BluetoothError Bluez5ProfileSpp::getIoCounters(const BluetoothSppChannelId channelId, SppIoCounters &counters)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	counters = deviceInfo->mStats.io;
+	return BLUETOOTH_ERROR_NONE;
+}
+
+void Bluez5ProfileSpp::recordRxBurst(SppDeviceInfo *deviceInfo, size_t size)
+{
+	if (!size)
+		return;
+
+	deviceInfo->mStats.rxBursts++;
+	deviceInfo->mStats.rxBurstMax = std::max(deviceInfo->mStats.rxBurstMax, (uint64_t) size);
+	deviceInfo->mLastRxTime = g_get_monotonic_time();
+}
+
+void Bluez5ProfileSpp::recordTxData(SppDeviceInfo *deviceInfo, size_t size)
+{
+	deviceInfo->mStats.io.bytesWritten += size;
+	deviceInfo->mLastTxTime = g_get_monotonic_time();
+	deviceInfo->mTxProgressTime = deviceInfo->mLastTxTime;
+}
+
+void Bluez5ProfileSpp::fillChannelStats(SppDeviceInfo *deviceInfo, gint64 now, SppChannelStats &stats)
+{
+	stats = deviceInfo->mStats;
+	stats.channelId = deviceInfo->mChannelId;
+	stats.address = deviceInfo->mDeviceAddress;
+	stats.uuid = deviceInfo->mUuid;
+	stats.txQueueDepth = deviceInfo->mTxQueuedBytes - deviceInfo->mTxWrittenBytes;
+	stats.rxIdleTime = (now - deviceInfo->mLastRxTime) / 1000;
+	stats.txIdleTime = (now - deviceInfo->mLastTxTime) / 1000;
+	stats.idleTime = std::min(stats.rxIdleTime, stats.txIdleTime);
+}
+
+BluetoothError Bluez5ProfileSpp::getChannelStats(const BluetoothSppChannelId channelId, SppChannelStats &stats)
+{
+	SppDeviceInfo *deviceInfo = getSppDevice(channelId);
+	if (!deviceInfo)
+		return BLUETOOTH_ERROR_PARAM_INVALID;
+
+	// Registered but not connected
+	if (!deviceInfo->mRxBuffer)
+		return BLUETOOTH_ERROR_NOT_READY;
+
+	fillChannelStats(deviceInfo, g_get_monotonic_time(), stats);
+	return BLUETOOTH_ERROR_NONE;
+}
+
+std::vector<SppChannelStats> Bluez5ProfileSpp::getChannelStats()
+{
+	std::vector<SppChannelStats> channels;
+	gint64 now = g_get_monotonic_time();
+
+	mConnectedDevices.forEach([this, now, &channels](SppDeviceInfo *deviceInfo) {
+		if (!deviceInfo->mRxBuffer)
+			return;
+
+		channels.push_back(SppChannelStats());
+		fillChannelStats(deviceInfo, now, channels.back());
+	});
+
+	return channels;
+}
+
+SppChannelHealth Bluez5ProfileSpp::checkChannelHealth(SppDeviceInfo *deviceInfo, gint64 now)
+{
+	uint64_t pending = deviceInfo->mTxQueuedBytes - deviceInfo->mTxWrittenBytes;
+
+	if (mHealthOptions.stallTimeout && pending &&
+	    now - deviceInfo->mTxProgressTime >= (gint64) mHealthOptions.stallTimeout * 1000)
+		return SPP_CHANNEL_HEALTH_STALLED;
+
+	gint64 lastActivity = std::max(deviceInfo->mLastRxTime, deviceInfo->mLastTxTime);
+	if (mHealthOptions.idleTimeout && !pending &&
+	    now - lastActivity >= (gint64) mHealthOptions.idleTimeout * 1000)
+		return SPP_CHANNEL_HEALTH_IDLE;
+
+	return SPP_CHANNEL_HEALTH_ACTIVE;
+}
+
+void Bluez5ProfileSpp::setHealthMonitoring(const SppHealthOptions &options, SppHealthCallback callback)
+{
+	mHealthOptions = options;
+	mHealthCallback = callback;
+
+	if (mHealthTimer)
+	{
+		g_source_remove(mHealthTimer);
+		mHealthTimer = 0;
+	}
+
+	uint32_t shortest = std::min(options.idleTimeout ? options.idleTimeout : G_MAXUINT32,
+	                             options.stallTimeout ? options.stallTimeout : G_MAXUINT32);
+	if (shortest == G_MAXUINT32)
+		return;
+
+	mHealthTimer = g_timeout_add(std::max<uint32_t>(shortest / 4, SPP_HEALTH_CHECK_MIN_INTERVAL), onHealthCheck, this);
+}
+
+gboolean Bluez5ProfileSpp::onHealthCheck(gpointer user_data)
+{
+	Bluez5ProfileSpp *profile = static_cast<Bluez5ProfileSpp*>(user_data);
+	gint64 now = g_get_monotonic_time();
+
+	// The callback may remove channels, so it is only called once all of
+	// them were looked at
+	std::vector<std::pair<BluetoothSppChannelId, SppChannelHealth>> changes;
+
+	profile->mConnectedDevices.forEach([profile, now, &changes](SppDeviceInfo *deviceInfo) {
+		if (!deviceInfo->mRxBuffer)
+			return;
+
+		SppChannelHealth health = profile->checkChannelHealth(deviceInfo, now);
+		if (health == deviceInfo->mStats.health)
+			return;
+
+		deviceInfo->mStats.health = health;
+		changes.push_back({ deviceInfo->mChannelId, health });
+	});
+
+	for (auto &change : changes)
+	{
+		if (profile->mHealthCallback)
+			profile->mHealthCallback(change.first, change.second);
+	}
+
+	return TRUE;
+}
+
+BluetoothError Bluez5ProfileSpp::createChannel(const std::string &name, const std::string &uuid)
+{
+	DEBUG("%s::%s",__FILE__,__FUNCTION__);
+
+	SppDeviceInfo *channelInfo = addDeviceInfo(SERVER, name, uuid);
+	if (!channelInfo)
+		return BLUETOOTH_ERROR_FAIL;
 
 	BluetoothError error = createSkeletonAndExport(uuid, channelInfo);
 
 	if (error != BLUETOOTH_ERROR_NONE)
 	{
+		removeDeviceInfo(channelInfo->mChannelId);
 		return error;
 	}
 
-	mConnectedDevices[channelId] = std::move(channelInfo);
 	return BLUETOOTH_ERROR_NONE;
 }
 
@@ -545,72 +1289,72 @@ BluetoothError Bluez5ProfileSpp::removeChannel(const std::string &uuid)
 		bluez_profile_manager1_call_unregister_profile_sync(mAdapter->getProfileManager(), objPath.c_str(), NULL, NULL);
 		g_object_unref(sppConnectionInfo->mInterface);
 		getSppObserver()->channelStateChanged(sppConnectionInfo->mAdapterAddress, sppConnectionInfo->mDeviceAddress, uuid, sppConnectionInfo->mChannelId, false);
-		removeConnectedDevice(sppConnectionInfo->mChannelId);
-		deallocateChannelId(sppConnectionInfo->mChannelId);
+		removeDeviceInfo(sppConnectionInfo->mChannelId);
 	}
 
 	return BLUETOOTH_ERROR_NONE;
 }
 
-BluetoothSppChannelId Bluez5ProfileSpp::allocateChannelId()
+Bluez5ProfileSpp::SppDeviceInfo* Bluez5ProfileSpp::addDeviceInfo(DeviceRole deviceRole, const std::string &name, const std::string &uuid)
 {
-	BluetoothSppChannelId retChId = 0;
-	for (auto& ids : mChannelIdList)
+	if (mFreeRfcommChannels.empty())
 	{
-		if (!ids.second)
-		{
-			retChId = ids.first;
-			ids.second = true;
-			break;
-		}
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "No RFCOMM channel left for a new channel");
+		return nullptr;
 	}
 
-	return retChId;
-}
+	// Reserve the id first, the device info is created with it
+	BluetoothSppChannelId channelId = mConnectedDevices.insert(nullptr);
+	if (!channelId)
+	{
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to allocate Channel Id, %zu channels in use", mConnectedDevices.size());
+		return nullptr;
+	}
 
-void Bluez5ProfileSpp::deallocateChannelId(BluetoothSppChannelId channelId)
-{
-	 if(mChannelIdList[channelId])
-		mChannelIdList[channelId] = false;
+	SppDeviceInfo *deviceInfo = new (std::nothrow) SppDeviceInfo(this, channelId, deviceRole, name, uuid);
+	if (!deviceInfo)
+	{
+		mConnectedDevices.release(channelId);
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to allocate memory for sppDevice");
+		return nullptr;
+	}
+
+	deviceInfo->mRfcommChannel = mFreeRfcommChannels.back();
+	mFreeRfcommChannels.pop_back();
+	mConnectedDevices.set(channelId, spDeviceInfo(deviceInfo));
+
+	return deviceInfo;
 }
 
-bool Bluez5ProfileSpp::removeConnectedDevice(BluetoothSppChannelId channelId)
+void Bluez5ProfileSpp::removeDeviceInfo(BluetoothSppChannelId channelId)
 {
-	return mConnectedDevices.erase(channelId);
+	SppDeviceInfo *deviceInfo = mConnectedDevices.find(channelId);
+	if (!deviceInfo)
+		return;
+
+	// A channel which was taken out of the configured list is not reused
+	if (std::find(mRfcommChannels.begin(), mRfcommChannels.end(), deviceInfo->mRfcommChannel) != mRfcommChannels.end())
+		mFreeRfcommChannels.push_back(deviceInfo->mRfcommChannel);
+
+	mConnectedDevices.release(channelId);
 }
 
 Bluez5ProfileSpp::SppDeviceInfo* Bluez5ProfileSpp::getSppDevice(const BluetoothSppChannelId channelId)
 {
-	SppDeviceInfo* deviceInfo = nullptr;
-
-	auto deviceIterator = mConnectedDevices.find(channelId);
-	if (deviceIterator != mConnectedDevices.end())
-		deviceInfo = (deviceIterator->second).get();
-
-	return deviceInfo;
+	return mConnectedDevices.find(channelId);
 }
 
 Bluez5ProfileSpp::SppDeviceInfo* Bluez5ProfileSpp::getSppDevice(const std::string& uuid)
 {
-	SppDeviceInfo* deviceInfo = nullptr;
-
-	auto matchUuid = [&uuid](std::pair<const unsigned char, std::unique_ptr<Bluez5ProfileSpp::SppDeviceInfo>>& device)
+	auto matchUuid = [&uuid](SppDeviceInfo *deviceInfo)
 	{
-		if((device.second)->mUuid == uuid)
-			return true;
-
-		return false;
+		return deviceInfo->mUuid == uuid;
 	};
 
-	ConnectedDevice::iterator deviceIterator = std::find_if(mConnectedDevices.begin(), mConnectedDevices.end(), matchUuid);
-
-	if (deviceIterator != mConnectedDevices.end())
-		deviceInfo = (deviceIterator->second).get();
-
-	return deviceInfo;
+	return mConnectedDevices.findIf(matchUuid);
 }
 
-BluetoothError Bluez5ProfileSpp::createSkeletonAndExport(std::string uuid, spDeviceInfo &channelInfo)
+BluetoothError Bluez5ProfileSpp::createSkeletonAndExport(std::string uuid, SppDeviceInfo *channelInfo)
 {
 	GError *error = nullptr;
 	UNUSED(uuid);
@@ -618,7 +1362,6 @@ BluetoothError Bluez5ProfileSpp::createSkeletonAndExport(std::string uuid, spDev
 
 	if (registerProfile(channelInfo, objPath, mAdapter->getProfileManager()))
 	{
-		deallocateChannelId(channelInfo->mChannelId);
 		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to register to profile to manager");
 		return BLUETOOTH_ERROR_NOT_READY;
 	}
@@ -628,17 +1371,17 @@ BluetoothError Bluez5ProfileSpp::createSkeletonAndExport(std::string uuid, spDev
 	g_signal_connect(channelInfo->mInterface,
 		"handle_new_connection",
 		G_CALLBACK (onHandleNewConnection),
-		channelInfo.get());
+		channelInfo);
 
 	g_signal_connect(channelInfo->mInterface,
 		"handle_request_disconnection",
 		G_CALLBACK (onHandleRequestDisconnection),
-		channelInfo.get());
+		channelInfo);
 
 	g_signal_connect(channelInfo->mInterface,
 		"handle_release",
 		G_CALLBACK (onHandleRelease),
-		channelInfo.get());
+		channelInfo);
 
 
 	if (mConn && !g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (channelInfo->mInterface),
@@ -646,7 +1389,6 @@ BluetoothError Bluez5ProfileSpp::createSkeletonAndExport(std::string uuid, spDev
 						objPath.c_str(),
 						&error))
 	{
-		deallocateChannelId(channelInfo->mChannelId);
 		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to export profile on system bus");
 		if (error)
 		{
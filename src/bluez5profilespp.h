@@ -19,9 +19,16 @@
 
 
 #include "bluez5profilebase.h"
+#include "bluez5sppbuffer.h"
+#include "bluez5sppchanneltable.h"
+#include "bluez5sppforwarder.h"
+#include "bluez5sppframer.h"
+#include "bluez5sppioworker.h"
 
 #include <fcntl.h>
+#include <deque>
 #include <memory>
+#include <vector>
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
 #include <sys/socket.h>
@@ -34,6 +41,114 @@ extern "C" {
 class Bluez5Adapter;
 class Bluez5ProfileSpp;
 
+// Buffering of the data received on a channel. Everything the socket has
+// is read at once, the observer gets it once batchSize bytes are buffered
+// or the oldest byte waited batchLatency ms, whatever comes first. A
+// batchSize of 0 only flushes on the latency. With the defaults the data
+// is handed on after every wakeup.
+struct SppReceiveOptions
+{
+	SppReceiveOptions()
+		: bufferSize(4096), maxBufferSize(65536), batchSize(0), batchLatency(0) {
+	}
+
+	// Initial size of the receive buffer, it grows up to maxBufferSize
+	size_t bufferSize;
+	size_t maxBufferSize;
+	size_t batchSize;
+	uint32_t batchLatency;
+};
+
+// Limits of the queue of data written to a channel but not yet taken by
+// the kernel. Once highWatermark bytes are queued writeData fails with
+// BLUETOOTH_ERROR_BUSY, the writable callback tells when the queue went
+// back down to lowWatermark.
+struct SppTransmitOptions
+{
+	SppTransmitOptions()
+		: lowWatermark(16384), highWatermark(65536) {
+	}
+
+	size_t lowWatermark;
+	size_t highWatermark;
+};
+
+// Socket calls made for a channel and the bytes they moved, counted from
+// the time it was connected
+struct SppIoCounters
+{
+	SppIoCounters()
+		: readCalls(0), writeCalls(0), bytesRead(0), bytesWritten(0) {
+	}
+
+	uint64_t readCalls;
+	uint64_t writeCalls;
+	uint64_t bytesRead;
+	uint64_t bytesWritten;
+};
+
+enum SppChannelHealth
+{
+	SPP_CHANNEL_HEALTH_ACTIVE = 0,
+	// Nothing went either way for the idle timeout
+	SPP_CHANNEL_HEALTH_IDLE,
+	// Data is queued but the peer took none of it for the stall timeout
+	SPP_CHANNEL_HEALTH_STALLED
+};
+
+// Snapshot of a connected channel. Counters start when it got connected.
+struct SppChannelStats
+{
+	SppChannelStats()
+		: channelId(BLUETOOTH_SPP_CHANNEL_ID_INVALID), framesReceived(0), framesSent(0),
+		  txQueueDepth(0), txQueueHighWater(0), wouldBlock(0), shortWrites(0),
+		  rxBursts(0), rxBurstMax(0), idleTime(0), rxIdleTime(0), txIdleTime(0),
+		  health(SPP_CHANNEL_HEALTH_ACTIVE) {
+	}
+
+	BluetoothSppChannelId channelId;
+	std::string address;
+	std::string uuid;
+
+	SppIoCounters io;
+	// Deliveries to the observer and writes accepted by writeData
+	uint64_t framesReceived;
+	uint64_t framesSent;
+
+	// Bytes accepted by writeData but not taken by the kernel yet
+	uint64_t txQueueDepth;
+	uint64_t txQueueHighWater;
+	// Writes the socket refused with EAGAIN and those it took only in part
+	uint64_t wouldBlock;
+	uint64_t shortWrites;
+
+	// Bytes read per wakeup, the average is io.bytesRead / rxBursts
+	uint64_t rxBursts;
+	uint64_t rxBurstMax;
+
+	// Time in ms since data last went either way, was received and was sent
+	gint64 idleTime;
+	gint64 rxIdleTime;
+	gint64 txIdleTime;
+
+	SppChannelHealth health;
+};
+
+// Timeouts in ms of the channel health monitoring, 0 turns a check off
+struct SppHealthOptions
+{
+	SppHealthOptions()
+		: idleTimeout(0), stallTimeout(0) {
+	}
+
+	uint32_t idleTimeout;
+	uint32_t stallTimeout;
+};
+
+typedef std::function<void(BluetoothSppChannelId channelId)> SppWritableCallback;
+typedef std::function<void(BluetoothSppChannelId channelId, SppChannelHealth health)> SppHealthCallback;
+typedef std::function<void(BluetoothSppChannelId channelId, SppForwardingResult result)> SppForwardingCallback;
+
 class Bluez5ProfileSpp : public Bluez5ProfileBase,
 						 public BluetoothSppProfile
 {
@@ -59,7 +174,7 @@ public:
 	gboolean handleNewConnection (GDBusMethodInvocation *invocation, const gchar *device, const GVariant *fd,
 								const GVariant *fd_props, SppDeviceInfo* deviceInfo);
 	gboolean handleRelease();
-	gboolean handleRxData(GIOChannel *io, GIOCondition condition, BluetoothSppChannelId id, const std::string &adapterAddress);
+	gboolean handleRxData(SppDeviceInfo *deviceInfo, GIOCondition condition);
 	gboolean handleRequestDisconnection (BluezProfile1 *interface, GDBusMethodInvocation *invocation, const gchar *device, SppDeviceInfo* deviceInfo);
 
 	static gboolean onHandleNewConnection (BluezProfile1 *interface, GDBusMethodInvocation *invocation, const gchar *device, const GVariant *fd,
@@ -67,6 +182,37 @@ public:
 	static gboolean ioCallback(GIOChannel * io, GIOCondition condition, gpointer data);
 	static gboolean onHandleRequestDisconnection (BluezProfile1 *interface, GDBusMethodInvocation *invocation, const gchar *device, gpointer user_data);
 	static gboolean onHandleRelease (BluezProfile1 *interface, GDBusMethodInvocation *invocation, gpointer user_data);
+	static gboolean onRxFlushTimeout(gpointer user_data);
+	static gboolean onTxReady(GIOChannel *io, GIOCondition condition, gpointer user_data);
+	static gboolean onHealthCheck(gpointer user_data);
+
+	void setDefaultReceiveOptions(const SppReceiveOptions &options) { mDefaultReceiveOptions = options; }
+	BluetoothError setReceiveOptions(const BluetoothSppChannelId channelId, const SppReceiveOptions &options);
+	void setDefaultTransmitOptions(const SppTransmitOptions &options) { mDefaultTransmitOptions = options; }
+	BluetoothError setTransmitOptions(const BluetoothSppChannelId channelId, const SppTransmitOptions &options);
+	void setWritableCallback(SppWritableCallback callback) { mWritableCallback = callback; }
+	void setDefaultFramingOptions(const SppFramingOptions &options) { mDefaultFramingOptions = options; }
+	BluetoothError setFramingOptions(const BluetoothSppChannelId channelId, const SppFramingOptions &options);
+	BluetoothError getFramingStats(const BluetoothSppChannelId channelId, SppFramingStats &stats);
+	BluetoothError getIoCounters(const BluetoothSppChannelId channelId, SppIoCounters &counters);
+	BluetoothError getChannelStats(const BluetoothSppChannelId channelId, SppChannelStats &stats);
+	std::vector<SppChannelStats> getChannelStats();
+	// The callback is called whenever a connected channel changes its health
+	void setHealthMonitoring(const SppHealthOptions &options, SppHealthCallback callback);
+	// Channels connected from now on have their socket I/O done by a
+	// thread of their own instead of the main loop
+	void setIoWorkerEnabled(bool enabled) { mIoWorkerEnabled = enabled; }
+	// RFCOMM channels handed out to new channels, in order, and the number
+	// of channels which can exist at the same time. Existing channels keep
+	// what they have.
+	BluetoothError setChannelLimits(const std::vector<uint8_t> &rfcommChannels, size_t maxChannels);
+	// Everything received on the channel goes to localFd and everything
+	// read from localFd is sent, without passing through the observer or
+	// the main loop. The caller keeps localFd. The callback is called once
+	// forwarding ended, from then on the channel is served as before.
+	BluetoothError startForwarding(const BluetoothSppChannelId channelId, int localFd, SppForwardingCallback callback);
+	BluetoothError stopForwarding(const BluetoothSppChannelId channelId);
+	BluetoothError getForwardingCounters(const BluetoothSppChannelId channelId, SppForwardingCounters &counters);
 
 private:
 	class SppDeviceInfo
@@ -77,12 +223,32 @@ private:
 			, mUuid (uuid)
 			, mChannelId(connectedChannelID)
 			, mDeviceRole(deviceRole)
+			, mRfcommChannel(0)
 			, mInterface(nullptr)
 			, mSockfd(-1)
 			, mChannel(nullptr)
 			, mIoWatchId(0)
 			, mSppProfile(sppProfile)
+			, mReceiveOptions(sppProfile->mDefaultReceiveOptions)
+			, mRxFlushSource(0)
+			, mFramingOptions(sppProfile->mDefaultFramingOptions)
+			, mTransmitOptions(sppProfile->mDefaultTransmitOptions)
+			, mTxWatchId(0)
+			, mTxQueuedBytes(0)
+			, mTxWrittenBytes(0)
+			, mTxBlocked(false)
+			, mLastRxTime(0)
+			, mLastTxTime(0)
+			, mTxProgressTime(0)
+			, mIoWorkerChannel(0)
+		{
+		}
+		~SppDeviceInfo()
 		{
+			if (mRxFlushSource)
+				g_source_remove(mRxFlushSource);
+			if (mTxWatchId)
+				g_source_remove(mTxWatchId);
 		}
 
 		std::string mAdapterAddress;
@@ -92,19 +258,68 @@ private:
 
 		BluetoothSppChannelId mChannelId;
 		DeviceRole mDeviceRole;
+		uint8_t mRfcommChannel;
 		BluezProfile1 *mInterface;
 		gint mSockfd;
 		GIOChannel *mChannel;
 		guint mIoWatchId;
 		Bluez5ProfileSpp *mSppProfile;
+
+		SppReceiveOptions mReceiveOptions;
+		std::unique_ptr<Bluez5SppRingBuffer> mRxBuffer;
+		guint mRxFlushSource;
+		SppFramingOptions mFramingOptions;
+		// Only set while connected with a framing mode other than NONE
+		std::unique_ptr<Bluez5SppFramer> mFramer;
+
+		SppTransmitOptions mTransmitOptions;
+		std::unique_ptr<Bluez5SppRingBuffer> mTxBuffer;
+		guint mTxWatchId;
+		// Byte counts since the connection was made. A write is complete
+		// once mTxWrittenBytes reached the count queued with it.
+		uint64_t mTxQueuedBytes;
+		uint64_t mTxWrittenBytes;
+		std::deque<std::pair<uint64_t, BluetoothResultCallback>> mTxCompletions;
+		// A write was refused, the writable callback is due
+		bool mTxBlocked;
+
+		SppChannelStats mStats;
+		gint64 mLastRxTime;
+		gint64 mLastTxTime;
+		// Last time the write queue started filling or got smaller
+		gint64 mTxProgressTime;
+
+		// Key of the channel with the I/O worker, 0 if the main loop does
+		// the I/O. The worker owns mSockfd then.
+		uint32_t mIoWorkerChannel;
+
+		// Kept after forwarding ended for its counters
+		std::unique_ptr<Bluez5SppForwarder> mForwarder;
+		SppForwardingCallback mForwardingCallback;
 	};
 	typedef std::unique_ptr<SppDeviceInfo> spDeviceInfo;
-	typedef std::unordered_map<BluetoothSppChannelId, spDeviceInfo> ConnectedDevice;
+	typedef Bluez5SppChannelTable<SppDeviceInfo> ConnectedDevice;
 
-	BluetoothSppChannelId allocateChannelId();
-	void deallocateChannelId(BluetoothSppChannelId channelId);
-	void initialiseChannelIds();
-	bool removeConnectedDevice(BluetoothSppChannelId channelId);
+	SppDeviceInfo* addDeviceInfo(DeviceRole deviceRole, const std::string &name, const std::string &uuid);
+	void removeDeviceInfo(BluetoothSppChannelId channelId);
+	void resetRfcommChannels();
+	void scheduleRxData(SppDeviceInfo *deviceInfo, bool closed);
+	void deliverRxData(SppDeviceInfo *deviceInfo);
+	void setupFramer(SppDeviceInfo *deviceInfo);
+	size_t getRxBufferLimit(SppDeviceInfo *deviceInfo);
+	bool flushTxData(SppDeviceInfo *deviceInfo);
+	void completeTxData(SppDeviceInfo *deviceInfo);
+	void recordRxBurst(SppDeviceInfo *deviceInfo, size_t size);
+	void recordTxData(SppDeviceInfo *deviceInfo, size_t size);
+	void fillChannelStats(SppDeviceInfo *deviceInfo, gint64 now, SppChannelStats &stats);
+	SppChannelHealth checkChannelHealth(SppDeviceInfo *deviceInfo, gint64 now);
+	void failTxData(SppDeviceInfo *deviceInfo);
+	bool attachIoWorker(SppDeviceInfo *deviceInfo);
+	void detachIoWorker(SppDeviceInfo *deviceInfo);
+	void handleIoWorkerEvent(Bluez5SppIoWorker::Event &event);
+	void watchChannel(SppDeviceInfo *deviceInfo);
+	bool isForwarding(SppDeviceInfo *deviceInfo);
+	void finishForwarding(SppDeviceInfo *deviceInfo, SppForwardingResult result);
 
 	SppDeviceInfo* getSppDevice(const BluetoothSppChannelId channelId);
 	SppDeviceInfo* getSppDevice(const std::string &uuid);
@@ -113,11 +328,24 @@ private:
 	GDBusConnection *mConn;
 
 	ConnectedDevice mConnectedDevices;
-	std::unordered_map<BluetoothSppChannelId, bool> mChannelIdList;
+	std::vector<uint8_t> mRfcommChannels;
+	// Channels not in use, the next one to hand out at the back
+	std::vector<uint8_t> mFreeRfcommChannels;
+	SppReceiveOptions mDefaultReceiveOptions;
+	SppTransmitOptions mDefaultTransmitOptions;
+	SppFramingOptions mDefaultFramingOptions;
+	SppWritableCallback mWritableCallback;
+	SppHealthOptions mHealthOptions;
+	SppHealthCallback mHealthCallback;
+	guint mHealthTimer;
+
+	bool mIoWorkerEnabled;
+	std::unique_ptr<Bluez5SppIoWorker> mIoWorker;
+	std::unordered_map<uint32_t, BluetoothSppChannelId> mIoWorkerChannels;
 
 public:
-	int registerProfile(spDeviceInfo &deviceInfo, std::string objPath, BluezProfileManager1 *proxy);
-	BluetoothError createSkeletonAndExport(std::string uuid, spDeviceInfo &deviceInfo);
+	int registerProfile(SppDeviceInfo *deviceInfo, std::string objPath, BluezProfileManager1 *proxy);
+	BluetoothError createSkeletonAndExport(std::string uuid, SppDeviceInfo *deviceInfo);
 };
 
 #endif // BLUEZ5PROFILESPP_H
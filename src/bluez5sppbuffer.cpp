@@ -0,0 +1,165 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <algorithm>
+#include <cstring>
+
+#include "bluez5sppbuffer.h"
+
+Bluez5SppRingBuffer::Bluez5SppRingBuffer(size_t capacity, size_t maxCapacity) :
+	mData(std::max<size_t>(capacity, 1)),
+	mHead(0),
+	mSize(0),
+	mMaxCapacity(std::max(maxCapacity, mData.size()))
+{
+}
+
+void Bluez5SppRingBuffer::setMaxCapacity(size_t maxCapacity)
+{
+	// An already grown buffer is kept, only further growth is limited
+	mMaxCapacity = std::max(maxCapacity, mData.size());
+}
+
+bool Bluez5SppRingBuffer::reserve(size_t count)
+{
+	if (freeSpace() >= count)
+		return true;
+
+	if (mSize + count > mMaxCapacity)
+		return false;
+
+	size_t capacity = mData.size();
+	while (capacity < mSize + count)
+		capacity *= 2;
+
+	resize(std::min(capacity, mMaxCapacity));
+	return true;
+}
+
+bool Bluez5SppRingBuffer::grow()
+{
+	if (mData.size() >= mMaxCapacity)
+		return false;
+
+	resize(std::min(mData.size() * 2, mMaxCapacity));
+	return true;
+}
+
+int Bluez5SppRingBuffer::getFreeRegions(struct iovec regions[2])
+{
+	if (!freeSpace())
+		return 0;
+
+	size_t tail = (mHead + mSize) % mData.size();
+	size_t first = std::min(freeSpace(), mData.size() - tail);
+
+	regions[0].iov_base = &mData[tail];
+	regions[0].iov_len = first;
+	if (first == freeSpace())
+		return 1;
+
+	regions[1].iov_base = &mData[0];
+	regions[1].iov_len = freeSpace() - first;
+	return 2;
+}
+
+void Bluez5SppRingBuffer::commit(size_t count)
+{
+	mSize += std::min(count, freeSpace());
+}
+
+int Bluez5SppRingBuffer::getDataRegions(struct iovec regions[2]) const
+{
+	if (!mSize)
+		return 0;
+
+	size_t first = std::min(mSize, mData.size() - mHead);
+
+	regions[0].iov_base = const_cast<uint8_t*>(&mData[mHead]);
+	regions[0].iov_len = first;
+	if (first == mSize)
+		return 1;
+
+	regions[1].iov_base = const_cast<uint8_t*>(&mData[0]);
+	regions[1].iov_len = mSize - first;
+	return 2;
+}
+
+void Bluez5SppRingBuffer::consume(size_t count)
+{
+	count = std::min(count, mSize);
+	mSize -= count;
+
+	// Starting over at the front keeps the data in one block as often as possible
+	mHead = mSize ? (mHead + count) % mData.size() : 0;
+}
+
+size_t Bluez5SppRingBuffer::append(const uint8_t *data, size_t count)
+{
+	if (!reserve(count))
+		reserve(mMaxCapacity - mSize);
+
+	struct iovec regions[2];
+	int regionCount = getFreeRegions(regions);
+	size_t copied = 0;
+
+	for (int n = 0; n < regionCount && copied < count; n++)
+	{
+		size_t length = std::min(regions[n].iov_len, count - copied);
+		memcpy(regions[n].iov_base, data + copied, length);
+		copied += length;
+	}
+
+	commit(copied);
+	return copied;
+}
+
+const uint8_t* Bluez5SppRingBuffer::linearize()
+{
+	if (mHead + mSize > mData.size())
+		resize(mData.size());
+	else if (mHead && mSize)
+	{
+		memmove(&mData[0], &mData[mHead], mSize);
+		mHead = 0;
+	}
+
+	return &mData[mHead];
+}
+
+void Bluez5SppRingBuffer::copyOut(size_t offset, uint8_t *data, size_t count) const
+{
+	size_t start = (mHead + offset) % mData.size();
+	size_t first = std::min(count, mData.size() - start);
+
+	memcpy(data, &mData[start], first);
+	memcpy(data + first, &mData[0], count - first);
+}
+
+void Bluez5SppRingBuffer::clear()
+{
+	mHead = 0;
+	mSize = 0;
+}
+
+void Bluez5SppRingBuffer::resize(size_t capacity)
+{
+	std::vector<uint8_t> data(capacity);
+	copyOut(0, data.data(), mSize);
+
+	mData.swap(data);
+	mHead = 0;
+}
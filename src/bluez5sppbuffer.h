@@ -0,0 +1,79 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BLUEZ5SPPBUFFER_H
+#define BLUEZ5SPPBUFFER_H
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Byte ring buffer for the data path of an SPP channel. Sockets read into
+// and write from it directly through the iovecs of its free and used
+// regions. It starts small and doubles its capacity on demand up to a
+// maximum, so idle channels stay cheap and busy ones stop reallocating
+// once they reached their working size.
+class Bluez5SppRingBuffer
+{
+public:
+	Bluez5SppRingBuffer(size_t capacity, size_t maxCapacity);
+
+	Bluez5SppRingBuffer(const Bluez5SppRingBuffer&) = delete;
+	Bluez5SppRingBuffer& operator = (const Bluez5SppRingBuffer&) = delete;
+
+	size_t size() const { return mSize; }
+	bool empty() const { return mSize == 0; }
+	size_t capacity() const { return mData.size(); }
+	size_t maxCapacity() const { return mMaxCapacity; }
+	size_t freeSpace() const { return mData.size() - mSize; }
+
+	void setMaxCapacity(size_t maxCapacity);
+
+	// Makes room for at least count more bytes without going over the
+	// maximum capacity. Returns false if that is not possible.
+	bool reserve(size_t count);
+	// Doubles the capacity if the maximum allows it
+	bool grow();
+
+	// Up to two regions, returns how many are filled in
+	int getFreeRegions(struct iovec regions[2]);
+	void commit(size_t count);
+
+	int getDataRegions(struct iovec regions[2]) const;
+	void consume(size_t count);
+
+	// Copies in as much as fits, growing the buffer if needed
+	size_t append(const uint8_t *data, size_t count);
+	// Moves the data to the start of the buffer so it can be handed out as
+	// a single block
+	const uint8_t* linearize();
+	// Byte at the given position from the start of the data
+	uint8_t at(size_t index) const { return mData[(mHead + index) % mData.size()]; }
+	void copyOut(size_t offset, uint8_t *data, size_t count) const;
+
+	void clear();
+
+private:
+	void resize(size_t capacity);
+
+	std::vector<uint8_t> mData;
+	size_t mHead;
+	size_t mSize;
+	size_t mMaxCapacity;
+};
+
+#endif // BLUEZ5SPPBUFFER_H
@@ -0,0 +1,199 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef BLUEZ5SPPCHANNELTABLE_H
+#define BLUEZ5SPPCHANNELTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Slot table handing out SPP channel ids in constant time. Values live in
+// dense slots, free slots are reused in the order they were freed. An id
+// carries the slot in its low bits and the generation of the slot in its
+// high bits, the generation changes whenever a slot is freed. An id which
+// was released therefore doesn't find the next channel using the same slot.
+template <typename T>
+class Bluez5SppChannelTable
+{
+public:
+	typedef uint8_t Id;
+
+	// The id is a BluetoothSppChannelId, so slots and generations share 8
+	// bits. A released id comes back after its slot was freed GENERATIONS
+	// times, which takes at least GENERATIONS * (free slots) releases as
+	// the least recently freed slot is reused first. Even a single free
+	// slot makes it 16 connections before a stale id is valid again.
+	static const unsigned int SLOT_BITS = 4;
+	static const unsigned int GENERATIONS = 1 << (8 - SLOT_BITS);
+	// Id 0 is invalid, so slot n has id n + 1 in generation 0
+	static const size_t MAX_SLOTS = (1 << SLOT_BITS) - 1;
+
+	Bluez5SppChannelTable(size_t limit = MAX_SLOTS) :
+		mLimit(limit < MAX_SLOTS ? limit : MAX_SLOTS),
+		mUsed(0)
+	{
+	}
+
+	Bluez5SppChannelTable(const Bluez5SppChannelTable&) = delete;
+	Bluez5SppChannelTable& operator = (const Bluez5SppChannelTable&) = delete;
+
+	size_t size() const { return mUsed; }
+	size_t getLimit() const { return mLimit; }
+
+	// Values above a lowered limit stay valid until they are released
+	void setLimit(size_t limit)
+	{
+		mLimit = (limit < MAX_SLOTS ? limit : MAX_SLOTS);
+	}
+
+	// Reserves a slot and stores the value in it, 0 if the table is full.
+	// The value can be left empty and set once the id is known.
+	Id insert(std::unique_ptr<T> value)
+	{
+		if (mUsed >= mLimit)
+			return 0;
+
+		size_t slot;
+		if (!mFree.empty())
+		{
+			slot = mFree.front();
+			mFree.pop_front();
+		}
+		else
+		{
+			slot = mSlots.size();
+			mSlots.push_back(Slot());
+		}
+
+		mSlots[slot].used = true;
+		mSlots[slot].value = std::move(value);
+		mUsed++;
+
+		return makeId(slot, mSlots[slot].generation);
+	}
+
+	// nullptr if the id is not in use, also if it was released before
+	T* find(Id id) const
+	{
+		const Slot *slot = getSlot(id);
+		return slot ? slot->value.get() : nullptr;
+	}
+
+	bool set(Id id, std::unique_ptr<T> value)
+	{
+		Slot *slot = const_cast<Slot*>(getSlot(id));
+		if (!slot)
+			return false;
+
+		slot->value = std::move(value);
+		return true;
+	}
+
+	// Destroys the value
+	bool release(Id id)
+	{
+		Slot *slot = const_cast<Slot*>(getSlot(id));
+		if (!slot)
+			return false;
+
+		releaseSlot(slot - mSlots.data());
+		return true;
+	}
+
+	void clear()
+	{
+		for (size_t slot = 0; slot < mSlots.size(); slot++)
+		{
+			if (mSlots[slot].used)
+				releaseSlot(slot);
+		}
+	}
+
+	// The function must not insert or release values
+	template <typename Function>
+	void forEach(Function function) const
+	{
+		for (auto &slot : mSlots)
+		{
+			if (slot.used && slot.value)
+				function(slot.value.get());
+		}
+	}
+
+	template <typename Predicate>
+	T* findIf(Predicate predicate) const
+	{
+		for (auto &slot : mSlots)
+		{
+			if (slot.used && slot.value && predicate(slot.value.get()))
+				return slot.value.get();
+		}
+
+		return nullptr;
+	}
+
+private:
+	struct Slot
+	{
+		Slot() : generation(0), used(false) {}
+
+		std::unique_ptr<T> value;
+		uint8_t generation;
+		bool used;
+	};
+
+	static Id makeId(size_t slot, uint8_t generation)
+	{
+		return (generation << SLOT_BITS) | (slot + 1);
+	}
+
+	const Slot* getSlot(Id id) const
+	{
+		size_t slot = (id & MAX_SLOTS);
+		if (!slot || slot > mSlots.size())
+			return nullptr;
+
+		const Slot &entry = mSlots[slot - 1];
+		if (!entry.used || makeId(slot - 1, entry.generation) != id)
+			return nullptr;
+
+		return &entry;
+	}
+
+	void releaseSlot(size_t slot)
+	{
+		// The value may look itself up while it is destroyed, so it goes
+		// after the slot is free
+		std::unique_ptr<T> value(std::move(mSlots[slot].value));
+
+		mSlots[slot].used = false;
+		mSlots[slot].generation = (mSlots[slot].generation + 1) % GENERATIONS;
+		mUsed--;
+
+		mFree.push_back(slot);
+	}
+
+	std::vector<Slot> mSlots;
+	std::deque<size_t> mFree;
+	size_t mLimit;
+	size_t mUsed;
+};
+
+#endif // BLUEZ5SPPCHANNELTABLE_H
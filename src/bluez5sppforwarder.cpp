@@ -0,0 +1,503 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bluez5sppforwarder.h"
+#include "logging.h"
+#include "utils.h"
+
+// Requested size of the pipe of each direction, the kernel may round it
+#define SPP_FORWARDER_PIPE_SIZE    65536
+// Window of a direction without a pipe
+#define SPP_FORWARDER_BUFFER_SIZE  65536
+
+Bluez5SppForwarder::Direction::Direction(int fromFd, int toFd, SppForwardingResult fromClosedResult, SppForwardingResult toClosedResult) :
+	from(fromFd),
+	to(toFd),
+	fromClosed(fromClosedResult),
+	toClosed(toClosedResult),
+	pipeBytes(0),
+	window(SPP_FORWARDER_BUFFER_SIZE),
+	full(false),
+	eof(false),
+	hangup(false),
+	bytes(0),
+	undeliveredBytes(0)
+{
+	pipe[0] = -1;
+	pipe[1] = -1;
+}
+
+Bluez5SppForwarder::Bluez5SppForwarder(int channelFd, int localFd, FinishedCallback callback) :
+	mChannelFd(channelFd),
+	mLocalFd(localFd),
+	mCallback(callback),
+	mToLocal(channelFd, localFd, SPP_FORWARDING_CHANNEL_CLOSED, SPP_FORWARDING_LOCAL_CLOSED),
+	mToChannel(localFd, channelFd, SPP_FORWARDING_LOCAL_CLOSED, SPP_FORWARDING_CHANNEL_CLOSED),
+	mSpliceCalls(0),
+	mReadCalls(0),
+	mWriteCalls(0),
+	mThrottled(0),
+	mStopFd(-1),
+	mFinishedFd(-1),
+	mFinishedChannel(nullptr),
+	mFinishedWatch(0),
+	mResult(SPP_FORWARDING_STOPPED)
+{
+}
+
+Bluez5SppForwarder::~Bluez5SppForwarder()
+{
+	stop();
+}
+
+bool Bluez5SppForwarder::start()
+{
+	if (isRunning())
+		return true;
+
+	int flags = fcntl(mLocalFd, F_GETFL);
+	if (flags < 0 || fcntl(mLocalFd, F_SETFL, flags | O_NONBLOCK) < 0)
+	{
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to make local fd non-blocking: %s", strerror(errno));
+		return false;
+	}
+
+	mStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	mFinishedFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (mStopFd < 0 || mFinishedFd < 0)
+	{
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to create SPP forwarder: %s", strerror(errno));
+		stop();
+		return false;
+	}
+
+	setupDirection(mToLocal);
+	setupDirection(mToChannel);
+
+	mResult = SPP_FORWARDING_STOPPED;
+	mFinishedChannel = g_io_channel_unix_new(mFinishedFd);
+	mFinishedWatch = g_io_add_watch(mFinishedChannel, G_IO_IN, onFinished, this);
+
+	mThread = std::thread(&Bluez5SppForwarder::run, this);
+
+	return true;
+}
+
+void Bluez5SppForwarder::stop()
+{
+	if (isRunning())
+	{
+		uint64_t value = 1;
+		if (write(mStopFd, &value, sizeof(value)) < 0)
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to stop SPP forwarder: %s", strerror(errno));
+		mThread.join();
+	}
+
+	if (mFinishedWatch)
+	{
+		g_source_remove(mFinishedWatch);
+		mFinishedWatch = 0;
+	}
+
+	if (mFinishedChannel)
+	{
+		g_io_channel_unref(mFinishedChannel);
+		mFinishedChannel = nullptr;
+	}
+
+	if (mFinishedFd >= 0)
+	{
+		close(mFinishedFd);
+		mFinishedFd = -1;
+	}
+
+	if (mStopFd >= 0)
+	{
+		close(mStopFd);
+		mStopFd = -1;
+	}
+
+	drainDirection(mToLocal);
+	drainDirection(mToChannel);
+	closeDirection(mToLocal);
+	closeDirection(mToChannel);
+}
+
+SppForwardingCounters Bluez5SppForwarder::getCounters() const
+{
+	SppForwardingCounters counters;
+
+	counters.bytesToLocal = mToLocal.bytes.load(std::memory_order_relaxed);
+	counters.bytesToChannel = mToChannel.bytes.load(std::memory_order_relaxed);
+	counters.spliceCalls = mSpliceCalls.load(std::memory_order_relaxed);
+	counters.readCalls = mReadCalls.load(std::memory_order_relaxed);
+	counters.writeCalls = mWriteCalls.load(std::memory_order_relaxed);
+	counters.throttled = mThrottled.load(std::memory_order_relaxed);
+	counters.undeliveredToLocal = mToLocal.undeliveredBytes;
+	counters.undeliveredToChannel = mToChannel.undeliveredBytes;
+
+	return counters;
+}
+
+void Bluez5SppForwarder::takeUndelivered(std::vector<uint8_t> &toLocal, std::vector<uint8_t> &toChannel)
+{
+	toLocal.clear();
+	toChannel.clear();
+
+	if (isRunning())
+		return;
+
+	toLocal.swap(mToLocal.undelivered);
+	toChannel.swap(mToChannel.undelivered);
+}
+
+void Bluez5SppForwarder::setupDirection(Direction &direction)
+{
+	closeDirection(direction);
+
+	direction.full = false;
+	direction.eof = false;
+	direction.hangup = false;
+	direction.undelivered.clear();
+	direction.undeliveredBytes = 0;
+
+	if (pipe2(direction.pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+	{
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to create forwarding pipe: %s", strerror(errno));
+		direction.pipe[0] = -1;
+		direction.pipe[1] = -1;
+		direction.window = SPP_FORWARDER_BUFFER_SIZE;
+		direction.buffer.reset(new Bluez5SppRingBuffer(direction.window, direction.window));
+		return;
+	}
+
+	fcntl(direction.pipe[1], F_SETPIPE_SZ, SPP_FORWARDER_PIPE_SIZE);
+	int size = fcntl(direction.pipe[1], F_GETPIPE_SZ);
+	direction.window = size > 0 ? size : SPP_FORWARDER_PIPE_SIZE;
+}
+
+void Bluez5SppForwarder::drainDirection(Direction &direction)
+{
+	size_t drained = direction.undelivered.size();
+
+	if (direction.buffer)
+	{
+		size_t size = direction.buffer->size();
+		const uint8_t *data = direction.buffer->linearize();
+		direction.undelivered.insert(direction.undelivered.end(), data, data + size);
+		direction.buffer->consume(size);
+	}
+
+	while (direction.pipeBytes && direction.pipe[0] >= 0)
+	{
+		size_t offset = direction.undelivered.size();
+		direction.undelivered.resize(offset + direction.pipeBytes);
+
+		ssize_t count = read(direction.pipe[0], direction.undelivered.data() + offset, direction.pipeBytes);
+		if (count <= 0)
+		{
+			direction.undelivered.resize(offset);
+			if (count < 0 && errno == EINTR)
+				continue;
+
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to empty forwarding pipe, %zu bytes lost", direction.pipeBytes);
+			break;
+		}
+
+		direction.undelivered.resize(offset + count);
+		direction.pipeBytes -= count;
+	}
+
+	// Counts what was lost as well
+	direction.undeliveredBytes += direction.undelivered.size() - drained + direction.pipeBytes;
+}
+
+void Bluez5SppForwarder::closeDirection(Direction &direction)
+{
+	for (int n = 0; n < 2; n++)
+	{
+		if (direction.pipe[n] >= 0)
+			close(direction.pipe[n]);
+		direction.pipe[n] = -1;
+	}
+
+	direction.pipeBytes = 0;
+	direction.buffer.reset();
+}
+
+void Bluez5SppForwarder::run()
+{
+	// A peer which went away shows up as EPIPE, not as a signal taking
+	// down the process
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	while (true)
+	{
+		struct pollfd fds[3];
+		memset(fds, 0, sizeof(fds));
+		fds[0].fd = mStopFd;
+		fds[0].events = POLLIN;
+		fds[1].fd = mChannelFd;
+		fds[1].events = getEvents(mToLocal, mToChannel, fds[1].fd);
+		fds[2].fd = mLocalFd;
+		fds[2].events = getEvents(mToChannel, mToLocal, fds[2].fd);
+
+		if (poll(fds, 3, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "SPP forwarder failed to wait: %s", strerror(errno));
+			finish(SPP_FORWARDING_FAILED);
+			return;
+		}
+
+		if (fds[0].revents)
+			return;
+
+		if ((fds[1].revents | fds[2].revents) & POLLNVAL)
+		{
+			finish(SPP_FORWARDING_FAILED);
+			return;
+		}
+
+		if (fds[1].revents & (POLLHUP | POLLERR))
+			mToLocal.hangup = true;
+		if (fds[2].revents & (POLLHUP | POLLERR))
+			mToChannel.hangup = true;
+
+		// Reading tells what a hang up was about, end of file or an error
+		if (!transfer(mToLocal, fds[1].revents & (POLLIN | POLLHUP | POLLERR)) ||
+		    !transfer(mToChannel, fds[2].revents & (POLLIN | POLLHUP | POLLERR)))
+			return;
+	}
+}
+
+short Bluez5SppForwarder::getEvents(Direction &source, Direction &destination, int &fd)
+{
+	short events = 0;
+
+	if (!source.eof && !source.full)
+		events |= POLLIN;
+	if (destination.pending())
+		events |= POLLOUT;
+
+	// A hang up is reported whatever is asked for, the fd is left out for
+	// as long as there is nothing to do with it
+	if (!events && source.hangup)
+		fd = -1;
+
+	return events;
+}
+
+bool Bluez5SppForwarder::transfer(Direction &direction, bool readable)
+{
+	// Whatever the destination takes first makes room to read into
+	if (direction.pending() && flush(direction) < 0)
+		return false;
+
+	if (readable && !direction.eof && !direction.full)
+	{
+		if (fill(direction) < 0)
+			return false;
+
+		if (direction.pending() && flush(direction) < 0)
+			return false;
+	}
+
+	if (direction.eof && !direction.pending())
+	{
+		finish(direction.fromClosed);
+		return false;
+	}
+
+	return true;
+}
+
+ssize_t Bluez5SppForwarder::fill(Direction &direction)
+{
+	ssize_t count;
+
+	if (direction.buffer)
+	{
+		struct iovec regions[2];
+		int regionCount = direction.buffer->getFreeRegions(regions);
+		count = readv(direction.from, regions, regionCount);
+		mReadCalls.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		count = splice(direction.from, nullptr, direction.pipe[1], nullptr,
+		               direction.window - direction.pipeBytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		mSpliceCalls.fetch_add(1, std::memory_order_relaxed);
+
+		if (count < 0 && errno == EINVAL)
+			return fallBack(direction) ? fill(direction) : -1;
+
+		// The source is readable, so it is the pipe which is full. That
+		// can happen well below the window if the data came in many small
+		// packets.
+		if (count < 0 && errno == EAGAIN && direction.pipeBytes)
+		{
+			direction.full = true;
+			mThrottled.fetch_add(1, std::memory_order_relaxed);
+			return 0;
+		}
+	}
+
+	if (count > 0)
+	{
+		if (direction.buffer)
+			direction.buffer->commit(count);
+		else
+			direction.pipeBytes += count;
+
+		if (direction.pending() >= direction.window)
+		{
+			direction.full = true;
+			mThrottled.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		return count;
+	}
+
+	if (count == 0)
+	{
+		direction.eof = true;
+		return 0;
+	}
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return 0;
+
+	ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to read data to forward: %s", strerror(errno));
+	finish(direction.fromClosed);
+	return -1;
+}
+
+ssize_t Bluez5SppForwarder::flush(Direction &direction)
+{
+	ssize_t count;
+
+	if (direction.buffer)
+	{
+		struct iovec regions[2];
+		int regionCount = direction.buffer->getDataRegions(regions);
+		count = writev(direction.to, regions, regionCount);
+		mWriteCalls.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		count = splice(direction.pipe[0], nullptr, direction.to, nullptr,
+		               direction.pipeBytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		mSpliceCalls.fetch_add(1, std::memory_order_relaxed);
+
+		if (count < 0 && errno == EINVAL)
+			return fallBack(direction) ? flush(direction) : -1;
+	}
+
+	if (count > 0)
+	{
+		if (direction.buffer)
+			direction.buffer->consume(count);
+		else
+			direction.pipeBytes -= count;
+
+		direction.full = false;
+		direction.bytes.fetch_add(count, std::memory_order_relaxed);
+		return count;
+	}
+
+	if (count == 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return 0;
+
+	ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to write forwarded data: %s", strerror(errno));
+	finish(direction.toClosed);
+	return -1;
+}
+
+bool Bluez5SppForwarder::fallBack(Direction &direction)
+{
+	DEBUG("Forwarding from fd %d to fd %d can't splice, copying instead", direction.from, direction.to);
+
+	std::unique_ptr<Bluez5SppRingBuffer> buffer(new Bluez5SppRingBuffer(direction.window, direction.window));
+
+	// What is in the pipe already goes first
+	while (direction.pipeBytes)
+	{
+		struct iovec regions[2];
+		int regionCount = buffer->getFreeRegions(regions);
+		ssize_t count = readv(direction.pipe[0], regions, regionCount);
+		if (count <= 0)
+		{
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to empty forwarding pipe: %s", strerror(errno));
+			finish(SPP_FORWARDING_FAILED);
+			return false;
+		}
+
+		buffer->commit(count);
+		direction.pipeBytes -= count;
+	}
+
+	closeDirection(direction);
+	direction.buffer = std::move(buffer);
+	direction.full = direction.buffer->size() >= direction.window;
+
+	return true;
+}
+
+void Bluez5SppForwarder::finish(SppForwardingResult result)
+{
+	mResult = result;
+
+	uint64_t value = 1;
+	if (write(mFinishedFd, &value, sizeof(value)) < 0)
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to report end of SPP forwarding: %s", strerror(errno));
+}
+
+gboolean Bluez5SppForwarder::onFinished(GIOChannel *io, GIOCondition condition, gpointer user_data)
+{
+	UNUSED(io);
+	UNUSED(condition);
+
+	Bluez5SppForwarder *forwarder = static_cast<Bluez5SppForwarder*>(user_data);
+
+	// The thread is done once it reported the end
+	forwarder->mThread.join();
+	forwarder->mFinishedWatch = 0;
+
+	// The callback may destroy the forwarder
+	FinishedCallback callback = forwarder->mCallback;
+	SppForwardingResult result = forwarder->mResult;
+	if (callback)
+		callback(result);
+
+	return FALSE;
+}
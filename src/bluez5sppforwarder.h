@@ -0,0 +1,153 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef BLUEZ5SPPFORWARDER_H
+#define BLUEZ5SPPFORWARDER_H
+
+#include <glib.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bluez5sppbuffer.h"
+
+enum SppForwardingResult
+{
+	SPP_FORWARDING_STOPPED = 0,
+	// End of file or an error on the local fd
+	SPP_FORWARDING_LOCAL_CLOSED,
+	// The peer closed the channel or the socket failed
+	SPP_FORWARDING_CHANNEL_CLOSED,
+	SPP_FORWARDING_FAILED
+};
+
+struct SppForwardingCounters
+{
+	SppForwardingCounters()
+		: bytesToLocal(0), bytesToChannel(0), spliceCalls(0), readCalls(0), writeCalls(0), throttled(0),
+		  undeliveredToLocal(0), undeliveredToChannel(0) {
+	}
+
+	uint64_t bytesToLocal;
+	uint64_t bytesToChannel;
+	uint64_t spliceCalls;
+	// Only made by a direction which can't splice
+	uint64_t readCalls;
+	uint64_t writeCalls;
+	// Times a direction stopped reading because its window was full
+	uint64_t throttled;
+	// Read but not written yet when the forwarding ended
+	uint64_t undeliveredToLocal;
+	uint64_t undeliveredToChannel;
+};
+
+// Copies everything between the socket of a channel and a local fd, e.g. a
+// UART, a pty or a Unix socket, on a thread of its own. Each direction
+// moves the data with splice() through a pipe, so it never passes through
+// user space. An fd which can't be spliced makes its direction fall back
+// to read() and write() through a buffer. Either way a direction holds at
+// most one pipe worth of data, once that is full it stops reading until
+// the other side took some.
+//
+// Neither fd is closed, the local one is made non-blocking. What a direction
+// still held when the forwarding ended is kept until it is taken with
+// takeUndelivered(). All public methods are to be called from the main
+// context.
+class Bluez5SppForwarder
+{
+public:
+	typedef std::function<void(SppForwardingResult result)> FinishedCallback;
+
+	Bluez5SppForwarder(int channelFd, int localFd, FinishedCallback callback);
+	~Bluez5SppForwarder();
+
+	Bluez5SppForwarder(const Bluez5SppForwarder&) = delete;
+	Bluez5SppForwarder& operator = (const Bluez5SppForwarder&) = delete;
+
+	bool start();
+	// The callback is not called for a forwarding stopped this way
+	void stop();
+	bool isRunning() const { return mThread.joinable(); }
+
+	SppForwardingCounters getCounters() const;
+	// Only returns data once the forwarding ended
+	void takeUndelivered(std::vector<uint8_t> &toLocal, std::vector<uint8_t> &toChannel);
+
+private:
+	struct Direction
+	{
+		Direction(int fromFd, int toFd, SppForwardingResult fromClosed, SppForwardingResult toClosed);
+
+		size_t pending() const { return buffer ? buffer->size() : pipeBytes; }
+
+		int from;
+		int to;
+		// Why forwarding ends when reading from or writing to the fds fails
+		SppForwardingResult fromClosed;
+		SppForwardingResult toClosed;
+		int pipe[2];
+		size_t pipeBytes;
+		size_t window;
+		// Only set once the direction fell back to read() and write()
+		std::unique_ptr<Bluez5SppRingBuffer> buffer;
+		// The window is full, or the pipe can't take more though it holds
+		// less than that
+		bool full;
+		bool eof;
+		bool hangup;
+		std::atomic<uint64_t> bytes;
+		// Left over once the forwarding ended
+		std::vector<uint8_t> undelivered;
+		uint64_t undeliveredBytes;
+	};
+
+	void run();
+	void setupDirection(Direction &direction);
+	void drainDirection(Direction &direction);
+	void closeDirection(Direction &direction);
+	short getEvents(Direction &source, Direction &destination, int &fd);
+	bool transfer(Direction &direction, bool readable);
+	ssize_t fill(Direction &direction);
+	ssize_t flush(Direction &direction);
+	bool fallBack(Direction &direction);
+	void finish(SppForwardingResult result);
+	static gboolean onFinished(GIOChannel *io, GIOCondition condition, gpointer user_data);
+
+	int mChannelFd;
+	int mLocalFd;
+	FinishedCallback mCallback;
+
+	Direction mToLocal;
+	Direction mToChannel;
+	std::atomic<uint64_t> mSpliceCalls;
+	std::atomic<uint64_t> mReadCalls;
+	std::atomic<uint64_t> mWriteCalls;
+	std::atomic<uint64_t> mThrottled;
+
+	int mStopFd;
+	int mFinishedFd;
+	GIOChannel *mFinishedChannel;
+	guint mFinishedWatch;
+	SppForwardingResult mResult;
+	std::thread mThread;
+};
+
+#endif // BLUEZ5SPPFORWARDER_H
@@ -0,0 +1,224 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <algorithm>
+
+#include "bluez5sppframer.h"
+
+Bluez5SppFramer::Bluez5SppFramer(const SppFramingOptions &options) :
+	mOptions(options),
+	mSkip(0),
+	mDiscarding(false),
+	mScanned(0)
+{
+}
+
+bool Bluez5SppFramer::isValid(const SppFramingOptions &options)
+{
+	switch (options.mode)
+	{
+	case SppFramingOptions::NONE:
+		return true;
+	case SppFramingOptions::LENGTH_PREFIX:
+		return options.prefixSize == 1 || options.prefixSize == 2 || options.prefixSize == 4;
+	case SppFramingOptions::DELIMITER:
+		return !options.delimiter.empty();
+	}
+
+	return false;
+}
+
+size_t Bluez5SppFramer::getHeaderSize() const
+{
+	if (mOptions.mode == SppFramingOptions::LENGTH_PREFIX)
+		return mOptions.prefixSize;
+
+	return mOptions.delimiter.size();
+}
+
+size_t Bluez5SppFramer::getBufferSize() const
+{
+	if (!mOptions.maxFrameSize)
+		return 0;
+
+	return mOptions.maxFrameSize + getHeaderSize();
+}
+
+size_t Bluez5SppFramer::getMaxFrameSize(const Bluez5SppRingBuffer &buffer) const
+{
+	if (mOptions.maxFrameSize)
+		return mOptions.maxFrameSize;
+
+	return buffer.maxCapacity() - std::min(buffer.maxCapacity(), getHeaderSize());
+}
+
+void Bluez5SppFramer::process(Bluez5SppRingBuffer &buffer, FrameCallback callback)
+{
+	while (true)
+	{
+		if (mSkip)
+		{
+			size_t count = std::min(mSkip, buffer.size());
+			discard(buffer, count);
+			mSkip -= count;
+			if (mSkip)
+				return;
+		}
+
+		bool more = false;
+		if (mOptions.mode == SppFramingOptions::LENGTH_PREFIX)
+			more = processLengthPrefix(buffer, callback);
+		else if (mOptions.mode == SppFramingOptions::DELIMITER)
+			more = processDelimiter(buffer, callback);
+
+		if (!more)
+			return;
+	}
+}
+
+bool Bluez5SppFramer::processLengthPrefix(Bluez5SppRingBuffer &buffer, FrameCallback &callback)
+{
+	size_t prefixSize = mOptions.prefixSize;
+	if (buffer.size() < prefixSize)
+		return false;
+
+	uint32_t length = 0;
+	for (size_t n = 0; n < prefixSize; n++)
+	{
+		uint32_t byte = buffer.at(n);
+		if (mOptions.bigEndian)
+			length = (length << 8) | byte;
+		else
+			length |= byte << (8 * n);
+	}
+
+	if (length > getMaxFrameSize(buffer))
+	{
+		// The peer is still expected to send the whole frame, dropping it
+		// as it comes keeps us in sync
+		mStats.malformedFrames++;
+		discard(buffer, prefixSize);
+		mSkip = length;
+		return true;
+	}
+
+	if (buffer.size() < prefixSize + length)
+		return false;
+
+	deliverFrame(buffer, prefixSize, length, callback);
+	buffer.consume(prefixSize + length);
+	return true;
+}
+
+bool Bluez5SppFramer::processDelimiter(Bluez5SppRingBuffer &buffer, FrameCallback &callback)
+{
+	size_t delimiterSize = mOptions.delimiter.size();
+	size_t position;
+
+	if (findDelimiter(buffer, position))
+	{
+		mScanned = 0;
+
+		if (mDiscarding)
+		{
+			mDiscarding = false;
+			discard(buffer, position + delimiterSize);
+			return true;
+		}
+
+		if (position > getMaxFrameSize(buffer))
+		{
+			mStats.malformedFrames++;
+			discard(buffer, position + delimiterSize);
+			return true;
+		}
+
+		deliverFrame(buffer, 0, position, callback);
+		buffer.consume(position + delimiterSize);
+		return true;
+	}
+
+	// Everything before mScanned is known not to start a delimiter
+	if (mDiscarding)
+	{
+		discard(buffer, mScanned);
+		mScanned = 0;
+	}
+	else if (mScanned > getMaxFrameSize(buffer))
+	{
+		mStats.malformedFrames++;
+		mDiscarding = true;
+		discard(buffer, mScanned);
+		mScanned = 0;
+	}
+
+	return false;
+}
+
+bool Bluez5SppFramer::findDelimiter(const Bluez5SppRingBuffer &buffer, size_t &position)
+{
+	const std::vector<uint8_t> &delimiter = mOptions.delimiter;
+
+	for (; mScanned + delimiter.size() <= buffer.size(); mScanned++)
+	{
+		size_t n = 0;
+		while (n < delimiter.size() && buffer.at(mScanned + n) == delimiter[n])
+			n++;
+
+		if (n == delimiter.size())
+		{
+			position = mScanned;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Bluez5SppFramer::deliverFrame(Bluez5SppRingBuffer &buffer, size_t offset, size_t size, FrameCallback &callback)
+{
+	if (!size)
+		return;
+
+	mStats.frames++;
+
+	struct iovec regions[2];
+	buffer.getDataRegions(regions);
+
+	if (regions[0].iov_len >= offset + size)
+		callback(static_cast<const uint8_t*>(regions[0].iov_base) + offset, size);
+	else
+		callback(buffer.linearize() + offset, size);
+}
+
+void Bluez5SppFramer::discard(Bluez5SppRingBuffer &buffer, size_t count)
+{
+	buffer.consume(count);
+	mStats.discardedBytes += count;
+}
+
+void Bluez5SppFramer::finish(Bluez5SppRingBuffer &buffer)
+{
+	// Frames being dropped were counted already
+	if (!buffer.empty() && !mSkip && !mDiscarding)
+		mStats.malformedFrames++;
+
+	discard(buffer, buffer.size());
+	mSkip = 0;
+	mDiscarding = false;
+	mScanned = 0;
+}
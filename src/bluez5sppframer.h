@@ -0,0 +1,112 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef BLUEZ5SPPFRAMER_H
+#define BLUEZ5SPPFRAMER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "bluez5sppbuffer.h"
+
+// How the data received on a channel is split into messages. Frames are
+// handed on without their length prefix or delimiter, empty frames are
+// dropped. A frame longer than maxFrameSize is counted as malformed and
+// discarded, with a maxFrameSize of 0 the receive buffer is the limit.
+struct SppFramingOptions
+{
+	enum Mode
+	{
+		NONE = 0,
+		LENGTH_PREFIX,
+		DELIMITER
+	};
+
+	SppFramingOptions()
+		: mode(NONE), prefixSize(2), bigEndian(true), maxFrameSize(0) {
+	}
+
+	Mode mode;
+	// Size of the length prefix in bytes, 1, 2 or 4
+	uint8_t prefixSize;
+	bool bigEndian;
+	std::vector<uint8_t> delimiter;
+	size_t maxFrameSize;
+};
+
+struct SppFramingStats
+{
+	SppFramingStats()
+		: frames(0), malformedFrames(0), discardedBytes(0) {
+	}
+
+	uint64_t frames;
+	// Frames over the size limit or cut off by the disconnection
+	uint64_t malformedFrames;
+	uint64_t discardedBytes;
+};
+
+// Splits the content of a receive buffer into frames. Frames are handed
+// out straight from the buffer, they are only moved if they wrap around
+// its end.
+class Bluez5SppFramer
+{
+public:
+	typedef std::function<void(const uint8_t *data, size_t size)> FrameCallback;
+
+	Bluez5SppFramer(const SppFramingOptions &options);
+
+	Bluez5SppFramer(const Bluez5SppFramer&) = delete;
+	Bluez5SppFramer& operator = (const Bluez5SppFramer&) = delete;
+
+	static bool isValid(const SppFramingOptions &options);
+
+	// Capacity the receive buffer needs so that every frame which is not
+	// over the limit fits into it, 0 if any capacity will do
+	size_t getBufferSize() const;
+
+	// Hands every complete frame to the callback and takes it off the
+	// buffer, an incomplete one at the end is left in place
+	void process(Bluez5SppRingBuffer &buffer, FrameCallback callback);
+	// No more data is coming, what is left is an incomplete frame
+	void finish(Bluez5SppRingBuffer &buffer);
+
+	const SppFramingStats& getStats() const { return mStats; }
+
+private:
+	size_t getMaxFrameSize(const Bluez5SppRingBuffer &buffer) const;
+	size_t getHeaderSize() const;
+	bool processLengthPrefix(Bluez5SppRingBuffer &buffer, FrameCallback &callback);
+	bool processDelimiter(Bluez5SppRingBuffer &buffer, FrameCallback &callback);
+	bool findDelimiter(const Bluez5SppRingBuffer &buffer, size_t &position);
+	void deliverFrame(Bluez5SppRingBuffer &buffer, size_t offset, size_t size, FrameCallback &callback);
+	void discard(Bluez5SppRingBuffer &buffer, size_t count);
+
+	SppFramingOptions mOptions;
+	SppFramingStats mStats;
+	// Bytes of a malformed frame which are still to come and get dropped
+	size_t mSkip;
+	// The current frame is over the limit, everything up to the next
+	// delimiter is dropped
+	bool mDiscarding;
+	// Where the search for the delimiter continues
+	size_t mScanned;
+};
+
+#endif // BLUEZ5SPPFRAMER_H
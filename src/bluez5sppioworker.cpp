@@ -0,0 +1,557 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bluez5sppioworker.h"
+#include "logging.h"
+#include "utils.h"
+
+#define SPP_IO_WORKER_MAX_EVENTS     16
+#define SPP_IO_WORKER_READ_CHUNK     16384
+// Larger reads are handed on in pieces so one link can't starve the others
+#define SPP_IO_WORKER_MAX_READ       262144
+#define SPP_IO_WORKER_TX_BUFFER      4096
+
+// Key of the command eventfd in the epoll set, channel keys start at 1
+#define SPP_IO_WORKER_COMMAND_KEY    0
+
+Bluez5SppIoWorker::Channel::Channel(int channelFd, size_t channelRxLimit) :
+	fd(channelFd),
+	closed(false),
+	events(EPOLLIN),
+	rxInFlight(0),
+	rxLimit(channelRxLimit),
+	txBuffer(SPP_IO_WORKER_TX_BUFFER, SPP_IO_WORKER_TX_BUFFER),
+	txQueued(0),
+	txWritten(0),
+	readCalls(0),
+	writeCalls(0),
+	wouldBlock(0),
+	shortWrites(0)
+{
+}
+
+Bluez5SppIoWorker::Bluez5SppIoWorker(EventHandler handler) :
+	mHandler(handler),
+	mEpollFd(-1),
+	mCommandFd(-1),
+	mEventFd(-1),
+	mEventChannel(nullptr),
+	mEventWatch(0),
+	mNextChannel(1)
+{
+}
+
+Bluez5SppIoWorker::~Bluez5SppIoWorker()
+{
+	stop();
+}
+
+bool Bluez5SppIoWorker::start()
+{
+	if (isRunning())
+		return true;
+
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	mCommandFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (mEpollFd < 0 || mCommandFd < 0 || mEventFd < 0)
+	{
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to create SPP I/O worker: %s", strerror(errno));
+		stop();
+		return false;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = SPP_IO_WORKER_COMMAND_KEY;
+	if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCommandFd, &event) < 0)
+	{
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to watch SPP I/O worker commands: %s", strerror(errno));
+		stop();
+		return false;
+	}
+
+	mEventChannel = g_io_channel_unix_new(mEventFd);
+	mEventWatch = g_io_add_watch(mEventChannel, G_IO_IN, onEvents, this);
+
+	mThread = std::thread(&Bluez5SppIoWorker::run, this);
+
+	return true;
+}
+
+void Bluez5SppIoWorker::stop()
+{
+	if (isRunning())
+	{
+		Command command;
+		command.type = Command::STOP;
+		sendCommand(std::move(command));
+		mThread.join();
+	}
+
+	// Whatever the worker still reported is of no interest anymore
+	mEvents.popAll();
+	mCommands.popAll();
+
+	for (auto &channel : mChannels)
+		close(channel.second->fd);
+	mChannels.clear();
+
+	if (mEventWatch)
+	{
+		g_source_remove(mEventWatch);
+		mEventWatch = 0;
+	}
+
+	if (mEventChannel)
+	{
+		g_io_channel_unref(mEventChannel);
+		mEventChannel = nullptr;
+	}
+
+	if (mEventFd >= 0)
+	{
+		close(mEventFd);
+		mEventFd = -1;
+	}
+
+	if (mCommandFd >= 0)
+	{
+		close(mCommandFd);
+		mCommandFd = -1;
+	}
+
+	if (mEpollFd >= 0)
+	{
+		close(mEpollFd);
+		mEpollFd = -1;
+	}
+}
+
+uint32_t Bluez5SppIoWorker::addChannel(int fd, size_t rxLimit)
+{
+	if (!isRunning())
+		return 0;
+
+	Command command;
+	command.type = Command::ADD;
+	command.channel = mNextChannel++;
+	command.fd = fd;
+	command.size = rxLimit;
+
+	uint32_t channel = command.channel;
+	sendCommand(std::move(command));
+
+	return channel;
+}
+
+void Bluez5SppIoWorker::removeChannel(uint32_t channel)
+{
+	if (!isRunning())
+		return;
+
+	Command command;
+	command.type = Command::REMOVE;
+	command.channel = channel;
+	sendCommand(std::move(command));
+}
+
+void Bluez5SppIoWorker::write(uint32_t channel, uint64_t writeId, const uint8_t *data, size_t size)
+{
+	Command command;
+	command.type = Command::WRITE;
+	command.channel = channel;
+	command.writeId = writeId;
+	command.data.assign(data, data + size);
+	sendCommand(std::move(command));
+}
+
+void Bluez5SppIoWorker::acknowledge(uint32_t channel, size_t size)
+{
+	if (!isRunning() || !size)
+		return;
+
+	Command command;
+	command.type = Command::ACKNOWLEDGE;
+	command.channel = channel;
+	command.size = size;
+	sendCommand(std::move(command));
+}
+
+void Bluez5SppIoWorker::setReceiveLimit(uint32_t channel, size_t rxLimit)
+{
+	if (!isRunning())
+		return;
+
+	Command command;
+	command.type = Command::SET_RECEIVE_LIMIT;
+	command.channel = channel;
+	command.size = rxLimit;
+	sendCommand(std::move(command));
+}
+
+void Bluez5SppIoWorker::sendCommand(Command &&command)
+{
+	if (!mCommands.push(std::move(command)))
+		return;
+
+	uint64_t wakeup = 1;
+	if (::write(mCommandFd, &wakeup, sizeof(wakeup)) < 0 && errno != EAGAIN)
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to wake up SPP I/O worker: %s", strerror(errno));
+}
+
+void Bluez5SppIoWorker::postEvent(Channel &channel, Event &&event)
+{
+	event.readCalls = channel.readCalls;
+	event.writeCalls = channel.writeCalls;
+	event.wouldBlock = channel.wouldBlock;
+	event.shortWrites = channel.shortWrites;
+	channel.readCalls = 0;
+	channel.writeCalls = 0;
+	channel.wouldBlock = 0;
+	channel.shortWrites = 0;
+
+	postEvent(std::move(event));
+}
+
+void Bluez5SppIoWorker::postEvent(Event &&event)
+{
+	if (!mEvents.push(std::move(event)))
+		return;
+
+	uint64_t wakeup = 1;
+	if (::write(mEventFd, &wakeup, sizeof(wakeup)) < 0 && errno != EAGAIN)
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to wake up main loop for SPP: %s", strerror(errno));
+}
+
+gboolean Bluez5SppIoWorker::onEvents(GIOChannel *io, GIOCondition condition, gpointer user_data)
+{
+	UNUSED(io);
+	UNUSED(condition);
+	Bluez5SppIoWorker *worker = static_cast<Bluez5SppIoWorker*>(user_data);
+
+	worker->dispatchEvents();
+
+	return TRUE;
+}
+
+void Bluez5SppIoWorker::dispatchEvents()
+{
+	// Reset the eventfd before looking at the queue, anything posted after
+	// that wakes us up again
+	uint64_t wakeups;
+	if (read(mEventFd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to read SPP I/O worker events: %s", strerror(errno));
+
+	std::vector<Event> events = mEvents.popAll();
+	for (auto &event : events)
+		mHandler(event);
+}
+
+void Bluez5SppIoWorker::run()
+{
+	struct epoll_event events[SPP_IO_WORKER_MAX_EVENTS];
+
+	while (true)
+	{
+		int count = epoll_wait(mEpollFd, events, SPP_IO_WORKER_MAX_EVENTS, -1);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "SPP I/O worker failed to wait: %s", strerror(errno));
+			return;
+		}
+
+		for (int n = 0; n < count; n++)
+		{
+			uint32_t key = events[n].data.u64;
+			if (key == SPP_IO_WORKER_COMMAND_KEY)
+			{
+				if (!processCommands())
+					return;
+				continue;
+			}
+
+			// Might have been removed by a command handled in this round
+			auto channelIter = mChannels.find(key);
+			if (channelIter == mChannels.end())
+				continue;
+
+			Channel &channel = *channelIter->second;
+			if (events[n].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				readChannel(key, channel, events[n].events & (EPOLLHUP | EPOLLERR));
+			if (!channel.closed && (events[n].events & EPOLLOUT))
+				flushChannel(key, channel);
+		}
+	}
+}
+
+bool Bluez5SppIoWorker::processCommands()
+{
+	uint64_t wakeups;
+	if (read(mCommandFd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to read SPP I/O worker commands: %s", strerror(errno));
+
+	std::vector<Command> commands = mCommands.popAll();
+	for (auto &command : commands)
+	{
+		if (command.type == Command::STOP)
+			return false;
+
+		if (command.type == Command::ADD)
+		{
+			std::unique_ptr<Channel> channel(new Channel(command.fd, command.size));
+
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.u64 = command.channel;
+			if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, command.fd, &event) < 0)
+			{
+				ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to watch SPP socket: %s", strerror(errno));
+				channel->closed = true;
+
+				Event closedEvent;
+				closedEvent.type = Event::CLOSED;
+				closedEvent.channel = command.channel;
+				postEvent(std::move(closedEvent));
+			}
+
+			mChannels[command.channel] = std::move(channel);
+			continue;
+		}
+
+		auto channelIter = mChannels.find(command.channel);
+
+		if (command.type == Command::REMOVE)
+		{
+			if (channelIter == mChannels.end())
+				continue;
+
+			Channel &channel = *channelIter->second;
+			if (!channel.closed)
+				epoll_ctl(mEpollFd, EPOLL_CTL_DEL, channel.fd, NULL);
+			close(channel.fd);
+			mChannels.erase(channelIter);
+			continue;
+		}
+
+		if (command.type == Command::ACKNOWLEDGE || command.type == Command::SET_RECEIVE_LIMIT)
+		{
+			if (channelIter == mChannels.end())
+				continue;
+
+			Channel &channel = *channelIter->second;
+			if (command.type == Command::ACKNOWLEDGE)
+				channel.rxInFlight -= std::min(command.size, channel.rxInFlight);
+			else
+				channel.rxLimit = command.size;
+
+			// Resumes reading once the main context caught up
+			updateEvents(command.channel, channel);
+			continue;
+		}
+
+		// Command::WRITE
+		if (channelIter == mChannels.end() || channelIter->second->closed)
+		{
+			Event event;
+			event.type = Event::WRITTEN;
+			event.channel = command.channel;
+			event.writeId = command.writeId;
+			event.success = false;
+			postEvent(std::move(event));
+			continue;
+		}
+
+		Channel &channel = *channelIter->second;
+		// The main context enforces the watermarks, here everything is taken
+		channel.txBuffer.setMaxCapacity(std::max(channel.txBuffer.maxCapacity(), channel.txBuffer.size() + command.data.size()));
+		channel.txBuffer.append(command.data.data(), command.data.size());
+		channel.txQueued += command.data.size();
+		channel.txPending.push_back({ command.writeId, channel.txQueued });
+
+		flushChannel(command.channel, channel);
+	}
+
+	return true;
+}
+
+void Bluez5SppIoWorker::readChannel(uint32_t key, Channel &channel, bool hangup)
+{
+	Event event;
+	event.type = Event::DATA;
+	event.channel = key;
+
+	// After a hangup the rest is read regardless of the limit, the socket
+	// buffer bounds it and the hangup would keep waking us up otherwise
+	size_t budget = SPP_IO_WORKER_MAX_READ;
+	if (!hangup)
+		budget = std::min(budget, channel.rxLimit - std::min(channel.rxLimit, channel.rxInFlight));
+
+	bool closed = false;
+
+	while (event.data.size() < budget)
+	{
+		size_t offset = event.data.size();
+		size_t chunk = std::min<size_t>(SPP_IO_WORKER_READ_CHUNK, budget - offset);
+		event.data.resize(offset + chunk);
+
+		ssize_t bytesRead = recv(channel.fd, event.data.data() + offset, chunk, MSG_DONTWAIT);
+		channel.readCalls++;
+		event.data.resize(offset + std::max<ssize_t>(bytesRead, 0));
+
+		if (bytesRead > 0)
+			continue;
+
+		if (bytesRead < 0 && errno == EINTR)
+			continue;
+
+		if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		if (bytesRead < 0)
+			ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to read data due to %s", strerror(errno));
+
+		closed = true;
+		break;
+	}
+
+	if (!event.data.empty())
+	{
+		channel.rxInFlight += event.data.size();
+		postEvent(channel, std::move(event));
+	}
+
+	if (closed)
+		closeChannel(key, channel);
+	else
+		updateEvents(key, channel);
+}
+
+void Bluez5SppIoWorker::flushChannel(uint32_t key, Channel &channel)
+{
+	while (!channel.txBuffer.empty())
+	{
+		struct iovec regions[2];
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = regions;
+		message.msg_iovlen = channel.txBuffer.getDataRegions(regions);
+
+		ssize_t count = sendmsg(channel.fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+		channel.writeCalls++;
+		if (count > 0)
+		{
+			if ((size_t) count < channel.txBuffer.size())
+				channel.shortWrites++;
+			channel.txBuffer.consume(count);
+			channel.txWritten += count;
+			continue;
+		}
+
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			channel.wouldBlock++;
+			break;
+		}
+
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to write data due to %s", strerror(errno));
+		closeChannel(key, channel);
+		return;
+	}
+
+	while (!channel.txPending.empty() && channel.txPending.front().second <= channel.txWritten)
+	{
+		Event event;
+		event.type = Event::WRITTEN;
+		event.channel = key;
+		event.writeId = channel.txPending.front().first;
+		event.success = true;
+		postEvent(channel, std::move(event));
+
+		channel.txPending.pop_front();
+	}
+
+	updateEvents(key, channel);
+}
+
+void Bluez5SppIoWorker::closeChannel(uint32_t key, Channel &channel)
+{
+	if (channel.closed)
+		return;
+
+	// Level triggered hangups would keep waking us up, the fd itself stays
+	// open until the main context removes the channel
+	channel.closed = true;
+	epoll_ctl(mEpollFd, EPOLL_CTL_DEL, channel.fd, NULL);
+
+	for (auto &pending : channel.txPending)
+	{
+		Event event;
+		event.type = Event::WRITTEN;
+		event.channel = key;
+		event.writeId = pending.first;
+		event.success = false;
+		postEvent(std::move(event));
+	}
+	channel.txPending.clear();
+	channel.txBuffer.clear();
+
+	Event event;
+	event.type = Event::CLOSED;
+	event.channel = key;
+	postEvent(channel, std::move(event));
+}
+
+void Bluez5SppIoWorker::updateEvents(uint32_t key, Channel &channel)
+{
+	uint32_t events = 0;
+	if (channel.rxInFlight < channel.rxLimit)
+		events |= EPOLLIN;
+	if (!channel.txBuffer.empty())
+		events |= EPOLLOUT;
+
+	if (channel.closed || events == channel.events)
+		return;
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.u64 = key;
+	if (epoll_ctl(mEpollFd, EPOLL_CTL_MOD, channel.fd, &event) < 0)
+	{
+		ERROR(MSGID_PROFILE_MANAGER_ERROR, 0, "Failed to update SPP socket watch: %s", strerror(errno));
+		return;
+	}
+
+	channel.events = events;
+}
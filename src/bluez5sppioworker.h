@@ -0,0 +1,243 @@
+// Copyright (c) 2018-2020 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef BLUEZ5SPPIOWORKER_H
+#define BLUEZ5SPPIOWORKER_H
+
+#include <glib.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bluez5sppbuffer.h"
+
+// Unbounded multi-producer, single-consumer queue without locks. Producers
+// push onto a list, the consumer takes the whole list at once and gets the
+// items back in the order they were pushed.
+template <typename T>
+class Bluez5SppMessageQueue
+{
+public:
+	Bluez5SppMessageQueue() : mHead(nullptr) {}
+	~Bluez5SppMessageQueue() { popAll(); }
+
+	Bluez5SppMessageQueue(const Bluez5SppMessageQueue&) = delete;
+	Bluez5SppMessageQueue& operator = (const Bluez5SppMessageQueue&) = delete;
+
+	// Returns true if the queue was empty before, i.e. the consumer may be
+	// asleep and has to be woken up
+	bool push(T value)
+	{
+		Node *node = new Node(std::move(value));
+		Node *head = mHead.load(std::memory_order_relaxed);
+		do
+		{
+			node->next = head;
+		}
+		while (!mHead.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+
+		return head == nullptr;
+	}
+
+	std::vector<T> popAll()
+	{
+		Node *node = mHead.exchange(nullptr, std::memory_order_acquire);
+
+		// The list is newest first
+		Node *reversed = nullptr;
+		while (node)
+		{
+			Node *next = node->next;
+			node->next = reversed;
+			reversed = node;
+			node = next;
+		}
+
+		std::vector<T> values;
+		while (reversed)
+		{
+			Node *next = reversed->next;
+			values.push_back(std::move(reversed->value));
+			delete reversed;
+			reversed = next;
+		}
+
+		return values;
+	}
+
+private:
+	struct Node
+	{
+		Node(T &&nodeValue) : value(std::move(nodeValue)), next(nullptr) {}
+
+		T value;
+		Node *next;
+	};
+
+	std::atomic<Node*> mHead;
+};
+
+// Thread which does the socket I/O of SPP channels, so a busy link does not
+// hold up the GLib main loop. A channel is handed over with its fd, from
+// then on only the worker reads, writes and eventually closes it. What it
+// read and which writes completed comes back as events, dispatched from
+// the main context the worker was started from.
+//
+// Received data counts against a per channel limit until the main context
+// acknowledges it as consumed. Once the limit is reached the worker stops
+// reading the socket, so the peer is held back by RFCOMM flow control
+// instead of the data piling up in memory.
+//
+// All public methods are to be called from the main context.
+class Bluez5SppIoWorker
+{
+public:
+	struct Event
+	{
+		enum Type
+		{
+			DATA = 0,
+			// The peer closed the connection or the socket failed
+			CLOSED,
+			// A write was taken by the kernel or failed
+			WRITTEN
+		};
+
+		Event() : type(DATA), channel(0), writeId(0), success(false), readCalls(0), writeCalls(0),
+		          wouldBlock(0), shortWrites(0) {}
+
+		Type type;
+		uint32_t channel;
+		std::vector<uint8_t> data;
+		uint64_t writeId;
+		bool success;
+		// Socket calls made for the channel since its previous event
+		uint32_t readCalls;
+		uint32_t writeCalls;
+		uint32_t wouldBlock;
+		uint32_t shortWrites;
+	};
+
+	typedef std::function<void(Event &event)> EventHandler;
+
+	Bluez5SppIoWorker(EventHandler handler);
+	~Bluez5SppIoWorker();
+
+	Bluez5SppIoWorker(const Bluez5SppIoWorker&) = delete;
+	Bluez5SppIoWorker& operator = (const Bluez5SppIoWorker&) = delete;
+
+	bool start();
+	void stop();
+	bool isRunning() const { return mThread.joinable(); }
+
+	// Returns the key the channel goes by in events, 0 on failure. Keys are
+	// never reused, so events still queued for a removed channel can be
+	// told apart from those of a new one on the same fd. At most rxLimit
+	// bytes of DATA events are unacknowledged at any time.
+	uint32_t addChannel(int fd, size_t rxLimit);
+	// The worker closes the fd, pending writes are reported as failed
+	void removeChannel(uint32_t channel);
+	void write(uint32_t channel, uint64_t writeId, const uint8_t *data, size_t size);
+	// Bytes of DATA events the main context is done with
+	void acknowledge(uint32_t channel, size_t size);
+	void setReceiveLimit(uint32_t channel, size_t rxLimit);
+
+	// Hands whatever the worker reported so far to the event handler
+	void dispatchEvents();
+
+private:
+	struct Command
+	{
+		enum Type
+		{
+			ADD = 0,
+			REMOVE,
+			WRITE,
+			ACKNOWLEDGE,
+			SET_RECEIVE_LIMIT,
+			STOP
+		};
+
+		Command() : type(STOP), channel(0), fd(-1), writeId(0), size(0) {}
+
+		Type type;
+		uint32_t channel;
+		int fd;
+		uint64_t writeId;
+		std::vector<uint8_t> data;
+		// Acknowledged bytes or receive limit
+		size_t size;
+	};
+
+	struct Channel
+	{
+		Channel(int channelFd, size_t channelRxLimit);
+
+		int fd;
+		bool closed;
+		// Events the fd is watched for
+		uint32_t events;
+		// Bytes posted in DATA events and not acknowledged yet
+		size_t rxInFlight;
+		size_t rxLimit;
+		Bluez5SppRingBuffer txBuffer;
+		uint64_t txQueued;
+		uint64_t txWritten;
+		uint32_t readCalls;
+		uint32_t writeCalls;
+		uint32_t wouldBlock;
+		uint32_t shortWrites;
+		// Write id and the byte count at which it is complete
+		std::deque<std::pair<uint64_t, uint64_t>> txPending;
+	};
+
+	void sendCommand(Command &&command);
+	void postEvent(Event &&event);
+	void postEvent(Channel &channel, Event &&event);
+	static gboolean onEvents(GIOChannel *io, GIOCondition condition, gpointer user_data);
+
+	void run();
+	bool processCommands();
+	void readChannel(uint32_t key, Channel &channel, bool hangup);
+	void flushChannel(uint32_t key, Channel &channel);
+	void closeChannel(uint32_t key, Channel &channel);
+	void updateEvents(uint32_t key, Channel &channel);
+
+	EventHandler mHandler;
+	int mEpollFd;
+	// Wakes up the worker for commands and the main context for events
+	int mCommandFd;
+	int mEventFd;
+	GIOChannel *mEventChannel;
+	guint mEventWatch;
+	std::thread mThread;
+	uint32_t mNextChannel;
+
+	Bluez5SppMessageQueue<Command> mCommands;
+	Bluez5SppMessageQueue<Event> mEvents;
+
+	// Only touched from the worker thread
+	std::unordered_map<uint32_t, std::unique_ptr<Channel>> mChannels;
+};
+
+#endif // BLUEZ5SPPIOWORKER_H